@@ -0,0 +1,79 @@
+﻿#include "bench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+static atomic<size_t> allocation_count(0);
+static atomic<size_t> allocation_bytes(0);
+
+void* operator new(size_t size) {
+	allocation_count.fetch_add(1, memory_order_relaxed);
+	allocation_bytes.fetch_add(size, memory_order_relaxed);
+	if (void* p = malloc(size ? size : 1)) return p;
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+
+AllocationCounters Allocations() {
+	return { allocation_count.load(memory_order_relaxed), allocation_bytes.load(memory_order_relaxed) };
+}
+
+bool BenchRunner::IsSelected(const string& name) const {
+	return filter_.empty() || name.find(filter_) != string::npos;
+}
+
+void BenchRunner::PrintHeader() const {
+	printf("%-32s %10s %12s %12s %12s %12s %12s\n", "benchmark", "items", "min, ms", "mean, ms", "ns/item", "allocs/run", "KB/run");
+}
+
+void BenchRunner::Run(const string& name, size_t items, const function<void()>& body) {
+	if (!IsSelected(name)) return;
+	body();
+
+	double min_ms = 0.0;
+	double sum_ms = 0.0;
+	AllocationCounters before = Allocations();
+	for (int i = 0; i < iterations_; ++i) {
+		auto start = chrono::steady_clock::now();
+		body();
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		min_ms = i == 0 ? ms : min(min_ms, ms);
+		sum_ms += ms;
+	}
+	AllocationCounters after = Allocations();
+
+	double runs = max(iterations_, 1);
+	printf("%-32s %10zu %12.3f %12.3f %12.1f %12.1f %12.1f\n",
+		name.c_str(),
+		items,
+		min_ms,
+		sum_ms / runs,
+		items ? min_ms * 1000000.0 / static_cast<double>(items) : 0.0,
+		static_cast<double>(after.count_ - before.count_) / runs,
+		static_cast<double>(after.bytes_ - before.bytes_) / runs / 1024.0);
+	fflush(stdout);
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Totals of the replaced global operator new since the start of the program.
+struct AllocationCounters {
+	size_t count_;
+	size_t bytes_;
+};
+
+AllocationCounters Allocations();
+
+// Runs every benchmark whose name contains the filter: one untimed warm-up run, then the given
+// number of timed runs. Time and allocations are reported per run and time also per item.
+class BenchRunner {
+public:
+	BenchRunner(const std::string& filter, int iterations) : filter_(filter), iterations_(iterations) {}
+	bool IsSelected(const std::string& name) const;
+	void Run(const std::string& name, size_t items, const std::function<void()>& body);
+	void PrintHeader() const;
+private:
+	std::string filter_;
+	int iterations_;
+};
@@ -0,0 +1,181 @@
+﻿#include "fixtures.h"
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static const uint32_t FIRST_PID = 1000;
+static const size_t ENTRY_ALIGNMENT = 8;
+
+NT_FILETIME toFileTime(uint64_t value) {
+	return { static_cast<uint32_t>(value), static_cast<uint32_t>(value >> 32) };
+}
+
+size_t alignedSize(size_t size) {
+	return (size + ENTRY_ALIGNMENT - 1) / ENTRY_ALIGNMENT * ENTRY_ALIGNMENT;
+}
+
+SnapshotFixture::SnapshotFixture(uint32_t processes, uint32_t threads_per_process, const wstring& name) {
+	const wstring other_name = L"svchost.exe";
+	const size_t header_size = offsetof(SYSTEM_PROCESS_INFORMATION, ThreadInfos);
+	uint32_t others = processes / 10;
+	uint32_t total = processes + others;
+
+	size_t size = 0;
+	for (uint32_t i = 0; i < total; ++i) {
+		const wstring& image_name = i < processes ? name : other_name;
+		offsets_.push_back(size);
+		size += alignedSize(header_size + threads_per_process * sizeof(SYSTEM_THREAD_INFORMATION) + image_name.size() * sizeof(char16_t));
+	}
+	buffer_.resize(size);
+
+	uint32_t tid = 1;
+	for (uint32_t i = 0; i < total; ++i) {
+		const wstring& image_name = i < processes ? name : other_name;
+		uint8_t* entry = buffer_.data() + offsets_[i];
+		size_t name_offset = header_size + threads_per_process * sizeof(SYSTEM_THREAD_INFORMATION);
+		char16_t* name_buffer = reinterpret_cast<char16_t*>(entry + name_offset);
+		for (size_t j = 0; j < image_name.size(); ++j) {
+			name_buffer[j] = static_cast<char16_t>(image_name[j]);
+		}
+
+		SYSTEM_PROCESS_INFORMATION info;
+		memset(&info, 0, sizeof(info));
+		info.NextOffset = i + 1 < total ? static_cast<uint32_t>(offsets_[i + 1] - offsets_[i]) : 0;
+		info.ThreadCount = threads_per_process;
+		info.CreateTime = toFileTime(FIRST_PID + i);
+		info.ImageName.Length = static_cast<uint16_t>(image_name.size() * sizeof(char16_t));
+		info.ImageName.MaximumLength = info.ImageName.Length;
+		info.ImageName.Buffer = name_buffer;
+		info.ProcessId = FIRST_PID + i;
+		memcpy(entry, &info, header_size);
+
+		for (uint32_t j = 0; j < threads_per_process; ++j) {
+			SYSTEM_THREAD_INFORMATION thread;
+			memset(&thread, 0, sizeof(thread));
+			thread.CreateTime = toFileTime(tid);
+			thread.Client_Id.UniqueProcess = FIRST_PID + i;
+			thread.Client_Id.UniqueThread = tid++;
+			thread.ThreadState = 5;
+			memcpy(entry + header_size + j * sizeof(SYSTEM_THREAD_INFORMATION), &thread, sizeof(thread));
+		}
+		if (i < processes) threads_ += threads_per_process;
+	}
+}
+
+// Advances USER_TIME of every process and restarts every restart_every-th one (a new create time under the same pid).
+void SnapshotFixture::Tick(uint32_t restart_every) {
+	++tick_;
+	for (size_t i = 0; i < offsets_.size(); ++i) {
+		SYSTEM_PROCESS_INFORMATION* info = reinterpret_cast<SYSTEM_PROCESS_INFORMATION*>(buffer_.data() + offsets_[i]);
+		info->UserTime = toFileTime(fileTimeToInt64(info->UserTime) + 10000 * (i % 100 + 1));
+		if (restart_every && (i + tick_) % restart_every == 0) {
+			info->CreateTime = toFileTime(fileTimeToInt64(info->CreateTime) + 1000000);
+		}
+	}
+}
+
+void writeFile(const fs::path& path, const string& content) {
+	ofstream out(path, ios::out | ios::binary);
+	out << content;
+}
+
+string statLine(uint32_t id, const string& name, uint32_t threads) {
+	// Fields 1-24 of proc(5): utime 14, stime 15, num_threads 20, starttime 22.
+	return to_string(id) + " (" + name + ") S 1 " + to_string(id) + " " + to_string(id) +
+		" 0 -1 4194560 100 0 0 0 " + to_string(id % 1000) + " 10 0 0 20 0 " + to_string(threads) +
+		" 0 " + to_string(id) + " 1000000 100\n";
+}
+
+ProcfsFixture::ProcfsFixture(uint32_t processes, uint32_t threads_per_process, const string& name, uint32_t other_processes) {
+	root_ = fs::temp_directory_path() / ("yb-bench-" + to_string(processes) + "-" + to_string(threads_per_process) + "-" + to_string(other_processes));
+	error_code ec;
+	fs::remove_all(root_, ec);
+	procfs_root_ = root_ / "proc";
+	sysfs_root_ = root_ / "sys";
+
+	fs::create_directories(sysfs_root_ / "devices/system/node/node0");
+	fs::create_directories(sysfs_root_ / "devices/system/node/node1");
+	writeFile(sysfs_root_ / "devices/system/node/node0/cpulist", "0-31\n");
+	writeFile(sysfs_root_ / "devices/system/node/node1/cpulist", "32-63\n");
+
+	const string status = "Name:\t" + name + "\nState:\tS (sleeping)\nCpus_allowed_list:\t0-63\n";
+	uint32_t tid = FIRST_PID + processes;
+	for (uint32_t i = 0; i < processes; ++i) {
+		uint32_t pid = FIRST_PID + i;
+		fs::path process_dir = procfs_root_ / to_string(pid);
+		fs::create_directories(process_dir / "task");
+		writeFile(process_dir / "stat", statLine(pid, name, threads_per_process));
+		writeFile(process_dir / "status", status);
+		for (uint32_t j = 0; j < threads_per_process; ++j) {
+			uint32_t id = j == 0 ? pid : tid++;
+			fs::path task_dir = process_dir / "task" / to_string(id);
+			fs::create_directory(task_dir);
+			writeFile(task_dir / "stat", statLine(id, name, threads_per_process));
+			writeFile(task_dir / "status", status);
+		}
+	}
+	const string other_status = "Name:\tbash\nState:\tS (sleeping)\nCpus_allowed_list:\t0-63\n";
+	for (uint32_t i = 0; i < other_processes; ++i) {
+		uint32_t pid = tid++;
+		fs::path process_dir = procfs_root_ / to_string(pid);
+		fs::create_directories(process_dir / "task" / to_string(pid));
+		writeFile(process_dir / "stat", statLine(pid, "bash", 1));
+		writeFile(process_dir / "status", other_status);
+		writeFile(process_dir / "task" / to_string(pid) / "stat", statLine(pid, "bash", 1));
+		writeFile(process_dir / "task" / to_string(pid) / "status", other_status);
+	}
+}
+
+ProcfsFixture::~ProcfsFixture() {
+	error_code ec;
+	fs::remove_all(root_, ec);
+}
+
+string cpuRange(uint32_t first, uint32_t last) {
+	return to_string(first) + "-" + to_string(last) + "\n";
+}
+
+CpuStatFixture::CpuStatFixture(uint32_t cpus, uint32_t nodes) {
+	const uint32_t l3_cpus = 16;
+	root_ = fs::temp_directory_path() / ("yb-bench-cpus-" + to_string(cpus));
+	error_code ec;
+	fs::remove_all(root_, ec);
+	procfs_root_ = root_ / "proc";
+	sysfs_root_ = root_ / "sys";
+	fs::create_directories(procfs_root_);
+
+	string stat = "cpu  " + to_string(uint64_t(cpus) * 1000) + " 0 500 90000 100 0 10 0 0 0\n";
+	for (uint32_t cpu = 0; cpu < cpus; ++cpu) {
+		stat += "cpu" + to_string(cpu) + " " + to_string(1000 + cpu) + " 0 500 90000 100 0 10 0 0 0\n";
+	}
+	stat += "intr 1000 0 0 0\nctxt 100000\nbtime 1700000000\nprocesses 1000\nprocs_running 2\nprocs_blocked 0\n";
+	writeFile(procfs_root_ / "stat", stat);
+
+	uint32_t node_cpus = cpus / nodes;
+	for (uint32_t node = 0; node < nodes; ++node) {
+		fs::path node_dir = sysfs_root_ / "devices/system/node" / ("node" + to_string(node));
+		fs::create_directories(node_dir);
+		writeFile(node_dir / "cpulist", cpuRange(node * node_cpus, (node + 1) * node_cpus - 1));
+	}
+	for (uint32_t cpu = 0; cpu < cpus; ++cpu) {
+		fs::path cpu_dir = sysfs_root_ / "devices/system/cpu" / ("cpu" + to_string(cpu));
+		fs::create_directories(cpu_dir / "topology");
+		fs::create_directories(cpu_dir / "cache/index0");
+		fs::create_directories(cpu_dir / "cache/index1");
+		uint32_t core = cpu / 2 * 2;
+		writeFile(cpu_dir / "topology/thread_siblings_list", cpuRange(core, core + 1));
+		writeFile(cpu_dir / "cache/index0/level", "2\n");
+		writeFile(cpu_dir / "cache/index0/shared_cpu_list", cpuRange(core, core + 1));
+		uint32_t l3 = cpu / l3_cpus * l3_cpus;
+		writeFile(cpu_dir / "cache/index1/level", "3\n");
+		writeFile(cpu_dir / "cache/index1/shared_cpu_list", cpuRange(l3, l3 + l3_cpus - 1));
+	}
+}
+
+CpuStatFixture::~CpuStatFixture() {
+	error_code ec;
+	fs::remove_all(root_, ec);
+}
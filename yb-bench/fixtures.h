@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "process_snapshot.h"
+
+// Synthetic SystemProcessInformation snapshot laid out as NtQuerySystemInformation returns it:
+// entries with their threads and the image name stored after them. Besides the balanced
+// processes it holds a tenth as many others that the filter skips.
+class SnapshotFixture {
+public:
+	SnapshotFixture(uint32_t processes, uint32_t threads_per_process, const std::wstring& name);
+	const uint8_t* Data() const { return buffer_.data(); }
+	size_t Size() const { return buffer_.size(); }
+	size_t Threads() const { return threads_; }
+	void Tick(uint32_t restart_every);
+private:
+	std::vector<uint8_t> buffer_;
+	std::vector<size_t> offsets_;
+	size_t threads_ = 0;
+	uint64_t tick_ = 0;
+};
+
+// /proc/stat and the sysfs topology of a machine with the given number of CPUs: two SMT threads per
+// core and 16 CPUs per L3 cache, split evenly between the nodes. Removed on destruction.
+class CpuStatFixture {
+public:
+	CpuStatFixture(uint32_t cpus, uint32_t nodes);
+	~CpuStatFixture();
+	const std::filesystem::path& ProcfsRoot() const { return procfs_root_; }
+	const std::filesystem::path& SysfsRoot() const { return sysfs_root_; }
+private:
+	std::filesystem::path root_;
+	std::filesystem::path procfs_root_;
+	std::filesystem::path sysfs_root_;
+};
+
+// Synthetic procfs and sysfs trees in a temporary directory for LinuxSystemProbe, removed on destruction.
+class ProcfsFixture {
+public:
+	// other_processes are single-threaded processes of another name, the rest of the host.
+	ProcfsFixture(uint32_t processes, uint32_t threads_per_process, const std::string& name, uint32_t other_processes = 0);
+	~ProcfsFixture();
+	const std::filesystem::path& ProcfsRoot() const { return procfs_root_; }
+	const std::filesystem::path& SysfsRoot() const { return sysfs_root_; }
+private:
+	std::filesystem::path root_;
+	std::filesystem::path procfs_root_;
+	std::filesystem::path sysfs_root_;
+};
@@ -0,0 +1,375 @@
+﻿#include <boost/program_options.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "Logger.h"
+#include "bench.h"
+#include "cpu_stat.h"
+#include "decision_journal.h"
+#include "fixtures.h"
+#include "metrics.h"
+#include "perf_monitor.h"
+#include "placement_planner.h"
+#include "process_snapshot.h"
+#include "process_table.h"
+#include "ring_buffer.h"
+#include "self_profile.h"
+#include "time_series_store.h"
+#ifdef __linux__
+#include "system_probe_linux.h"
+#endif
+
+namespace opt = boost::program_options;
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+static const uint32_t SNAPSHOT_THREADS = 50;
+static const uint32_t PROCFS_THREADS = 10;
+static const uint32_t RESTART_EVERY = 10;
+static const size_t RING_BUFFER_SIZE = 6;
+
+// ActiveProcesses on Windows without the thread handles: the snapshot walk, the filter and the visits.
+void benchSnapshot(BenchRunner& runner, uint32_t processes) {
+    std::string visit_name = "snapshot.visit/" + std::to_string(processes);
+    std::string merge_name = "table.merge/" + std::to_string(processes);
+    if (!runner.IsSelected(visit_name) && !runner.IsSelected(merge_name)) return;
+
+    SnapshotFixture fixture(processes, SNAPSHOT_THREADS, L"rphost.exe");
+    std::unordered_set<std::wstring> filter = { L"rphost.exe" };
+    std::wstring image_name;
+    ProcessTable table;
+    table.SetRingBufferSize(RING_BUFFER_SIZE);
+    auto scan = [&]() {
+        table.BeginScan();
+        bool is_complete = VisitProcessSnapshot(fixture.Data(), fixture.Size(), filter, image_name, table,
+            [](const SYSTEM_PROCESS_INFORMATION&) {},
+            [](const SYSTEM_PROCESS_INFORMATION&, const SYSTEM_THREAD_INFORMATION&)->GroupAffinity { return { 0, 0 }; });
+        table.EndScan(is_complete);
+    };
+
+    // Steady state: the same processes on every tick.
+    runner.Run(visit_name, fixture.Threads(), scan);
+    // Every tick a tenth of the processes restarts under the same pid and is removed and added again.
+    runner.Run(merge_name, fixture.Threads(), [&]() {
+        fixture.Tick(RESTART_EVERY);
+        scan();
+    });
+}
+
+#ifdef __linux__
+void benchProcfs(BenchRunner& runner, uint32_t processes) {
+    std::string name = "procfs.visit/" + std::to_string(processes);
+    if (!runner.IsSelected(name)) return;
+
+    ProcfsFixture fixture(processes, PROCFS_THREADS, "rphost");
+    LinuxSystemProbe probe(fixture.ProcfsRoot(), fixture.SysfsRoot());
+    probe.Init();
+    std::unordered_set<std::wstring> filter = { L"rphost" };
+    ProcessTable table;
+    table.SetRingBufferSize(RING_BUFFER_SIZE);
+    runner.Run(name, static_cast<size_t>(processes) * PROCFS_THREADS, [&]() {
+        table.BeginScan();
+        table.EndScan(probe.ActiveProcesses(filter, table));
+    });
+}
+
+// A few balanced processes among many others: only the stat of every process is read.
+void benchProcfsHost(BenchRunner& runner, uint32_t other_processes) {
+    std::string name = "procfs.host/" + std::to_string(other_processes);
+    if (!runner.IsSelected(name)) return;
+
+    ProcfsFixture fixture(10, PROCFS_THREADS, "rphost", other_processes);
+    LinuxSystemProbe probe(fixture.ProcfsRoot(), fixture.SysfsRoot());
+    probe.Init();
+    std::unordered_set<std::wstring> filter = { L"rphost" };
+    ProcessTable table;
+    table.SetRingBufferSize(RING_BUFFER_SIZE);
+    runner.Run(name, other_processes + 10, [&]() {
+        table.BeginScan();
+        table.EndScan(probe.ActiveProcesses(filter, table));
+    });
+}
+
+void benchCpuStat(BenchRunner& runner, uint32_t cpus) {
+    std::string name = "procstat.sample/" + std::to_string(cpus);
+    if (!runner.IsSelected(name)) return;
+
+    CpuStatFixture fixture(cpus, 4);
+    CpuStatSampler sampler(fixture.ProcfsRoot(), fixture.SysfsRoot());
+    if (!sampler.Init()) return;
+    runner.Run(name, cpus, [&]() {
+        sampler.Sample();
+    });
+}
+#endif
+
+// N > 0 measures the buffer with the capacity fixed at compile time.
+template <size_t N>
+void benchRingBuffer(BenchRunner& runner, size_t window, size_t buffers) {
+    std::string name = std::string(N ? "ringbuffer.fixed/" : "ringbuffer.avg/") + std::to_string(window);
+    if (!runner.IsSelected(name)) return;
+
+    std::vector<RingBuffer<int64_t, N>> values(buffers, RingBuffer<int64_t, N>(window));
+    for (size_t i = 0; i < buffers; ++i) {
+        for (size_t j = 0; j < window; ++j) values[i].Add(static_cast<int64_t>(i * j));
+    }
+    int64_t sum = 0;
+    runner.Run(name, buffers, [&]() {
+        for (auto it = values.begin(); it != values.end(); ++it) {
+            it->Add(sum & 0xFFFF);
+            sum += it->Avg();
+        }
+    });
+    if (sum == 42) std::cout << '\n';
+}
+
+// The pass ProcessTable::EndScan makes over the samples of all processes.
+void benchTimeSeries(BenchRunner& runner, uint32_t processes, size_t window) {
+    std::string name = "timeseries.aggregate/" + std::to_string(processes) + "x" + std::to_string(window);
+    if (!runner.IsSelected(name)) return;
+
+    TimeSeriesStore store;
+    store.SetWindow(window);
+    std::vector<uint32_t> rows;
+    for (uint32_t i = 0; i < processes; ++i) rows.push_back(store.AddRow());
+    int64_t value = 0;
+    runner.Run(name, processes, [&]() {
+        store.Advance();
+        for (auto it = rows.begin(); it != rows.end(); ++it) store.Set(*it, ++value & 0xFFFF);
+        store.Aggregate();
+    });
+}
+
+// Counters are fed through AddValues, the collecting thread is not started.
+void benchPerfMonitor(BenchRunner& runner, size_t counters, int window) {
+    std::string name = "perfmonitor.avg/" + std::to_string(counters);
+    if (!runner.IsSelected(name)) return;
+
+    PerfMonitor perf_monitor;
+    perf_monitor.SetCollectionPeriod(window);
+    for (size_t i = 0; i < counters; ++i) {
+        perf_monitor.AddCounter(i == 0 ? L"cpu" : L"node" + std::to_wstring(i - 1));
+    }
+    std::vector<double> values(counters, 50.0);
+    for (int i = 0; i < window; ++i) perf_monitor.AddValues(values);
+    double sum = 0.0;
+    runner.Run(name, counters, [&]() {
+        perf_monitor.AddValues(values);
+        std::vector<double> avg = perf_monitor.GetAvgValues();
+        sum += avg.empty() ? 0.0 : avg[0];
+    });
+    if (sum < 0.0) std::cout << '\n';
+}
+
+// The part of SetAffinity after the scan: ordering by average load and planning the nodes.
+void benchAssignment(BenchRunner& runner, uint32_t processes) {
+    std::string sort_name = "affinity.sort/" + std::to_string(processes);
+    std::string plan_name = "affinity.plan/" + std::to_string(processes);
+    if (!runner.IsSelected(sort_name) && !runner.IsSelected(plan_name)) return;
+
+    SnapshotFixture fixture(processes, 1, L"rphost.exe");
+    std::unordered_set<std::wstring> filter = { L"rphost.exe" };
+    std::wstring image_name;
+    ProcessTable table;
+    table.SetRingBufferSize(RING_BUFFER_SIZE);
+    for (size_t i = 0; i < RING_BUFFER_SIZE + 1; ++i) {
+        fixture.Tick(0);
+        table.BeginScan();
+        table.EndScan(VisitProcessSnapshot(fixture.Data(), fixture.Size(), filter, image_name, table,
+            [](const SYSTEM_PROCESS_INFORMATION&) {},
+            [](const SYSTEM_PROCESS_INFORMATION&, const SYSTEM_THREAD_INFORMATION&)->GroupAffinity { return { 0, 0 }; }));
+    }
+
+    const TimeSeriesStore& user_times = table.UserTimes();
+    std::vector<ProcessTable::Map::iterator> processes_affinity;
+    runner.Run(sort_name, processes, [&]() {
+        processes_affinity.clear();
+        for (auto it = table.Processes().begin(); it != table.Processes().end(); ++it) {
+            processes_affinity.push_back(it);
+        }
+        std::sort(processes_affinity.begin(), processes_affinity.end(),
+            [&user_times](ProcessTable::Map::iterator lhs, ProcessTable::Map::iterator rhs)->bool {
+                return user_times.Avg(lhs->second.user_time_row_) > user_times.Avg(rhs->second.user_time_row_);
+            }
+        );
+    });
+
+    std::vector<NodeLoad> nodes(4, { 32.0, 1.0, 0.0, 0.0 });
+    std::vector<Placement> placements;
+    int node = 0;
+    for (auto it = table.Processes().begin(); it != table.Processes().end(); ++it) {
+        double load = static_cast<double>(user_times.Avg(it->second.user_time_row_)) / 1e7;
+        placements.push_back({ it->second.pid_, load, node, node });
+        node = (node + 1) % static_cast<int>(nodes.size());
+    }
+    PlacementPlanner planner;
+    runner.Run(plan_name, processes, [&]() {
+        PlacementPlan plan = planner.Plan(nodes, placements);
+        if (plan.planned_max_load_ < 0.0) std::cout << '\n';
+    });
+}
+
+void benchLogger(BenchRunner& runner, size_t lines) {
+    std::string name = "logger.print/" + std::to_string(lines);
+    if (!runner.IsSelected(name)) return;
+
+    runner.Run(name, lines, [&]() {
+        for (size_t i = 0; i < lines; ++i) {
+            std::wstring msg(L"Set affinity mask 255 group 0 for process rphost.exe with pid ");
+            msg.append(std::to_wstring(1000 + i));
+            LOGGER->Print(msg, true);
+        }
+    });
+}
+
+void benchLoggerFormat(BenchRunner& runner, size_t lines) {
+    std::string name = "logger.format/" + std::to_string(lines);
+    if (!runner.IsSelected(name)) return;
+
+    const std::wstring process_name(L"rphost.exe");
+    runner.Run(name, lines, [&]() {
+        for (size_t i = 0; i < lines; ++i) {
+            LOGGER->Print(Logger::Type::Info, true, L"Set affinity mask ", 255, L" group ", 0,
+                L" for process ", process_name, L" with pid ", 1000 + i, L" load=", 0.25 * i);
+        }
+    });
+}
+
+// Disabled trace lines cost only the level check, or nothing when trace is compiled out.
+void benchLoggerTrace(BenchRunner& runner, size_t lines) {
+    std::string name = "logger.trace_disabled/" + std::to_string(lines);
+    if (!runner.IsSelected(name)) return;
+
+    const std::wstring process_name(L"rphost.exe");
+    runner.Run(name, lines, [&]() {
+        for (size_t i = 0; i < lines; ++i) {
+            LOGGER->Print(Logger::Type::Trace, false, L"AVG USER_TIME=", 0.25 * i, L" for process ", process_name, L" with pid ", 1000 + i);
+        }
+    });
+}
+
+// A tick of the journal: the node loads, the candidates and an affinity call for each of them.
+void benchJournal(BenchRunner& runner, const fs::path& dir, uint32_t processes) {
+    std::string name = "journal.tick/" + std::to_string(processes);
+    if (!runner.IsSelected(name)) return;
+
+    DecisionJournal journal;
+    if (!journal.Open(dir / "journal.ybj", DecisionJournal::RECORDS_PER_MEGABYTE)) return;
+    const GroupAffinity group_affinity = { 0xFFFFFFFF, 1 };
+    runner.Run(name, processes, [&]() {
+        journal.BeginTick(true, 80.0, 40.0);
+        for (int node = -1; node < 4; ++node) journal.AddNode(node, 50.0);
+        for (uint32_t i = 0; i < processes; ++i) {
+            journal.AddCandidate(1000 + i, 0, 1000000.0, 0.1);
+            journal.AddAffinity(DecisionJournal::ProcessAffinity, 1000 + i, 0, group_affinity, 0);
+        }
+    });
+}
+
+// A scrape of the metrics of the given number of tracked processes into a buffer kept between scrapes.
+void benchMetrics(BenchRunner& runner, uint32_t processes) {
+    std::string name = "metrics.write/" + std::to_string(processes);
+    if (!runner.IsSelected(name)) return;
+
+    BalancerMetrics metrics;
+    metrics.SetCounters({ L"cpu", L"node0", L"node1", L"node2", L"node3" }, { 60.0, 80.0, 40.0, 70.0, 50.0 });
+    metrics.BeginProcesses();
+    for (uint32_t i = 0; i < processes; ++i) metrics.AddProcess(1000 + i, L"rphost.exe", 1234567.0 * (i % 13), static_cast<int>(i % 4));
+    metrics.EndProcesses();
+    for (int i = 0; i < 100; ++i) {
+        metrics.AddTick(0.001 * i, i % 3 == 0);
+        metrics.AddScan(0.0005 * i, true);
+    }
+    std::string out;
+    runner.Run(name, processes, [&]() {
+        out.clear();
+        metrics.Write(out);
+    });
+}
+
+// Overhead of one measured phase: two clock reads and the histogram update.
+void benchProfile(BenchRunner& runner, uint32_t scopes) {
+    std::string name = "profile.scope/" + std::to_string(scopes);
+    if (!runner.IsSelected(name)) return;
+
+    SelfProfile profile;
+    runner.Run(name, scopes, [&]() {
+        for (uint32_t i = 0; i < scopes; ++i) {
+            ScopedPhase phase(profile, SelfProfile::GetAvgValues);
+        }
+    });
+}
+
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, "");
+
+    std::string filter;
+    int iterations = 0;
+
+    opt::options_description desc("yb-bench - timings and allocations of the balancer hot paths on synthetic data");
+    desc.add_options()
+        ("filter,f", opt::value<std::string>(&filter), "run only the benchmarks whose name contains the string")
+        ("iterations,i", opt::value<int>(&iterations)->default_value(5), "timed runs of every benchmark")
+        ("quick,q", "skip the 10000 processes fixtures")
+        ("help,h", "produce help message");
+
+    opt::variables_map vm;
+    try {
+        opt::store(opt::parse_command_line(argc, argv, desc), vm);
+        opt::notify(vm);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << '\n';
+        return 0;
+    }
+    if (iterations <= 0) {
+        std::cerr << "iterations must be positive\n";
+        return 1;
+    }
+
+    fs::path log_dir = fs::temp_directory_path() / "yb-bench-logs";
+    fs::create_directories(log_dir);
+    LOGGER->Open(log_dir);
+
+    std::vector<uint32_t> sizes = { 100, 1000 };
+    if (!vm.count("quick")) sizes.push_back(10000);
+
+    BenchRunner runner(filter, iterations);
+    runner.PrintHeader();
+    for (auto it = sizes.begin(); it != sizes.end(); ++it) benchSnapshot(runner, *it);
+#ifdef __linux__
+    benchProcfs(runner, 100);
+    benchProcfs(runner, 1000);
+    benchProcfsHost(runner, 1000);
+    benchCpuStat(runner, 512);
+    benchCpuStat(runner, 1024);
+#endif
+    for (size_t window : { 6, 60, 600 }) benchRingBuffer<0>(runner, window, 10000);
+    benchRingBuffer<6>(runner, 6, 10000);
+    benchRingBuffer<60>(runner, 60, 10000);
+    for (auto it = sizes.begin(); it != sizes.end(); ++it) {
+        benchTimeSeries(runner, *it, 6);
+        benchTimeSeries(runner, *it, 60);
+    }
+    for (size_t counters : { 2, 9, 65 }) benchPerfMonitor(runner, counters, 60);
+    for (auto it = sizes.begin(); it != sizes.end(); ++it) benchAssignment(runner, *it);
+    benchLogger(runner, 1000);
+    benchLoggerFormat(runner, 1000);
+    benchLoggerTrace(runner, 1000);
+    benchJournal(runner, log_dir, 1000);
+    for (auto it = sizes.begin(); it != sizes.end(); ++it) benchMetrics(runner, *it);
+    benchProfile(runner, 1000);
+
+    std::error_code ec;
+    fs::remove_all(log_dir, ec);
+    return 0;
+}
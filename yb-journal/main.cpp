@@ -0,0 +1,176 @@
+﻿#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "decision_journal.h"
+#include "encoding_string.h"
+
+namespace opt = boost::program_options;
+
+struct JournalFilter {
+    std::vector<uint16_t> types_;
+    uint32_t pid_ = 0;
+    uint32_t tick_from_ = 0;
+    uint32_t tick_to_ = UINT32_MAX;
+    bool is_failed_ = false;
+};
+
+bool parseTypes(const std::string& types, std::vector<uint16_t>& result) {
+    std::string::size_type begin = 0;
+    for (;;) {
+        std::string::size_type end = types.find(',', begin);
+        std::string name = types.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        uint16_t type = DecisionJournal::Tick;
+        while (type <= DecisionJournal::ThreadAffinity && name != DecisionJournal::TypeName(type)) ++type;
+        if (type > DecisionJournal::ThreadAffinity) return false;
+        result.push_back(type);
+        if (end == std::string::npos) break;
+        begin = end + 1;
+    }
+    return true;
+}
+
+bool isAffinity(const JournalRecord& record) {
+    return record.type_ == DecisionJournal::ProcessAffinity || record.type_ == DecisionJournal::ThreadAffinity;
+}
+
+bool isSelected(const JournalRecord& record, const JournalFilter& filter) {
+    if (record.tick_ < filter.tick_from_ || record.tick_ > filter.tick_to_) return false;
+    if (filter.pid_ && record.pid_ != filter.pid_) return false;
+    if (filter.is_failed_ && (!isAffinity(record) || record.result_ == 0)) return false;
+    if (filter.types_.empty()) return true;
+    for (auto it = filter.types_.begin(); it != filter.types_.end(); ++it) {
+        if (*it == record.type_) return true;
+    }
+    return false;
+}
+
+std::string formatTime(int64_t milliseconds) {
+    time_t time = static_cast<time_t>(milliseconds / 1000);
+    struct tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &time);
+#else
+    localtime_r(&time, &tm);
+#endif
+    char buffer[32];
+    size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buffer + length, sizeof(buffer) - length, ".%03d", static_cast<int>(milliseconds % 1000));
+    return buffer;
+}
+
+std::string nodeName(int16_t node) {
+    return node >= 0 ? std::to_string(node) : "none";
+}
+
+void printRecord(std::ostream& out, const JournalRecord& record) {
+    out << formatTime(record.time_) << " tick " << record.tick_ << ' ' << DecisionJournal::TypeName(record.type_);
+    switch (record.type_)
+    {
+    case DecisionJournal::Tick:
+        out << " max load=" << record.value_ << " spread=" << record.load_ << (record.result_ ? " rebalance" : "");
+        break;
+    case DecisionJournal::Node:
+        out << ' ' << (record.node_ >= 0 ? "node" + std::to_string(record.node_) : std::string("cpu")) << " avg=" << record.value_;
+        break;
+    case DecisionJournal::Candidate:
+        out << " pid=" << record.pid_ << " numa=" << nodeName(record.node_) << " avg user time=" << record.value_ << " load=" << record.load_;
+        break;
+    case DecisionJournal::Move:
+        out << " pid=" << record.pid_ << " numa=" << nodeName(record.node_) << " new numa=" << record.target_node_ << " load=" << record.load_;
+        break;
+    case DecisionJournal::ProcessAffinity:
+    case DecisionJournal::ThreadAffinity:
+        out << " pid=" << record.pid_;
+        if (record.tid_) out << " tid=" << record.tid_;
+        out << " group=" << record.group_ << " mask=" << record.mask_ << " result=" << record.result_;
+        break;
+    }
+    out << '\n';
+}
+
+void writeCsvRecord(std::ostream& out, const JournalRecord& record) {
+    out << record.sequence_ << ',' << formatTime(record.time_) << ',' << record.tick_ << ',' << DecisionJournal::TypeName(record.type_) << ','
+        << record.pid_ << ',' << record.tid_ << ',' << record.node_ << ',' << record.target_node_ << ','
+        << record.group_ << ',' << record.mask_ << ',' << record.value_ << ',' << record.load_ << ',' << record.result_ << '\n';
+}
+
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, "");
+
+    std::string journal_path;
+    std::string csv_path;
+    std::string types;
+    JournalFilter filter;
+    uint32_t last_ticks = 0;
+
+    opt::options_description desc("yb-journal - decodes the decision journal of the balancer");
+    desc.add_options()
+        ("journal,j", opt::value<std::string>(&journal_path), "journal file (logs/journal.ybj next to the service)")
+        ("csv,c", opt::value<std::string>(&csv_path), "export the selected records to a CSV file instead of printing them")
+        ("type,t", opt::value<std::string>(&types), "record types, comma separated: tick, node, candidate, move, process_affinity, thread_affinity")
+        ("pid,p", opt::value<uint32_t>(&filter.pid_), "records of one process")
+        ("tick-from", opt::value<uint32_t>(&filter.tick_from_), "first tick")
+        ("tick-to", opt::value<uint32_t>(&filter.tick_to_), "last tick")
+        ("last", opt::value<uint32_t>(&last_ticks), "only the given number of the latest ticks")
+        ("failed", "only affinity calls that failed")
+        ("help,h", "produce help message");
+    opt::positional_options_description positional;
+    positional.add("journal", 1);
+
+    opt::variables_map vm;
+    try {
+        opt::store(opt::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        opt::notify(vm);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    if (vm.count("help") || journal_path.empty()) {
+        std::cout << desc << '\n';
+        return vm.count("help") ? 0 : 1;
+    }
+    if (!types.empty() && !parseTypes(types, filter.types_)) {
+        std::cerr << "Wrong --type value: " << types << '\n';
+        return 1;
+    }
+    filter.is_failed_ = vm.count("failed") > 0;
+
+    std::vector<JournalRecord> records;
+    std::wstring error;
+    if (!DecisionJournal::Read(journal_path, records, error)) {
+        std::cerr << WideCharToUtf8(error) << '\n';
+        return 1;
+    }
+    if (last_ticks && !records.empty() && records.back().tick_ >= last_ticks) {
+        filter.tick_from_ = std::max(filter.tick_from_, records.back().tick_ - last_ticks + 1);
+    }
+
+    std::ofstream csv;
+    if (!csv_path.empty()) {
+        csv.open(csv_path, std::ios::out | std::ios::binary);
+        if (!csv.is_open()) {
+            std::cerr << "Can't write " << csv_path << '\n';
+            return 1;
+        }
+        csv << "sequence,time,tick,type,pid,tid,node,target_node,group,mask,value,load,result\n";
+    }
+
+    size_t selected = 0;
+    for (auto it = records.begin(); it != records.end(); ++it) {
+        if (!isSelected(*it, filter)) continue;
+        ++selected;
+        if (csv.is_open()) writeCsvRecord(csv, *it);
+        else printRecord(std::cout, *it);
+    }
+    if (csv.is_open()) {
+        std::cout << "records: " << records.size() << ", exported: " << selected << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+﻿#include "load_trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include "encoding_string.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static const int64_t SYNTHETIC_STEP = 60;
+static const double PI = 3.14159265358979323846;
+
+bool splitLine(const string& line, vector<string>& fields) {
+	fields.clear();
+	size_t begin = 0;
+	for (;;) {
+		size_t end = line.find(',', begin);
+		fields.push_back(line.substr(begin, end == string::npos ? string::npos : end - begin));
+		if (end == string::npos) break;
+		begin = end + 1;
+	}
+	return fields.size() == 4;
+}
+
+bool ReadLoadTrace(const fs::path& path, LoadTrace& trace, wstring& error) {
+	trace = LoadTrace();
+	ifstream in(path);
+	if (!in.is_open()) {
+		error = wstring(L"Can't open trace ").append(path.wstring());
+		return false;
+	}
+	string line;
+	vector<string> fields;
+	size_t line_number = 0;
+	while (getline(in, line)) {
+		++line_number;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+		char* end_second = nullptr;
+		char* end_pid = nullptr;
+		char* end_load = nullptr;
+		if (splitLine(line, fields)) {
+			LoadSample sample = {
+				strtoll(fields[0].c_str(), &end_second, 10),
+				static_cast<uint32_t>(strtoul(fields[1].c_str(), &end_pid, 10)),
+				Utf8ToWideChar(fields[2]),
+				strtod(fields[3].c_str(), &end_load)
+			};
+			if (*end_second == '\0' && *end_pid == '\0' && *end_load == '\0' && sample.second_ >= 0 && sample.load_ >= 0.0) {
+				trace.samples_.push_back(sample);
+				trace.duration_ = max(trace.duration_, sample.second_ + 1);
+				continue;
+			}
+		}
+		error = wstring(L"Wrong trace line ").append(to_wstring(line_number)).append(L": ").append(Utf8ToWideChar(line));
+		return false;
+	}
+	stable_sort(trace.samples_.begin(), trace.samples_.end(),
+		[](const LoadSample& lhs, const LoadSample& rhs)->bool {
+			return lhs.second_ < rhs.second_;
+		}
+	);
+	return true;
+}
+
+bool WriteLoadTrace(const fs::path& path, const LoadTrace& trace) {
+	ofstream out(path, ios::out | ios::binary);
+	if (!out.is_open()) return false;
+	out << "# second,pid,name,load\n";
+	for (auto it = trace.samples_.begin(); it != trace.samples_.end(); ++it) {
+		out << it->second_ << ',' << it->pid_ << ',' << WideCharToUtf8(it->name_) << ',' << it->load_ << '\n';
+	}
+	return out.good();
+}
+
+// Every process has a base load, a daily wave with its own phase and a random walk on top of it,
+// resampled once a minute. mt19937 is fully specified, so a seed gives the same trace everywhere.
+LoadTrace SyntheticLoadTrace(uint32_t processes, int64_t duration, uint32_t seed, const wstring& name) {
+	mt19937 rng(seed);
+	auto uniform = [&rng](double from, double to) {
+		return from + (to - from) * (rng() >> 8) * (1.0 / 16777216.0);
+	};
+
+	struct Profile {
+		double base_;
+		double amplitude_;
+		double phase_;
+		double walk_;
+	};
+	vector<Profile> profiles;
+	for (uint32_t i = 0; i < processes; ++i) {
+		profiles.push_back({ uniform(0.5, 6.0), uniform(0.1, 0.6), uniform(0.0, 2.0 * PI), 1.0 });
+	}
+
+	LoadTrace trace;
+	trace.duration_ = duration;
+	for (int64_t second = 0; second < duration; second += SYNTHETIC_STEP) {
+		double day = 2.0 * PI * static_cast<double>(second) / 86400.0;
+		for (uint32_t i = 0; i < processes; ++i) {
+			Profile& profile = profiles[i];
+			profile.walk_ = min(max(profile.walk_ * uniform(0.9, 1.1), 0.3), 3.0);
+			double load = profile.base_ * (1.0 + profile.amplitude_ * sin(day + profile.phase_)) * profile.walk_;
+			trace.samples_.push_back({ second, 1000 + i, name, round(load * 1000.0) / 1000.0 });
+		}
+	}
+	return trace;
+}
@@ -0,0 +1,25 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Demand of a process in logical CPUs from second_ on, until the next sample of the same pid.
+struct LoadSample {
+	int64_t second_;
+	uint32_t pid_;
+	std::wstring name_;
+	double load_;
+};
+
+// Samples sorted by time. A process exists from its first sample to the end of the trace.
+struct LoadTrace {
+	std::vector<LoadSample> samples_;
+	int64_t duration_ = 0;
+};
+
+// CSV with the lines "second,pid,name,load"; empty lines and lines starting with '#' are skipped.
+bool ReadLoadTrace(const std::filesystem::path& path, LoadTrace& trace, std::wstring& error);
+bool WriteLoadTrace(const std::filesystem::path& path, const LoadTrace& trace);
+LoadTrace SyntheticLoadTrace(uint32_t processes, int64_t duration, uint32_t seed, const std::wstring& name);
@@ -0,0 +1,179 @@
+﻿#include <boost/program_options.hpp>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Logger.h"
+#include "load_trace.h"
+#include "simulator.h"
+
+namespace opt = boost::program_options;
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+bool parseNodes(const std::string& cpus, const std::string& background, std::vector<SimNode>& nodes) {
+    std::vector<uint32_t> node_cpus;
+    std::string::size_type begin = 0;
+    for (;;) {
+        std::string::size_type end = cpus.find(',', begin);
+        char* p_end = nullptr;
+        std::string value = cpus.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        unsigned long count = strtoul(value.c_str(), &p_end, 10);
+        if (value.empty() || *p_end != '\0' || count == 0 || count > 64) return false;
+        node_cpus.push_back(static_cast<uint32_t>(count));
+        if (end == std::string::npos) break;
+        begin = end + 1;
+    }
+    nodes.clear();
+    for (auto it = node_cpus.begin(); it != node_cpus.end(); ++it) {
+        nodes.push_back({ *it, 0.0 });
+    }
+    begin = 0;
+    for (size_t i = 0; !background.empty() && i < nodes.size(); ++i) {
+        std::string::size_type end = background.find(',', begin);
+        nodes[i].background_ = strtod(background.substr(begin, end == std::string::npos ? std::string::npos : end - begin).c_str(), nullptr);
+        if (end == std::string::npos) break;
+        begin = end + 1;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, "");
+
+    std::string trace_path;
+    std::string save_trace_path;
+    std::string series_path;
+    std::string journal_path;
+    std::string state_path;
+    std::string log_dir;
+    std::string nodes_cpus;
+    std::string nodes_background;
+    std::string name;
+    std::string initial_node;
+    uint32_t synthetic = 0;
+    int64_t duration = 0;
+    uint32_t seed = 0;
+    SimOptions options;
+
+    opt::options_description desc("yb-sim - replays CPU load traces through the balancer decisions");
+    desc.add_options()
+        ("trace,t", opt::value<std::string>(&trace_path), "CSV trace with the lines 'second,pid,name,load', load in logical CPUs")
+        ("synthetic,s", opt::value<uint32_t>(&synthetic), "generate a synthetic trace for the given number of processes")
+        ("duration,d", opt::value<int64_t>(&duration)->default_value(86400), "duration of the replay (in seconds), by default a day for a synthetic trace and up to the last sample for a recorded one")
+        ("seed", opt::value<uint32_t>(&seed)->default_value(1), "seed of the synthetic trace")
+        ("name", opt::value<std::string>(&name)->default_value("rphost"), "process name of the synthetic trace")
+        ("save-trace", opt::value<std::string>(&save_trace_path), "write the replayed trace to a CSV file")
+        ("nodes,n", opt::value<std::string>(&nodes_cpus)->default_value("32,32"), "logical CPUs of every NUMA node, comma separated (at most 64 per node)")
+        ("background", opt::value<std::string>(&nodes_background), "load of every node not related to the processes (in logical CPUs), comma separated")
+        ("threads", opt::value<uint32_t>(&options.threads_per_process_)->default_value(8), "threads of every process")
+        ("initial", opt::value<std::string>(&initial_node)->default_value("round-robin"), "node of a new process (spread - all nodes, round-robin - nodes in turn, first - node 0)")
+        ("packages", opt::value<uint32_t>(&options.packages_)->default_value(1), "packages (sockets) the nodes are split over in order")
+        ("cpu-analysis-period", opt::value<int>(&options.cpu_analysis_period_)->default_value(60), "cpu_analysis_period_in_seconds")
+        ("switching-frequency", opt::value<int>(&options.switching_frequency_)->default_value(10), "switching_frequency_in_seconds")
+        ("maximum-cpu-value", opt::value<int>(&options.maximum_cpu_value_)->default_value(70), "maximum_cpu_value")
+        ("delta-cpu-values", opt::value<int>(&options.delta_cpu_values_)->default_value(30), "delta_cpu_values")
+        ("migration-cost", opt::value<int>(&options.migration_cost_)->default_value(5), "migration_cost_percent")
+        ("remote-memory-penalty", opt::value<int>(&options.remote_memory_penalty_)->default_value(30), "remote_memory_penalty_percent")
+        ("memory-migration", opt::value<int>(&options.memory_migration_)->default_value(128), "memory_migration_in_megabytes_per_second")
+        ("minimum-dwell-time", opt::value<int>(&options.minimum_dwell_time_)->default_value(300), "minimum_dwell_time_in_seconds")
+        ("maximum-moves-per-tick", opt::value<int>(&options.maximum_moves_per_tick_)->default_value(4), "maximum_moves_per_tick")
+        ("move-damping", opt::value<int>(&options.move_damping_)->default_value(100), "move_damping_percent")
+        ("thread-balancing", "spread the hottest threads of a process too big for one node (thread_balancing)")
+        ("spawn-placement", "bind every new process to the least loaded node at its start (spawn_placement)")
+        ("fast-warm-up", "balance before the analysis window is full (fast_warm_up)")
+        ("series", opt::value<std::string>(&series_path), "write node loads after every decision to a CSV file")
+        ("journal", opt::value<std::string>(&journal_path), "write the decision journal to a file, to be read with yb-journal")
+        ("journal-size", opt::value<int>(&options.journal_size_)->default_value(16), "journal_size_in_megabytes")
+        ("state", opt::value<std::string>(&state_path), "restore the balancer state from a file and save it there")
+        ("state-save-period", opt::value<int>(&options.state_save_period_)->default_value(60), "state_save_period_in_seconds")
+        ("state-max-age", opt::value<int>(&options.state_max_age_)->default_value(300), "state_max_age_in_seconds")
+        ("log-dir", opt::value<std::string>(&log_dir), "directory for the balancer logs (default - current directory)")
+        ("profile", "print the durations, OS calls and allocations of the tick phases")
+        ("help,h", "produce help message");
+
+    opt::variables_map vm;
+    try {
+        opt::store(opt::parse_command_line(argc, argv, desc), vm);
+        opt::notify(vm);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    if (vm.count("help") || (trace_path.empty() && synthetic == 0)) {
+        std::cout << desc << '\n';
+        return vm.count("help") ? 0 : 1;
+    }
+    if (!parseNodes(nodes_cpus, nodes_background, options.nodes_)) {
+        std::cerr << "Wrong --nodes value: " << nodes_cpus << '\n';
+        return 1;
+    }
+    if (options.switching_frequency_ <= 0 || options.cpu_analysis_period_ < options.switching_frequency_) {
+        std::cerr << "cpu-analysis-period must not be less than switching-frequency, both positive\n";
+        return 1;
+    }
+    if (initial_node == "spread") options.initial_node_ = SimProbe::Spread;
+    else if (initial_node == "round-robin") options.initial_node_ = SimProbe::RoundRobin;
+    else if (initial_node == "first") options.initial_node_ = SimProbe::First;
+    else {
+        std::cerr << "Wrong --initial value: " << initial_node << '\n';
+        return 1;
+    }
+    options.series_path_ = series_path;
+    options.journal_path_ = journal_path;
+    options.state_path_ = state_path;
+    options.is_profile_ = vm.count("profile") > 0;
+    options.is_thread_balancing_ = vm.count("thread-balancing") > 0;
+    options.is_spawn_placement_ = vm.count("spawn-placement") > 0;
+    options.is_fast_warm_up_ = vm.count("fast-warm-up") > 0;
+
+    LOGGER->Open(log_dir.empty() ? fs::current_path() : fs::path(log_dir));
+    LOGGER->SetLogType(Logger::Type::Error);
+
+    LoadTrace trace;
+    if (!trace_path.empty()) {
+        std::wstring error;
+        if (!ReadLoadTrace(trace_path, trace, error)) {
+            std::wcerr << error << L'\n';
+            return 1;
+        }
+    }
+    else {
+        trace = SyntheticLoadTrace(synthetic, duration, seed, Utf8ToWideChar(name));
+    }
+    if (!trace_path.empty() && !vm["duration"].defaulted()) {
+        trace.duration_ = duration;
+    }
+    if (!save_trace_path.empty() && !WriteLoadTrace(save_trace_path, trace)) {
+        std::cerr << "Can't write trace " << save_trace_path << '\n';
+        return 1;
+    }
+
+    SimReport report = Simulate(trace, options);
+
+    std::cout
+        << "simulated seconds: " << report.seconds_ << '\n'
+        << "decisions: " << report.decisions_ << '\n'
+        << "peak node load, %: " << report.peak_node_load_ << '\n'
+        << "average imbalance, %: " << report.avg_imbalance_ << '\n'
+        << "maximum imbalance, %: " << report.max_imbalance_ << '\n'
+        << "overloaded node-seconds: " << report.overload_seconds_ << '\n'
+        << "placements: " << report.placements_ << '\n'
+        << "spawn placements: " << report.spawn_placements_ << '\n'
+        << "migrations: " << report.migrations_ << '\n'
+        << "prevented oscillations: " << report.prevented_oscillations_ << '\n'
+        << "thread moves: " << report.thread_moves_ << '\n'
+        << "remote memory CPU-seconds: " << report.remote_seconds_ << '\n'
+        << "migrated memory, MB: " << report.migrated_bytes_ / (1024 * 1024) << '\n'
+        << "converged at, s: " << report.converged_at_ << '\n'
+        << "balanced from, s: " << report.balanced_from_ << '\n'
+        << "wall time, s: " << report.wall_seconds_ << '\n'
+        << "speed, x real time: " << (report.wall_seconds_ > 0.0 ? report.seconds_ / report.wall_seconds_ : 0.0) << '\n';
+    for (auto it = report.profile_.begin(); it != report.profile_.end(); ++it) {
+        std::cout << "profile " << *it << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,258 @@
+﻿#include "sim_probe.h"
+#include <algorithm>
+
+using namespace std;
+
+// USER_TIME is kept in 100-nanosecond units, as the real probes do.
+static const double TIME_UNITS_PER_SECOND = 10000000.0;
+static const double PROCESS_MEMORY = 4.0 * 1024 * 1024 * 1024;
+static const double MEMORY_PER_CPU_SECOND = 16.0 * 1024 * 1024;
+
+SimProbe::SimProbe(const vector<SimNode>& nodes, uint32_t threads_per_process, InitialNode initial_node) :
+	nodes_(nodes),
+	threads_per_process_(threads_per_process),
+	initial_node_(initial_node) {
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		uint32_t cpus = min<uint32_t>(nodes_[i].cpus_, 64);
+		uint64_t mask = cpus == 64 ? UINT64_MAX : (uint64_t(1) << cpus) - 1;
+		numa_nodes_.push_back({ static_cast<uint32_t>(i), { mask, static_cast<uint16_t>(i) } });
+		capacities_.push_back(cpus);
+		total_capacity_ += cpus;
+	}
+	loads_.resize(nodes_.size());
+	served_.resize(nodes_.size());
+	double weights = 0.0;
+	for (uint32_t i = 0; i < threads_per_process_; ++i) {
+		thread_weights_.push_back(1.0 / (i + 1));
+		weights += thread_weights_.back();
+	}
+	for (auto it = thread_weights_.begin(); it != thread_weights_.end(); ++it) {
+		*it /= weights;
+	}
+}
+
+GroupAffinity SimProbe::NodeAffinity(int node) const {
+	return numa_nodes_[node >= 0 ? node : 0].group_mask_;
+}
+
+vector<NumaNode> SimProbe::NumaNodes() {
+	return numa_nodes_;
+}
+
+bool SimProbe::ReadTopology(CpuTopology& topology) {
+	topology.Clear();
+	uint32_t nodes = static_cast<uint32_t>(numa_nodes_.size());
+	for (uint32_t i = 0; i < nodes; ++i) {
+		uint32_t first_cpu = i * 64;
+		uint32_t package = static_cast<uint32_t>(static_cast<uint64_t>(i) * packages_ / nodes);
+		for (uint32_t cpu = first_cpu; cpu < first_cpu + static_cast<uint32_t>(capacities_[i]); ++cpu) {
+			topology.AddCpu(cpu, cpu, first_cpu, i, package);
+		}
+	}
+	topology.Finish();
+	return !topology.IsEmpty();
+}
+
+bool SimProbe::ActiveProcesses(const unordered_set<wstring>& process_filter, ProcessVisitor& visitor) {
+	for (auto it = processes_.begin(); it != processes_.end(); ++it) {
+		if (process_filter.size() != 0 && process_filter.find(it->name_) == process_filter.end()) continue;
+		visitor.Process({ it->pid_, it->name_, it->create_time_, it->user_time_, 0, static_cast<uint32_t>(it->tids_.size()) });
+		for (size_t i = 0; i < it->tids_.size(); ++i) {
+			visitor.Thread({ it->tids_[i], it->create_time_, it->thread_user_times_[i], 5, 0, NodeAffinity(it->thread_nodes_[i]) });
+		}
+	}
+	return true;
+}
+
+vector<uint16_t> SimProbe::ProcessNumaGroups(uint32_t pid) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end()) return {};
+	const SimProcess& process = processes_[it->second];
+	if (process.node_ >= 0) return { static_cast<uint16_t>(process.node_) };
+	vector<uint16_t> groups;
+	for (size_t i = 0; i < numa_nodes_.size(); ++i) {
+		groups.push_back(static_cast<uint16_t>(i));
+	}
+	return groups;
+}
+
+pair<uint64_t, uint64_t> SimProbe::ProcessAffinityMask(uint32_t pid) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end()) return { 0, 0 };
+	GroupAffinity group_affinity = NodeAffinity(processes_[it->second].node_);
+	return { group_affinity.mask_, group_affinity.mask_ };
+}
+
+bool SimProbe::SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end() || group_affinity.group_ >= numa_nodes_.size()) return false;
+	SimProcess& process = processes_[it->second];
+	int node = group_affinity.group_;
+	if (process.node_ != node) {
+		if (process.node_ >= 0) ++migrations_;
+		else ++placements_;
+		last_move_time_ = second_;
+		process.node_ = node;
+	}
+	return true;
+}
+
+bool SimProbe::SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) {
+	auto it = thread_index_.find(tid);
+	if (it == thread_index_.end() || group_affinity.group_ >= numa_nodes_.size()) return false;
+	SimProcess& process = processes_[it->second.first];
+	int& node = process.thread_nodes_[it->second.second];
+	if (node != group_affinity.group_ && group_affinity.group_ != process.node_) ++thread_moves_;
+	node = group_affinity.group_;
+	return true;
+}
+
+int64_t SimProbe::CurrentTime() {
+	return second_ * static_cast<int64_t>(TIME_UNITS_PER_SECOND);
+}
+
+bool SimProbe::ProcessName(uint32_t pid, wstring& name) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end()) return false;
+	name = processes_[it->second].name_;
+	return true;
+}
+
+// The process has not run yet, so it has no memory to leave behind and its threads go with it.
+bool SimProbe::SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end() || group_affinity.group_ >= numa_nodes_.size()) return false;
+	SimProcess& process = processes_[it->second];
+	process.node_ = group_affinity.group_;
+	fill(process.thread_nodes_.begin(), process.thread_nodes_.end(), process.node_);
+	++spawn_placements_;
+	return true;
+}
+
+bool SimProbe::SetDemand(uint32_t pid, const wstring& name, double load) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end()) {
+		int node = -1;
+		if (initial_node_ == RoundRobin && !nodes_.empty()) node = static_cast<int>(processes_.size() % nodes_.size());
+		else if (initial_node_ == First && !nodes_.empty()) node = 0;
+		SimProcess process = { pid, name, second_ * static_cast<int64_t>(TIME_UNITS_PER_SECOND), 0, load, node, {}, {}, {}, vector<double>(nodes_.size()), 0.0 };
+		for (uint32_t i = 0; i < threads_per_process_; ++i) {
+			thread_index_[next_tid_] = { processes_.size(), i };
+			process.tids_.push_back(next_tid_++);
+			process.thread_nodes_.push_back(node);
+			process.thread_user_times_.push_back(0);
+		}
+		process_index_[pid] = processes_.size();
+		processes_.push_back(move(process));
+		return true;
+	}
+	processes_[it->second].demand_ = load;
+	return false;
+}
+
+// A thread with node -1 runs on all nodes in proportion to their capacity.
+void SimProbe::AddLoad(int node, double load) {
+	if (node >= 0) {
+		loads_[node] += load;
+		return;
+	}
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		loads_[i] += load * capacities_[i] / total_capacity_;
+	}
+}
+
+double SimProbe::Share(int node) const {
+	if (node >= 0) return served_[node];
+	double share = 0.0;
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		share += served_[i] * capacities_[i] / total_capacity_;
+	}
+	return share;
+}
+
+bool SimProbe::ProcessNodeMemory(uint32_t pid, vector<uint64_t>& node_bytes) {
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end()) return false;
+	const SimProcess& process = processes_[it->second];
+	node_bytes.clear();
+	for (auto it_memory = process.memory_.begin(); it_memory != process.memory_.end(); ++it_memory) {
+		node_bytes.push_back(static_cast<uint64_t>(*it_memory));
+	}
+	return true;
+}
+
+bool SimProbe::ProcessMemoryRegions(uint32_t pid, vector<MemoryRegion>& regions) {
+	if (process_index_.find(pid) == process_index_.end()) return false;
+	regions.assign(1, { 0, static_cast<uint64_t>(PROCESS_MEMORY) });
+	return true;
+}
+
+// The rest of the region from begin holds the rest of the pages, so [begin, end) holds their share (end - begin) / (size - begin).
+bool SimProbe::MovePages(uint32_t pid, uint64_t begin, uint64_t end, uint32_t node_number, uint64_t& moved_bytes) {
+	moved_bytes = 0;
+	auto it = process_index_.find(pid);
+	if (it == process_index_.end() || node_number >= nodes_.size()) return false;
+	if (static_cast<double>(begin) >= PROCESS_MEMORY || end <= begin) return true;
+	SimProcess& process = processes_[it->second];
+	double share = min(static_cast<double>(end - begin) / (PROCESS_MEMORY - static_cast<double>(begin)), 1.0);
+	double moved = 0.0;
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		if (i == node_number) continue;
+		double bytes = process.memory_[i] * share;
+		process.memory_[i] -= bytes;
+		moved += bytes;
+	}
+	process.memory_[node_number] += moved;
+	moved_bytes = static_cast<uint64_t>(moved);
+	return true;
+}
+
+void SimProbe::Allocate(SimProcess& process, int node, double bytes) {
+	bytes = min(bytes, PROCESS_MEMORY - process.resident_);
+	if (bytes <= 0.0) return;
+	process.resident_ += bytes;
+	if (node >= 0) {
+		process.memory_[node] += bytes;
+		return;
+	}
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		process.memory_[i] += bytes * capacities_[i] / total_capacity_;
+	}
+}
+
+double SimProbe::RemoteShare(const SimProcess& process, int node) const {
+	if (process.resident_ <= 0.0) return 0.0;
+	if (node >= 0) return 1.0 - process.memory_[node] / process.resident_;
+	double share = 0.0;
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		share += (1.0 - process.memory_[i] / process.resident_) * capacities_[i] / total_capacity_;
+	}
+	return share;
+}
+
+// Returns the load of every node for the step, in units of its capacity; it exceeds 1.0 when the node is overloaded.
+const vector<double>& SimProbe::Step(double seconds) {
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		loads_[i] = nodes_[i].background_;
+	}
+	for (auto it = processes_.begin(); it != processes_.end(); ++it) {
+		for (size_t i = 0; i < it->tids_.size(); ++i) {
+			AddLoad(it->thread_nodes_[i], it->demand_ * thread_weights_[i]);
+		}
+	}
+	for (size_t i = 0; i < nodes_.size(); ++i) {
+		served_[i] = loads_[i] > capacities_[i] ? capacities_[i] / loads_[i] : 1.0;
+		loads_[i] = capacities_[i] > 0.0 ? loads_[i] / capacities_[i] : 0.0;
+	}
+	for (auto it = processes_.begin(); it != processes_.end(); ++it) {
+		for (size_t i = 0; i < it->tids_.size(); ++i) {
+			double cpu_seconds = it->demand_ * thread_weights_[i] * Share(it->thread_nodes_[i]) * seconds;
+			remote_seconds_ += cpu_seconds * RemoteShare(*it, it->thread_nodes_[i]);
+			Allocate(*it, it->thread_nodes_[i], cpu_seconds * MEMORY_PER_CPU_SECOND);
+			int64_t user_time = static_cast<int64_t>(cpu_seconds * TIME_UNITS_PER_SECOND);
+			it->thread_user_times_[i] += user_time;
+			it->user_time_ += user_time;
+		}
+	}
+	return loads_;
+}
@@ -0,0 +1,99 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "system_probe.h"
+
+struct SimNode {
+	uint32_t cpus_;
+	double background_;
+};
+
+// SystemProbe over a modelled machine. The balancer sees the processes, threads and masks it would
+// see on a real server; Step runs the model for a while and charges USER_TIME for the CPU time
+// every process actually got. A bound process runs on its node, an unbound one on all nodes in
+// proportion to their capacity, and an overloaded node shares its CPUs in proportion to demand.
+// The demand of a process is split over its threads by Zipf's law, the first thread is the hottest,
+// and every thread runs where its own mask points, so the threads of a process may be spread.
+// Memory is first-touch: a process allocates in proportion to the CPU time it got, on the node that
+// ran it, up to a fixed size, and the pages stay where they were allocated unless they are moved with
+// MovePages. The pages of every node are spread evenly over the one region of the process.
+class SimProbe : public SystemProbe {
+public:
+	// Where a new process starts: unbound, on the nodes in turn (as Windows assigns processor groups) or on node 0.
+	enum InitialNode { Spread, RoundRobin, First };
+	SimProbe(const std::vector<SimNode>& nodes, uint32_t threads_per_process, InitialNode initial_node);
+	bool Init() override { return true; }
+	std::vector<NumaNode> NumaNodes() override;
+	bool ActiveProcesses(const std::unordered_set<std::wstring>& process_filter, ProcessVisitor& visitor) override;
+	std::vector<uint16_t> ProcessNumaGroups(uint32_t pid) override;
+	std::pair<uint64_t, uint64_t> ProcessAffinityMask(uint32_t pid) override;
+	bool SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) override;
+	bool SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) override;
+	int64_t CurrentTime() override;
+	bool ProcessNodeMemory(uint32_t pid, std::vector<uint64_t>& node_bytes) override;
+	bool CanMovePages() const override { return true; }
+	bool ProcessMemoryRegions(uint32_t pid, std::vector<MemoryRegion>& regions) override;
+	bool MovePages(uint32_t pid, uint64_t begin, uint64_t end, uint32_t node_number, uint64_t& moved_bytes) override;
+	bool ProcessName(uint32_t pid, std::wstring& name) override;
+	bool SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) override;
+	// The nodes are split over the packages in order, every node is one L3 cache and every CPU a core.
+	bool ReadTopology(CpuTopology& topology) override;
+	void SetPackages(uint32_t packages) { packages_ = packages ? packages : 1; }
+
+	// True when the pid starts a new process.
+	bool SetDemand(uint32_t pid, const std::wstring& name, double load);
+	const std::vector<double>& Step(double seconds);
+	void SetTime(int64_t second) { second_ = second; }
+	size_t Migrations() const { return migrations_; }
+	size_t Placements() const { return placements_; }
+	// New processes bound by SetNewProcessAffinity.
+	size_t SpawnPlacements() const { return spawn_placements_; }
+	// Threads bound to another node than their process.
+	size_t ThreadMoves() const { return thread_moves_; }
+	int64_t LastMoveTime() const { return last_move_time_; }
+	// CPU-seconds the processes ran away from their memory, weighted by the remote share of it.
+	double RemoteSeconds() const { return remote_seconds_; }
+private:
+	struct SimProcess {
+		uint32_t pid_;
+		std::wstring name_;
+		int64_t create_time_;
+		int64_t user_time_;
+		double demand_;
+		int node_;
+		std::vector<uint32_t> tids_;
+		std::vector<int> thread_nodes_;
+		std::vector<int64_t> thread_user_times_;
+		std::vector<double> memory_;
+		double resident_;
+	};
+	std::vector<SimNode> nodes_;
+	std::vector<NumaNode> numa_nodes_;
+	std::vector<SimProcess> processes_;
+	std::unordered_map<uint32_t, size_t> process_index_;
+	std::unordered_map<uint32_t, std::pair<size_t, size_t>> thread_index_;
+	std::vector<double> capacities_;
+	std::vector<double> loads_;
+	std::vector<double> served_;
+	std::vector<double> thread_weights_;
+	uint32_t threads_per_process_;
+	InitialNode initial_node_;
+	uint32_t packages_ = 1;
+	uint32_t next_tid_ = 1;
+	double total_capacity_ = 0.0;
+	int64_t second_ = 0;
+	size_t migrations_ = 0;
+	size_t placements_ = 0;
+	size_t spawn_placements_ = 0;
+	size_t thread_moves_ = 0;
+	int64_t last_move_time_ = -1;
+	double remote_seconds_ = 0.0;
+	GroupAffinity NodeAffinity(int node) const;
+	void AddLoad(int node, double load);
+	double Share(int node) const;
+	void Allocate(SimProcess& process, int node, double bytes);
+	double RemoteShare(const SimProcess& process, int node) const;
+};
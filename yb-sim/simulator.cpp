@@ -0,0 +1,106 @@
+﻿#include "simulator.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include "ProcessInfo.h"
+
+using namespace std;
+
+SimReport Simulate(const LoadTrace& trace, const SimOptions& options) {
+	auto start = chrono::steady_clock::now();
+	SimReport report;
+
+	unique_ptr<SimProbe> probe_owner = make_unique<SimProbe>(options.nodes_, options.threads_per_process_, options.initial_node_);
+	SimProbe* probe = probe_owner.get();
+	probe->SetPackages(options.packages_);
+	ProcessesInfo processes_info(move(probe_owner));
+	processes_info.SetExternalCounters();
+	processes_info.Init(options.cpu_analysis_period_, options.switching_frequency_, options.maximum_cpu_value_, options.delta_cpu_values_);
+	processes_info.SetMigrationCost(options.migration_cost_);
+	processes_info.SetRemoteMemoryPenalty(options.remote_memory_penalty_);
+	processes_info.SetMemoryMigration(options.memory_migration_);
+	processes_info.SetHysteresis(options.minimum_dwell_time_, options.maximum_moves_per_tick_, options.move_damping_);
+	processes_info.SetThreadBalancing(options.is_thread_balancing_);
+	processes_info.SetFastWarmUp(options.is_fast_warm_up_);
+	if (!options.journal_path_.empty()) processes_info.OpenJournal(options.journal_path_, options.journal_size_);
+	if (!options.state_path_.empty()) processes_info.OpenState(options.state_path_, options.state_save_period_, options.state_max_age_);
+
+	ofstream series;
+	if (!options.series_path_.empty()) {
+		series.open(options.series_path_, ios::out | ios::binary);
+		series << "second";
+		for (size_t i = 0; i < options.nodes_.size(); ++i) series << ",node" << i;
+		series << ",migrations\n";
+	}
+
+	double total_capacity = 0.0;
+	for (auto it = options.nodes_.begin(); it != options.nodes_.end(); ++it) {
+		total_capacity += min<uint32_t>(it->cpus_, 64);
+	}
+
+	vector<double> counters(options.nodes_.size() + 1);
+	double sum_imbalance = 0.0;
+	auto it_sample = trace.samples_.begin();
+	for (int64_t second = 0; second < trace.duration_; ++second) {
+		probe->SetTime(second);
+		for (; it_sample != trace.samples_.end() && it_sample->second_ <= second; ++it_sample) {
+			if (probe->SetDemand(it_sample->pid_, it_sample->name_, it_sample->load_) && options.is_spawn_placement_) {
+				processes_info.PlaceNewProcess(it_sample->pid_);
+			}
+		}
+
+		processes_info.StepMemoryMigration(1.0);
+		const vector<double>& loads = probe->Step(1.0);
+		double busy = 0.0;
+		double max_load = 0.0;
+		double min_load = loads.empty() ? 0.0 : loads[0];
+		for (size_t i = 0; i < loads.size(); ++i) {
+			counters[i + 1] = min(loads[i], 1.0) * 100.0;
+			busy += min(loads[i], 1.0) * min<uint32_t>(options.nodes_[i].cpus_, 64);
+			max_load = max(max_load, loads[i]);
+			min_load = min(min_load, loads[i]);
+			if (loads[i] > 1.0) report.overload_seconds_ += 1.0;
+		}
+		counters[0] = total_capacity > 0.0 ? busy / total_capacity * 100.0 : 0.0;
+		processes_info.AddCounterValues(counters);
+
+		double imbalance = (max_load - min_load) * 100.0;
+		report.peak_node_load_ = max(report.peak_node_load_, max_load * 100.0);
+		report.max_imbalance_ = max(report.max_imbalance_, imbalance);
+		sum_imbalance += imbalance;
+		if (imbalance > options.delta_cpu_values_) report.balanced_from_ = -1;
+		else if (report.balanced_from_ < 0) report.balanced_from_ = second;
+
+		if ((second + 1) % max(options.switching_frequency_, 1) == 0) {
+			probe->SetTime(second + 1);
+			processes_info.Read();
+			processes_info.SetAffinity();
+			++report.decisions_;
+			if (series.is_open()) {
+				series << second + 1;
+				for (size_t i = 0; i < loads.size(); ++i) series << ',' << loads[i] * 100.0;
+				series << ',' << probe->Migrations() << '\n';
+			}
+		}
+	}
+
+	report.seconds_ = trace.duration_;
+	report.avg_imbalance_ = trace.duration_ > 0 ? sum_imbalance / static_cast<double>(trace.duration_) : 0.0;
+	report.migrations_ = probe->Migrations();
+	report.placements_ = probe->Placements();
+	report.spawn_placements_ = probe->SpawnPlacements();
+	report.thread_moves_ = probe->ThreadMoves();
+	report.remote_seconds_ = probe->RemoteSeconds();
+	report.migrated_bytes_ = processes_info.MemoryMigration().MigratedBytes();
+	report.prevented_oscillations_ = processes_info.PreventedOscillations();
+	report.converged_at_ = probe->LastMoveTime();
+	report.wall_seconds_ = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (options.is_profile_) {
+		for (int i = 0; i < SelfProfile::PHASE_COUNT; ++i) {
+			string line;
+			if (processes_info.Profile().AppendPhase(line, static_cast<SelfProfile::Phase>(i))) report.profile_.push_back(line);
+		}
+	}
+	return report;
+}
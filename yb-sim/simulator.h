@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "load_trace.h"
+#include "sim_probe.h"
+
+struct SimOptions {
+	std::vector<SimNode> nodes_;
+	uint32_t threads_per_process_ = 8;
+	SimProbe::InitialNode initial_node_ = SimProbe::RoundRobin;
+	uint32_t packages_ = 1;
+	int cpu_analysis_period_ = 60;
+	int switching_frequency_ = 10;
+	int maximum_cpu_value_ = 70;
+	int delta_cpu_values_ = 30;
+	int migration_cost_ = 5;
+	int remote_memory_penalty_ = 30;
+	int memory_migration_ = 128;
+	int minimum_dwell_time_ = 300;
+	int maximum_moves_per_tick_ = 4;
+	int move_damping_ = 100;
+	std::filesystem::path series_path_;
+	std::filesystem::path journal_path_;
+	int journal_size_ = 16;
+	std::filesystem::path state_path_;
+	int state_save_period_ = 60;
+	int state_max_age_ = 300;
+	bool is_profile_ = false;
+	bool is_thread_balancing_ = false;
+	bool is_spawn_placement_ = false;
+	bool is_fast_warm_up_ = false;
+};
+
+// Loads are in percent of node capacity and may exceed 100 on an overloaded node.
+// converged_at_ is the time of the last move, balanced_from_ the time from which the imbalance
+// stays within delta_cpu_values until the end; both are -1 when it never happened.
+struct SimReport {
+	int64_t seconds_ = 0;
+	int64_t decisions_ = 0;
+	double peak_node_load_ = 0.0;
+	double avg_imbalance_ = 0.0;
+	double max_imbalance_ = 0.0;
+	double overload_seconds_ = 0.0;
+	size_t migrations_ = 0;
+	size_t placements_ = 0;
+	size_t spawn_placements_ = 0;
+	size_t thread_moves_ = 0;
+	double remote_seconds_ = 0.0;
+	uint64_t migrated_bytes_ = 0;
+	size_t prevented_oscillations_ = 0;
+	int64_t converged_at_ = -1;
+	int64_t balanced_from_ = -1;
+	double wall_seconds_ = 0.0;
+	// Summaries of the tick phases, filled with is_profile_.
+	std::vector<std::string> profile_;
+};
+
+// Replays the trace one simulated second at a time: node counters are fed to ProcessesInfo every
+// second and Read/SetAffinity run every switching_frequency seconds, as the service loop does.
+SimReport Simulate(const LoadTrace& trace, const SimOptions& options);
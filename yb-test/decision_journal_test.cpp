@@ -0,0 +1,53 @@
+﻿#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "decision_journal.h"
+#include "test.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+fs::path writeJournal() {
+	fs::path path = fs::temp_directory_path() / "yb-test-journal.ybj";
+	fs::remove(path);
+	DecisionJournal journal;
+	journal.Open(path, 4);
+	journal.BeginTick(true, 0.9, 0.4);
+	journal.AddNode(0, 0.9);
+	journal.AddNode(1, 0.5);
+	return path;
+}
+
+void testJournalRoundTrip() {
+	fs::path path = writeJournal();
+	vector<JournalRecord> records;
+	wstring error;
+	CHECK(DecisionJournal::Read(path, records, error));
+	CHECK(records.size() == 3);
+	CHECK(records.size() == 3 && records[0].type_ == DecisionJournal::Tick && records[2].type_ == DecisionJournal::Node);
+	fs::remove(path);
+}
+
+// The capacity follows the magic, version and record size.
+void testCorruptJournalCapacityIsDamaged() {
+	fs::path path = writeJournal();
+	{
+		fstream file(path, ios::in | ios::out | ios::binary);
+		uint64_t capacity = UINT64_MAX / 2;
+		file.seekp(16);
+		file.write(reinterpret_cast<const char*>(&capacity), sizeof(capacity));
+	}
+	vector<JournalRecord> records;
+	wstring error;
+	CHECK(!DecisionJournal::Read(path, records, error));
+	CHECK(error.find(L"damaged") != wstring::npos);
+	fs::remove(path);
+}
+
+void RunDecisionJournalTests(TestRunner& runner) {
+	runner.Run("DecisionJournal.RoundTrip", testJournalRoundTrip);
+	runner.Run("DecisionJournal.CorruptCapacityIsDamaged", testCorruptJournalCapacityIsDamaged);
+}
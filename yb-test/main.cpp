@@ -0,0 +1,33 @@
+﻿#include <cstdio>
+#include <string>
+#include "test.h"
+
+size_t TestRunner::failed_checks_ = 0;
+
+void TestRunner::Run(const std::string& name, const std::function<void()>& body) {
+    if (name.find(filter_) == std::string::npos) return;
+    size_t failed_checks = failed_checks_;
+    body();
+    ++runs_;
+    if (failed_checks_ != failed_checks) {
+        ++failed_;
+        printf("FAILED %s\n", name.c_str());
+    }
+}
+
+void TestRunner::Fail(const char* condition, const char* file, int line) {
+    ++failed_checks_;
+    printf("%s:%d: CHECK(%s)\n", file, line, condition);
+}
+
+// yb-test [filter] - runs the unit tests whose name contains the filter, all of them without one.
+int main(int argc, char** argv) {
+    TestRunner runner(argc > 1 ? argv[1] : "");
+    RunDecisionJournalTests(runner);
+    RunPlacementPlannerTests(runner);
+    RunProcessSnapshotTests(runner);
+    RunRingBufferTests(runner);
+    RunStateSnapshotTests(runner);
+    printf("%zu tests, %zu failed\n", runner.Runs(), runner.Failed());
+    return runner.Failed() ? 1 : 0;
+}
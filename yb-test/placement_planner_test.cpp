@@ -0,0 +1,173 @@
+﻿#include <vector>
+#include "placement_planner.h"
+#include "test.h"
+
+using namespace std;
+
+vector<NodeLoad> emptyNodes(size_t count, double capacity) {
+	return vector<NodeLoad>(count, { capacity, 0.0, 0.0, 0.0 });
+}
+
+Placement placement(uint32_t pid, double load, int node) {
+	return { pid, load, node, node };
+}
+
+// The plan sorts its placements by load.
+const Placement& findPlacement(const PlacementPlan& plan, uint32_t pid) {
+	for (auto it = plan.placements_.begin(); it != plan.placements_.end(); ++it) {
+		if (it->pid_ == pid) return *it;
+	}
+	static const Placement none = { 0, 0.0, -1, -1 };
+	return none;
+}
+
+void testUnboundProcessesByLpt() {
+	PlacementPlanner planner;
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), { placement(1, 8, -1), placement(2, 6, -1), placement(3, 4, -1), placement(4, 2, -1) });
+	CHECK(findPlacement(plan, 1).target_node_ == 0);
+	CHECK(findPlacement(plan, 2).target_node_ == 1);
+	CHECK(findPlacement(plan, 3).target_node_ == 1);
+	CHECK(findPlacement(plan, 4).target_node_ == 0);
+	CHECK(plan.Moves() == 0);
+	CHECK_NEAR(plan.nodes_[0].planned_, 10.0 / 32);
+	CHECK_NEAR(plan.nodes_[1].planned_, 10.0 / 32);
+}
+
+void testBackgroundStaysOnItsNode() {
+	PlacementPlanner planner;
+	vector<NodeLoad> nodes = emptyNodes(2, 32);
+	nodes[0].background_ = 16;
+	PlacementPlan plan = planner.Plan(nodes, { placement(1, 8, -1) });
+	CHECK(findPlacement(plan, 1).target_node_ == 1);
+	CHECK_NEAR(plan.nodes_[0].planned_, 0.5);
+	CHECK_NEAR(plan.nodes_[1].planned_, 0.25);
+}
+
+// A quarter of the window of process 1 ran on node 0 before its move, process 2 is spread by capacity.
+void testMovedLoadStaysOnOrigin() {
+	vector<NodeLoad> nodes = emptyNodes(2, 32);
+	Placement moved = placement(1, 8, 1);
+	moved.origin_node_ = 0;
+	moved.moved_share_ = 0.25;
+	PlacementPlanner::SetBackgrounds(nodes, { 12, 7 }, { moved, placement(2, 4, -1) });
+	CHECK_NEAR(nodes[0].background_, 8.0);
+	CHECK_NEAR(nodes[1].background_, 0.0);
+}
+
+void testBalancedBoundProcessesStay() {
+	PlacementPlanner planner;
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), { placement(1, 10, 0), placement(2, 8, 1) });
+	CHECK(!plan.is_rebalanced_);
+	CHECK(plan.Moves() == 0);
+	CHECK_NEAR(plan.current_max_load_, 10.0 / 32);
+}
+
+void testOverloadedNodeIsSplit() {
+	PlacementPlanner planner;
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), { placement(1, 8, 0), placement(2, 8, 0), placement(3, 8, 0), placement(4, 8, 0) });
+	CHECK(plan.is_rebalanced_);
+	CHECK(plan.Moves() == 2);
+	CHECK_NEAR(plan.current_max_load_, 1.0);
+	CHECK_NEAR(plan.planned_max_load_, 0.5);
+}
+
+void testMaxMovesLimitsBoundMoves() {
+	PlacementPlanner planner;
+	planner.SetMaxMoves(1);
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), { placement(1, 8, 0), placement(2, 8, 0), placement(3, 8, 0), placement(4, 8, 0) });
+	CHECK(plan.is_rebalanced_);
+	CHECK(plan.Moves() == 1);
+	CHECK_NEAR(plan.planned_max_load_, 0.75);
+}
+
+// The first process still fits its own node best, the other five would go back to their origin.
+void testPinnedProcessesCountPrevented() {
+	PlacementPlanner planner;
+	planner.SetDamping(1.0);
+	vector<Placement> placements;
+	for (uint32_t pid = 1; pid <= 6; ++pid) {
+		placements.push_back(placement(pid, 4, 1));
+		placements.back().is_pinned_ = true;
+		placements.back().origin_node_ = 0;
+	}
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), placements);
+	CHECK(!plan.is_rebalanced_);
+	CHECK(plan.Moves() == 0);
+	CHECK(plan.prevented_ == 5);
+}
+
+// The move back gains 0.075 of the node: more than the migration cost, less than it with the damping of 2.
+void testDampingKeepsProcessFromOrigin() {
+	vector<NodeLoad> nodes = emptyNodes(2, 32);
+	nodes[1].background_ = 4;
+	Placement process = placement(1, 8, 1);
+	process.origin_node_ = 0;
+
+	PlacementPlanner planner;
+	PlacementPlan plan = planner.Plan(nodes, { process });
+	CHECK(plan.is_rebalanced_);
+	CHECK(findPlacement(plan, 1).target_node_ == 0);
+
+	planner.SetDamping(2.0);
+	plan = planner.Plan(nodes, { process });
+	CHECK(!plan.is_rebalanced_);
+	CHECK(findPlacement(plan, 1).target_node_ == 1);
+	CHECK(plan.prevented_ == 1);
+}
+
+void testRemoteMemoryDrawsToItsNode() {
+	PlacementPlanner planner;
+	planner.SetRemotePenalty(0.3);
+	Placement process = placement(1, 8, -1);
+	process.memory_row_ = 0;
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), { process }, { 1.0, 0.0 });
+	CHECK(findPlacement(plan, 1).target_node_ == 1);
+}
+
+// Nodes 0 and 1 share a package, as do 2 and 3; node 1 is a little busier than the remote ones.
+void testMoveDistancesPreferNearNode() {
+	vector<NodeLoad> nodes = emptyNodes(4, 16);
+	nodes[0].background_ = 14;
+	nodes[1].background_ = 1;
+	const double remote = 32.0 / 12.0;
+
+	PlacementPlanner planner;
+	PlacementPlan plan = planner.Plan(nodes, { placement(1, 4, 0) });
+	CHECK(findPlacement(plan, 1).target_node_ == 2);
+
+	planner.SetMoveDistances({
+		1.0, 1.0, remote, remote,
+		1.0, 1.0, remote, remote,
+		remote, remote, 1.0, 1.0,
+		remote, remote, 1.0, 1.0 });
+	plan = planner.Plan(nodes, { placement(1, 4, 0) });
+	CHECK(findPlacement(plan, 1).target_node_ == 1);
+}
+
+// A move of a thread has to lower the larger of the two node loads by more than the migration cost.
+void testSpreadThreadsMovesHottestThreads() {
+	PlacementPlanner planner;
+	PlacementPlan plan = planner.Plan(emptyNodes(2, 32), { placement(1, 24, 0) });
+	CHECK(findPlacement(plan, 1).target_node_ == 0);
+	vector<ThreadPlacement> threads = { { 11, 4, 0, 0 }, { 12, 10, 0, 0 }, { 13, 2, 0, 0 }, { 14, 8, 0, 0 } };
+	CHECK(planner.SpreadThreads(plan, 0, threads) == 2);
+	for (auto it = threads.begin(); it != threads.end(); ++it) {
+		CHECK(it->target_node_ == (it->tid_ == 12 || it->tid_ == 13 ? 1 : 0));
+	}
+	CHECK_NEAR(plan.nodes_[0].planned_, 12.0 / 32);
+	CHECK_NEAR(plan.nodes_[1].planned_, 12.0 / 32);
+}
+
+void RunPlacementPlannerTests(TestRunner& runner) {
+	runner.Run("PlacementPlanner.UnboundProcessesByLpt", testUnboundProcessesByLpt);
+	runner.Run("PlacementPlanner.BackgroundStaysOnItsNode", testBackgroundStaysOnItsNode);
+	runner.Run("PlacementPlanner.MovedLoadStaysOnOrigin", testMovedLoadStaysOnOrigin);
+	runner.Run("PlacementPlanner.BalancedBoundProcessesStay", testBalancedBoundProcessesStay);
+	runner.Run("PlacementPlanner.OverloadedNodeIsSplit", testOverloadedNodeIsSplit);
+	runner.Run("PlacementPlanner.MaxMovesLimitsBoundMoves", testMaxMovesLimitsBoundMoves);
+	runner.Run("PlacementPlanner.PinnedProcessesCountPrevented", testPinnedProcessesCountPrevented);
+	runner.Run("PlacementPlanner.DampingKeepsProcessFromOrigin", testDampingKeepsProcessFromOrigin);
+	runner.Run("PlacementPlanner.RemoteMemoryDrawsToItsNode", testRemoteMemoryDrawsToItsNode);
+	runner.Run("PlacementPlanner.MoveDistancesPreferNearNode", testMoveDistancesPreferNearNode);
+	runner.Run("PlacementPlanner.SpreadThreadsMovesHottestThreads", testSpreadThreadsMovesHottestThreads);
+}
@@ -0,0 +1,147 @@
+﻿#include <cstddef>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "process_snapshot.h"
+#include "test.h"
+
+using namespace std;
+
+// A snapshot laid out as NtQuerySystemInformation returns it: entries aligned to 8 bytes, each with its
+// threads and then its image name. The name of an entry points into the buffer, so it is built once.
+class SnapshotBuilder {
+public:
+	void Add(uint32_t pid, const wstring& name, uint32_t threads) { entries_.push_back({ pid, name, threads }); }
+	vector<uint8_t> Build(vector<size_t>& offsets) const;
+private:
+	struct Entry {
+		uint32_t pid_;
+		wstring name_;
+		uint32_t threads_;
+	};
+	vector<Entry> entries_;
+};
+
+const size_t HEADER_SIZE = offsetof(SYSTEM_PROCESS_INFORMATION, ThreadInfos);
+
+vector<uint8_t> SnapshotBuilder::Build(vector<size_t>& offsets) const {
+	offsets.clear();
+	size_t size = 0;
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		offsets.push_back(size);
+		size += (HEADER_SIZE + it->threads_ * sizeof(SYSTEM_THREAD_INFORMATION) + it->name_.size() * sizeof(char16_t) + 7) / 8 * 8;
+	}
+	vector<uint8_t> buffer(size);
+	for (size_t i = 0; i < entries_.size(); ++i) {
+		const Entry& entry = entries_[i];
+		uint8_t* data = buffer.data() + offsets[i];
+		char16_t* name = reinterpret_cast<char16_t*>(data + HEADER_SIZE + entry.threads_ * sizeof(SYSTEM_THREAD_INFORMATION));
+		for (size_t j = 0; j < entry.name_.size(); ++j) name[j] = static_cast<char16_t>(entry.name_[j]);
+
+		SYSTEM_PROCESS_INFORMATION info;
+		memset(&info, 0, sizeof(info));
+		info.NextOffset = i + 1 < entries_.size() ? static_cast<uint32_t>(offsets[i + 1] - offsets[i]) : 0;
+		info.ThreadCount = entry.threads_;
+		info.ImageName.Length = static_cast<uint16_t>(entry.name_.size() * sizeof(char16_t));
+		info.ImageName.MaximumLength = info.ImageName.Length;
+		info.ImageName.Buffer = entry.name_.empty() ? nullptr : name;
+		info.ProcessId = entry.pid_;
+		memcpy(data, &info, HEADER_SIZE);
+		for (uint32_t j = 0; j < entry.threads_; ++j) {
+			SYSTEM_THREAD_INFORMATION thread;
+			memset(&thread, 0, sizeof(thread));
+			thread.Client_Id.UniqueProcess = entry.pid_;
+			thread.Client_Id.UniqueThread = entry.pid_ * 100 + j;
+			memcpy(data + HEADER_SIZE + j * sizeof(thread), &thread, sizeof(thread));
+		}
+	}
+	return buffer;
+}
+
+SYSTEM_PROCESS_INFORMATION* entryAt(vector<uint8_t>& buffer, size_t offset) {
+	return reinterpret_cast<SYSTEM_PROCESS_INFORMATION*>(buffer.data() + offset);
+}
+
+class RecordingVisitor : public ProcessVisitor {
+public:
+	vector<uint32_t> pids_;
+	vector<wstring> names_;
+	vector<uint32_t> tids_;
+	void Process(const ProcessRecord& process) override {
+		pids_.push_back(process.pid_);
+		names_.push_back(wstring(process.name_));
+	}
+	void Thread(const ThreadInfo& thread) override { tids_.push_back(thread.thread_id_); }
+};
+
+bool visit(const vector<uint8_t>& buffer, size_t size, const unordered_set<wstring>& filter, RecordingVisitor& visitor) {
+	wstring image_name;
+	return VisitProcessSnapshot(buffer.data(), size, filter, image_name, visitor,
+		[](const SYSTEM_PROCESS_INFORMATION&) {},
+		[](const SYSTEM_PROCESS_INFORMATION&, const SYSTEM_THREAD_INFORMATION&) { return GroupAffinity{ 1, 0 }; });
+}
+
+SnapshotBuilder threeProcesses() {
+	SnapshotBuilder builder;
+	builder.Add(0, L"", 1);
+	builder.Add(4, L"rphost.exe", 2);
+	builder.Add(8, L"svchost.exe", 1);
+	return builder;
+}
+
+void testSnapshotChain() {
+	vector<size_t> offsets;
+	vector<uint8_t> buffer = threeProcesses().Build(offsets);
+	RecordingVisitor all;
+	CHECK(visit(buffer, buffer.size(), {}, all));
+	CHECK(all.pids_ == vector<uint32_t>({ 0, 4, 8 }));
+	CHECK(all.names_ == vector<wstring>({ L"System Idle Process", L"rphost.exe", L"svchost.exe" }));
+	CHECK(all.tids_ == vector<uint32_t>({ 0, 400, 401, 800 }));
+
+	RecordingVisitor filtered;
+	CHECK(visit(buffer, buffer.size(), { L"rphost.exe" }, filtered));
+	CHECK(filtered.pids_ == vector<uint32_t>({ 4 }));
+	CHECK(filtered.tids_ == vector<uint32_t>({ 400, 401 }));
+}
+
+// The entries before the broken link are still visited, the snapshot is reported incomplete.
+void testSnapshotNextOffsetPastBuffer() {
+	vector<size_t> offsets;
+	vector<uint8_t> buffer = threeProcesses().Build(offsets);
+	entryAt(buffer, offsets[1])->NextOffset = static_cast<uint32_t>(buffer.size());
+	RecordingVisitor visitor;
+	CHECK(!visit(buffer, buffer.size(), {}, visitor));
+	CHECK(visitor.pids_ == vector<uint32_t>({ 0, 4 }));
+}
+
+void testSnapshotTruncatedThreads() {
+	vector<size_t> offsets;
+	vector<uint8_t> buffer = threeProcesses().Build(offsets);
+	RecordingVisitor visitor;
+	CHECK(!visit(buffer, offsets[1] + HEADER_SIZE + sizeof(SYSTEM_THREAD_INFORMATION), {}, visitor));
+	CHECK(visitor.pids_ == vector<uint32_t>({ 0 }));
+	CHECK(visitor.tids_ == vector<uint32_t>({ 0 }));
+}
+
+// A name of zero length is empty, a process without a name buffer is reported as unknown.
+void testSnapshotZeroLengthImageName() {
+	vector<size_t> offsets;
+	vector<uint8_t> buffer = threeProcesses().Build(offsets);
+	entryAt(buffer, offsets[1])->ImageName.Length = 0;
+	entryAt(buffer, offsets[2])->ImageName.Buffer = nullptr;
+	RecordingVisitor all;
+	CHECK(visit(buffer, buffer.size(), {}, all));
+	CHECK(all.names_ == vector<wstring>({ L"System Idle Process", L"", L"unknow" }));
+
+	RecordingVisitor filtered;
+	CHECK(visit(buffer, buffer.size(), { L"rphost.exe" }, filtered));
+	CHECK(filtered.pids_.empty());
+}
+
+void RunProcessSnapshotTests(TestRunner& runner) {
+	runner.Run("ProcessSnapshot.Chain", testSnapshotChain);
+	runner.Run("ProcessSnapshot.NextOffsetPastBuffer", testSnapshotNextOffsetPastBuffer);
+	runner.Run("ProcessSnapshot.TruncatedThreads", testSnapshotTruncatedThreads);
+	runner.Run("ProcessSnapshot.ZeroLengthImageName", testSnapshotZeroLengthImageName);
+}
@@ -0,0 +1,71 @@
+﻿#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "ring_buffer.h"
+#include "test.h"
+
+using namespace std;
+
+// A sawtooth with a falling and a rising run, so that the extremes leave the window by age as well as by value.
+vector<int64_t> sawtooth(size_t count) {
+	vector<int64_t> values;
+	for (size_t i = 0; i < count; ++i) {
+		int64_t phase = static_cast<int64_t>(i % 11);
+		values.push_back(phase < 6 ? 50 - phase * 7 : phase * 5 + static_cast<int64_t>(i % 3));
+	}
+	return values;
+}
+
+template <size_t N>
+void checkMinMax(RingBuffer<int64_t, N>& buffer, const vector<int64_t>& values) {
+	for (size_t i = 0; i < values.size(); ++i) {
+		buffer.Add(values[i]);
+		size_t first = i + 1 > buffer.Capacity() ? i + 1 - buffer.Capacity() : 0;
+		auto window = minmax_element(values.begin() + first, values.begin() + i + 1);
+		CHECK(buffer.Min() == *window.first);
+		CHECK(buffer.Max() == *window.second);
+	}
+}
+
+void testMinMaxAcrossWrapAround() {
+	RingBuffer<int64_t> buffer(4);
+	checkMinMax(buffer, sawtooth(50));
+	RingBuffer<int64_t, 5> inline_buffer;
+	checkMinMax(inline_buffer, sawtooth(50));
+}
+
+// The variance is kept by adding and removing values between the recomputations at every wrap-around.
+void testVarianceAcrossWrapAround() {
+	RingBuffer<double> buffer(7);
+	vector<double> values;
+	for (size_t i = 0; i < 100; ++i) {
+		values.push_back(1000.0 + static_cast<double>((i * 37) % 23) * 0.5 - static_cast<double>(i % 4) * 3.25);
+		buffer.Add(values.back());
+
+		size_t first = i + 1 > buffer.Capacity() ? i + 1 - buffer.Capacity() : 0;
+		size_t count = i + 1 - first;
+		double mean = 0.0;
+		for (size_t j = first; j <= i; ++j) mean += values[j];
+		mean /= static_cast<double>(count);
+		double variance = 0.0;
+		for (size_t j = first; j <= i; ++j) variance += (values[j] - mean) * (values[j] - mean);
+		variance /= static_cast<double>(count);
+		CHECK(std::fabs(buffer.Variance() - variance) < 1e-6);
+		CHECK(std::fabs(buffer.StdDev() - std::sqrt(variance)) < 1e-6);
+	}
+}
+
+void testConstantWindowHasNoVariance() {
+	RingBuffer<double> buffer(3);
+	for (int i = 0; i < 10; ++i) buffer.Add(0.1);
+	CHECK_NEAR(buffer.Variance(), 0.0);
+	CHECK_NEAR(buffer.Min(), 0.1);
+	CHECK_NEAR(buffer.Max(), 0.1);
+}
+
+void RunRingBufferTests(TestRunner& runner) {
+	runner.Run("RingBuffer.MinMaxAcrossWrapAround", testMinMaxAcrossWrapAround);
+	runner.Run("RingBuffer.VarianceAcrossWrapAround", testVarianceAcrossWrapAround);
+	runner.Run("RingBuffer.ConstantWindowHasNoVariance", testConstantWindowHasNoVariance);
+}
@@ -0,0 +1,65 @@
+﻿#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "state_snapshot.h"
+#include "test.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+fs::path writeSnapshot() {
+	fs::path path = fs::temp_directory_path() / "yb-test-state.ybs";
+	StateSnapshot snapshot;
+	snapshot.Begin(10, 42, 1000);
+	snapshot.AddSplitProcess(7, 500);
+	snapshot.AddCounter(1, { 1.5, 2.5 });
+	snapshot.Write(path);
+	return path;
+}
+
+void testSnapshotRoundTrip() {
+	fs::path path = writeSnapshot();
+	StateSnapshot snapshot;
+	wstring error;
+	CHECK(snapshot.Read(path, error));
+	CHECK(snapshot.SwitchingFrequency() == 10);
+	CHECK(snapshot.Generation() == 42);
+	CHECK(snapshot.SplitProcesses().size() == 1 && snapshot.SplitProcesses().at(7) == 500);
+	CHECK(snapshot.Counters().size() == 2 && snapshot.Counters()[1] == vector<double>({ 1.5, 2.5 }));
+	fs::remove(path);
+}
+
+void testTruncatedSnapshotIsDamaged() {
+	fs::path path = writeSnapshot();
+	fs::resize_file(path, fs::file_size(path) - 8);
+	StateSnapshot snapshot;
+	wstring error;
+	CHECK(!snapshot.Read(path, error));
+	CHECK(error.find(L"damaged") != wstring::npos);
+	fs::remove(path);
+}
+
+// The size of the records follows the magic, version, switching frequency, generation and time.
+void testCorruptHeaderSizeIsDamaged() {
+	fs::path path = writeSnapshot();
+	{
+		fstream file(path, ios::in | ios::out | ios::binary);
+		uint64_t size = UINT64_MAX / 2;
+		file.seekp(32);
+		file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	}
+	StateSnapshot snapshot;
+	wstring error;
+	CHECK(!snapshot.Read(path, error));
+	CHECK(error.find(L"damaged") != wstring::npos);
+	fs::remove(path);
+}
+
+void RunStateSnapshotTests(TestRunner& runner) {
+	runner.Run("StateSnapshot.RoundTrip", testSnapshotRoundTrip);
+	runner.Run("StateSnapshot.TruncatedFileIsDamaged", testTruncatedSnapshotIsDamaged);
+	runner.Run("StateSnapshot.CorruptHeaderSizeIsDamaged", testCorruptHeaderSizeIsDamaged);
+}
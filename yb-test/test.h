@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Runs every test whose name contains the filter. A test reports its failed checks with CHECK, a test
+// with a failed check fails and the run fails with it.
+class TestRunner {
+public:
+	explicit TestRunner(const std::string& filter) : filter_(filter) {}
+	void Run(const std::string& name, const std::function<void()>& body);
+	size_t Runs() const { return runs_; }
+	size_t Failed() const { return failed_; }
+	static void Fail(const char* condition, const char* file, int line);
+private:
+	static size_t failed_checks_;
+	std::string filter_;
+	size_t runs_ = 0;
+	size_t failed_ = 0;
+};
+
+#define CHECK(condition) do { if (!(condition)) TestRunner::Fail(#condition, __FILE__, __LINE__); } while (false)
+#define CHECK_NEAR(value, expected) CHECK(std::fabs((value) - (expected)) < 1e-9)
+
+void RunDecisionJournalTests(TestRunner& runner);
+void RunPlacementPlannerTests(TestRunner& runner);
+void RunProcessSnapshotTests(TestRunner& runner);
+void RunRingBufferTests(TestRunner& runner);
+void RunStateSnapshotTests(TestRunner& runner);
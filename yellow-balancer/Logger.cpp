@@ -1,11 +1,21 @@
-﻿#include "logger.h"
+﻿#include "Logger.h"
 
 using namespace std;
 
 Logger* Logger::logger_ = nullptr;
 LoggerDestroyer Logger::destroyer_;
 static mutex get_instance_;
-static mutex print_;
+
+static const size_t MAX_BATCH_LINES = 1024;
+static const chrono::milliseconds WRITER_IDLE(50);
+
+static void localTime(const time_t* time, struct tm* tm) {
+#ifdef _WIN32
+    localtime_s(tm, time);
+#else
+    localtime_r(time, tm);
+#endif
+}
 
 LoggerDestroyer::~LoggerDestroyer() {
     delete logger_;
@@ -15,13 +25,24 @@ void LoggerDestroyer::initialize(Logger* logger) {
     logger_ = logger;
 }
 
+Logger::Logger() :
+    time_buffer_(24, '\0'),
+    out_console_(false),
+    minimum_type_(Type::Error),
+    cur_hour_(-1),
+    log_storage_duration_(24),
+    queue_(QUEUE_CAPACITY),
+    dropped_(0),
+    written_(0),
+    is_writer_waiting_(false),
+    is_stop_(false) {
+    writer_ = thread(&Logger::Write, this);
+}
+
 Logger* Logger::getInstance() {
     lock_guard<mutex> guard(get_instance_);
     if (!logger_) {
         logger_ = new Logger();
-        logger_->time_buffer_ = string(24, '\0');
-        logger_->minimum_type_ = Type::Error;
-        logger_->out_console_ = false;
         destroyer_.initialize(logger_);
     }
     return logger_;
@@ -29,6 +50,11 @@ Logger* Logger::getInstance() {
 
 Logger::~Logger() {
     Print(L"LOGGER DESTROYER!!!", Logger::Type::Trace);
+    is_stop_ = true;
+    wake_.notify_one();
+    if (writer_.joinable()) {
+        writer_.join();
+    }
     if (fs_.is_open()) {
         fs_.close();
     }
@@ -38,7 +64,7 @@ int Logger::CurHour() {
     chrono::system_clock::time_point now = chrono::system_clock::now();
     time_t time = chrono::system_clock::to_time_t(now);
     struct tm tm;
-    localtime_s(&tm, &time);
+    localTime(&time, &tm);
     return tm.tm_hour;
 }
 
@@ -46,7 +72,7 @@ wstring Logger::LogFileName() {
     chrono::system_clock::time_point now = chrono::system_clock::now();
     time_t time = chrono::system_clock::to_time_t(now);
     struct tm tm;
-    localtime_s(&tm, &time);
+    localTime(&time, &tm);
     cur_hour_ = tm.tm_hour;
     vector<char> buffer(20);
     strftime(&buffer[0], buffer.size(), "%y%m%d%H", &tm);
@@ -57,7 +83,7 @@ void DeleteLogHistory(filesystem::path dir, int log_storage_duration) {
     chrono::system_clock::time_point now = chrono::system_clock::now() - chrono::hours(log_storage_duration);
     time_t time = chrono::system_clock::to_time_t(now);
     struct tm tm;
-    localtime_s(&tm, &time);
+    localTime(&time, &tm);
     vector<char> buffer(20);
     strftime(&buffer[0], buffer.size(), "%y%m%d%H", &tm);
     wstring max_file_name = Utf8ToWideChar(string(&buffer[0]).append(".log"));
@@ -77,8 +103,12 @@ void DeleteLogHistory(filesystem::path dir, int log_storage_duration) {
 }
 
 void Logger::Open(filesystem::path dir) {
+    lock_guard<mutex> guard(file_);
+    OpenFile(dir);
+}
+
+void Logger::OpenFile(filesystem::path dir) {
     dir_ = dir;
-    log_storage_duration_ = 24;
     if (!fs_.is_open()) {
         wstring file_name = LogFileName();
         dir.append(L"logs");
@@ -97,27 +127,31 @@ void Logger::SetLogStorageDuration(int log_storage_duration) {
     log_storage_duration_ = log_storage_duration;
 }
 
-const string& Logger::CurTime() {
-    chrono::system_clock::time_point now = chrono::system_clock::now();
-    time_t time = chrono::system_clock::to_time_t(now);
-    const chrono::duration<double> tse = now.time_since_epoch();
-    chrono::seconds::rep milliseconds = chrono::duration_cast<chrono::milliseconds>(tse).count() % 1000;
-    ss_.str("");
-    ss_.clear();
-    ss_ << setw(3) << setfill('0') << milliseconds;
-
-    struct tm new_time;
-    localtime_s(&new_time, &time);
-    strftime(&time_buffer_[0], time_buffer_.size(), "%Y-%m-%d %H:%M:%S", &new_time);
-    time_buffer_.replace(19, 1, ".");
-    time_buffer_.replace(20, 3, ss_.str());
-    time_buffer_.replace(23, 1, ";");
-
+// Only the writer thread formats the time; the date and time are formatted once per second and the
+// milliseconds once per millisecond, lines within the same millisecond reuse the whole prefix.
+const string& Logger::CurTime(chrono::system_clock::time_point now) {
+    int64_t milliseconds = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()).count();
+    if (milliseconds == time_buffer_ms_) return time_buffer_;
+    int64_t second = milliseconds / 1000;
+    if (second != time_buffer_second_) {
+        time_t time = static_cast<time_t>(second);
+        struct tm new_time;
+        localTime(&time, &new_time);
+        strftime(&time_buffer_[0], time_buffer_.size(), "%Y-%m-%d %H:%M:%S", &new_time);
+        time_buffer_[19] = '.';
+        time_buffer_[23] = ';';
+        time_buffer_second_ = second;
+    }
+    int millisecond = static_cast<int>(milliseconds % 1000);
+    time_buffer_[20] = static_cast<char>('0' + millisecond / 100);
+    time_buffer_[21] = static_cast<char>('0' + millisecond / 10 % 10);
+    time_buffer_[22] = static_cast<char>('0' + millisecond % 10);
+    time_buffer_ms_ = milliseconds;
     return time_buffer_;
 }
 
 void Logger::NewFileWithLock() {
-    lock_guard<mutex> guard(print_);
+    lock_guard<mutex> guard(file_);
     NewFile();
 }
 
@@ -126,61 +160,121 @@ void Logger::NewFile() {
         if (fs_.is_open()) {
             fs_.close();
         }
-        Open(dir_);
+        if (!dir_.empty()) OpenFile(dir_);
     }
 }
 
-void Logger::Print(const string& msg, Logger::Type type, bool anyway) {
-    Print(Utf8ToWideChar(msg), type, anyway);
+static const char* typeName(int type) {
+    switch (type)
+    {
+    case Logger::Type::Trace:
+        return u8"TRACE;";
+    case Logger::Type::Info:
+        return u8"INFO;";
+    case Logger::Type::Error:
+        return u8"ERROR;";
+    default:
+        return "";
+    }
 }
 
-void Logger::Print(const wstring& msg, Logger::Type type, bool anyway) {
-    lock_guard<mutex> guard(print_);
-    NewFile();
+string& Logger::LineBuffer() {
+    thread_local string line;
+    line.clear();
+    return line;
+}
 
-    if (!anyway && type < minimum_type_) {
-        return;
+void Logger::Push(Logger::Type type, string_view msg) {
+    chrono::system_clock::time_point now = chrono::system_clock::now();
+    bool is_pushed = queue_.Push([&](LogEntry& entry) {
+        entry.time_ = now;
+        entry.type_ = type;
+        entry.text_.assign(msg.data(), msg.size());
+    });
+    if (!is_pushed) {
+        dropped_.fetch_add(1, memory_order_relaxed);
     }
+    else if (is_writer_waiting_.load(memory_order_relaxed)) {
+        wake_.notify_one();
+    }
+}
 
-    const string& cur_time = CurTime();
-    fs_ << cur_time;
-    if (out_console_) wcout << Utf8ToWideChar(cur_time);
+void Logger::Write() {
+    for (;;) {
+        if (WriteBatch()) continue;
+        if (is_stop_) break;
+        unique_lock<mutex> lock(wake_mutex_);
+        is_writer_waiting_ = true;
+        wake_.wait_for(lock, WRITER_IDLE);
+        is_writer_waiting_ = false;
+    }
+}
+
+// Writes up to MAX_BATCH_LINES queued lines with one write and one flush.
+bool Logger::WriteBatch() {
+    batch_.clear();
+    uint64_t lines = 0;
+    while (lines < MAX_BATCH_LINES && queue_.Pop([this](const LogEntry& entry) {
+        batch_.append(CurTime(entry.time_)).append(typeName(entry.type_)).append(entry.text_).push_back('\n');
+    })) {
+        ++lines;
+    }
+    uint64_t dropped = dropped_.load(memory_order_relaxed);
+    if (dropped != reported_dropped_) {
+        batch_.append(CurTime(chrono::system_clock::now())).append(typeName(Type::Error))
+            .append("Logger dropped ").append(to_string(dropped - reported_dropped_)).append(" lines, the queue is full\n");
+        reported_dropped_ = dropped;
+    }
+    if (batch_.empty()) return false;
 
-    switch (type)
     {
-    case Type::Trace:
-        fs_ << u8"TRACE;";
-        if (out_console_) wcout << L"TRACE;";
-        break;
-    case Type::Info:
-        fs_ << u8"INFO;";
-        if (out_console_) wcout << L"INFO;";
-        break;
-    case Type::Error:
-        fs_ << u8"ERROR;";
-        if (out_console_) wcout << L"ERROR;";
-        break;
-    default:
-        break;
+        lock_guard<mutex> guard(file_);
+        NewFile();
+        fs_.write(batch_.data(), static_cast<streamsize>(batch_.size()));
+        fs_.flush();
     }
+    if (out_console_) wcout << Utf8ToWideChar(batch_);
+    written_.fetch_add(lines, memory_order_release);
+    return true;
+}
 
-    fs_ << WideCharToUtf8(msg);
-    if (out_console_) wcout << msg;
+void Logger::Flush() {
+    uint64_t pushed = queue_.Pushed();
+    wake_.notify_one();
+    while (written_.load(memory_order_acquire) < pushed && !is_stop_) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
 
-    fs_ << '\n';
-    if (out_console_) wcout << L"\n";
+void Logger::Print(const wstring& msg, Logger::Type type, bool anyway) {
+    if (!IsEnabled(type, anyway)) return;
+    string& line = LineBuffer();
+    AppendUtf8(line, msg);
+    Push(type, line);
+}
 
-    fs_.flush();
+void appendLog(string& line, string_view value) {
+    line.append(value);
 }
 
-void Logger::Print(const string& msg, bool anyway) {
-    Print(msg, Type::Info, anyway);
+void appendLog(string& line, wstring_view value) {
+    AppendUtf8(line, value);
 }
 
-void Logger::Print(const wstring& msg, bool anyway) {
-    Print(msg, Type::Info, anyway);
+void appendLog(string& line, char value) {
+    line.push_back(value);
+}
+
+void appendLog(string& line, wchar_t value) {
+    AppendUtf8(line, wstring_view(&value, 1));
+}
+
+void appendLog(string& line, double value) {
+    char buffer[400];
+    auto result = to_chars(buffer, buffer + sizeof(buffer), value, chars_format::fixed, 6);
+    line.append(buffer, result.ptr);
 }
 
 void Logger::SetOutConsole(bool out_console) {
     out_console_ = out_console;
-}
\ No newline at end of file
+}
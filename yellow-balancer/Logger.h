@@ -6,10 +6,43 @@
 #include <fstream>
 #include <chrono>
 #include <iomanip>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+#include <string_view>
+#include <type_traits>
+#include <charconv>
 #include "encoding_string.h"
+#include "log_queue.h"
+
+// Trace call sites are compiled only with LOGGER_TRACE 1, which is the default for debug builds.
+#ifndef LOGGER_TRACE
+#ifdef NDEBUG
+#define LOGGER_TRACE 0
+#else
+#define LOGGER_TRACE 1
+#endif
+#endif
+
+// Arguments of a formatted line are appended to the UTF-8 line as they are: wide strings are converted,
+// integers are written with to_chars and doubles with 6 digits after the point, as to_wstring writes them.
+void appendLog(std::string& line, std::string_view value);
+void appendLog(std::string& line, std::wstring_view value);
+void appendLog(std::string& line, char value);
+void appendLog(std::string& line, wchar_t value);
+void appendLog(std::string& line, double value);
+
+template <class T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+void appendLog(std::string& line, T value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    line.append(buffer, result.ptr);
+}
 
 class Logger;
 
@@ -22,17 +55,22 @@ public:
     void initialize(Logger* logger);
 };
 
+// Print formats nothing and never waits on the file: the line is pushed into a bounded queue and a
+// writer thread formats the time prefix, writes the lines in batches and rotates the file every hour.
+// Lines that do not fit into a full queue are dropped and reported by the writer as a count.
 class Logger {
 public:
     enum Type { All, Trace, Info, Error };
 private:
+    static const size_t QUEUE_CAPACITY = 8192;
     std::string time_buffer_;
-    std::ostringstream ss_;
-    bool out_console_;
+    int64_t time_buffer_ms_ = -1;
+    int64_t time_buffer_second_ = -1;
+    std::atomic<bool> out_console_;
     static Logger* logger_;
     static LoggerDestroyer destroyer_;
-    Logger::Type minimum_type_;
-    const std::string& CurTime();
+    std::atomic<Logger::Type> minimum_type_;
+    const std::string& CurTime(std::chrono::system_clock::time_point now);
     std::ofstream fs_;
     int cur_hour_;
     std::wstring LogFileName();
@@ -40,8 +78,24 @@ private:
     std::filesystem::path dir_;
     int log_storage_duration_;
     void NewFile();
+    void OpenFile(std::filesystem::path dir);
+    LogQueue queue_;
+    std::atomic<uint64_t> dropped_;
+    uint64_t reported_dropped_ = 0;
+    std::atomic<uint64_t> written_;
+    std::mutex file_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> is_writer_waiting_;
+    std::atomic<bool> is_stop_;
+    std::thread writer_;
+    std::string batch_;
+    static std::string& LineBuffer();
+    void Push(Logger::Type type, std::string_view msg);
+    void Write();
+    bool WriteBatch();
 protected:
-    Logger() {}
+    Logger();
     Logger(const Logger&);
     Logger& operator=(Logger&);
     ~Logger();
@@ -52,13 +106,35 @@ public:
     void SetLogStorageDuration(int log_storage_duration);
 
     void NewFileWithLock();
+    // Waits until the lines pushed before the call are written, for exits that skip the destructors.
+    void Flush();
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
     
-    void Print(const std::string& msg, bool anyway = false);
-    void Print(const std::wstring& msg, bool anyway = false);
-    void Print(const std::string& msg, Logger::Type type, bool anyway = false);
+    // With a constant type a disabled trace call folds to nothing, the level is not even loaded.
+    bool IsEnabled(Logger::Type type, bool anyway = false) const {
+        return anyway || ((LOGGER_TRACE || type != Type::Trace) && type >= minimum_type_.load(std::memory_order_relaxed));
+    }
+
+    void Print(const std::string& msg, bool anyway = false) { Print(msg, Type::Info, anyway); }
+    void Print(const std::wstring& msg, bool anyway = false) { Print(msg, Type::Info, anyway); }
+    void Print(const std::string& msg, Logger::Type type, bool anyway = false) {
+        if (IsEnabled(type, anyway)) Push(type, msg);
+    }
     void Print(const std::wstring& msg, Logger::Type type, bool anyway = false);
+    // The line is built from args only when it passes the filter, in a thread-local buffer that is
+    // reused between lines, so a steady stream of lines does not allocate.
+    template <class... Args>
+    void Print(Logger::Type type, bool anyway, const Args&... args);
 
     void SetOutConsole(bool out_console);
     void SetLogType(Type type) { minimum_type_ = type; }
     Type LogType() { return minimum_type_; }
 };
+
+template <class... Args>
+void Logger::Print(Logger::Type type, bool anyway, const Args&... args) {
+    if (!IsEnabled(type, anyway)) return;
+    std::string& line = LineBuffer();
+    (appendLog(line, args), ...);
+    Push(type, line);
+}
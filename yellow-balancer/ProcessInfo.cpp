@@ -4,57 +4,12 @@ using namespace std;
 
 static auto LOGGER = Logger::getInstance();
 
-const WCHAR* ThreadStateValueNames[] = {
-  L"Initialized",
-  L"Ready",
-  L"Running",
-  L"Standby",
-  L"Terminated",
-  L"Waiting",
-  L"Transition",
-  L"DeferredReady"
-};
-
-const WCHAR* ThreadWaitReasonValueNames[] = {
-	L"Executive",
-	L"FreePage",
-	L"PageIn",
-	L"PoolAllocation",
-	L"DelayExecution",
-	L"Suspended",
-	L"UserRequest",
-	L"WrExecutive ",
-	L"WrFreePage",
-	L"WrPageIn",
-	L"WrPoolAllocation",
-	L"WrDelayExecution",
-	L"WrSuspended",
-	L"WrUserRequest",
-	L"WrEventPair",
-	L"WrQueue",
-	L"WrLpcReceive",
-	L"WrLpcReply",
-	L"WrVirtualMemory",
-	L"WrPageOut",
-	L"WrRendezvous",
-	L"WrKeyedEvent",
-	L"WrTerminated",
-	L"WrProcessInSwap",
-	L"WrCpuRateControl",
-	L"WrCalloutStack",
-	L"WrKernel",
-	L"WrResource",
-	L"WrPushLock",
-	L"WrMutex",
-	L"WrQuantumEnd",
-	L"WrDispatchInt",
-	L"WrPreempted",
-	L"WrYieldExecution",
-	L"WrFastMutex",
-	L"WrGuardedMutex",
-	L"WrRundown",
-	L"MaximumWaitReason"
-};
+// Only a process that takes at least this share of its node has its threads spread, smaller ones keep them together.
+static const double THREAD_SPLIT_SHARE = 0.25;
+// Processes whose numa_maps are read per tick, a full pass over the processes takes processes / this ticks.
+static const size_t MEMORY_SAMPLES_PER_TICK = 4;
+// A process younger than a second has no lifetime average worth the name, in 100-nanosecond units.
+static const int64_t MIN_LIFETIME = 10000000;
 
 wstringstream wss_;
 
@@ -71,543 +26,645 @@ wstring vectorToWstring(const vector<T>& v) {
 	return wstr;
 }
 
-void print_bitmap(ULONG_PTR mask){
-	for (int i = sizeof(mask) * 8 - 1; i >= 0; --i) {
-		printf("%d", (int)(mask >> i) & 1);
-	}
+ProcessesInfo::ProcessesInfo() :
+	probe_(CreateSystemProbe()) {}
+
+ProcessesInfo::ProcessesInfo(unique_ptr<SystemProbe> probe) :
+	probe_(move(probe)) {}
+
+void ProcessesInfo::Init(int cpu_analysis_period, int switching_frequency, int maximum_cpu_value, int delta_cpu_values) {
+	cpu_analysis_period_ = cpu_analysis_period;
+	switching_frequency_ = switching_frequency;
+	ring_buffer_size_ = cpu_analysis_period / switching_frequency;
+	processes_.SetRingBufferSize(ring_buffer_size_);
+	maximum_cpu_value_ = maximum_cpu_value;
+	delta_cpu_values_ = delta_cpu_values;
+	probe_ready_ = probe_->Init();
+	GetNumaInfo();
+	InitPerfMonitor(cpu_analysis_period);
 }
 
-pair<DWORD, wstring> getLastError() {
-	DWORD errorMessageID = ::GetLastError();
-	if (errorMessageID == 0) {
-		return { errorMessageID, std::wstring() }; //No error message has been recorded
+void ProcessesInfo::InitPerfMonitor(int cpu_analysis_period) {
+	perf_monitor_.SetCollectionPeriod(cpu_analysis_period);
+#ifdef _WIN32
+	if (!is_external_counters_) {
+		wstring computer_name = L"\\\\";
+		computer_name.resize(MAX_COMPUTERNAME_LENGTH + 3, L'\0');
+		DWORD sz_computer_name = static_cast<DWORD>(computer_name.size()) - 2;
+		GetComputerNameW(&computer_name[2], &sz_computer_name);
+		computer_name.resize(sz_computer_name + 2);
+
+		perf_monitor_.AddCounter(wstring(computer_name).append(L"\\Processor Information(_Total)\\% Processor Time"));
+		for (auto it = numa_nodes_.begin(); it != numa_nodes_.end(); ++it) {
+			perf_monitor_.AddCounter(wstring(computer_name).append(L"\\Processor Information(").append(to_wstring(it->node_number_)).append(L",_Total)\\% Processor Time"));
+		}
+		perf_monitor_.StartCollecting();
+		return;
+	}
+#endif
+	perf_monitor_.AddCounter(L"cpu");
+	for (auto it = numa_nodes_.begin(); it != numa_nodes_.end(); ++it) {
+		perf_monitor_.AddCounter(wstring(L"node").append(to_wstring(it->node_number_)), probe_->GroupCpus(it->group_mask_));
 	}
+	// With external counters the owner feeds the samples through AddCounterValues instead of the collecting thread.
+	if (!is_external_counters_) {
+		perf_monitor_.SetCpuSampler(probe_->CreateCpuSampler());
+		perf_monitor_.StartCollecting();
+	}
+}
 
-	LPWSTR messageBuffer = nullptr;
+ProcessesInfo::~ProcessesInfo() {
+	SaveState();
+	LOGGER->Print(L"~ProcessesInfo", Logger::Type::Trace);
+}
 
-	size_t size = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-		NULL, errorMessageID, MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US), (LPWSTR)&messageBuffer, 0, NULL);
+ProcessesInfo& ProcessesInfo::AddFilter(wstring process_name) {
+	process_filter_.insert(process_name);
+	spawn_placer_.SetFilter(process_filter_);
+	return *this;
+}
 
-	wstring message(messageBuffer, size - 2);
+void ProcessesInfo::SetFilter(const vector<wstring>& process_names) {
+	process_filter_.clear();
+	process_filter_.insert(process_names.begin(), process_names.end());
+	spawn_placer_.SetFilter(process_filter_);
+}
 
-	while (message.back() == L'\n' || message.back() == L'\n') {
-		message.pop_back();
+void ProcessesInfo::Reconfigure(int cpu_analysis_period, int switching_frequency, int maximum_cpu_value, int delta_cpu_values) {
+	maximum_cpu_value_ = maximum_cpu_value;
+	delta_cpu_values_ = delta_cpu_values;
+	if (cpu_analysis_period != cpu_analysis_period_ || switching_frequency != switching_frequency_) {
+		// The kept deltas are rescaled to the new interval, so that the loads of the processes stay as they were.
+		processes_.ScaleUserTimes(switching_frequency, switching_frequency_);
+		cpu_analysis_period_ = cpu_analysis_period;
+		switching_frequency_ = switching_frequency;
+		ring_buffer_size_ = cpu_analysis_period / switching_frequency;
+		processes_.SetRingBufferSize(ring_buffer_size_);
+		perf_monitor_.SetCollectionPeriod(cpu_analysis_period);
+		SetStateSavePeriod(state_save_period_);
 	}
-
-	LocalFree(messageBuffer);
-
-	return { errorMessageID, message };
 }
 
-HANDLE openProcess(ULONG id_process) {
-	HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, id_process);
-	if (hProcess == NULL) {
-		
-		auto error = getLastError();
-		if (error.first != ERROR_ACCESS_DENIED) {
-			std::wstring err_wstr = L"Error connecting to local process pid ";
-			err_wstr
-				.append(std::to_wstring(id_process)).append(L". ")
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
-			return NULL;
-		}
-
-		HANDLE hToken;
-		if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &hToken) == FALSE) {
-			error = getLastError();
-			std::wstring err_wstr = L"Error getting token for current process. ";
-			err_wstr
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
-			return NULL;
+void ProcessesInfo::LogProcesses() {
+	const ThreadStore& threads = processes_.Threads();
+	for (auto it_process = processes_.Processes().begin(); it_process != processes_.Processes().end(); ++it_process) {
+		auto process_numa_group = probe_->ProcessNumaGroups(it_process->second.pid_);
+		auto proc_affinity_mask = probe_->ProcessAffinityMask(it_process->second.pid_);
+		LOGGER->Print(Logger::Type::Trace, test,
+			it_process->second.name_,
+			L" pid ", it_process->second.pid_,
+			L" groups ", vectorToWstring(process_numa_group),
+			L" mask ", proc_affinity_mask.first);
+
+		if (LOGGER->IsEnabled(Logger::Type::Trace)) {
+			const ThreadRange& range = it_process->second.threads_;
+			for (uint32_t i = range.offset_; i < range.offset_ + range.count_; ++i) {
+				LOGGER->Print(Logger::Type::Trace, false,
+					L"tid ", threads.ThreadId(i),
+					L" group ", threads.Affinity(i).group_,
+					L" mask ", threads.Affinity(i).mask_);
+			}
 		}
+	}
+}
 
-		LUID luid;
-		if (LookupPrivilegeValueW(NULL, SE_DEBUG_NAME, &luid) == FALSE) {
-			error = getLastError();
-			std::wstring err_wstr = L"Error reading SE_DEBUG_NAME privilege value for current process. ";
-			err_wstr
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
-			CloseHandle(hToken);
-			return NULL;
-		}
+void ProcessesInfo::Read() {
+	ScopedPhase phase(profile_, SelfProfile::Read);
+	tick_start_ = chrono::steady_clock::now();
+	processes_.BeginScan();
+	bool is_complete;
+	{
+		ScopedPhase active_processes(profile_, SelfProfile::ActiveProcesses);
+		is_complete = probe_->ActiveProcesses(process_filter_, processes_);
+	}
+	processes_.EndScan(is_complete);
+	scan_time_ = probe_->CurrentTime();
+	if (is_state_restoring_ && is_complete) {
+		LOGGER->Print(Logger::Type::Info, true,
+			L"State is restored;processes=", processes_.Restored(),
+			L";stale processes=", state_processes_ - processes_.Restored());
+		is_state_restoring_ = false;
+	}
+	metrics_.AddScan(chrono::duration<double>(chrono::steady_clock::now() - tick_start_).count(), is_complete);
+	if (LOGGER->IsEnabled(Logger::Type::Trace, test)) {
+		LogProcesses();
+	}
+}
 
-		TOKEN_PRIVILEGES newState;
-		newState.PrivilegeCount = 1;
-		newState.Privileges[0].Luid = luid;
-		newState.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
-		bool res_adj_token = AdjustTokenPrivileges(hToken, FALSE, &newState, sizeof(newState), NULL, NULL);
-		error = getLastError();
-		if (!res_adj_token || error.first == ERROR_NOT_ALL_ASSIGNED) {
-			std::wstring err_wstr = L"Error setting SE_DEBUG_NAME privilege value for current process. ";
-			err_wstr
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
-			CloseHandle(hToken);
-			return NULL;
-		}
+// While the windows fill, both thresholds are raised by the unfilled share of delta_cpu_values, so a
+// short average has to show a larger imbalance.
+bool ProcessesInfo::IsNeedToSetAffinity(const vector<double>& values, double confidence) {
+	double min = values[1];
+	double max = values[1];
+	for (size_t i = 2; i < values.size(); ++i) {
+		if (values[i] < min) min = values[i];
+		if (values[i] > max) max = values[i];
+	}
+	double margin = (1.0 - confidence) * delta_cpu_values_;
+	return max > maximum_cpu_value_ + margin && max - min > delta_cpu_values_ + margin;
+}
 
-		hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, id_process);
-		if (hProcess == NULL) {
-			error = getLastError();
-			wstring err_wstr = L"Error connecting to local process pid ";
-			err_wstr
-				.append(std::to_wstring(id_process)).append(L". ")
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
-			CloseHandle(hToken);
-			return NULL;
-		}
+// A process is planned with a full window, during the warm-up also with a part of it or a known lifetime average.
+bool ProcessesInfo::HasUserTime(const ProcessInfo& process) const {
+	const TimeSeriesStore& user_times = processes_.UserTimes();
+	if (user_times.IsFull(process.user_time_row_)) return true;
+	return is_fast_warm_up_ && (user_times.Samples(process.user_time_row_) > 0 || LifetimeUserTime(process) >= 0.0);
+}
 
-		CloseHandle(hToken);
-	}
-	
-	return hProcess;
+// USER_TIME per switching interval over the whole life of the process, -1 when the age is unknown or too short.
+double ProcessesInfo::LifetimeUserTime(const ProcessInfo& process) const {
+	if (scan_time_ < 0) return -1.0;
+	int64_t age = scan_time_ - process.create_time_;
+	if (age < MIN_LIFETIME) return -1.0;
+	return static_cast<double>(process.cur_user_time_) / static_cast<double>(age) * static_cast<double>(max(switching_frequency_, 1)) * 10000000.0;
 }
 
-LONGLONG fileTimeToLongLong(const FILETIME& fileTime) {
-	uint64_t uTime;
-	memcpy(&uTime, &fileTime, sizeof(uTime));
-	return uTime;
+// The average of the window; before it is full, the samples so far weigh by the share of the window they fill
+// and the lifetime average of the process stands for the rest.
+int64_t ProcessesInfo::UserTimeAvg(const ProcessInfo& process) const {
+	const TimeSeriesStore& user_times = processes_.UserTimes();
+	uint32_t row = process.user_time_row_;
+	if (!is_fast_warm_up_ || user_times.IsFull(row)) return user_times.Avg(row);
+	double lifetime = LifetimeUserTime(process);
+	if (lifetime < 0.0) return user_times.Avg(row);
+	double confidence = static_cast<double>(user_times.Samples(row)) / static_cast<double>(user_times.Window());
+	return static_cast<int64_t>(confidence * static_cast<double>(user_times.Avg(row)) + (1.0 - confidence) * lifetime);
 }
 
-wstring systemTimeToWstring(const SYSTEMTIME& time) {
-	wss_ << setfill(L'0') << setw(4) << time.wYear << L'-' << setw(2) << time.wMonth << L'-' << setw(2) << time.wDay
-		<< L' '
-		<< setw(2) << time.wHour << L':' << setw(2) << time.wMinute << L':' << setw(2) << time.wSecond << L'.' << setw(3) << time.wMilliseconds;
-	wstring wstr = wss_.str();
-	wss_.str(L"");
-	wss_.clear();
-	return wstr;
+// Share of the samples of the process taken before its last move, 0 for a process not moved within its window.
+// The node loads cover the same window, so that share of its load is still in the load of its origin node.
+double ProcessesInfo::MovedShare(const ProcessInfo& process) const {
+	if (process.moved_generation_ == 0) return 0.0;
+	size_t samples = processes_.UserTimes().Samples(process.user_time_row_);
+	uint64_t moved_scans = processes_.Generation() - process.moved_generation_;
+	if (samples == 0 || moved_scans >= samples) return 0.0;
+	return 1.0 - static_cast<double>(moved_scans) / static_cast<double>(samples);
 }
 
-wstring ThreadStateToWstring(ULONG thread_state) {
-	if (thread_state < 8)
-		return ThreadStateValueNames[thread_state];
-	else
-		return to_wstring(thread_state);
+// Every tick with its node loads goes into the journal, the candidates and moves only when the tick rebalances.
+void ProcessesInfo::JournalLoads(const vector<double>& values, bool is_rebalance) {
+	if (!journal_.IsOpen() || values.size() < 2) return;
+	auto [min, max] = minmax_element(values.begin() + 1, values.end());
+	journal_.BeginTick(is_rebalance, *max, *max - *min);
+	for (size_t i = 0; i < values.size(); ++i) {
+		journal_.AddNode(static_cast<int>(i) - 1, values[i]);
+	}
 }
 
-wstring ThreadWaitReasonToWstring(ULONG thread_wait_reason) {
-	if (thread_wait_reason < 38)
-		return ThreadWaitReasonValueNames[thread_wait_reason];
-	else
-		return to_wstring(thread_wait_reason);
+bool ProcessesInfo::OpenJournal(const filesystem::path& path, int size_in_megabytes) {
+	if (size_in_megabytes <= 0) return false;
+	return journal_.Open(path, static_cast<size_t>(size_in_megabytes) * DecisionJournal::RECORDS_PER_MEGABYTE);
 }
 
-void ProcessesInfo::Init(int cpu_analysis_period, int switching_frequency, int maximum_cpu_value, int delta_cpu_values) {
-	cpu_analysis_period_ = cpu_analysis_period;
-	ring_buffer_size_ = cpu_analysis_period / switching_frequency;
-	maximum_cpu_value_ = maximum_cpu_value;
-	delta_cpu_values_ = delta_cpu_values;
-	GetNumaInfo();
-	InitPerfMonitor(cpu_analysis_period);
-	InitNtSetInformationProcess();
-	InitNtQuerySystemInformation();
+void ProcessesInfo::SetStateSavePeriod(int save_period) {
+	state_save_period_ = save_period;
+	int switching_frequency = max(switching_frequency_, 1);
+	state_save_scans_ = static_cast<uint64_t>((max(save_period, 0) + switching_frequency - 1) / switching_frequency);
 }
 
-void ProcessesInfo::InitPerfMonitor(int cpu_analysis_period) {
-	perf_monitor_.SetCollectionPeriod(cpu_analysis_period);
-	wstring computer_name = L"\\\\";
-	computer_name.resize(MAX_COMPUTERNAME_LENGTH + 3, L'\0');
-	DWORD sz_computer_name = static_cast<DWORD>(computer_name.size()) - 2;
-	GetComputerNameW(&computer_name[2], &sz_computer_name);
-	computer_name.resize(sz_computer_name + 2);
+bool ProcessesInfo::OpenState(const filesystem::path& path, int save_period, int max_age) {
+	state_path_.clear();
+	if (save_period <= 0) return false;
+	state_path_ = path;
+	SetStateSavePeriod(save_period);
+	if (!filesystem::exists(path)) return true;
 
-	perf_monitor_.AddCounter(wstring(computer_name).append(L"\\Processor Information(_Total)\\% Processor Time"));
-	for (auto it = numa_nodes_.begin(); it != numa_nodes_.end(); ++it) {
-		perf_monitor_.AddCounter(wstring(computer_name).append(L"\\Processor Information(").append(to_wstring(it->NodeNumber)).append(L",_Total)\\% Processor Time"));
+	wstring error;
+	if (!state_.Read(path, error)) {
+		LOGGER->Print(Logger::Type::Error, true, error);
+		return true;
+	}
+	// A snapshot from before a reboot or older than max_age describes a load that is gone. max_age covers the
+	// restart delay after a failure and the save period, so a restarted service finds its snapshot in time.
+	int64_t now = probe_->CurrentTime();
+	if (now >= 0 && (state_.Time() < 0 || now < state_.Time() || now - state_.Time() > static_cast<int64_t>(max(max_age, 0)) * 10000000)) {
+		LOGGER->Print(Logger::Type::Info, true, L"State is stale and is not restored: ", path.wstring());
+		return true;
 	}
-	perf_monitor_.StartCollecting();
+	if (state_.SwitchingFrequency() == switching_frequency_) {
+		state_processes_ = state_.Processes().size();
+		processes_.Restore(state_.Generation(), move(state_.Processes()));
+		state_saved_generation_ = state_.Generation();
+		is_state_restoring_ = true;
+	}
+	split_processes_.insert(state_.SplitProcesses().begin(), state_.SplitProcesses().end());
+	if (state_.Counters().size() == perf_monitor_.GetCountersName().size()) perf_monitor_.AddSecondValues(state_.Counters());
+	LOGGER->Print(Logger::Type::Info, true,
+		L"State is read;processes=", state_processes_,
+		L";split processes=", state_.SplitProcesses().size(),
+		L";counters=", state_.Counters().size());
+	return true;
 }
 
-void ProcessesInfo::InitNtSetInformationProcess() {
-	auto handle = GetModuleHandle(L"ntdll");
-	if (!handle) {
-		LOGGER->Print(L"GetModuleHandle(\"ntdll\") - not found!", Logger::Type::Error);
-		return;
+// Until the first complete scan takes the restored processes over, the file keeps the previous state.
+void ProcessesInfo::SaveState() {
+	if (state_path_.empty() || is_state_restoring_ || processes_.Generation() == 0) return;
+	ScopedPhase phase(profile_, SelfProfile::SaveState);
+	state_.Begin(switching_frequency_, processes_.Generation(), scan_time_);
+	const TimeSeriesStore& user_times = processes_.UserTimes();
+	for (auto it = processes_.Processes().begin(); it != processes_.Processes().end(); ++it) {
+		state_.AddProcess(it->second, user_times);
+	}
+	for (auto it = split_processes_.begin(); it != split_processes_.end(); ++it) {
+		state_.AddSplitProcess(it->first, it->second);
 	}
-	void* p_void = GetProcAddress(handle, "NtSetInformationProcess");
-	if (!p_void) {
-		LOGGER->Print(L"GetProcAddress(GetModuleHandle(\"ntdll\"), \"NtSetInformationProcess\") - not found!", Logger::Type::Error);
-		return;		
+	perf_monitor_.GetSecondValues(state_counters_);
+	for (size_t i = 0; i < state_counters_.size(); ++i) {
+		state_.AddCounter(static_cast<uint32_t>(i), state_counters_[i]);
 	}
-	NtSetInformationProcess = (pNtSetInformationProcess)p_void;
+	state_.Write(state_path_);
+	state_saved_generation_ = processes_.Generation();
 }
 
-void ProcessesInfo::InitNtQuerySystemInformation() {
-	auto handle = GetModuleHandle(L"ntdll");
-	if (!handle) {
-		LOGGER->Print(L"GetModuleHandle(\"ntdll\") - not found!", Logger::Type::Error);
-		return;
-	}
-	void* p_void = GetProcAddress(handle, "NtQuerySystemInformation");
-	if (!p_void) {
-		LOGGER->Print(L"GetProcAddress(GetModuleHandle(\"ntdll\"), \"NtQuerySystemInformation\") - not found!", Logger::Type::Error);
-		return;
+void ProcessesInfo::SetMigrationCost(int migration_cost) {
+	planner_.SetMigrationCost(migration_cost / 100.0);
+}
+
+void ProcessesInfo::SetRemoteMemoryPenalty(int remote_memory_penalty) {
+	planner_.SetRemotePenalty(remote_memory_penalty / 100.0);
+}
+
+// Without a way to move pages there are no jobs to submit, the migration stays off.
+void ProcessesInfo::SetMemoryMigration(int megabytes_per_second) {
+	if (megabytes_per_second > 0 && !probe_->CanMovePages()) {
+		LOGGER->Print(Logger::Type::Info, true, L"Memory migration is not supported on this platform");
+		megabytes_per_second = 0;
 	}
-	NtQuerySystemInformation = (pNtQuerySystemInformation)p_void;
+	memory_migrator_.SetBandwidth(static_cast<uint64_t>(max(megabytes_per_second, 0)) * 1024 * 1024);
+	if (megabytes_per_second > 0 && !is_external_counters_) memory_migrator_.Start();
+	else memory_migrator_.Stop();
 }
 
-ProcessesInfo::~ProcessesInfo() {
-	LOGGER->Print(L"~ProcessesInfo", Logger::Type::Trace);
+void ProcessesInfo::SetSpawnPlacement(bool is_spawn_placement) {
+	if (is_spawn_placement && probe_ready_ && !is_external_counters_) spawn_placer_.Start();
+	else spawn_placer_.Stop();
 }
 
-ProcessesInfo& ProcessesInfo::AddFilter(wstring process_name) {
-	process_filter_.insert(process_name);
-	return *this;
+void ProcessesInfo::SetHysteresis(int dwell_time, int max_moves, int damping) {
+	int switching_frequency = max(switching_frequency_, 1);
+	dwell_scans_ = static_cast<uint64_t>((max(dwell_time, 0) + switching_frequency - 1) / switching_frequency);
+	planner_.SetMaxMoves(static_cast<size_t>(max(max_moves, 0)));
+	planner_.SetDamping(max(damping, 0) / 100.0);
 }
 
-unordered_map<ULONG, ProcessInfoShort> ProcessesInfo::ActiveProcesses() {
-	ULONG buflen = 0;
-	NTSTATUS lResult = NtQuerySystemInformation(SYSTEMPROCESSINFORMATION, NULL, buflen, &buflen);
-	if (lResult == STATUS_INFO_LENGTH_MISMATCH) {
-		size_t new_size = static_cast<size_t>(buflen) * 2;
-		if(buffer_active_processes.size() < new_size) buffer_active_processes.resize(new_size);
-	}
-	else {
-		wstring msg = L"ProcessesInfo::ActiveProcesses: ";
-		msg
-			.append(getLastError().second)
-			.append(L". Buflen=").append(to_wstring(buflen));
-		LOGGER->Print(msg, Logger::Type::Error);
-		return {};
-	}
-
-	buflen = static_cast<ULONG>(buffer_active_processes.size());
-	if (NtQuerySystemInformation(SYSTEMPROCESSINFORMATION, &buffer_active_processes[0], buflen, &buflen)) {
-		wstring msg = L"ProcessesInfo::ActiveProcesses: ";
-		msg.append(getLastError().second);
-		LOGGER->Print(msg, Logger::Type::Error);
-		return {};
-	}
-
-	unordered_map<ULONG, ProcessInfoShort> res;
-	unsigned int i = 0;
-	SYSTEM_PROCESS_INFORMATION* info = nullptr;
-	do {
-		info = (SYSTEM_PROCESS_INFORMATION*)&buffer_active_processes[i];
-		std::wstring image_name = (info->ImageName.Buffer ? info->ImageName.Buffer : L"unknow");
-		if (info->ProcessId == 0) image_name = L"System Idle Process";
-		if (process_filter_.size() == 0 || process_filter_.find(image_name) != process_filter_.end()) {
-			auto it_process = res.insert(pair<ULONG, ProcessInfoShort>(
-				info->ProcessId,
-				{
-					info->ProcessId,
-					move(image_name),
-					info->CreateTime,
-					info->UserTime,
-					info->KernelTime,
-					{}
-				}
-			));
-
-			if (LOGGER->LogType() == Logger::Type::Trace || test) {
-				auto process_numa_group = GetProcessNumaGroup(info->ProcessId);
-				DWORD process_affinity_mask = 0;
-				DWORD system_affinity_mask = 0;
-				auto proc_affinity_mask = GetProcAffinityMask(info->ProcessId);
-				wstring msg = L"";
-				msg
-					.append(it_process.first->second.name_)
-					.append(L" pid ").append(to_wstring(it_process.first->second.pid_))
-					.append(L" groups ").append(vectorToWstring(process_numa_group))
-					.append(L" mask ").append(to_wstring(proc_affinity_mask.first));
-				LOGGER->Print(msg, Logger::Type::Trace, test);
-			}
+void ProcessesInfo::SampleMemory() {
+	if (!probe_ready_ || planner_.RemotePenalty() <= 0.0) return;
+	ScopedPhase phase(profile_, SelfProfile::SampleMemory);
+	memory_locality_.Sample(*probe_, processes_.Processes(), MEMORY_SAMPLES_PER_TICK);
+}
 
-			for (unsigned int j = 0; j < info->ThreadCount; j++) {
-				it_process.first->second.threads_.push_back({
-					info->ThreadInfos[j].Client_Id.UniqueThread,
-					info->ThreadInfos[j].ThreadState,
-					info->ThreadInfos[j].ThreadWaitReason,
-					{}
-					});
-				HANDLE thread_handle = OpenThread(THREAD_ALL_ACCESS, FALSE, info->ThreadInfos[j].Client_Id.UniqueThread);
-				if (NULL != thread_handle) {
-					GetThreadGroupAffinity(thread_handle, &(it_process.first->second.threads_.back().group_affinity_));
-					CloseHandle(thread_handle);
-					if (LOGGER->LogType() == Logger::Type::Trace) {
-						wstring msg = L"";
-						msg
-							.append(L"tid ").append(to_wstring(it_process.first->second.threads_.back().thread_id_))
-							.append(L" group ").append(to_wstring(it_process.first->second.threads_.back().group_affinity_.Group))
-							.append(L" mask ").append(to_wstring(it_process.first->second.threads_.back().group_affinity_.Mask));
-						LOGGER->Print(msg, Logger::Type::Trace);
-					}
-				}
+// The node whose mask the process is bound to, -1 when it is bound to several nodes or to a part of one.
+bool ProcessesInfo::ProcessNode(uint32_t pid, int& node) {
+	auto process_numa_groups = probe_->ProcessNumaGroups(pid);
+	if (process_numa_groups.empty()) return false;
+	node = -1;
+	if (process_numa_groups.size() == 1) {
+		auto process_affinity_mask = probe_->ProcessAffinityMask(pid);
+		for (size_t i = 0; i < numa_nodes_.size(); ++i) {
+			if (numa_nodes_[i].group_mask_.group_ == process_numa_groups[0] && numa_nodes_[i].group_mask_.mask_ == process_affinity_mask.first) {
+				node = static_cast<int>(i);
+				break;
 			}
 		}
-		i += info->NextOffset;
-	} while (info->NextOffset != 0);
-	return res;
-}
-
-void ProcessesInfo::DeleteOldProcess(unordered_map<ULONG, ProcessInfo>& lhs, const unordered_map<ULONG, ProcessInfoShort>& rhs) {
-	vector<ULONG> key_delete;
-	for (auto it = lhs.begin(); it != lhs.end(); ++it) {
-		if (rhs.find(it->first) == rhs.end()) key_delete.push_back(it->first);
-	}
-	for (auto it = key_delete.begin(); it != key_delete.end(); ++it) {
-		lhs.erase(*it);
-	}
-}
-
-void ProcessesInfo::AddProcess(std::unordered_map<ULONG, ProcessInfo>& lhs, std::unordered_map<ULONG, ProcessInfoShort>& rhs) {
-	for (auto it_rhs = rhs.begin(); it_rhs != rhs.end(); ++it_rhs) {
-		auto it_lhs = lhs.find(it_rhs->first);
-		if (it_lhs != lhs.end()) {
-			it_lhs->second.user_time_.Add(fileTimeToLongLong(it_rhs->second.user_time_) - fileTimeToLongLong(it_lhs->second.cur_user_time_));
-			it_lhs->second.cur_user_time_ = it_rhs->second.user_time_;
-			it_lhs->second.threads_ = move(it_rhs->second.threads_);
-			if (LOGGER->LogType() == Logger::Type::Trace && it_lhs->second.user_time_.Size() == it_lhs->second.user_time_.Capacity()) {
-				wstring msg = L"AVG USER_TIME=";
-				msg.append(to_wstring(it_lhs->second.user_time_.Avg()))
-					.append(L" for process ").append(it_lhs->second.name_)
-					.append(L" with pid ").append(to_wstring(it_lhs->second.pid_));
-				LOGGER->Print(msg, Logger::Type::Trace);
+	}
+	return true;
+}
+
+PlacementPlan ProcessesInfo::PlanPlacement(const vector<double>& avg_values, const vector<ProcessTable::Map::iterator>& processes) {
+	ScopedPhase phase(profile_, SelfProfile::PlanPlacement);
+	// USER_TIME deltas are collected once per switching interval, in 100-nanosecond units.
+	const double interval = static_cast<double>(max(switching_frequency_, 1)) * 10000000.0;
+
+	vector<Placement> placements;
+	vector<double> remote_shares;
+	int memory_rows = 0;
+	for (auto it = processes.begin(); it != processes.end(); ++it) {
+		ProcessInfo& process = (*it)->second;
+		// A process with spread threads is left to SpreadThreads, its load stays in the measured load of the nodes.
+		if (is_thread_balancing_ && IsSplit(process)) continue;
+		int node;
+		if (!ProcessNode(process.pid_, node)) continue;
+		int64_t user_time = UserTimeAvg(process);
+		double load = static_cast<double>(user_time) / interval;
+		placements.push_back({ process.pid_, load, node, node });
+		placements.back().is_pinned_ = process.moved_generation_ > 0 && processes_.Generation() - process.moved_generation_ < dwell_scans_;
+		placements.back().origin_node_ = process.origin_node_;
+		placements.back().moved_share_ = MovedShare(process);
+		if (planner_.RemotePenalty() > 0.0 && memory_locality_.AppendRemoteShares(process, remote_shares)) placements.back().memory_row_ = memory_rows++;
+		journal_.AddCandidate(process.pid_, node, static_cast<double>(user_time), load);
+	}
+
+	vector<NodeLoad> nodes(numa_nodes_.size());
+	vector<double> measured(numa_nodes_.size(), 0.0);
+	for (size_t i = 0; i < numa_nodes_.size(); ++i) {
+		uint64_t mask = numa_nodes_[i].group_mask_.mask_;
+		int cpus = 0;
+		for (; mask; mask &= mask - 1) ++cpus;
+		nodes[i].capacity_ = cpus;
+		if (i + 1 < avg_values.size()) measured[i] = avg_values[i + 1] / 100.0 * cpus;
+	}
+	// Whatever the node is busy with apart from the planned processes stays where it is.
+	PlacementPlanner::SetBackgrounds(nodes, measured, placements);
+
+	return planner_.Plan(nodes, placements, move(remote_shares));
+}
+
+void ProcessesInfo::ApplyPlan(const PlacementPlan& plan) {
+	ScopedPhase phase(profile_, SelfProfile::ApplyPlan);
+	const ThreadStore& threads = processes_.Threads();
+	for (auto it = plan.placements_.begin(); it != plan.placements_.end(); ++it) {
+		auto it_process = processes_.Processes().find(it->pid_);
+		if (it_process == processes_.Processes().end()) continue;
+		ProcessInfo& process = it_process->second;
+		const NumaNode& target_node = numa_nodes_[it->target_node_];
+
+		if (it->current_node_ != it->target_node_ || test) {
+			if (it->current_node_ >= 0) {
+				LOGGER->Print(Logger::Type::Info, true,
+					process.name_, L";pid=", process.pid_, L";load=", it->load_,
+					L";numa=", numa_nodes_[it->current_node_].node_number_,
+					L";new numa=", target_node.node_number_,
+					L";new numa group=", target_node.group_mask_.group_,
+					L";new mask=", target_node.group_mask_.mask_);
+			}
+			else {
+				LOGGER->Print(Logger::Type::Info, true,
+					process.name_, L";pid=", process.pid_, L";load=", it->load_,
+					L";numa=none",
+					L";new numa=", target_node.node_number_,
+					L";new numa group=", target_node.group_mask_.group_,
+					L";new mask=", target_node.group_mask_.mask_);
+			}
+
+			bool is_set = probe_->SetProcessAffinity(process.pid_, target_node.group_mask_);
+			journal_.AddAffinity(DecisionJournal::ProcessAffinity, process.pid_, 0, target_node.group_mask_, is_set ? 0 : probe_->LastError());
+			metrics_.AddAffinityCall(false, is_set);
+			if (is_set && it->current_node_ != it->target_node_) {
+				process.moved_generation_ = processes_.Generation();
+				process.origin_node_ = it->current_node_;
+				metrics_.AddMove(it->current_node_ < 0);
+				memory_migrator_.Submit(process.pid_, target_node.node_number_);
+			}
+			if (!is_set) {
+				LOGGER->Print(L"Error set process affinity!", Logger::Type::Error);
 			}
 		}
-		else {
-			lhs.insert(pair<ULONG, ProcessInfo>(
-				it_rhs->first,
-				{
-					it_rhs->second.pid_,
-					move(it_rhs->second.name_),
-					it_rhs->second.create_time_,
-					it_rhs->second.user_time_,
-					RingBuffer<LONGLONG>(ring_buffer_size_),
-					move(it_rhs->second.threads_)
+
+		// A process planned as a whole gathers its threads again.
+		split_processes_.erase(process.pid_);
+
+		for (uint32_t i = process.threads_.offset_; i < process.threads_.offset_ + process.threads_.count_; ++i) {
+			const GroupAffinity& thread_affinity = threads.Affinity(i);
+			if (thread_affinity != target_node.group_mask_ || test) {
+				bool is_set = probe_->SetThreadAffinity(threads.ThreadId(i), target_node.group_mask_);
+				journal_.AddAffinity(DecisionJournal::ThreadAffinity, process.pid_, threads.ThreadId(i), target_node.group_mask_, is_set ? 0 : probe_->LastError());
+				metrics_.AddAffinityCall(true, is_set);
+				if (is_set) {
+					LOGGER->Print(Logger::Type::Info, true,
+						process.name_, L";pid=", process.pid_, L";tid=", threads.ThreadId(i),
+						L";numa group=", thread_affinity.group_,
+						L";mask=", thread_affinity.mask_,
+						L";new numa group=", target_node.group_mask_.group_,
+						L";new mask=", target_node.group_mask_.mask_);
+				}
+				else {
+					LOGGER->Print(L"Error set thread affinity!", Logger::Type::Error);
 				}
-			));
+			}
 		}
 	}
 }
 
-void ProcessesInfo::Read() {
-	unordered_map<ULONG, ProcessInfoShort> active_processes = ActiveProcesses();
-	DeleteOldProcess(processes_, active_processes);
-	AddProcess(processes_, active_processes);
-}
-
-const NUMA_NODE_RELATIONSHIP* CalculateNumaWeight(const vector<ThreadInfo>& threads, const vector<NUMA_NODE_RELATIONSHIP>& numa_group) {
-	vector<UINT32> aggregator(numa_group.size(), 0);
-	for (auto it = threads.begin(); it < threads.end(); ++it) {
-		++aggregator[it->group_affinity_.Group];
-	}
-	UINT32 count_thread = 0;
-	int64_t index = -1;
-	for (size_t i = 0; i < aggregator.size(); ++i) {
-		if (count_thread > aggregator[i]) {
-			index = i;
-			count_thread = aggregator[i];
-		}
+// A tick is Read and SetAffinity together, its duration is measured from the start of Read.
+void ProcessesInfo::SetAffinity() {
+	bool is_rebalance;
+	{
+		ScopedPhase phase(profile_, SelfProfile::SetAffinity);
+		SampleMemory();
+		is_rebalance = Rebalance();
+		if (metrics_server_.IsRunning()) PublishProcesses();
 	}
-	
-	if (index != -1) {
-		return &numa_group[index];
+	auto now = chrono::steady_clock::now();
+	metrics_.AddTick(chrono::duration<double>(now - tick_start_).count(), is_rebalance);
+	if (state_save_scans_ > 0 && processes_.Generation() - state_saved_generation_ >= state_save_scans_) SaveState();
+	// The profile is written outside of the phases, its own lines are not measured.
+	if (profile_log_period_ > 0 && now - profile_logged_ >= chrono::seconds(profile_log_period_)) {
+		profile_.Log();
+		profile_logged_ = now;
 	}
-	else {
-		return &numa_group[0];
+}
+
+void ProcessesInfo::SetProfileLogPeriod(int seconds) {
+	profile_log_period_ = seconds;
+	profile_logged_ = chrono::steady_clock::now();
+}
+
+// The node all threads of the process are bound to as of the last scan, -1 when they are not on a single node.
+int ProcessesInfo::ThreadsNode(const ProcessInfo& process) const {
+	const ThreadStore& threads = processes_.Threads();
+	if (process.threads_.count_ == 0) return -1;
+	const GroupAffinity& affinity = threads.Affinity(process.threads_.offset_);
+	for (uint32_t i = process.threads_.offset_ + 1; i < process.threads_.offset_ + process.threads_.count_; ++i) {
+		if (threads.Affinity(i) != affinity) return -1;
 	}
+	return AffinityNode(affinity);
 }
 
-bool SetThreadAffinity(DWORD tid, const GROUP_AFFINITY* group_affinity) {
-	HANDLE thread_handle = OpenThread(THREAD_ALL_ACCESS, FALSE, tid);
-	if (NULL != thread_handle) {
-		SetThreadGroupAffinity(thread_handle, group_affinity, NULL);
-		CloseHandle(thread_handle);
-		return true;
+int ProcessesInfo::AffinityNode(const GroupAffinity& affinity) const {
+	for (size_t i = 0; i < numa_nodes_.size(); ++i) {
+		if (numa_nodes_[i].group_mask_ == affinity) return static_cast<int>(i);
 	}
-	return false;
+	return -1;
+}
+
+bool ProcessesInfo::IsSplit(const ProcessInfo& process) const {
+	auto it = split_processes_.find(process.pid_);
+	return it != split_processes_.end() && it->second == process.create_time_;
 }
 
-bool SetProcessAffinity(pNtSetInformationProcess p_set_process_affinity, DWORD pid, const GROUP_AFFINITY* group_affinity) {
-	HANDLE hProcess = openProcess(pid);
-	if (hProcess != NULL) {
-		NTSTATUS status = p_set_process_affinity(hProcess, (PROCESS_INFORMATION_CLASS)0x15, (void*)group_affinity, sizeof(GROUP_AFFINITY));
-		if (!status) {
-			LOGGER->Print(wstring(L"Error set process affinity: ").append(to_wstring(status)), Logger::Type::Error);
-			CloseHandle(hProcess);
-			return false;
+// Runs when even the process plan leaves the hottest node over maximum_cpu_value and too far from the
+// coolest one. The biggest processes of that node give their hottest threads to the other nodes; the
+// main thread stays, on Linux its mask is the mask of the whole process. Loads of the threads are
+// their USER_TIME over the last interval, processes come sorted by their average load.
+void ProcessesInfo::SpreadThreads(PlacementPlan& plan, const vector<ProcessTable::Map::iterator>& processes) {
+	for (auto it = split_processes_.begin(); it != split_processes_.end();) {
+		auto it_process = processes_.Processes().find(it->first);
+		if (it_process == processes_.Processes().end() || it_process->second.create_time_ != it->second) it = split_processes_.erase(it);
+		else ++it;
+	}
+	if (plan.nodes_.size() < 2) return;
+	const double interval = static_cast<double>(max(switching_frequency_, 1)) * 10000000.0;
+	const ThreadStore& threads = processes_.Threads();
+	for (auto it = processes.begin(); it != processes.end(); ++it) {
+		auto [min_node, max_node] = minmax_element(plan.nodes_.begin(), plan.nodes_.end(),
+			[](const NodeLoad& lhs, const NodeLoad& rhs)->bool { return lhs.planned_ < rhs.planned_; });
+		if (max_node->planned_ * 100.0 <= maximum_cpu_value_ || (max_node->planned_ - min_node->planned_) * 100.0 <= delta_cpu_values_) return;
+		int node = static_cast<int>(max_node - plan.nodes_.begin());
+		ProcessInfo& process = (*it)->second;
+
+		// Threads of a process planned as a whole are where the plan put it, the spread ones where they were bound.
+		bool is_split = IsSplit(process);
+		int process_node = -1;
+		if (!is_split) {
+			auto it_placement = find_if(plan.placements_.begin(), plan.placements_.end(),
+				[&process](const Placement& placement)->bool { return placement.pid_ == process.pid_; });
+			if (it_placement == plan.placements_.end()) continue;
+			process_node = it_placement->target_node_;
+		}
+		thread_placements_.clear();
+		double node_load = 0.0;
+		for (uint32_t i = process.threads_.offset_; i < process.threads_.offset_ + process.threads_.count_; ++i) {
+			if (threads.ThreadId(i) == process.pid_) continue;
+			int thread_node = is_split ? AffinityNode(threads.Affinity(i)) : process_node;
+			double load = static_cast<double>(threads.UserTimeDelta(i)) / interval;
+			if (thread_node == node) node_load += load;
+			thread_placements_.push_back({ threads.ThreadId(i), load, thread_node, thread_node });
+		}
+		if (node_load < max_node->capacity_ * THREAD_SPLIT_SHARE) continue;
+		if (planner_.SpreadThreads(plan, node, thread_placements_) == 0) continue;
+		split_processes_[process.pid_] = process.create_time_;
+		// The memory of a spread process stays where it is, its threads run on both nodes.
+		memory_migrator_.Cancel(process.pid_);
+
+		for (auto it_thread = thread_placements_.begin(); it_thread != thread_placements_.end(); ++it_thread) {
+			if (it_thread->target_node_ == it_thread->current_node_) continue;
+			const NumaNode& target_node = numa_nodes_[it_thread->target_node_];
+			bool is_set = probe_->SetThreadAffinity(it_thread->tid_, target_node.group_mask_);
+			journal_.AddAffinity(DecisionJournal::ThreadAffinity, process.pid_, it_thread->tid_, target_node.group_mask_, is_set ? 0 : probe_->LastError());
+			metrics_.AddAffinityCall(true, is_set);
+			if (is_set) {
+				LOGGER->Print(Logger::Type::Info, true,
+					process.name_, L";pid=", process.pid_, L";tid=", it_thread->tid_, L";load=", it_thread->load_,
+					L";numa=", numa_nodes_[node].node_number_,
+					L";new numa=", target_node.node_number_,
+					L";new numa group=", target_node.group_mask_.group_,
+					L";new mask=", target_node.group_mask_.mask_);
+			}
+			else {
+				LOGGER->Print(L"Error set thread affinity!", Logger::Type::Error);
+			}
 		}
-		CloseHandle(hProcess);
-		return true;
 	}
-	return false;
 }
 
-bool ProcessesInfo::IsNeedToSetAffinity(const vector<double>& values) {
-	double min = values[1];
-	double max = values[1];
-	for (size_t i = 2; i < values.size(); ++i) {
-		if (values[i] < min) min = values[i];
-		if (values[i] > max) max = values[i];
+void ProcessesInfo::PublishProcesses() {
+	const TimeSeriesStore& user_times = processes_.UserTimes();
+	metrics_.BeginProcesses();
+	for (auto it = processes_.Processes().begin(); it != processes_.Processes().end(); ++it) {
+		metrics_.AddProcess(it->second.pid_, it->second.name_, static_cast<double>(user_times.Avg(it->second.user_time_row_)), ThreadsNode(it->second));
 	}
-	return max > maximum_cpu_value_ && max - min > delta_cpu_values_;
+	metrics_.EndProcesses();
 }
 
-void ProcessesInfo::SetAffinity() {
-	if (!NtSetInformationProcess) return;
+bool ProcessesInfo::Rebalance() {
+	if (!probe_ready_ || numa_nodes_.empty()) return false;
 	
-	vector<double> avg_values = perf_monitor_.GetAvgValues();
-	if (!IsNeedToSetAffinity(avg_values)) return;
+	vector<double> avg_values;
+	double confidence = 1.0;
+	{
+		ScopedPhase phase(profile_, SelfProfile::GetAvgValues);
+		avg_values = is_fast_warm_up_ ? perf_monitor_.GetAvgValues(confidence) : perf_monitor_.GetAvgValues();
+	}
+	metrics_.SetCounters(perf_monitor_.GetCountersName(), avg_values);
+	spawn_placer_.SetNodeLoads(avg_values);
+	bool is_rebalance = IsNeedToSetAffinity(avg_values, confidence);
+	JournalLoads(avg_values, is_rebalance);
+	if (!is_rebalance) return false;
 
 	auto& counters_name = perf_monitor_.GetCountersName();
 	for (size_t i = 0; i < counters_name.size(); ++i) {
-		wstring msg = L"AVG for ";
-		msg.append(counters_name[i]);
-		msg.append(L"=").append(to_wstring(avg_values[i]));
-		LOGGER->Print(msg, Logger::Type::Info, true);
+		LOGGER->Print(Logger::Type::Info, true, L"AVG for ", counters_name[i], L"=", avg_values[i]);
 	}
+	if (confidence < 1.0) LOGGER->Print(Logger::Type::Info, true, L"Warm-up;confidence=", confidence);
+	LogHottestDomains();
 	
-	vector<unordered_map<ULONG, ProcessInfo>::iterator> processes_affinity;
-	for (auto it = processes_.begin(); it != processes_.end(); ++it) {
-		if (it->second.user_time_.Size() == it->second.user_time_.Capacity()) processes_affinity.push_back(it);
+	// Averages are precomputed by the table at the end of the scan, only the ones of the warm-up are blended here,
+	// once per process rather than on every comparison of the sort.
+	vector<pair<int64_t, ProcessTable::Map::iterator>> ranked;
+	for (auto it = processes_.Processes().begin(); it != processes_.Processes().end(); ++it) {
+		if (HasUserTime(it->second)) ranked.push_back({ UserTimeAvg(it->second), it });
 	}
 	
-	sort(processes_affinity.begin(), processes_affinity.end(),
-		[](unordered_map<ULONG, ProcessInfo>::iterator lhs, unordered_map<ULONG, ProcessInfo>::iterator rhs)->bool {
-			return lhs->second.user_time_.Avg() > rhs->second.user_time_.Avg();
+	sort(ranked.begin(), ranked.end(),
+		[](const pair<int64_t, ProcessTable::Map::iterator>& lhs, const pair<int64_t, ProcessTable::Map::iterator>& rhs)->bool {
+			return lhs.first > rhs.first;
 		}
 	);
 
-	for (auto it = processes_affinity.begin(); it != processes_affinity.end(); ++it) {
-		wstring msg = L"AVG USER_TIME=";
-		msg.append(to_wstring((*it)->second.user_time_.Avg()))
-			.append(L" for process ").append((*it)->second.name_)
-			.append(L" with pid ").append(to_wstring((*it)->second.pid_));
-		LOGGER->Print(msg, true);
-	}
-		
-	int index_numa_group = 0;
-	const NUMA_NODE_RELATIONSHIP* cur_numa_node = nullptr;
-	for (auto it = processes_affinity.begin(); it != processes_affinity.end(); ++it) {
-			
-		ProcessInfo& process = (*it)->second;
-		auto process_numa_groups = GetProcessNumaGroup(process.pid_);
-		auto process_affinity_mask = GetProcAffinityMask(process.pid_);
-
-		if (process_numa_groups.size()) {
-
-			if (!cur_numa_node) {
-				if (process_numa_groups.size() == 1) {
-					cur_numa_node = &numa_nodes_[0];
-				}
-				else if (process_numa_groups.size() > 1) {
-					cur_numa_node = CalculateNumaWeight(process.threads_, numa_nodes_);
-				}
-				else {
-					LOGGER->Print(L"Error get numa groups for process", Logger::Type::Error);
-					break;
-				}
-			}
-
-			if (process_numa_groups.size() > 1 || process_numa_groups[0] != cur_numa_node->GroupMask.Group || process_affinity_mask.first != cur_numa_node->GroupMask.Mask || test) {
-				LOGGER->Print(
-					wstring(process.name_).
-					append(L";pid=").append(to_wstring(process.pid_)).
-					append(L";numa group=").append(vectorToWstring(process_numa_groups)).
-					append(L";mask=").append(to_wstring(process_affinity_mask.first)).
-					append(L";new numa=").append(to_wstring(cur_numa_node->GroupMask.Group)).
-					append(L";new mask=").append(to_wstring(cur_numa_node->GroupMask.Mask)),
-					true
-				);
-
-				if (!SetProcessAffinity(NtSetInformationProcess, process.pid_, &cur_numa_node->GroupMask)) {
-					LOGGER->Print(L"Error set process affinity!", Logger::Type::Error);
-				}
-			}
-
-			for (auto it_thread = process.threads_.begin(); it_thread < process.threads_.end(); ++it_thread) {
-				if (it_thread->group_affinity_.Group != cur_numa_node->GroupMask.Group || it_thread->group_affinity_.Mask != cur_numa_node->GroupMask.Mask || test) {
-					if (SetThreadAffinity(it_thread->thread_id_, &cur_numa_node->GroupMask)) {
-						LOGGER->Print(
-							wstring(process.name_).
-							append(L";pid=").append(to_wstring(process.pid_)).
-							append(L";tid=").append(to_wstring(it_thread->thread_id_)).
-							append(L";numa group=").append(to_wstring(it_thread->group_affinity_.Group)).
-							append(L";mask=").append(to_wstring(it_thread->group_affinity_.Mask)).
-							append(L";new numa group=").append(to_wstring(cur_numa_node->GroupMask.Group)).
-							append(L";new mask=").append(to_wstring(cur_numa_node->GroupMask.Mask)),
-							true
-						);
-					}
-					else {
-						LOGGER->Print(L"Error set thread affinity!", Logger::Type::Error);
-					}
-				}
-			}
-			++index_numa_group;
-			if (index_numa_group >= numa_nodes_.size()) index_numa_group = 0;
-			cur_numa_node = &numa_nodes_[index_numa_group];
-		}
+	vector<ProcessTable::Map::iterator> processes_affinity;
+	processes_affinity.reserve(ranked.size());
+	for (auto it = ranked.begin(); it != ranked.end(); ++it) {
+		processes_affinity.push_back(it->second);
+		LOGGER->Print(Logger::Type::Info, true,
+			L"AVG USER_TIME=", it->first,
+			L" for process ", it->second->second.name_,
+			L" with pid ", it->second->second.pid_);
 	}
-}
 
-void ProcessesInfo::GetNumaInfo() {
-	numa_nodes_.resize(0);
-	DWORD ReturnLength = 0;
-	GetLogicalProcessorInformationEx(LOGICAL_PROCESSOR_RELATIONSHIP::RelationNumaNode, NULL, &ReturnLength);
-	std::vector<BYTE> buffer(ReturnLength);
-	SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* p;
-	if (GetLogicalProcessorInformationEx(LOGICAL_PROCESSOR_RELATIONSHIP::RelationNumaNode, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&buffer[0], &ReturnLength)) {
-		BYTE* pCur = (BYTE*)&buffer[0];
-		BYTE* pEnd = pCur + ReturnLength;
-		for (int i = 0; pCur < pEnd; pCur += ((SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)pCur)->Size, ++i) {
-			p = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)pCur;
-			numa_nodes_.push_back(p->NumaNode);
-			wstring msg = L"";
-			msg
-				.append(L"NodeNumber=").append(to_wstring(p->NumaNode.NodeNumber))
-				.append(L";GroupMask.Group=").append(to_wstring(p->NumaNode.GroupMask.Group))
-				.append(L";GroupMask.Mask=").append(to_wstring(p->NumaNode.GroupMask.Mask));
-			LOGGER->Print(msg, Logger::Type::Info, true);
-		}
+	PlacementPlan plan = PlanPlacement(avg_values, processes_affinity);
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		LOGGER->Print(Logger::Type::Info, true,
+			L"Plan for numa=", numa_nodes_[i].node_number_,
+			L";capacity=", plan.nodes_[i].capacity_,
+			L";background=", plan.nodes_[i].background_,
+			L";load=", plan.nodes_[i].current_,
+			L";planned load=", plan.nodes_[i].planned_);
+	}
+	LOGGER->Print(Logger::Type::Info, true,
+		L"Plan max load=", plan.current_max_load_,
+		L";planned max load=", plan.planned_max_load_,
+		L";moves=", plan.Moves(),
+		L";prevented oscillations=", plan.prevented_,
+		plan.is_rebalanced_ ? L"" : L";bound processes are kept");
+	prevented_oscillations_ += plan.prevented_;
+	metrics_.AddPreventedOscillations(plan.prevented_);
+	for (auto it = plan.placements_.begin(); it != plan.placements_.end(); ++it) {
+		if (it->current_node_ != it->target_node_) journal_.AddMove(it->pid_, it->current_node_, it->target_node_, it->load_);
 	}
+
+	ApplyPlan(plan);
+	if (is_thread_balancing_) SpreadThreads(plan, processes_affinity);
+	return true;
 }
 
-vector<USHORT> ProcessesInfo::GetProcessNumaGroup(ULONG id_process) {
-	HANDLE hProcess = openProcess(id_process);
-	if (hProcess != NULL) {
-		std::vector<USHORT> GroupArray(128);
-		USHORT GroupCount = static_cast<USHORT>(GroupArray.size());
-		if (GetProcessGroupAffinity(hProcess, &GroupCount, &GroupArray[0])) {
-			CloseHandle(hProcess);
-			GroupArray.resize(GroupCount);
-			return GroupArray;
+// Node averages hide a single saturated core or L3 cache, so the hottest ones of the last sample are logged with them.
+void ProcessesInfo::LogHottestDomains() {
+	const CpuStatSampler::View views[] = { CpuStatSampler::L3, CpuStatSampler::Core };
+	const wchar_t* names[] = { L"L3 of cpu ", L"core of cpu " };
+	for (size_t i = 0; i < 2; ++i) {
+		uint32_t id;
+		double load;
+		if (perf_monitor_.GetHottestDomain(views[i], id, load)) {
+			LOGGER->Print(Logger::Type::Info, true, L"MAX for ", names[i], id, L"=", load);
 		}
-		else {
-			CloseHandle(hProcess);
-			std::wstring err_wstr = L"Failed to retrieve processor group affinity for process pid ";
-			err_wstr
-				.append(std::to_wstring(id_process)).append(L". ")
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
-			return {};
-		}
-		CloseHandle(hProcess);
 	}
-	return {};
 }
 
-pair<DWORD_PTR, DWORD_PTR> ProcessesInfo::GetProcAffinityMask(ULONG id_process) {
-	DWORD_PTR process_affinity_mask = 0;
-	DWORD_PTR system_affinity_mask = 0;
+void ProcessesInfo::GetNumaInfo() {
+	numa_nodes_ = probe_->NumaNodes();
+	memory_locality_.SetNodes(numa_nodes_);
+	spawn_placer_.SetNodes(numa_nodes_);
+	for (auto it = numa_nodes_.begin(); it != numa_nodes_.end(); ++it) {
+		LOGGER->Print(Logger::Type::Info, true,
+			L"NodeNumber=", it->node_number_,
+			L";GroupMask.Group=", it->group_mask_.group_,
+			L";GroupMask.Mask=", it->group_mask_.mask_);
+	}
 
-	HANDLE hProcess = openProcess(id_process);
-	if (hProcess != NULL) {
-		if (!GetProcessAffinityMask(hProcess, &process_affinity_mask, &system_affinity_mask)) {
-			std::wstring err_wstr = L"Failed to retrieve processor affinity mask for process pid ";
-			err_wstr
-				.append(std::to_wstring(id_process)).append(L". ")
-				.append(getLastError().second);
-			LOGGER->Print(err_wstr, Logger::Type::Error);
+	// A move costs more between nodes that are further apart than the nearest two, a node the topology
+	// does not know is as near as those.
+	vector<double> move_distances;
+	if (probe_->ReadTopology(topology_)) {
+		topology_.Log();
+		double nearest = topology_.NearestNodeDistance();
+		for (auto it = numa_nodes_.begin(); it != numa_nodes_.end(); ++it) {
+			uint32_t node = topology_.FindDomain(CpuTopology::Node, it->node_number_);
+			for (auto it_target = numa_nodes_.begin(); it_target != numa_nodes_.end(); ++it_target) {
+				uint32_t target_node = topology_.FindDomain(CpuTopology::Node, it_target->node_number_);
+				bool is_known = node != CpuTopology::NO_DOMAIN && target_node != CpuTopology::NO_DOMAIN && node != target_node;
+				move_distances.push_back(is_known ? topology_.NodeDistance(node, target_node) / nearest : 1.0);
+			}
 		}
-		CloseHandle(hProcess);
 	}
-	return { process_affinity_mask, system_affinity_mask };
-}
-
+	planner_.SetMoveDistances(move_distances);
+}
\ No newline at end of file
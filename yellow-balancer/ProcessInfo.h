@@ -1,227 +1,143 @@
 ﻿#pragma once
 
-#define _WIN32_WINNT 0x0601
-
 #include <iostream>
-#include <windows.h>
 #include <string>
 #include <unordered_set>
 #include <vector>
 #include <unordered_map>
-#include <processtopologyapi.h>
+#include <memory>
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
 #include "Logger.h"
+#include "decision_journal.h"
+#include "memory_locality.h"
+#include "memory_migrator.h"
+#include "metrics.h"
+#include "metrics_server.h"
 #include "perf_monitor.h"
+#include "placement_planner.h"
 #include "ring_buffer.h"
-
-typedef LONG KPRIORITY;
-
-struct CLIENT_ID {
-	DWORD UniqueProcess; // Process ID
-#ifdef _WIN64
-	ULONG pad1;
-#endif
-	DWORD UniqueThread;  // Thread ID
-#ifdef _WIN64
-	ULONG pad2;
-#endif
-};
-
-typedef struct {
-	FILETIME ProcessorTime;
-	FILETIME UserTime;
-	FILETIME CreateTime;
-	ULONG WaitTime;
-#ifdef _WIN64
-	ULONG pad1;
-#endif
-	PVOID StartAddress;
-	CLIENT_ID Client_Id;
-	KPRIORITY CurrentPriority;
-	KPRIORITY BasePriority;
-	ULONG ContextSwitchesPerSec;
-	ULONG ThreadState;
-	ULONG ThreadWaitReason;
-	ULONG pad2;
-} SYSTEM_THREAD_INFORMATION;
-
-typedef struct {
-	USHORT Length;
-	USHORT MaximumLength;
-	PWSTR  Buffer;
-} UNICODE_STRING;
-
-typedef struct {
-	ULONG_PTR PeakVirtualSize;
-	ULONG_PTR VirtualSize;
-	ULONG PageFaultCount;
-#ifdef _WIN64
-	ULONG pad1;
-#endif
-	ULONG_PTR PeakWorkingSetSize;
-	ULONG_PTR WorkingSetSize;
-	ULONG_PTR QuotaPeakPagedPoolUsage;
-	ULONG_PTR QuotaPagedPoolUsage;
-	ULONG_PTR QuotaPeakNonPagedPoolUsage;
-	ULONG_PTR QuotaNonPagedPoolUsage;
-	ULONG_PTR PagefileUsage;
-	ULONG_PTR PeakPagefileUsage;
-} VM_COUNTERS;
-
-typedef struct {
-	ULONG NextOffset;
-	ULONG ThreadCount;
-	LARGE_INTEGER WorkingSetPrivateSize;
-	ULONG HardFaultCount;
-	ULONG NumberOfThreadsHighWatermark;
-	ULONGLONG CycleTime;
-	FILETIME CreateTime;
-	FILETIME UserTime;
-	FILETIME KernelTime;
-	UNICODE_STRING ImageName;
-	KPRIORITY BasePriority;
-#ifdef _WIN64
-	ULONG pad1;
-#endif
-	ULONG ProcessId;
-#ifdef _WIN64
-	ULONG pad2;
-#endif
-	ULONG InheritedFromProcessId;
-#ifdef _WIN64
-	ULONG pad3;
-#endif
-	ULONG HandleCount;
-	ULONG SessionId;
-	ULONG_PTR UniqueProcessKey; // always NULL, use SystemExtendedProcessInformation (57) to get value
-	VM_COUNTERS VirtualMemoryCounters;
-	ULONG_PTR PrivatePageCount;
-	IO_COUNTERS IoCounters;
-	SYSTEM_THREAD_INFORMATION ThreadInfos[1];
-} SYSTEM_PROCESS_INFORMATION;
-
-#define SYSTEMPROCESSINFORMATION 5
-#define STATUS_INFO_LENGTH_MISMATCH ((NTSTATUS) 0xC0000004)
-
-typedef NTSTATUS(WINAPI* pNtQuerySystemInformation)(int, PVOID, ULONG, PULONG);
-
-typedef NTSTATUS(NTAPI* pNtSetInformationProcess)(
-	HANDLE ProcessHandle,
-	PROCESS_INFORMATION_CLASS ProcessInformationClass,
-	PVOID ProcessInformation,
-	ULONG ProcessInformationLength
-	);
-
-typedef enum {
-	ThreadStateInitialized,
-	ThreadStateReady,
-	ThreadStateRunning,
-	ThreadStateStandby,
-	ThreadStateTerminated,
-	ThreadStateWaiting,
-	ThreadStateTransition,
-	ThreadStateDeferredReady
-} THREAD_STATE;
-
-typedef enum {
-	ThreadWaitReasonExecutive,
-	ThreadWaitReasonFreePage,
-	ThreadWaitReasonPageIn,
-	ThreadWaitReasonPoolAllocation,
-	ThreadWaitReasonDelayExecution,
-	ThreadWaitReasonSuspended,
-	ThreadWaitReasonUserRequest,
-	ThreadWaitReasonWrExecutive,
-	ThreadWaitReasonWrFreePage,
-	ThreadWaitReasonWrPageIn,
-	ThreadWaitReasonWrPoolAllocation,
-	ThreadWaitReasonWrDelayExecution,
-	ThreadWaitReasonWrSuspended,
-	ThreadWaitReasonWrUserRequest,
-	ThreadWaitReasonWrEventPair,
-	ThreadWaitReasonWrQueue,
-	ThreadWaitReasonWrLpcReceive,
-	ThreadWaitReasonWrLpcReply,
-	ThreadWaitReasonWrVirtualMemory,
-	ThreadWaitReasonWrPageOut,
-	ThreadWaitReasonWrRendezvous,
-	ThreadWaitReasonWrKeyedEvent,
-	ThreadWaitReasonWrTerminated,
-	ThreadWaitReasonWrProcessInSwap,
-	ThreadWaitReasonWrCpuRateControl,
-	ThreadWaitReasonWrCalloutStack,
-	ThreadWaitReasonWrKernel,
-	ThreadWaitReasonWrResource,
-	ThreadWaitReasonWrPushLock,
-	ThreadWaitReasonWrMutex,
-	ThreadWaitReasonWrQuantumEnd,
-	ThreadWaitReasonWrDispatchInt,
-	ThreadWaitReasonWrPreempted,
-	ThreadWaitReasonWrYieldExecution,
-	ThreadWaitReasonWrFastMutex,
-	ThreadWaitReasonWrGuardedMutex,
-	ThreadWaitReasonWrRundown,
-	ThreadWaitReasonMaximumWaitReason
-} THREAD_WAIT_REASON;
-
-struct ThreadInfo {
-	DWORD thread_id_;
-	ULONG thread_state_;
-	ULONG thread_wait_reason_;
-	GROUP_AFFINITY group_affinity_;
-};
-
-struct ProcessInfo {
-	ULONG pid_;
-	std::wstring name_;
-	FILETIME create_time_;
-	FILETIME cur_user_time_;
-	RingBuffer<LONGLONG> user_time_;
-	std::vector<ThreadInfo> threads_;
-};
-
-struct ProcessInfoShort {
-	ULONG pid_;
-	std::wstring name_;
-	FILETIME create_time_;
-	FILETIME user_time_;
-	FILETIME kernel_time_;
-	std::vector<ThreadInfo> threads_;
-};
+#include "process_table.h"
+#include "self_profile.h"
+#include "spawn_placer.h"
+#include "state_snapshot.h"
+#include "system_probe.h"
 
 class ProcessesInfo {
 public:
+	ProcessesInfo();
+	explicit ProcessesInfo(std::unique_ptr<SystemProbe> probe);
 	~ProcessesInfo();
 	ProcessesInfo& AddFilter(std::wstring process_name);
 	void Init(int cpu_analysis_period, int switching_frequency, int maximum_cpu_value, int delta_cpu_values);
+	// Applies the values of Init to a running balancer; the collected samples that fit the new windows are kept.
+	void Reconfigure(int cpu_analysis_period, int switching_frequency, int maximum_cpu_value, int delta_cpu_values);
+	// Replaces the filter, the processes that no longer match leave the table on the next scan.
+	void SetFilter(const std::vector<std::wstring>& process_names);
 	void Read();
 	void SetAffinity();
+	void SetMigrationCost(int migration_cost);
+	// Percent of its own load a process costs for its memory on other nodes; 0 - the memory is not sampled.
+	void SetRemoteMemoryPenalty(int remote_memory_penalty);
+	// Moves the memory of a moved process after it at the given rate, 0 - the memory stays where it is.
+	// With external counters the owner drives the migration through StepMemoryMigration.
+	void SetMemoryMigration(int megabytes_per_second);
+	// A moved process stays on its node for dwell_time seconds, a plan moves at most max_moves processes
+	// (0 - any number) and a move back to the node a process came from costs damping percent more.
+	void SetHysteresis(int dwell_time, int max_moves, int damping);
+	size_t PreventedOscillations() const { return prevented_oscillations_; }
+	void StepMemoryMigration(double seconds) { memory_migrator_.Step(seconds); }
+	const MemoryMigrator& MemoryMigration() const { return memory_migrator_; }
+	// Spreads the hottest threads of a process too big for one node when moving processes does not help.
+	void SetThreadBalancing(bool is_thread_balancing) { is_thread_balancing_ = is_thread_balancing; }
+	// Balances before the windows are full, on the values collected so far and the lifetime averages of the processes.
+	void SetFastWarmUp(bool is_fast_warm_up) { is_fast_warm_up_ = is_fast_warm_up; }
+	// Binds a new process to the least loaded node as soon as it starts. With external counters the owner
+	// reports the new processes through PlaceNewProcess.
+	void SetSpawnPlacement(bool is_spawn_placement);
+	bool PlaceNewProcess(uint32_t pid) { return spawn_placer_.Place(pid); }
+	size_t SpawnPlacements() const { return spawn_placer_.Placed(); }
+	void SetSampleInterval(int sample_interval) { perf_monitor_.SetSampleInterval(sample_interval); }
 	void SetTest() { test = true; }
+	bool OpenJournal(const std::filesystem::path& path, int size_in_megabytes);
+	// Restores the state a previous run left in the file, if it is younger than the analysis window, and
+	// saves the state there every save_period seconds and at the end (0 - the state is not kept).
+	// A snapshot older than max_age seconds is not restored.
+	bool OpenState(const std::filesystem::path& path, int save_period, int max_age);
+	void SaveState();
+	bool StartMetricsServer(int port) { return metrics_server_.Start(port); }
+	const BalancerMetrics& Metrics() const { return metrics_; }
+	// The profile of the tick phases is logged every period (0 - only by LogProfile).
+	void SetProfileLogPeriod(int seconds);
+	const SelfProfile& Profile() const { return profile_; }
+	void LogProfile() const { profile_.Log(); }
+	void SetExternalCounters() { is_external_counters_ = true; }
+	void AddCounterValues(const std::vector<double>& values) { perf_monitor_.AddValues(values); }
 private:
+	std::unique_ptr<SystemProbe> probe_;
+	bool probe_ready_ = false;
+	bool is_external_counters_ = false;
 	std::unordered_set<std::wstring> process_filter_;
-	std::vector<ProcessInfoShort> processes_short_;
-	std::unordered_map<ULONG, ProcessInfo> processes_;
-	std::vector<NUMA_NODE_RELATIONSHIP> numa_nodes_;
+	ProcessTable processes_;
+	std::vector<NumaNode> numa_nodes_;
+	CpuTopology topology_;
 	PerfMonitor perf_monitor_;
+	PlacementPlanner planner_;
+	MemoryLocality memory_locality_;
+	DecisionJournal journal_;
+	BalancerMetrics metrics_;
+	MetricsServer metrics_server_{ metrics_ };
+	MemoryMigrator memory_migrator_{ *probe_, metrics_ };
+	SpawnPlacer spawn_placer_{ *probe_, metrics_ };
+	StateSnapshot state_;
+	std::filesystem::path state_path_;
+	int state_save_period_ = 0;
+	uint64_t state_save_scans_ = 0;
+	uint64_t state_saved_generation_ = 0;
+	// Processes of the restored state, until the first complete scan takes them over.
+	size_t state_processes_ = 0;
+	bool is_state_restoring_ = false;
+	std::vector<std::vector<double>> state_counters_;
+	std::chrono::steady_clock::time_point tick_start_;
+	SelfProfile profile_;
+	int profile_log_period_ = 0;
+	std::chrono::steady_clock::time_point profile_logged_;
+	bool is_thread_balancing_ = false;
+	bool is_fast_warm_up_ = false;
+	// The time of the last scan on the clock of the create times, -1 when the probe can't tell it.
+	int64_t scan_time_ = -1;
+	// Create times of the processes whose threads were spread over several nodes, by pid.
+	std::unordered_map<uint32_t, int64_t> split_processes_;
+	std::vector<ThreadPlacement> thread_placements_;
+	uint64_t dwell_scans_ = 0;
+	size_t prevented_oscillations_ = 0;
 	int cpu_analysis_period_;
+	int switching_frequency_;
 	int ring_buffer_size_;
 	int maximum_cpu_value_;
 	int delta_cpu_values_;
-	std::vector<BYTE> buffer_active_processes;
 
 	void InitPerfMonitor(int cpu_analysis_period);
-	void InitNtSetInformationProcess();
-	void InitNtQuerySystemInformation();
 	void GetNumaInfo();
-	std::vector<USHORT> GetProcessNumaGroup(ULONG id_process);
-	std::pair<DWORD_PTR, DWORD_PTR> GetProcAffinityMask(ULONG id_process);
-	pNtSetInformationProcess NtSetInformationProcess;
-	pNtQuerySystemInformation NtQuerySystemInformation;
-	std::unordered_map<ULONG, ProcessInfoShort> ActiveProcesses();
-	void DeleteOldProcess(std::unordered_map<ULONG, ProcessInfo>& lhs, const std::unordered_map<ULONG, ProcessInfoShort>& rhs);
-	void AddProcess(std::unordered_map<ULONG, ProcessInfo>& lhs, std::unordered_map<ULONG, ProcessInfoShort>& rhs);
-	bool IsNeedToSetAffinity(const std::vector<double>& values);
+	void SetStateSavePeriod(int save_period);
+	void LogProcesses();
+	void LogHottestDomains();
+	bool Rebalance();
+	int ThreadsNode(const ProcessInfo& process) const;
+	int AffinityNode(const GroupAffinity& affinity) const;
+	bool IsSplit(const ProcessInfo& process) const;
+	void SpreadThreads(PlacementPlan& plan, const std::vector<ProcessTable::Map::iterator>& processes);
+	void PublishProcesses();
+	bool IsNeedToSetAffinity(const std::vector<double>& values, double confidence);
+	bool HasUserTime(const ProcessInfo& process) const;
+	double LifetimeUserTime(const ProcessInfo& process) const;
+	int64_t UserTimeAvg(const ProcessInfo& process) const;
+	double MovedShare(const ProcessInfo& process) const;
+	void JournalLoads(const std::vector<double>& values, bool is_rebalance);
+	bool ProcessNode(uint32_t pid, int& node);
+	void SampleMemory();
+	PlacementPlan PlanPlacement(const std::vector<double>& avg_values, const std::vector<ProcessTable::Map::iterator>& processes);
+	void ApplyPlan(const PlacementPlan& plan);
 	bool test = false;
 };
@@ -0,0 +1,32 @@
+﻿#include <cstdlib>
+#include <new>
+#include "self_profile.h"
+
+// Replaces the global operator new of the program to count the allocations of every thread for the
+// phases of SelfProfile. Only programs without their own replacement link this file.
+
+void* operator new(size_t size) {
+	++thread_counters.allocations_;
+	if (void* p = malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
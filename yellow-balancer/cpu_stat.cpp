@@ -0,0 +1,227 @@
+﻿#include "cpu_stat.h"
+#include <algorithm>
+#include <cstdlib>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include "system_probe_linux.h"
+#include "topology.h"
+#endif
+#include "Logger.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+static const size_t INITIAL_BUFFER_SIZE = 16 * 1024;
+
+static const char* skipSpaces(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t')) ++p;
+	return p;
+}
+
+static const char* parseNumber(const char* p, const char* end, uint64_t& value) {
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + static_cast<uint64_t>(*p - '0');
+		++p;
+	}
+	return p;
+}
+
+// Fields: user nice system idle iowait irq softirq steal guest guest_nice; guest time is already counted in user.
+static const char* parseCpuTimes(const char* p, const char* end, CpuTimes& times) {
+	uint64_t fields[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	for (size_t i = 0; i < 8; ++i) {
+		p = skipSpaces(p, end);
+		if (p == end || *p < '0' || *p > '9') break;
+		p = parseNumber(p, end, fields[i]);
+	}
+	uint64_t idle = fields[3] + fields[4];
+	times.total_ = fields[0] + fields[1] + fields[2] + idle + fields[5] + fields[6] + fields[7];
+	times.busy_ = times.total_ - idle;
+	return p;
+}
+
+size_t ParseProcStat(const char* data, size_t size, CpuTimes& total, vector<CpuTimes>& cpus) {
+	const char* p = data;
+	const char* end = data + size;
+	size_t found = 0;
+	while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+		p += 3;
+		if (*p == ' ') {
+			p = parseCpuTimes(p, end, total);
+		}
+		else {
+			uint64_t cpu;
+			p = parseNumber(p, end, cpu);
+			if (cpu < cpus.size()) {
+				p = parseCpuTimes(p, end, cpus[cpu]);
+				++found;
+			}
+		}
+		while (p < end && *p != '\n') ++p;
+		if (p < end) ++p;
+	}
+	return found;
+}
+
+static double loadPercent(const CpuTimes& current, const CpuTimes& previous) {
+	if (current.total_ <= previous.total_ || current.busy_ < previous.busy_) return 0.0;
+	double load = static_cast<double>(current.busy_ - previous.busy_) / static_cast<double>(current.total_ - previous.total_) * 100.0;
+	return min(load, 100.0);
+}
+
+CpuStatSampler::CpuStatSampler(fs::path procfs_root, fs::path sysfs_root) :
+	procfs_root_(move(procfs_root)),
+	sysfs_root_(move(sysfs_root)) {}
+
+double CpuStatSampler::Load(const vector<uint32_t>& cpus) const {
+	if (cpus.empty()) return total_load_;
+	double sum = 0.0;
+	size_t count = 0;
+	for (auto it = cpus.begin(); it != cpus.end(); ++it) {
+		if (*it < loads_.size()) {
+			sum += loads_[*it];
+			++count;
+		}
+	}
+	return count ? sum / static_cast<double>(count) : 0.0;
+}
+
+size_t CpuStatSampler::HottestDomain(View view) const {
+	const vector<double>& loads = views_[view].loads_;
+	return static_cast<size_t>(max_element(loads.begin(), loads.end()) - loads.begin());
+}
+
+void CpuStatSampler::AddDomain(View view, uint32_t cpu, uint32_t id) {
+	Domains& domains = views_[view];
+	auto it = find(domains.ids_.begin(), domains.ids_.end(), id);
+	uint32_t domain = static_cast<uint32_t>(it - domains.ids_.begin());
+	if (it == domains.ids_.end()) {
+		domains.ids_.push_back(id);
+		domains.cpus_.push_back(0);
+	}
+	domains.domain_of_cpu_[cpu] = domain;
+	++domains.cpus_[domain];
+}
+
+bool CpuStatSampler::Sample() {
+	size_t size = Read();
+	if (!size) return false;
+	ParseProcStat(buffer_.data(), size, total_, times_);
+
+	total_load_ = loadPercent(total_, previous_total_);
+	previous_total_ = total_;
+	for (size_t i = 0; i < times_.size(); ++i) {
+		loads_[i] = loadPercent(times_[i], previous_times_[i]);
+		previous_times_[i] = times_[i];
+	}
+
+	for (size_t v = 0; v < 3; ++v) {
+		Domains& domains = views_[v];
+		fill(domains.loads_.begin(), domains.loads_.end(), 0.0);
+		for (size_t i = 0; i < loads_.size(); ++i) {
+			uint32_t domain = domains.domain_of_cpu_[i];
+			if (domain != NO_DOMAIN) domains.loads_[domain] += loads_[i];
+		}
+		for (size_t i = 0; i < domains.loads_.size(); ++i) {
+			domains.loads_[i] /= max<uint32_t>(domains.cpus_[i], 1);
+		}
+	}
+	return true;
+}
+
+#ifdef __linux__
+CpuStatSampler::~CpuStatSampler() {
+	if (fd_ >= 0) close(fd_);
+}
+
+// The buffer is doubled only when the file fills it, so the steady state is one pread per sample.
+size_t CpuStatSampler::Read() {
+	if (fd_ < 0) return 0;
+	for (;;) {
+		ssize_t size = pread(fd_, buffer_.data(), buffer_.size(), 0);
+		if (size <= 0) return 0;
+		if (static_cast<size_t>(size) < buffer_.size()) return static_cast<size_t>(size);
+		buffer_.resize(buffer_.size() * 2);
+	}
+}
+
+// The node, L3 cache and core of every sampled CPU from the sysfs topology. A CPU the topology does not
+// know is on node 0 and is an L3 cache and a core of its own.
+void CpuStatSampler::ReadTopology() {
+	CpuTopology topology;
+	ReadSysfsTopology(sysfs_root_, topology);
+	for (uint32_t cpu = 0; cpu < loads_.size(); ++cpu) {
+		if (topology.DomainOf(CpuTopology::Node, cpu) == CpuTopology::NO_DOMAIN) {
+			AddDomain(Node, cpu, 0);
+			AddDomain(L3, cpu, cpu);
+			AddDomain(Core, cpu, cpu);
+			continue;
+		}
+		AddDomain(Node, cpu, topology.DomainId(CpuTopology::Node, topology.DomainOf(CpuTopology::Node, cpu)));
+		AddDomain(L3, cpu, topology.DomainId(CpuTopology::L3, topology.DomainOf(CpuTopology::L3, cpu)));
+		AddDomain(Core, cpu, topology.DomainId(CpuTopology::Core, topology.DomainOf(CpuTopology::Core, cpu)));
+	}
+}
+
+// The number of CPUs is taken from /proc/stat, so CPUs that are offline at start are not sampled.
+bool CpuStatSampler::Init() {
+	if (fd_ >= 0) close(fd_);
+	fd_ = open((procfs_root_ / "stat").c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_ < 0) {
+		LOGGER->Print(wstring(L"CpuStatSampler: can't open ").append((procfs_root_ / "stat").wstring()), Logger::Type::Error);
+		return false;
+	}
+	buffer_.resize(INITIAL_BUFFER_SIZE);
+	size_t size = Read();
+	if (!size) return false;
+
+	uint32_t max_cpu = 0;
+	bool is_found = false;
+	const char* p = buffer_.data();
+	const char* end = p + size;
+	while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+		if (p[3] >= '0' && p[3] <= '9') {
+			uint64_t cpu;
+			parseNumber(p + 3, end, cpu);
+			max_cpu = max(max_cpu, static_cast<uint32_t>(cpu));
+			is_found = true;
+		}
+		while (p < end && *p != '\n') ++p;
+		if (p < end) ++p;
+	}
+	if (!is_found) return false;
+
+	size_t cpus = static_cast<size_t>(max_cpu) + 1;
+	times_.assign(cpus, { 0, 0 });
+	previous_times_.assign(cpus, { 0, 0 });
+	loads_.assign(cpus, 0.0);
+	for (size_t v = 0; v < 3; ++v) {
+		views_[v].domain_of_cpu_.assign(cpus, NO_DOMAIN);
+		views_[v].ids_.clear();
+		views_[v].cpus_.clear();
+	}
+	ReadTopology();
+	for (size_t v = 0; v < 3; ++v) {
+		views_[v].loads_.assign(views_[v].ids_.size(), 0.0);
+	}
+	// The first sample is the baseline of the first interval.
+	return Sample();
+}
+#else
+CpuStatSampler::~CpuStatSampler() {}
+
+size_t CpuStatSampler::Read() {
+	return 0;
+}
+
+void CpuStatSampler::ReadTopology() {}
+
+bool CpuStatSampler::Init() {
+	return false;
+}
+#endif
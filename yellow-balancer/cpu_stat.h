@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct CpuTimes {
+	uint64_t busy_;
+	uint64_t total_;
+};
+
+// Parses the "cpu" lines of /proc/stat in place: the summary line into total and line "cpuN" into
+// cpus[N]. CPUs beyond cpus.size() are skipped, so a preallocated vector is never resized.
+// Returns the number of per-CPU lines found.
+size_t ParseProcStat(const char* data, size_t size, CpuTimes& total, std::vector<CpuTimes>& cpus);
+
+// Per-CPU load from /proc/stat with the node, L3 and core views of the sysfs topology. The file stays
+// open and is re-read with pread into a buffer that only grows; all counters and views are sized in
+// Init, so Sample allocates nothing. Loads are in percent of the time between the last two samples.
+class CpuStatSampler {
+public:
+	enum View { Node, L3, Core };
+	CpuStatSampler(std::filesystem::path procfs_root, std::filesystem::path sysfs_root);
+	~CpuStatSampler();
+	CpuStatSampler(const CpuStatSampler&) = delete;
+	CpuStatSampler& operator=(const CpuStatSampler&) = delete;
+	bool Init();
+	bool Sample();
+	size_t Cpus() const { return loads_.size(); }
+	double TotalLoad() const { return total_load_; }
+	const std::vector<double>& CpuLoads() const { return loads_; }
+	// Average load of the given CPUs, the total load for an empty list.
+	double Load(const std::vector<uint32_t>& cpus) const;
+	// Domains of a view are identified by the node number or by the first CPU of the L3 cache or core.
+	const std::vector<uint32_t>& DomainIds(View view) const { return views_[view].ids_; }
+	const std::vector<double>& DomainLoads(View view) const { return views_[view].loads_; }
+	size_t HottestDomain(View view) const;
+private:
+	struct Domains {
+		std::vector<uint32_t> domain_of_cpu_;
+		std::vector<uint32_t> ids_;
+		std::vector<uint32_t> cpus_;
+		std::vector<double> loads_;
+	};
+	static constexpr uint32_t NO_DOMAIN = UINT32_MAX;
+	std::filesystem::path procfs_root_;
+	std::filesystem::path sysfs_root_;
+	int fd_ = -1;
+	std::vector<char> buffer_;
+	CpuTimes total_ = { 0, 0 };
+	CpuTimes previous_total_ = { 0, 0 };
+	std::vector<CpuTimes> times_;
+	std::vector<CpuTimes> previous_times_;
+	std::vector<double> loads_;
+	double total_load_ = 0.0;
+	Domains views_[3];
+	size_t Read();
+	void AddDomain(View view, uint32_t cpu, uint32_t id);
+	void ReadTopology();
+};
@@ -0,0 +1,257 @@
+﻿#include "decision_journal.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include "Logger.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+static const char JOURNAL_MAGIC[8] = { 'Y', 'B', 'J', 'O', 'U', 'R', 'N', 'L' };
+
+#ifdef _WIN32
+
+bool DecisionJournal::Map(const fs::path& path, size_t size, bool& is_new) {
+	file_ = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_ == INVALID_HANDLE_VALUE) {
+		file_ = nullptr;
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't open ", path.wstring(), L". Error ", ::GetLastError());
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	is_new = !GetFileSizeEx(file_, &file_size) || static_cast<size_t>(file_size.QuadPart) != size;
+	LARGE_INTEGER end;
+	end.QuadPart = static_cast<LONGLONG>(size);
+	if (is_new && (!SetFilePointerEx(file_, end, NULL, FILE_BEGIN) || !SetEndOfFile(file_))) {
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't resize ", path.wstring(), L". Error ", ::GetLastError());
+		return false;
+	}
+	mapping_ = CreateFileMappingW(file_, NULL, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), NULL);
+	if (mapping_ == NULL) {
+		mapping_ = nullptr;
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't map ", path.wstring(), L". Error ", ::GetLastError());
+		return false;
+	}
+	void* data = MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, size);
+	if (data == NULL) {
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't map ", path.wstring(), L". Error ", ::GetLastError());
+		return false;
+	}
+	header_ = static_cast<Header*>(data);
+	return true;
+}
+
+void DecisionJournal::Close() {
+	if (header_) {
+		FlushViewOfFile(header_, 0);
+		UnmapViewOfFile(header_);
+	}
+	if (mapping_) CloseHandle(mapping_);
+	if (file_) CloseHandle(file_);
+	mapping_ = nullptr;
+	file_ = nullptr;
+	header_ = nullptr;
+	records_ = nullptr;
+}
+
+#else
+
+bool DecisionJournal::Map(const fs::path& path, size_t size, bool& is_new) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd_ < 0) {
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't open ", path.wstring(), L". ", strerror(errno));
+		return false;
+	}
+	struct stat file_stat;
+	is_new = fstat(fd_, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) != size;
+	if (is_new && ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't resize ", path.wstring(), L". ", strerror(errno));
+		return false;
+	}
+	void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (data == MAP_FAILED) {
+		LOGGER->Print(Logger::Type::Error, false, L"DecisionJournal: can't map ", path.wstring(), L". ", strerror(errno));
+		return false;
+	}
+	header_ = static_cast<Header*>(data);
+	return true;
+}
+
+void DecisionJournal::Close() {
+	if (header_) {
+		msync(header_, mapped_size_, MS_ASYNC);
+		munmap(header_, mapped_size_);
+	}
+	if (fd_ >= 0) close(fd_);
+	fd_ = -1;
+	header_ = nullptr;
+	records_ = nullptr;
+}
+
+#endif
+
+// A file of another capacity or version is started over, an intact one is continued.
+bool DecisionJournal::Open(const fs::path& path, size_t capacity) {
+	Close();
+	if (capacity == 0) return false;
+	mapped_size_ = sizeof(Header) + capacity * sizeof(JournalRecord);
+	bool is_new = false;
+	if (!Map(path, mapped_size_, is_new)) {
+		Close();
+		return false;
+	}
+	if (!is_new) {
+		is_new = memcmp(header_->magic_, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || header_->version_ != VERSION
+			|| header_->record_size_ != sizeof(JournalRecord) || header_->capacity_ != capacity;
+	}
+	if (is_new) {
+		memset(header_, 0, mapped_size_);
+		memcpy(header_->magic_, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+		header_->version_ = VERSION;
+		header_->record_size_ = sizeof(JournalRecord);
+		header_->capacity_ = capacity;
+		header_->next_sequence_ = 1;
+	}
+	records_ = reinterpret_cast<JournalRecord*>(header_ + 1);
+	capacity_ = capacity;
+	return true;
+}
+
+// The slot is cleared first and gets its sequence last, so a record torn by a crash reads as empty.
+void DecisionJournal::Append(JournalRecord& record) {
+	uint64_t sequence = header_->next_sequence_;
+	JournalRecord& slot = records_[(sequence - 1) % capacity_];
+	slot.sequence_ = 0;
+	record.sequence_ = 0;
+	record.time_ = tick_time_;
+	record.tick_ = header_->tick_;
+	slot = record;
+	slot.sequence_ = sequence;
+	header_->next_sequence_ = sequence + 1;
+}
+
+void DecisionJournal::BeginTick(bool is_rebalance, double max_load, double spread) {
+	if (!IsOpen()) return;
+	++header_->tick_;
+	tick_time_ = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+	JournalRecord record = {};
+	record.type_ = Tick;
+	record.node_ = -1;
+	record.target_node_ = -1;
+	record.value_ = max_load;
+	record.load_ = spread;
+	record.result_ = is_rebalance ? 1 : 0;
+	Append(record);
+}
+
+void DecisionJournal::AddNode(int node, double load) {
+	if (!IsOpen()) return;
+	JournalRecord record = {};
+	record.type_ = Node;
+	record.node_ = static_cast<int16_t>(node);
+	record.target_node_ = -1;
+	record.value_ = load;
+	Append(record);
+}
+
+void DecisionJournal::AddCandidate(uint32_t pid, int node, double user_time, double load) {
+	if (!IsOpen()) return;
+	JournalRecord record = {};
+	record.type_ = Candidate;
+	record.pid_ = pid;
+	record.node_ = static_cast<int16_t>(node);
+	record.target_node_ = -1;
+	record.value_ = user_time;
+	record.load_ = load;
+	Append(record);
+}
+
+void DecisionJournal::AddMove(uint32_t pid, int node, int target_node, double load) {
+	if (!IsOpen()) return;
+	JournalRecord record = {};
+	record.type_ = Move;
+	record.pid_ = pid;
+	record.node_ = static_cast<int16_t>(node);
+	record.target_node_ = static_cast<int16_t>(target_node);
+	record.load_ = load;
+	Append(record);
+}
+
+void DecisionJournal::AddAffinity(Type type, uint32_t pid, uint32_t tid, const GroupAffinity& group_affinity, int32_t result) {
+	if (!IsOpen()) return;
+	JournalRecord record = {};
+	record.type_ = type;
+	record.pid_ = pid;
+	record.tid_ = tid;
+	record.node_ = -1;
+	record.target_node_ = -1;
+	record.group_ = group_affinity.group_;
+	record.mask_ = group_affinity.mask_;
+	record.result_ = result;
+	Append(record);
+}
+
+bool DecisionJournal::Read(const fs::path& path, vector<JournalRecord>& records, wstring& error) {
+	records.clear();
+	ifstream in(path, ios::in | ios::binary);
+	if (!in.is_open()) {
+		error = wstring(L"Can't open journal ").append(path.wstring());
+		return false;
+	}
+	Header header;
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic_, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+		error = wstring(L"Not a decision journal: ").append(path.wstring());
+		return false;
+	}
+	if (header.version_ != VERSION || header.record_size_ != sizeof(JournalRecord)) {
+		error = wstring(L"Unsupported journal version ").append(to_wstring(header.version_));
+		return false;
+	}
+	// The file holds the header and the whole ring, a larger capacity is a damaged header.
+	error_code ec;
+	uintmax_t file_size = fs::file_size(path, ec);
+	if (ec || header.capacity_ > (file_size - sizeof(Header)) / sizeof(JournalRecord)) {
+		error = wstring(L"Decision journal is damaged: ").append(path.wstring());
+		return false;
+	}
+	records.resize(static_cast<size_t>(header.capacity_));
+	in.read(reinterpret_cast<char*>(records.data()), static_cast<streamsize>(records.size() * sizeof(JournalRecord)));
+	records.resize(static_cast<size_t>(in.gcount()) / sizeof(JournalRecord));
+	records.erase(remove_if(records.begin(), records.end(), [](const JournalRecord& record) { return record.sequence_ == 0; }), records.end());
+	sort(records.begin(), records.end(), [](const JournalRecord& lhs, const JournalRecord& rhs) { return lhs.sequence_ < rhs.sequence_; });
+	return true;
+}
+
+const char* DecisionJournal::TypeName(uint16_t type) {
+	switch (type)
+	{
+	case Tick:
+		return "tick";
+	case Node:
+		return "node";
+	case Candidate:
+		return "candidate";
+	case Move:
+		return "move";
+	case ProcessAffinity:
+		return "process_affinity";
+	case ThreadAffinity:
+		return "thread_affinity";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "system_probe.h"
+
+// One fixed-size record of the journal. Which fields are used depends on the type:
+// Tick     - value_ the maximum node load, load_ the spread between the nodes, result_ 1 when the tick rebalances;
+// Node     - node_ the node index (-1 for the total), value_ the average load in percent;
+// Candidate - pid_, node_ the current node (-1 unbound), value_ the average USER_TIME, load_ in logical CPUs;
+// Move     - pid_, node_ the current node, target_node_, load_;
+// ProcessAffinity, ThreadAffinity - pid_, tid_, group_, mask_ and result_, 0 or the OS error code of the call.
+struct JournalRecord {
+	uint64_t sequence_;
+	int64_t time_;
+	uint32_t tick_;
+	uint16_t type_;
+	int16_t node_;
+	uint32_t pid_;
+	uint32_t tid_;
+	int16_t target_node_;
+	uint16_t group_;
+	int32_t result_;
+	uint64_t mask_;
+	double value_;
+	double load_;
+};
+
+static_assert(sizeof(JournalRecord) == 64, "journal records must stay 64 bytes");
+
+// Binary journal of the balancing decisions in a memory-mapped ring file of a fixed number of records.
+// A record is a copy into the mapping, so writing costs no system call, and the oldest records are
+// overwritten once the ring is full. The file is reopened in place after a restart and the sequence
+// and tick numbers continue. Time is in milliseconds since the Unix epoch.
+class DecisionJournal {
+public:
+	enum Type : uint16_t { Tick = 1, Node, Candidate, Move, ProcessAffinity, ThreadAffinity };
+	static const size_t RECORDS_PER_MEGABYTE = 1024 * 1024 / sizeof(JournalRecord);
+
+	DecisionJournal() {}
+	DecisionJournal(const DecisionJournal&) = delete;
+	DecisionJournal& operator=(const DecisionJournal&) = delete;
+	~DecisionJournal() { Close(); }
+
+	bool Open(const std::filesystem::path& path, size_t capacity);
+	void Close();
+	bool IsOpen() const { return records_ != nullptr; }
+
+	void BeginTick(bool is_rebalance, double max_load, double spread);
+	void AddNode(int node, double load);
+	void AddCandidate(uint32_t pid, int node, double user_time, double load);
+	void AddMove(uint32_t pid, int node, int target_node, double load);
+	void AddAffinity(Type type, uint32_t pid, uint32_t tid, const GroupAffinity& group_affinity, int32_t result);
+
+	// Records of a journal file ordered by sequence, for the readers of the journal.
+	static bool Read(const std::filesystem::path& path, std::vector<JournalRecord>& records, std::wstring& error);
+	static const char* TypeName(uint16_t type);
+private:
+	struct Header {
+		char magic_[8];
+		uint32_t version_;
+		uint32_t record_size_;
+		uint64_t capacity_;
+		uint64_t next_sequence_;
+		uint32_t tick_;
+		uint8_t reserved_[28];
+	};
+	static const uint32_t VERSION = 1;
+	Header* header_ = nullptr;
+	JournalRecord* records_ = nullptr;
+	size_t capacity_ = 0;
+	size_t mapped_size_ = 0;
+	int64_t tick_time_ = 0;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#else
+	int fd_ = -1;
+#endif
+	bool Map(const std::filesystem::path& path, size_t size, bool& is_new);
+	void Append(JournalRecord& record);
+};
@@ -1,5 +1,7 @@
 ﻿#include "encoding_string.h"
 
+#ifdef _WIN32
+
 std::wstring Utf8ToWideChar(const std::string& str) {
     int count = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), NULL, 0);
     std::wstring wstr(count, 0);
@@ -12,4 +14,68 @@ std::string WideCharToUtf8(const std::wstring& wstr) {
     std::string str(count, 0);
     WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, &str[0], count, NULL, NULL);
     return str;
-}
\ No newline at end of file
+}
+
+void AppendUtf8(std::string& str, std::wstring_view wstr) {
+    if (wstr.empty()) return;
+    int count = WideCharToMultiByte(CP_UTF8, 0, wstr.data(), static_cast<int>(wstr.size()), NULL, 0, NULL, NULL);
+    size_t size = str.size();
+    str.resize(size + count);
+    WideCharToMultiByte(CP_UTF8, 0, wstr.data(), static_cast<int>(wstr.size()), &str[size], count, NULL, NULL);
+}
+
+#else
+
+std::wstring Utf8ToWideChar(const std::string& str) {
+    std::wstring wstr;
+    wstr.reserve(str.size());
+    for (size_t i = 0; i < str.size();) {
+        unsigned char ch = static_cast<unsigned char>(str[i]);
+        size_t length = ch < 0x80 ? 1 : (ch >> 5) == 0x6 ? 2 : (ch >> 4) == 0xE ? 3 : (ch >> 3) == 0x1E ? 4 : 0;
+        if (length == 0 || i + length > str.size()) {
+            wstr.push_back(L'\xFFFD');
+            ++i;
+            continue;
+        }
+        char32_t code_point = length == 1 ? ch : ch & (0xFF >> (length + 1));
+        for (size_t j = 1; j < length; ++j) {
+            code_point = (code_point << 6) | (static_cast<unsigned char>(str[i + j]) & 0x3F);
+        }
+        wstr.push_back(static_cast<wchar_t>(code_point));
+        i += length;
+    }
+    return wstr;
+}
+
+std::string WideCharToUtf8(const std::wstring& wstr) {
+    std::string str;
+    str.reserve(wstr.size());
+    AppendUtf8(str, wstr);
+    return str;
+}
+
+void AppendUtf8(std::string& str, std::wstring_view wstr) {
+    for (wchar_t wch : wstr) {
+        char32_t code_point = static_cast<char32_t>(wch);
+        if (code_point < 0x80) {
+            str.push_back(static_cast<char>(code_point));
+        }
+        else if (code_point < 0x800) {
+            str.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+            str.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+        else if (code_point < 0x10000) {
+            str.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+            str.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+        else {
+            str.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+            str.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+    }
+}
+
+#endif
\ No newline at end of file
@@ -1,7 +1,12 @@
 ﻿#pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <string>
+#include <string_view>
 
 std::wstring Utf8ToWideChar(const std::string& str);
-std::string WideCharToUtf8(const std::wstring& wstr);
\ No newline at end of file
+std::string WideCharToUtf8(const std::wstring& wstr);
+// Appends the UTF-8 form of wstr to str, which allocates only when str has to grow.
+void AppendUtf8(std::string& str, std::wstring_view wstr);
\ No newline at end of file
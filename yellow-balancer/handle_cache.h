@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+
+// Cache of OS handles keyed by (id, create_time). The probe stamps every process or thread it sees
+// during a scan and Sweep closes the handles of everything that was not seen, in step with the
+// process table. A handle is opened lazily on first use and kept until its owner exits or its id
+// is reused by an object with another create time. Get on an id that was not stamped yet leaves the
+// create time unknown, and the next Stamp adopts it. Failed opens are retried only after a few scans
+// so that inaccessible objects do not cause an open attempt on every tick.
+// Traits must provide: static Handle Invalid(); static bool IsValid(const Handle&); static void Close(Handle&).
+template <class Handle, class Traits>
+class HandleCache {
+public:
+	HandleCache() {}
+	HandleCache(const HandleCache&) = delete;
+	HandleCache& operator=(const HandleCache&) = delete;
+	~HandleCache() { Clear(); }
+
+	void BeginScan() { ++generation_; }
+	bool Stamp(uint32_t id, int64_t create_time);
+	template <class Open>
+	Handle Get(uint32_t id, Open open);
+	bool Contains(uint32_t id) const { return entries_.find(id) != entries_.end(); }
+	void Reset(uint32_t id);
+	void Sweep();
+	void Clear();
+	size_t Size() const { return entries_.size(); }
+	size_t Opened() const { return opened_; }
+	size_t Closed() const { return closed_; }
+	size_t Live() const { return opened_ - closed_; }
+private:
+	struct Entry {
+		int64_t create_time_;
+		Handle handle_;
+		uint64_t generation_;
+		uint64_t open_generation_;
+		bool is_opened_;
+	};
+	static const uint64_t RETRY_GENERATIONS = 16;
+	static const int64_t UNKNOWN_CREATE_TIME = std::numeric_limits<int64_t>::min();
+	std::unordered_map<uint32_t, Entry> entries_;
+	uint64_t generation_ = 0;
+	size_t opened_ = 0;
+	size_t closed_ = 0;
+	void Close(Entry& entry);
+};
+
+template <class Handle, class Traits>
+void HandleCache<Handle, Traits>::Close(Entry& entry) {
+	if (Traits::IsValid(entry.handle_)) {
+		Traits::Close(entry.handle_);
+		++closed_;
+	}
+	entry.handle_ = Traits::Invalid();
+	entry.is_opened_ = false;
+}
+
+// Returns false when the id is new or now belongs to another object, i.e. when there is no usable cached handle.
+template <class Handle, class Traits>
+bool HandleCache<Handle, Traits>::Stamp(uint32_t id, int64_t create_time) {
+	auto it = entries_.find(id);
+	if (it == entries_.end()) {
+		entries_.insert({ id, { create_time, Traits::Invalid(), generation_, 0, false } });
+		return false;
+	}
+	Entry& entry = it->second;
+	entry.generation_ = generation_;
+	if (entry.create_time_ == UNKNOWN_CREATE_TIME) {
+		entry.create_time_ = create_time;
+	}
+	else if (entry.create_time_ != create_time) {
+		Close(entry);
+		entry.create_time_ = create_time;
+		return false;
+	}
+	if (entry.is_opened_ && !Traits::IsValid(entry.handle_) && generation_ - entry.open_generation_ >= RETRY_GENERATIONS) {
+		entry.is_opened_ = false;
+	}
+	return true;
+}
+
+template <class Handle, class Traits>
+template <class Open>
+Handle HandleCache<Handle, Traits>::Get(uint32_t id, Open open) {
+	auto it = entries_.find(id);
+	if (it == entries_.end()) {
+		it = entries_.insert({ id, { UNKNOWN_CREATE_TIME, Traits::Invalid(), generation_, 0, false } }).first;
+	}
+	Entry& entry = it->second;
+	if (!entry.is_opened_) {
+		entry.handle_ = open(id);
+		entry.is_opened_ = true;
+		entry.open_generation_ = generation_;
+		if (Traits::IsValid(entry.handle_)) ++opened_;
+	}
+	return entry.handle_;
+}
+
+template <class Handle, class Traits>
+void HandleCache<Handle, Traits>::Reset(uint32_t id) {
+	auto it = entries_.find(id);
+	if (it != entries_.end()) {
+		Close(it->second);
+		it->second.create_time_ = UNKNOWN_CREATE_TIME;
+	}
+}
+
+template <class Handle, class Traits>
+void HandleCache<Handle, Traits>::Sweep() {
+	for (auto it = entries_.begin(); it != entries_.end();) {
+		if (it->second.generation_ != generation_) {
+			Close(it->second);
+			it = entries_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+template <class Handle, class Traits>
+void HandleCache<Handle, Traits>::Clear() {
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		Close(it->second);
+	}
+	entries_.clear();
+}
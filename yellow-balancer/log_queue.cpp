@@ -0,0 +1,17 @@
+﻿#include "log_queue.h"
+
+using namespace std;
+
+// The capacity is rounded up to a power of two.
+LogQueue::LogQueue(size_t capacity) :
+    mask_(0),
+    enqueue_position_(0),
+    dequeue_position_(0) {
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+    slots_.reset(new Slot[size]);
+    for (size_t i = 0; i < size; ++i) {
+        slots_[i].sequence_.store(i, memory_order_relaxed);
+    }
+    mask_ = size - 1;
+}
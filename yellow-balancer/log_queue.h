@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct LogEntry {
+    std::chrono::system_clock::time_point time_;
+    int type_;
+    std::string text_;
+};
+
+// Bounded multi-producer single-consumer queue of log lines (D. Vyukov's bounded queue). Push never
+// waits: a full queue rejects the line and the caller counts it as dropped. The strings of the slots
+// are reused, so once they have grown to the usual line length a push does not allocate.
+class LogQueue {
+public:
+    explicit LogQueue(size_t capacity);
+    LogQueue(const LogQueue&) = delete;
+    LogQueue& operator=(const LogQueue&) = delete;
+    template <class Fill>
+    bool Push(Fill fill);
+    template <class Consume>
+    bool Pop(Consume consume);
+    uint64_t Pushed() const { return enqueue_position_.load(std::memory_order_acquire); }
+    uint64_t Popped() const { return dequeue_position_.load(std::memory_order_acquire); }
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence_;
+        LogEntry entry_;
+    };
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    alignas(64) std::atomic<uint64_t> enqueue_position_;
+    alignas(64) std::atomic<uint64_t> dequeue_position_;
+};
+
+// fill(LogEntry&) writes the line into the claimed slot.
+template <class Fill>
+bool LogQueue::Push(Fill fill) {
+    uint64_t position = enqueue_position_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &slots_[position & mask_];
+        uint64_t sequence = slot->sequence_.load(std::memory_order_acquire);
+        int64_t difference = static_cast<int64_t>(sequence - position);
+        if (difference == 0) {
+            if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        }
+        else if (difference < 0) {
+            return false;
+        }
+        else {
+            position = enqueue_position_.load(std::memory_order_relaxed);
+        }
+    }
+    fill(slot->entry_);
+    slot->sequence_.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+// Only the writer thread pops; consume(const LogEntry&) reads the line before the slot is released.
+template <class Consume>
+bool LogQueue::Pop(Consume consume) {
+    uint64_t position = dequeue_position_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[position & mask_];
+    if (slot.sequence_.load(std::memory_order_acquire) != position + 1) return false;
+    consume(slot.entry_);
+    slot.sequence_.store(position + mask_ + 1, std::memory_order_release);
+    dequeue_position_.store(position + 1, std::memory_order_release);
+    return true;
+}
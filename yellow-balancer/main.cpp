@@ -1,12 +1,19 @@
 ﻿#include <iostream>
 #include <thread>
 #include <time.h>
+#ifdef _WIN32
 #include <io.h>
 #include <fcntl.h>
+#else
+#include <atomic>
+#include <clocale>
+#include <csignal>
+#endif
 #include "ProcessInfo.h"
 #include "Logger.h"
 #include "program_options.h"
 #include "settings.h"
+#include "settings_watcher.h"
 
 using time_point = std::chrono::time_point<std::chrono::system_clock>;
 
@@ -15,6 +22,63 @@ static auto LOGGER = Logger::getInstance();
 static std::filesystem::path PROGRAM_PATH;
 static std::filesystem::path FILE_PATH;
 
+static const std::wstring VERSION = L"1.4";
+
+void RunConsole();
+void Testing();
+
+void SetLoggerLevel(Logger* logger, const std::wstring& level) {
+    if (level == L"trace") logger->SetLogType(Logger::Trace);
+    else if (level == L"info") logger->SetLogType(Logger::Info);
+    else if (level == L"error") logger->SetLogType(Logger::Error);
+}
+
+// The settings that a running balancer takes at the start and on every reload of settings.json.
+void Configure(ProcessesInfo& processes_info, Settings& settings) {
+    processes_info.SetMigrationCost(settings.MigrationCost());
+    processes_info.SetRemoteMemoryPenalty(settings.RemoteMemoryPenalty());
+    processes_info.SetMemoryMigration(settings.MemoryMigration());
+    processes_info.SetHysteresis(settings.MinimumDwellTime(), settings.MaximumMovesPerTick(), settings.MoveDamping());
+    processes_info.SetThreadBalancing(settings.IsThreadBalancing());
+    processes_info.SetFilter(settings.Processes());
+    processes_info.SetSpawnPlacement(settings.IsSpawnPlacement());
+    processes_info.SetFastWarmUp(settings.IsFastWarmUp());
+}
+
+// Applies a changed settings.json between two ticks. The file is read whole first, a file that can't be
+// read or has invalid values changes nothing and the balancer goes on with the previous settings.
+void Reload(ProcessesInfo& processes_info, Settings& settings, int& switching_frequency) {
+    if (!std::filesystem::exists(PROGRAM_PATH / L"settings.json")) return;
+    Settings reloaded;
+    if (!reloaded.Read(PROGRAM_PATH) || reloaded.SwitchingFrequency() <= 0 || reloaded.CpuAnalysisPeriod() < reloaded.SwitchingFrequency()) {
+        LOGGER->Print(L"settings.json is not applied, the previous settings are kept", Logger::Type::Error, true);
+        return;
+    }
+    if (reloaded.SampleInterval() != settings.SampleInterval() || reloaded.JournalSize() != settings.JournalSize()
+        || reloaded.StateSavePeriod() != settings.StateSavePeriod() || reloaded.StateMaxAge() != settings.StateMaxAge()) {
+        LOGGER->Print(L"sample_interval_in_milliseconds, journal_size_in_megabytes, state_save_period_in_seconds and state_max_age_in_seconds take effect after a restart", Logger::Type::Info, true);
+    }
+    LOGGER->SetLogStorageDuration(reloaded.LogStorageDuration());
+    processes_info.Reconfigure(reloaded.CpuAnalysisPeriod(), reloaded.SwitchingFrequency(), reloaded.MaximumCpuValue(), reloaded.DeltaCpuValues());
+    Configure(processes_info, reloaded);
+    if (reloaded.MetricsPort() != settings.MetricsPort()) {
+        processes_info.StartMetricsServer(reloaded.MetricsPort());
+    }
+    if (reloaded.ProfileLogPeriod() != settings.ProfileLogPeriod()) {
+        processes_info.SetProfileLogPeriod(reloaded.ProfileLogPeriod() * 60);
+    }
+    switching_frequency = reloaded.SwitchingFrequency();
+    settings = reloaded;
+    LOGGER->Print(Logger::Type::Info, true,
+        L"Settings are reloaded;switching frequency=", switching_frequency,
+        L";cpu analysis period=", settings.CpuAnalysisPeriod(),
+        L";maximum cpu value=", settings.MaximumCpuValue(),
+        L";delta cpu values=", settings.DeltaCpuValues(),
+        L";processes=", settings.Processes().size());
+}
+
+#ifdef _WIN32
+
 SERVICE_STATUS g_ServiceStatus = { 0 };
 SERVICE_STATUS_HANDLE g_StatusHandle = NULL;
 HANDLE g_ServiceStopEvent = INVALID_HANDLE_VALUE;
@@ -25,10 +89,7 @@ VOID WINAPI ServiceCtrlHandler(DWORD);
 DWORD WINAPI WorkerThread(LPVOID lpParam);
 
 wchar_t SERVICE_NAME[100] = L"Yellow Balancer Service";
-static const std::wstring VERSION = L"1.4";
 
-void RunConsole();
-void Testing();
 int InstallService(LPCWSTR serviceName, LPCWSTR servicePath);
 int RemoveService(LPCWSTR serviceName);
 
@@ -84,12 +145,6 @@ void GetPath() {
     PROGRAM_PATH = FILE_PATH.parent_path();
 }
 
-void SetLoggerLevel(Logger* logger, const std::wstring& level) {
-    if (level == L"trace") logger->SetLogType(Logger::Trace);
-    else if (level == L"info") logger->SetLogType(Logger::Info);
-    else if (level == L"error") logger->SetLogType(Logger::Error);
-}
-
 BOOL WINAPI HandlerRoutine(DWORD dwCtrlType) {
     if (!g_ServiceStopEvent) return false;
     switch (dwCtrlType) {
@@ -199,6 +254,7 @@ void Testing() {
 
     Settings settings;
     if (!settings.Read(PROGRAM_PATH)) {
+        LOGGER->Flush();
         ExitProcess(1);
     }
     LOGGER->SetLogStorageDuration(settings.LogStorageDuration());
@@ -215,6 +271,7 @@ void Testing() {
     std::this_thread::sleep_for(std::chrono::milliseconds(3100));
     p_processes_info->Read();
     p_processes_info->SetAffinity();
+    p_processes_info->LogProfile();
 }
 
 void RunConsole() {
@@ -332,6 +389,7 @@ DWORD WINAPI WorkerThread(LPVOID lpParam) {
     LOGGER->Print("Yellow Watcher: WorkerThread: Entry", Logger::Type::Trace);
     Settings settings;
     if (!settings.Read(PROGRAM_PATH)) {
+        LOGGER->Flush();
         ExitProcess(1);
     }
     LOGGER->SetLogStorageDuration(settings.LogStorageDuration());
@@ -339,10 +397,15 @@ DWORD WINAPI WorkerThread(LPVOID lpParam) {
 
     {
         std::shared_ptr<ProcessesInfo> p_processes_info = std::make_shared<ProcessesInfo>();
+        p_processes_info->SetSampleInterval(settings.SampleInterval());
         p_processes_info->Init(settings.CpuAnalysisPeriod(), switching_frequency, settings.MaximumCpuValue(), settings.DeltaCpuValues());
-        for (auto it = settings.Processes().begin(); it < settings.Processes().end(); ++it) {
-            p_processes_info->AddFilter(*it);
-        }
+        Configure(*p_processes_info, settings);
+        p_processes_info->OpenJournal(PROGRAM_PATH / L"logs" / L"journal.ybj", settings.JournalSize());
+        p_processes_info->OpenState(PROGRAM_PATH / L"logs" / L"state.ybs", settings.StateSavePeriod(), settings.StateMaxAge());
+        p_processes_info->StartMetricsServer(settings.MetricsPort());
+        p_processes_info->SetProfileLogPeriod(settings.ProfileLogPeriod() * 60);
+        SettingsWatcher settings_watcher;
+        settings_watcher.Start(PROGRAM_PATH / L"settings.json");
 
         time_point last_run = {};
         time_point cur_run = std::chrono::system_clock::now();
@@ -353,6 +416,9 @@ DWORD WINAPI WorkerThread(LPVOID lpParam) {
             if (g_ServiceStopEvent == INVALID_HANDLE_VALUE || res != WAIT_TIMEOUT) {
                 break;
             }
+            if (settings_watcher.IsChanged()) {
+                Reload(*p_processes_info, settings, switching_frequency);
+            }
             std::int64_t period = std::chrono::duration_cast<std::chrono::seconds>(cur_run - last_run).count();
             if (period >= switching_frequency) {
                 LOGGER->NewFileWithLock();
@@ -363,6 +429,7 @@ DWORD WINAPI WorkerThread(LPVOID lpParam) {
             cur_run = std::chrono::system_clock::now();
             std::this_thread::sleep_for(std::chrono::milliseconds(500));
         }
+        p_processes_info->LogProfile();
     }
 
     LOGGER->Print(L"Yellow Balancer: WorkerThread: Exit", Logger::Type::Trace);
@@ -458,4 +525,152 @@ VOID WINAPI ServiceCtrlHandler(DWORD CtrlCode) {
     default:
         break;
     }
-}
\ No newline at end of file
+}
+
+#else
+
+static std::atomic<bool> g_StopRequested(false);
+
+void SignalHandler(int) {
+    g_StopRequested = true;
+}
+
+void GetPath() {
+    std::error_code ec;
+    FILE_PATH = std::filesystem::read_symlink("/proc/self/exe", ec);
+    PROGRAM_PATH = FILE_PATH.parent_path();
+}
+
+void RunWorker();
+
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, "");
+
+    std::vector<std::wstring> args;
+    for (int i = 0; i < argc; ++i) {
+        args.push_back(Utf8ToWideChar(argv[i]));
+    }
+    std::vector<wchar_t*> wargv;
+    for (auto it = args.begin(); it != args.end(); ++it) {
+        wargv.push_back(&(*it)[0]);
+    }
+
+    ProgrammOptions program_options(argc, &wargv[0]);
+    GetPath();
+    LOGGER->Open(PROGRAM_PATH);
+    SetLoggerLevel(LOGGER, program_options.LogLevel());
+
+    if (program_options.IsHelp() || argc == 1) {
+        std::wcout << program_options.Help();
+        return 0;
+    }
+
+    if (program_options.IsVersion()) {
+        std::wcout << L"Yellow Balanser v" << VERSION;
+        return 0;
+    }
+
+    signal(SIGINT, SignalHandler);
+    signal(SIGTERM, SignalHandler);
+
+    std::wstring mode = program_options.Mode();
+    if (mode == L"test") {
+        LOGGER->SetOutConsole(true);
+        Testing();
+    }
+    else if (mode == L"console") {
+        LOGGER->SetOutConsole(true);
+        RunConsole();
+    }
+    else if (mode == L"service") {
+        LOGGER->Print(L"Yellow Balancer: run service mode", true);
+        LOGGER->Print(std::wstring(L"Version: ").append(VERSION), true);
+        RunWorker();
+        LOGGER->Print(L"Yellow Balancer: stop service", true);
+    }
+    else if (mode == L"install" || mode == L"uninstall") {
+        LOGGER->SetOutConsole(true);
+        LOGGER->Print(L"Service installation is not supported on Linux. Run '-M service' from a systemd unit.", Logger::Type::Error, true);
+        return -1;
+    }
+    return 0;
+}
+
+void Testing() {
+    LOGGER->Print(L"Yellow Balancer: start testing permissions", true);
+    LOGGER->Print(std::wstring(L"Version: ").append(VERSION), true);
+
+    Settings settings;
+    if (!settings.Read(PROGRAM_PATH)) {
+        exit(1);
+    }
+    LOGGER->SetLogStorageDuration(settings.LogStorageDuration());
+
+    std::shared_ptr<ProcessesInfo> p_processes_info = std::make_shared<ProcessesInfo>();
+    p_processes_info->SetTest();
+    p_processes_info->Init(3, 10, 0, -1);
+    for (auto it = settings.Processes().begin(); it < settings.Processes().end(); ++it) {
+        p_processes_info->AddFilter(*it);
+    }
+
+    LOGGER->NewFileWithLock();
+    LOGGER->Print(L"Collection of information...", true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(3100));
+    p_processes_info->Read();
+    p_processes_info->SetAffinity();
+    p_processes_info->LogProfile();
+}
+
+void RunConsole() {
+    LOGGER->Print(L"Yellow Balancer: run console mode", true);
+    LOGGER->Print(std::wstring(L"Version: ").append(VERSION), true);
+    std::wcout << L"Press Ctrl+C for exit\n";
+    RunWorker();
+    LOGGER->Print(L"Yellow Balancer: stop console mode", true);
+}
+
+void RunWorker() {
+    LOGGER->Print("Yellow Balancer: RunWorker: Entry", Logger::Type::Trace);
+    Settings settings;
+    if (!settings.Read(PROGRAM_PATH)) {
+        exit(1);
+    }
+    LOGGER->SetLogStorageDuration(settings.LogStorageDuration());
+    int switching_frequency = settings.SwitchingFrequency();
+
+    {
+        std::shared_ptr<ProcessesInfo> p_processes_info = std::make_shared<ProcessesInfo>();
+        p_processes_info->SetSampleInterval(settings.SampleInterval());
+        p_processes_info->Init(settings.CpuAnalysisPeriod(), switching_frequency, settings.MaximumCpuValue(), settings.DeltaCpuValues());
+        Configure(*p_processes_info, settings);
+        p_processes_info->OpenJournal(PROGRAM_PATH / L"logs" / L"journal.ybj", settings.JournalSize());
+        p_processes_info->OpenState(PROGRAM_PATH / L"logs" / L"state.ybs", settings.StateSavePeriod(), settings.StateMaxAge());
+        p_processes_info->StartMetricsServer(settings.MetricsPort());
+        p_processes_info->SetProfileLogPeriod(settings.ProfileLogPeriod() * 60);
+        SettingsWatcher settings_watcher;
+        settings_watcher.Start(PROGRAM_PATH / L"settings.json");
+
+        time_point last_run = {};
+        time_point cur_run = std::chrono::system_clock::now();
+
+        while (!g_StopRequested) {
+            if (settings_watcher.IsChanged()) {
+                Reload(*p_processes_info, settings, switching_frequency);
+            }
+            std::int64_t period = std::chrono::duration_cast<std::chrono::seconds>(cur_run - last_run).count();
+            if (period >= switching_frequency) {
+                LOGGER->NewFileWithLock();
+                p_processes_info->Read();
+                p_processes_info->SetAffinity();
+                last_run = cur_run;
+            }
+            cur_run = std::chrono::system_clock::now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+        p_processes_info->LogProfile();
+    }
+
+    LOGGER->Print(L"Yellow Balancer: RunWorker: Exit", Logger::Type::Trace);
+}
+
+#endif
@@ -0,0 +1,60 @@
+﻿#include "memory_locality.h"
+#include <algorithm>
+
+using namespace std;
+
+void MemoryLocality::SetNodes(const vector<NumaNode>& numa_nodes) {
+	node_numbers_.clear();
+	for (auto it = numa_nodes.begin(); it != numa_nodes.end(); ++it) {
+		node_numbers_.push_back(it->node_number_);
+	}
+	entries_.clear();
+}
+
+size_t MemoryLocality::Sample(SystemProbe& probe, const ProcessTable::Map& processes, size_t max_samples) {
+	++tick_;
+	for (auto it = entries_.begin(); it != entries_.end();) {
+		auto it_process = processes.find(it->first);
+		if (it_process == processes.end() || it_process->second.create_time_ != it->second.create_time_) it = entries_.erase(it);
+		else ++it;
+	}
+	if (node_numbers_.empty() || max_samples == 0) return 0;
+
+	candidates_.clear();
+	for (auto it = processes.begin(); it != processes.end(); ++it) {
+		auto it_entry = entries_.find(it->first);
+		candidates_.push_back({ it_entry == entries_.end() ? 0 : it_entry->second.sampled_, it->first });
+	}
+	if (candidates_.size() > max_samples) {
+		nth_element(candidates_.begin(), candidates_.begin() + max_samples, candidates_.end());
+		candidates_.resize(max_samples);
+	}
+
+	for (auto it = candidates_.begin(); it != candidates_.end(); ++it) {
+		const ProcessInfo& process = processes.find(it->second)->second;
+		Entry& entry = entries_[process.pid_];
+		entry.create_time_ = process.create_time_;
+		entry.sampled_ = tick_;
+		entry.total_ = 0;
+		entry.node_bytes_.assign(node_numbers_.size(), 0);
+		// A process that can't be read stays unknown until its next turn.
+		if (!probe.ProcessNodeMemory(process.pid_, bytes_buffer_)) continue;
+		for (auto it_bytes = bytes_buffer_.begin(); it_bytes != bytes_buffer_.end(); ++it_bytes) {
+			entry.total_ += *it_bytes;
+		}
+		for (size_t i = 0; i < node_numbers_.size(); ++i) {
+			if (node_numbers_[i] < bytes_buffer_.size()) entry.node_bytes_[i] = bytes_buffer_[node_numbers_[i]];
+		}
+	}
+	return candidates_.size();
+}
+
+bool MemoryLocality::AppendRemoteShares(const ProcessInfo& process, vector<double>& shares) const {
+	auto it = entries_.find(process.pid_);
+	if (it == entries_.end() || it->second.create_time_ != process.create_time_ || it->second.total_ == 0) return false;
+	const Entry& entry = it->second;
+	for (size_t i = 0; i < entry.node_bytes_.size(); ++i) {
+		shares.push_back(1.0 - static_cast<double>(entry.node_bytes_[i]) / static_cast<double>(entry.total_));
+	}
+	return true;
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "process_table.h"
+#include "system_probe.h"
+
+// Resident memory of the tracked processes by NUMA node. Reading it is expensive (numa_maps walks the
+// page tables of the process), so a tick samples only a few processes, those never sampled or sampled
+// the longest ago first, and the planner works with the last known shares.
+class MemoryLocality {
+public:
+	void SetNodes(const std::vector<NumaNode>& numa_nodes);
+	// Forgets the processes that are gone and samples up to max_samples of the others; returns the number sampled.
+	size_t Sample(SystemProbe& probe, const ProcessTable::Map& processes, size_t max_samples);
+	// Appends the share of the resident memory of the process outside every node; false when it is not known.
+	bool AppendRemoteShares(const ProcessInfo& process, std::vector<double>& shares) const;
+private:
+	struct Entry {
+		int64_t create_time_;
+		uint64_t sampled_;
+		uint64_t total_;
+		// By the index of the node in NumaNodes(); the groups of one node share its bytes.
+		std::vector<uint64_t> node_bytes_;
+	};
+	std::vector<uint32_t> node_numbers_;
+	std::unordered_map<uint32_t, Entry> entries_;
+	uint64_t tick_ = 0;
+	std::vector<uint64_t> bytes_buffer_;
+	std::vector<std::pair<uint64_t, uint32_t>> candidates_;
+};
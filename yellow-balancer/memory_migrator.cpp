@@ -0,0 +1,126 @@
+﻿#include "memory_migrator.h"
+#include <algorithm>
+#include "Logger.h"
+
+using namespace std;
+
+static auto LOGGER = Logger::getInstance();
+
+static const chrono::milliseconds STEP_PERIOD(100);
+// One move_pages call covers at most this range.
+static const uint64_t CHUNK_BYTES = 2 * 1024 * 1024;
+// Address ranges without pages to move cost syscalls too, a step scans at most this many times its budget.
+static const uint64_t SCAN_FACTOR = 16;
+
+void MemoryMigrator::Start() {
+	if (thread_.joinable()) return;
+	is_stop_ = false;
+	thread_ = thread(&MemoryMigrator::Run, this);
+}
+
+void MemoryMigrator::Stop() {
+	is_stop_ = true;
+	if (thread_.joinable()) thread_.join();
+}
+
+void MemoryMigrator::Run() {
+	auto deadline = chrono::steady_clock::now();
+	while (!is_stop_) {
+		deadline += STEP_PERIOD;
+		this_thread::sleep_until(deadline);
+		Step(chrono::duration<double>(STEP_PERIOD).count());
+	}
+}
+
+void MemoryMigrator::Submit(uint32_t pid, uint32_t node_number) {
+	if (bandwidth_ == 0) return;
+	Cancel(pid);
+	lock_guard<mutex> guard(access_);
+	jobs_.push_back({ next_id_++, pid, node_number, false, 0, 0, 0, chrono::steady_clock::now(), {} });
+}
+
+void MemoryMigrator::Cancel(uint32_t pid) {
+	lock_guard<mutex> guard(access_);
+	for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+		if (it->pid_ != pid) continue;
+		LOGGER->Print(Logger::Type::Info, true,
+			L"Memory migration cancelled;pid=", pid, L";new numa=", it->node_number_, L";moved bytes=", it->migrated_bytes_);
+		metrics_.AddMemoryMigration(BalancerMetrics::MigrationCancelled);
+		jobs_.erase(it);
+		return;
+	}
+}
+
+size_t MemoryMigrator::Active() const {
+	lock_guard<mutex> guard(access_);
+	return jobs_.size();
+}
+
+// Drops the first job.
+void MemoryMigrator::Finish(BalancerMetrics::MemoryMigration result) {
+	const Job& job = jobs_.front();
+	if (result == BalancerMetrics::MigrationCompleted) {
+		LOGGER->Print(Logger::Type::Info, true,
+			L"Memory migrated;pid=", job.pid_, L";new numa=", job.node_number_, L";moved bytes=", job.migrated_bytes_,
+			L";seconds=", chrono::duration<double>(chrono::steady_clock::now() - job.submitted_).count());
+	}
+	metrics_.AddMemoryMigration(result);
+	jobs_.pop_front();
+}
+
+// The lock is dropped around the syscalls, so Submit and Cancel of the worker never wait for them. Only
+// the first job is worked on and new jobs go to the back, so a job that is still first after a syscall
+// was not cancelled meanwhile.
+void MemoryMigrator::Step(double seconds) {
+	uint64_t budget = static_cast<uint64_t>(static_cast<double>(bandwidth_) * seconds);
+	unique_lock<mutex> lock(access_);
+	if (budget == 0 || jobs_.empty()) return;
+	uint64_t scan_budget = budget * SCAN_FACTOR;
+	uint64_t migrated = 0;
+	uint64_t scanned = 0;
+	vector<MemoryRegion> regions;
+	while (!jobs_.empty() && migrated < budget && scanned < scan_budget) {
+		Job* job = &jobs_.front();
+		uint64_t id = job->id_;
+		uint32_t pid = job->pid_;
+		if (!job->is_started_) {
+			lock.unlock();
+			bool is_read = probe_.ProcessMemoryRegions(pid, regions);
+			lock.lock();
+			if (!IsFront(id)) continue;
+			job = &jobs_.front();
+			job->is_started_ = true;
+			if (!is_read) {
+				Finish(BalancerMetrics::MigrationFailed);
+				continue;
+			}
+			job->regions_.swap(regions);
+			if (!job->regions_.empty()) job->address_ = job->regions_[0].begin_;
+		}
+		if (job->region_ >= job->regions_.size()) {
+			Finish(BalancerMetrics::MigrationCompleted);
+			continue;
+		}
+
+		uint64_t begin = job->address_;
+		uint64_t end = min(job->regions_[job->region_].end_, begin + min(CHUNK_BYTES, scan_budget - scanned));
+		uint32_t node_number = job->node_number_;
+		uint64_t moved = 0;
+		lock.unlock();
+		bool is_moved = probe_.MovePages(pid, begin, end, node_number, moved);
+		lock.lock();
+		scanned += end - begin;
+		migrated += moved;
+		if (!IsFront(id)) continue;
+		job = &jobs_.front();
+		if (!is_moved) {
+			Finish(BalancerMetrics::MigrationFailed);
+			continue;
+		}
+		job->migrated_bytes_ += moved;
+		job->address_ = end;
+		if (end >= job->regions_[job->region_].end_ && ++job->region_ < job->regions_.size()) job->address_ = job->regions_[job->region_].begin_;
+	}
+	migrated_bytes_.fetch_add(migrated, memory_order_relaxed);
+	metrics_.AddMigratedMemory(migrated, jobs_.size());
+}
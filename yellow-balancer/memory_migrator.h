@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+#include "system_probe.h"
+
+// Moves the pages of a process after the process was moved to another node, in chunks within a
+// bandwidth budget, so that its memory follows it in seconds without taking the memory bandwidth of
+// the nodes. The jobs go one after another, the oldest first; a process moved again before its pages
+// arrived gets a new job and the old one is cancelled.
+class MemoryMigrator {
+public:
+	MemoryMigrator(SystemProbe& probe, BalancerMetrics& metrics) : probe_(probe), metrics_(metrics) {}
+	MemoryMigrator(const MemoryMigrator&) = delete;
+	MemoryMigrator& operator=(const MemoryMigrator&) = delete;
+	~MemoryMigrator() { Stop(); }
+	void SetBandwidth(uint64_t bytes_per_second) { bandwidth_ = bytes_per_second; }
+	uint64_t Bandwidth() const { return bandwidth_; }
+	// Runs Step on a thread of its own; without it the owner calls Step itself.
+	void Start();
+	void Stop();
+	void Submit(uint32_t pid, uint32_t node_number);
+	void Cancel(uint32_t pid);
+	// Moves up to bandwidth * seconds bytes.
+	void Step(double seconds);
+	size_t Active() const;
+	uint64_t MigratedBytes() const { return migrated_bytes_.load(std::memory_order_relaxed); }
+private:
+	struct Job {
+		uint64_t id_;
+		uint32_t pid_;
+		uint32_t node_number_;
+		bool is_started_;
+		size_t region_;
+		uint64_t address_;
+		uint64_t migrated_bytes_;
+		std::chrono::steady_clock::time_point submitted_;
+		std::vector<MemoryRegion> regions_;
+	};
+	SystemProbe& probe_;
+	BalancerMetrics& metrics_;
+	mutable std::mutex access_;
+	std::deque<Job> jobs_;
+	uint64_t next_id_ = 0;
+	std::atomic<uint64_t> bandwidth_{ 0 };
+	std::atomic<uint64_t> migrated_bytes_{ 0 };
+	std::thread thread_;
+	std::atomic<bool> is_stop_{ false };
+	void Run();
+	void Finish(BalancerMetrics::MemoryMigration result);
+	bool IsFront(uint64_t id) const { return !jobs_.empty() && jobs_.front().id_ == id; }
+};
@@ -0,0 +1,211 @@
+﻿#include "metrics.h"
+#include "Logger.h"
+
+using namespace std;
+
+static const vector<double> DURATION_BOUNDS = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5 };
+
+Histogram::Histogram(const vector<double>& bounds) :
+	bounds_(bounds),
+	counts_(bounds.size() + 1, 0) {
+}
+
+void Histogram::Observe(double value) {
+	size_t i = 0;
+	while (i < bounds_.size() && value > bounds_[i]) ++i;
+	++counts_[i];
+	sum_ += value;
+	++count_;
+}
+
+void Histogram::Write(string& out, const char* name) const {
+	out.append("# TYPE ").append(name).append(" histogram\n");
+	uint64_t cumulative = 0;
+	for (size_t i = 0; i < counts_.size(); ++i) {
+		cumulative += counts_[i];
+		out.append(name).append("_bucket{le=\"");
+		if (i < bounds_.size()) appendLog(out, bounds_[i]);
+		else out.append("+Inf");
+		out.append("\"} ");
+		appendLog(out, cumulative);
+		out.push_back('\n');
+	}
+	out.append(name).append("_sum ");
+	appendLog(out, sum_);
+	out.append("\n").append(name).append("_count ");
+	appendLog(out, count_);
+	out.push_back('\n');
+}
+
+// Label values may hold any character of a process name, quotes and backslashes are escaped.
+static void appendLabel(string& out, const string& value) {
+	for (char ch : value) {
+		if (ch == '"' || ch == '\\') out.push_back('\\');
+		if (ch == '\n') out.append("\\n");
+		else out.push_back(ch);
+	}
+}
+
+static void appendCounter(string& out, const char* name, const char* help, uint64_t value) {
+	out.append("# TYPE ").append(name).append(" counter\n# HELP ").append(name).push_back(' ');
+	out.append(help).append("\n").append(name).append("_total ");
+	appendLog(out, value);
+	out.push_back('\n');
+}
+
+BalancerMetrics::BalancerMetrics() :
+	tick_duration_(DURATION_BOUNDS),
+	scan_duration_(DURATION_BOUNDS),
+	spawn_placement_duration_(DURATION_BOUNDS) {
+}
+
+void BalancerMetrics::SetCounters(const vector<wstring>& names, const vector<double>& values) {
+	lock_guard<mutex> guard(access_);
+	counter_names_.resize(names.size());
+	for (size_t i = 0; i < names.size(); ++i) {
+		counter_names_[i].clear();
+		AppendUtf8(counter_names_[i], names[i]);
+	}
+	counter_values_.assign(values.begin(), values.end());
+	counter_values_.resize(names.size(), 0.0);
+}
+
+// The processes of a tick are written into the entries of the previous one, reusing their names.
+void BalancerMetrics::BeginProcesses() {
+	lock_guard<mutex> guard(access_);
+	pending_processes_ = 0;
+}
+
+void BalancerMetrics::AddProcess(uint32_t pid, const wstring& name, double user_time, int node) {
+	lock_guard<mutex> guard(access_);
+	if (pending_processes_ == processes_.size()) processes_.emplace_back();
+	ProcessMetric& process = processes_[pending_processes_++];
+	process.pid_ = pid;
+	process.name_.clear();
+	AppendUtf8(process.name_, name);
+	process.user_time_ = user_time;
+	process.node_ = node;
+}
+
+void BalancerMetrics::EndProcesses() {
+	lock_guard<mutex> guard(access_);
+	process_count_ = pending_processes_;
+}
+
+void BalancerMetrics::AddTick(double seconds, bool is_rebalance) {
+	lock_guard<mutex> guard(access_);
+	++ticks_;
+	if (is_rebalance) ++rebalance_ticks_;
+	tick_duration_.Observe(seconds);
+}
+
+void BalancerMetrics::AddScan(double seconds, bool is_complete) {
+	lock_guard<mutex> guard(access_);
+	if (!is_complete) ++incomplete_scans_;
+	scan_duration_.Observe(seconds);
+}
+
+void BalancerMetrics::AddAffinityCall(bool is_thread, bool is_set) {
+	lock_guard<mutex> guard(access_);
+	++affinity_calls_[is_thread ? 1 : 0];
+	if (!is_set) ++affinity_failures_[is_thread ? 1 : 0];
+}
+
+void BalancerMetrics::AddMove(bool is_placement) {
+	lock_guard<mutex> guard(access_);
+	if (is_placement) ++placements_;
+	else ++migrations_;
+}
+
+void BalancerMetrics::AddPreventedOscillations(size_t count) {
+	lock_guard<mutex> guard(access_);
+	prevented_oscillations_ += count;
+}
+
+void BalancerMetrics::AddSpawnPlacement(double seconds) {
+	lock_guard<mutex> guard(access_);
+	++spawn_placements_;
+	spawn_placement_duration_.Observe(seconds);
+}
+
+void BalancerMetrics::AddMigratedMemory(uint64_t bytes, size_t active) {
+	lock_guard<mutex> guard(access_);
+	migrated_bytes_ += bytes;
+	active_memory_migrations_ = active;
+}
+
+void BalancerMetrics::AddMemoryMigration(MemoryMigration result) {
+	lock_guard<mutex> guard(access_);
+	++memory_migrations_[result];
+}
+
+void BalancerMetrics::Write(string& out) const {
+	lock_guard<mutex> guard(access_);
+	out.append("# TYPE yb_cpu_load_percent gauge\n# HELP yb_cpu_load_percent Average CPU load over cpu_analysis_period_in_seconds.\n");
+	for (size_t i = 0; i < counter_names_.size(); ++i) {
+		out.append("yb_cpu_load_percent{counter=\"");
+		appendLabel(out, counter_names_[i]);
+		out.append("\"} ");
+		appendLog(out, counter_values_[i]);
+		out.push_back('\n');
+	}
+
+	out.append("# TYPE yb_process_user_time gauge\n# HELP yb_process_user_time Average USER_TIME of a tracked process per switching interval, in 100 ns units.\n");
+	for (size_t i = 0; i < process_count_; ++i) {
+		out.append("yb_process_user_time{pid=\"");
+		appendLog(out, processes_[i].pid_);
+		out.append("\",name=\"");
+		appendLabel(out, processes_[i].name_);
+		out.append("\"} ");
+		appendLog(out, processes_[i].user_time_);
+		out.push_back('\n');
+	}
+	out.append("# TYPE yb_process_node gauge\n# HELP yb_process_node NUMA node all threads of a tracked process are bound to, -1 when there is none.\n");
+	for (size_t i = 0; i < process_count_; ++i) {
+		out.append("yb_process_node{pid=\"");
+		appendLog(out, processes_[i].pid_);
+		out.append("\",name=\"");
+		appendLabel(out, processes_[i].name_);
+		out.append("\"} ");
+		appendLog(out, processes_[i].node_);
+		out.push_back('\n');
+	}
+
+	appendCounter(out, "yb_ticks", "Balancing ticks.", ticks_);
+	appendCounter(out, "yb_rebalance_ticks", "Ticks on which the node loads called for rebalancing.", rebalance_ticks_);
+	appendCounter(out, "yb_incomplete_scans", "Process scans that did not return every process.", incomplete_scans_);
+	appendCounter(out, "yb_migrations", "Processes moved from one NUMA node to another.", migrations_);
+	appendCounter(out, "yb_placements", "Unbound processes bound to a NUMA node.", placements_);
+	appendCounter(out, "yb_spawn_placements", "New processes bound to the least loaded NUMA node at their start.", spawn_placements_);
+	appendCounter(out, "yb_prevented_oscillations", "Moves of moved processes held back by the dwell time, the damping or the limit of moves per tick.", prevented_oscillations_);
+	const char* kinds[] = { "process", "thread" };
+	out.append("# TYPE yb_affinity_calls counter\n# HELP yb_affinity_calls Affinity calls.\n");
+	for (size_t i = 0; i < 2; ++i) {
+		out.append("yb_affinity_calls_total{kind=\"").append(kinds[i]).append("\"} ");
+		appendLog(out, affinity_calls_[i]);
+		out.push_back('\n');
+	}
+	out.append("# TYPE yb_affinity_failures counter\n# HELP yb_affinity_failures Affinity calls that failed.\n");
+	for (size_t i = 0; i < 2; ++i) {
+		out.append("yb_affinity_failures_total{kind=\"").append(kinds[i]).append("\"} ");
+		appendLog(out, affinity_failures_[i]);
+		out.push_back('\n');
+	}
+
+	appendCounter(out, "yb_memory_migrated_bytes", "Bytes of process memory moved to the node of the process.", migrated_bytes_);
+	out.append("# TYPE yb_memory_migrations_active gauge\n# HELP yb_memory_migrations_active Processes whose memory is being moved.\nyb_memory_migrations_active ");
+	appendLog(out, active_memory_migrations_);
+	out.push_back('\n');
+	const char* results[] = { "completed", "cancelled", "failed" };
+	out.append("# TYPE yb_memory_migrations counter\n# HELP yb_memory_migrations Finished memory migrations of processes.\n");
+	for (size_t i = 0; i < MIGRATION_RESULTS; ++i) {
+		out.append("yb_memory_migrations_total{result=\"").append(results[i]).append("\"} ");
+		appendLog(out, memory_migrations_[i]);
+		out.push_back('\n');
+	}
+
+	tick_duration_.Write(out, "yb_tick_duration_seconds");
+	scan_duration_.Write(out, "yb_scan_duration_seconds");
+	spawn_placement_duration_.Write(out, "yb_spawn_placement_seconds");
+	out.append("# EOF\n");
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Cumulative histogram with fixed bucket bounds, as OpenMetrics expects it.
+class Histogram {
+public:
+	explicit Histogram(const std::vector<double>& bounds);
+	void Observe(double value);
+	void Write(std::string& out, const char* name) const;
+private:
+	std::vector<double> bounds_;
+	std::vector<uint64_t> counts_;
+	double sum_ = 0.0;
+	uint64_t count_ = 0;
+};
+
+// State of the balancer for scraping. The balancer thread updates it once per tick and the exporter
+// serializes it into a buffer that is reused between scrapes, so neither side allocates in the steady
+// state. Loads are in percent of the node, user time in 100-nanosecond units per switching interval.
+class BalancerMetrics {
+public:
+	enum MemoryMigration { MigrationCompleted, MigrationCancelled, MigrationFailed, MIGRATION_RESULTS };
+	BalancerMetrics();
+	void SetCounters(const std::vector<std::wstring>& names, const std::vector<double>& values);
+	void BeginProcesses();
+	void AddProcess(uint32_t pid, const std::wstring& name, double user_time, int node);
+	void EndProcesses();
+	void AddTick(double seconds, bool is_rebalance);
+	void AddScan(double seconds, bool is_complete);
+	void AddAffinityCall(bool is_thread, bool is_set);
+	void AddMove(bool is_placement);
+	void AddPreventedOscillations(size_t count);
+	// Progress of the memory migration: bytes moved so far, jobs in progress and finished jobs.
+	void AddMigratedMemory(uint64_t bytes, size_t active);
+	void AddMemoryMigration(MemoryMigration result);
+	// A new process placed at its start, seconds from its start event to its affinity.
+	void AddSpawnPlacement(double seconds);
+	// Appends the OpenMetrics text exposition, terminated by # EOF, to out.
+	void Write(std::string& out) const;
+private:
+	struct ProcessMetric {
+		uint32_t pid_;
+		std::string name_;
+		double user_time_;
+		int node_;
+	};
+	mutable std::mutex access_;
+	std::vector<std::string> counter_names_;
+	std::vector<double> counter_values_;
+	std::vector<ProcessMetric> processes_;
+	size_t process_count_ = 0;
+	size_t pending_processes_ = 0;
+	uint64_t ticks_ = 0;
+	uint64_t rebalance_ticks_ = 0;
+	uint64_t incomplete_scans_ = 0;
+	uint64_t affinity_calls_[2] = {};
+	uint64_t affinity_failures_[2] = {};
+	uint64_t migrations_ = 0;
+	uint64_t placements_ = 0;
+	uint64_t prevented_oscillations_ = 0;
+	uint64_t migrated_bytes_ = 0;
+	size_t active_memory_migrations_ = 0;
+	uint64_t memory_migrations_[MIGRATION_RESULTS] = {};
+	uint64_t spawn_placements_ = 0;
+	Histogram tick_duration_;
+	Histogram scan_duration_;
+	Histogram spawn_placement_duration_;
+};
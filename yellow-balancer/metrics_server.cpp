@@ -0,0 +1,177 @@
+﻿// winsock2.h has to be included before windows.h, which comes with Logger.h.
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+#include "metrics_server.h"
+#include "Logger.h"
+
+using namespace std;
+
+static auto LOGGER = Logger::getInstance();
+
+static const size_t MAX_REQUEST_SIZE = 4096;
+static const long ACCEPT_TIMEOUT_MS = 500;
+static const long RECEIVE_TIMEOUT_MS = 2000;
+static const long SEND_TIMEOUT_MS = 2000;
+
+#ifdef _WIN32
+static const intptr_t NO_SOCKET = static_cast<intptr_t>(INVALID_SOCKET);
+static const int SEND_FLAGS = 0;
+
+static void closeSocket(intptr_t socket) {
+	closesocket(static_cast<SOCKET>(socket));
+}
+
+static int socketError() {
+	return WSAGetLastError();
+}
+
+static void setSendTimeout(intptr_t socket, long timeout_ms) {
+	DWORD timeout = static_cast<DWORD>(timeout_ms);
+	setsockopt(static_cast<SOCKET>(socket), SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+#else
+static const intptr_t NO_SOCKET = -1;
+// A scraper that hangs up early must not kill the service with SIGPIPE.
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+
+static void closeSocket(intptr_t socket) {
+	close(static_cast<int>(socket));
+}
+
+static int socketError() {
+	return errno;
+}
+
+static void setSendTimeout(intptr_t socket, long timeout_ms) {
+	timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	setsockopt(static_cast<int>(socket), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+#endif
+
+// Waits up to timeout_ms for the socket to become readable, so that the thread notices Stop. poll, unlike
+// select, takes sockets numbered above FD_SETSIZE, which the handle caches make common.
+static bool waitReadable(intptr_t socket, long timeout_ms) {
+#ifdef _WIN32
+	WSAPOLLFD poll_fd = { static_cast<SOCKET>(socket), POLLRDNORM, 0 };
+	return WSAPoll(&poll_fd, 1, static_cast<INT>(timeout_ms)) > 0;
+#else
+	pollfd poll_fd = { static_cast<int>(socket), POLLIN, 0 };
+	return poll(&poll_fd, 1, static_cast<int>(timeout_ms)) > 0;
+#endif
+}
+
+// A scraper that stops reading fails the send after SEND_TIMEOUT_MS instead of blocking the thread and Stop.
+static bool sendAll(intptr_t socket, const string& data) {
+	size_t sent = 0;
+	while (sent < data.size()) {
+		int result = static_cast<int>(send(socket, data.data() + sent, static_cast<int>(data.size() - sent), SEND_FLAGS));
+		if (result <= 0) return false;
+		sent += static_cast<size_t>(result);
+	}
+	return true;
+}
+
+bool MetricsServer::Start(int port) {
+	Stop();
+	if (port <= 0 || port > 65535) return false;
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		LOGGER->Print(Logger::Type::Error, false, L"MetricsServer: WSAStartup failed");
+		return false;
+	}
+	intptr_t listen_socket = static_cast<intptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+#else
+	intptr_t listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+#endif
+	if (listen_socket == NO_SOCKET) {
+		LOGGER->Print(Logger::Type::Error, false, L"MetricsServer: can't create a socket. Error ", socketError());
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<uint16_t>(port));
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::bind(listen_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_socket, 8) != 0) {
+		LOGGER->Print(Logger::Type::Error, false, L"MetricsServer: can't listen on 127.0.0.1:", port, L". Error ", socketError());
+		closeSocket(listen_socket);
+		return false;
+	}
+	listen_socket_ = listen_socket;
+	is_stop_ = false;
+	thread_ = thread(&MetricsServer::Serve, this);
+	LOGGER->Print(Logger::Type::Info, true, L"Metrics are served on http://127.0.0.1:", port, L"/metrics");
+	return true;
+}
+
+void MetricsServer::Stop() {
+	is_stop_ = true;
+	if (thread_.joinable()) thread_.join();
+	if (listen_socket_ != NO_SOCKET) {
+		closeSocket(listen_socket_);
+		listen_socket_ = NO_SOCKET;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+}
+
+void MetricsServer::Serve() {
+	while (!is_stop_) {
+		if (!waitReadable(listen_socket_, ACCEPT_TIMEOUT_MS)) continue;
+		intptr_t client = static_cast<intptr_t>(accept(listen_socket_, nullptr, nullptr));
+		if (client == NO_SOCKET) continue;
+		setSendTimeout(client, SEND_TIMEOUT_MS);
+		Answer(client);
+		closeSocket(client);
+	}
+}
+
+// Reads the request head and answers GET /metrics; the connection is closed after every answer.
+void MetricsServer::Answer(intptr_t client) {
+	request_.clear();
+	char buffer[1024];
+	while (request_.find("\r\n\r\n") == string::npos && request_.size() < MAX_REQUEST_SIZE) {
+		if (!waitReadable(client, RECEIVE_TIMEOUT_MS)) return;
+		int received = static_cast<int>(recv(client, buffer, sizeof(buffer), 0));
+		if (received <= 0) return;
+		request_.append(buffer, static_cast<size_t>(received));
+	}
+
+	body_.clear();
+	const char* status;
+	const char* content_type = "text/plain; charset=utf-8";
+	if (request_.compare(0, 13, "GET /metrics ") == 0 || request_.compare(0, 13, "GET /metrics?") == 0) {
+		metrics_.Write(body_);
+		status = "200 OK";
+		content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+		scrapes_.fetch_add(1, memory_order_relaxed);
+	}
+	else if (request_.compare(0, 4, "GET ") == 0) {
+		status = "404 Not Found";
+		body_.append("Not found, the metrics are served on /metrics\n");
+	}
+	else {
+		status = "405 Method Not Allowed";
+	}
+
+	response_.clear();
+	response_.append("HTTP/1.1 ").append(status).append("\r\nContent-Type: ").append(content_type).append("\r\nContent-Length: ");
+	appendLog(response_, body_.size());
+	response_.append("\r\nConnection: close\r\n\r\n");
+	if (sendAll(client, response_)) sendAll(client, body_);
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include "metrics.h"
+
+// Serves GET /metrics with the OpenMetrics text of BalancerMetrics on 127.0.0.1:port. One thread
+// accepts and answers the scrapes one after another; the request and response buffers are kept
+// between scrapes.
+class MetricsServer {
+public:
+	explicit MetricsServer(const BalancerMetrics& metrics) : metrics_(metrics) {}
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(const MetricsServer&) = delete;
+	~MetricsServer() { Stop(); }
+	bool Start(int port);
+	void Stop();
+	bool IsRunning() const { return thread_.joinable(); }
+	uint64_t Scrapes() const { return scrapes_.load(std::memory_order_relaxed); }
+private:
+	const BalancerMetrics& metrics_;
+	intptr_t listen_socket_ = -1;
+	std::thread thread_;
+	std::atomic<bool> is_stop_{ false };
+	std::atomic<uint64_t> scrapes_{ 0 };
+	std::string request_;
+	std::string response_;
+	std::string body_;
+	void Serve();
+	void Answer(intptr_t client);
+};
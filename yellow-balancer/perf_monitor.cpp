@@ -4,12 +4,55 @@ using namespace std;
 
 static auto LOGGER = Logger::getInstance();
 
+static const int MIN_SAMPLE_INTERVAL = 100;
+static const size_t RAW_WINDOW_SECONDS = 10;
+static const size_t TEN_SECONDS_WINDOW = 60;
+static const size_t MINUTE_WINDOW = 60;
+
+CounterSeries::CounterSeries(size_t samples_per_second, size_t seconds) {
+	tiers_.push_back({ RingBuffer<double>(samples_per_second * RAW_WINDOW_SECONDS), 1, 0.0, 0 });
+	tiers_.push_back({ RingBuffer<double>(seconds), samples_per_second, 0.0, 0 });
+	tiers_.push_back({ RingBuffer<double>(TEN_SECONDS_WINDOW), 10, 0.0, 0 });
+	tiers_.push_back({ RingBuffer<double>(MINUTE_WINDOW), 6, 0.0, 0 });
+}
+
+// A completed value of a tier is added to the next one, so the tiers are filled in one cascade.
+void CounterSeries::Add(double value) {
+	tiers_[0].values_.Add(value);
+	for (size_t i = 1; i < tiers_.size(); ++i) {
+		Tier& tier = tiers_[i];
+		tier.sum_ += value;
+		if (++tier.count_ < tier.per_value_) break;
+		value = tier.sum_ / static_cast<double>(tier.count_);
+		tier.values_.Add(value);
+		tier.sum_ = 0.0;
+		tier.count_ = 0;
+	}
+}
+
+// Values of a previous run go straight into the Second tier, the other tiers fill as usual.
+void CounterSeries::AddSeconds(const vector<double>& values) {
+	for (auto it = values.begin(); it != values.end(); ++it) {
+		tiers_[1].values_.Add(*it);
+	}
+}
+
+// Samples are taken on a fixed grid of steady_clock deadlines, so a slow collection delays only its own
+// sample. Deadlines that have already passed are skipped instead of being collected in a burst.
 void StartCollectingThread(PerfMonitor* perf_monitor) {
 	perf_monitor->is_collect_ = true;
+	auto interval = perf_monitor->sample_interval_;
+	auto deadline = chrono::steady_clock::now();
 	while (perf_monitor->is_collect_) {
-		auto start = chrono::high_resolution_clock::now();
 		perf_monitor->Collect();
-		this_thread::sleep_for(chrono::microseconds(1000000) - chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start));
+		deadline += interval;
+		auto now = chrono::steady_clock::now();
+		if (deadline <= now) {
+			auto missed = (now - deadline) / interval + 1;
+			deadline += interval * missed;
+			LOGGER->Print(Logger::Type::Trace, false, L"PerfMonitor skipped samples: ", missed);
+		}
+		this_thread::sleep_until(deadline);
 	}
 	perf_monitor->collector_thread_id_ = std::thread::id();
 }
@@ -19,6 +62,7 @@ PerfMonitor::~PerfMonitor(){
 	while (collector_thread_id_ != std::thread::id()) {
 		this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
+#ifdef _WIN32
 	for (auto it = counters_.begin(); it < counters_.end(); ++it) {
 		GlobalFree(*it);
 		PdhRemoveCounter(*it);
@@ -26,17 +70,31 @@ PerfMonitor::~PerfMonitor(){
 	if (pdh_query_) {
 		PdhCloseQuery(pdh_query_);
 	}
+#endif
 	LOGGER->Print(L"~PerfMonitor", Logger::Type::Trace);
 }
 
+// May be called while the values are collected; the values of the counters are kept.
 void PerfMonitor::SetCollectionPeriod(int collection_period) {
+	lock_guard<mutex> guard(access_counters_);
 	collection_period_ = collection_period;
 	for (auto it = counters_values_.begin(); it < counters_values_.end(); ++it) {
-		*it = RingBuffer<double>(collection_period_);
+		it->SetSeconds(collection_period_);
+	}
+}
+
+// The interval is limited to 100-1000 ms and rounded so that a second holds a whole number of samples.
+// It takes effect for the collected values and the collecting thread started after the call.
+void PerfMonitor::SetSampleInterval(int sample_interval) {
+	int samples_per_second = 1000 / min(max(sample_interval, MIN_SAMPLE_INTERVAL), 1000);
+	sample_interval_ = chrono::milliseconds(1000 / samples_per_second);
+	for (auto it = counters_values_.begin(); it < counters_values_.end(); ++it) {
+		*it = CounterSeries(SamplesPerSecond(), collection_period_);
 	}
 }
 
 void PerfMonitor::AddCounter(const wstring& full_name) {
+#ifdef _WIN32
 	if (!pdh_query_) {
 		if (PdhOpenQueryW(NULL, NULL, &pdh_query_) != ERROR_SUCCESS) {
 			pdh_query_ = NULL;
@@ -45,8 +103,35 @@ void PerfMonitor::AddCounter(const wstring& full_name) {
 	}
 	counters_.push_back((HCOUNTER*)GlobalAlloc(GPTR, sizeof(HCOUNTER)));
 	PdhAddEnglishCounterW(pdh_query_, &full_name[0], 0, counters_.back());
+#endif
 	counters_name_.push_back(full_name);
-	counters_values_.push_back(RingBuffer<double>(collection_period_));
+	counters_values_.push_back(CounterSeries(SamplesPerSecond(), collection_period_));
+	counters_cpus_.push_back({});
+}
+
+// Without PDH the counter is the average load of the given CPUs from the sampler, of all CPUs for an empty list.
+void PerfMonitor::AddCounter(const wstring& full_name, const vector<uint32_t>& cpus) {
+	AddCounter(full_name);
+	counters_cpus_.back() = cpus;
+}
+
+// Must be called before StartCollecting; the sampler is used by the collecting thread only.
+void PerfMonitor::SetCpuSampler(unique_ptr<CpuStatSampler> cpu_sampler) {
+	cpu_sampler_ = move(cpu_sampler);
+	if (cpu_sampler_ && !cpu_sampler_->Init()) {
+		LOGGER->Print(L"PerfMonitor: per-CPU load is not available", Logger::Type::Error);
+		cpu_sampler_.reset();
+	}
+}
+
+// Domain of the view with the highest load in the last sample.
+bool PerfMonitor::GetHottestDomain(CpuStatSampler::View view, uint32_t& id, double& load) {
+	lock_guard<mutex> guard(access_counters_);
+	if (!cpu_sampler_ || cpu_sampler_->DomainIds(view).empty()) return false;
+	size_t domain = cpu_sampler_->HottestDomain(view);
+	id = cpu_sampler_->DomainIds(view)[domain];
+	load = cpu_sampler_->DomainLoads(view)[domain];
+	return true;
 }
 
 void PerfMonitor::StartCollecting() {
@@ -63,7 +148,16 @@ void PerfMonitor::StopCollecting() {
 	}
 }
 
+// Adds one sample per counter, in the order of AddCounter, for counters collected outside of PDH.
+void PerfMonitor::AddValues(const vector<double>& values) {
+	lock_guard<mutex> guard(access_counters_);
+	for (size_t i = 0; i < counters_values_.size() && i < values.size(); ++i) {
+		counters_values_[i].Add(values[i]);
+	}
+}
+
 void PerfMonitor::Collect() {
+#ifdef _WIN32
 	if (pdh_query_) {
 		PDH_STATUS pdhStatus;
 		pdhStatus = PdhCollectQueryData(pdh_query_);
@@ -77,7 +171,7 @@ void PerfMonitor::Collect() {
 					counters_values_[i].Add(pdhValue.doubleValue);
 				}
 				else {
-					if (LOGGER->LogType() == Logger::Type::Trace) {
+					if (LOGGER->IsEnabled(Logger::Type::Trace)) {
 						if (pdhStatus == PDH_INVALID_ARGUMENT) {
 							LOGGER->Print(L"PDH_INVALID_ARGUMENT", Logger::Type::Trace);
 						}
@@ -104,27 +198,78 @@ void PerfMonitor::Collect() {
 			LOGGER->Print(L"PdhCollectQueryData PDH_UNKNOW_HANDLE", Logger::Type::Trace);
 		}
 	}
-}
-
-vector<double> PerfMonitor::GetAvgValues() {
-	vector<double> res(counters_.size(), 0);
-	{
+#else
+	if (cpu_sampler_) {
 		lock_guard<mutex> guard(access_counters_);
-		auto it_res = res.begin();
-		for (auto it = counters_values_.begin(); it < counters_values_.end(); ++it) {
-			if (it->Size() == it->Capacity()) {
-				*it_res = it->Avg();
-				++it_res;
+		if (cpu_sampler_->Sample()) {
+			for (size_t i = 0; i < counters_values_.size(); ++i) {
+				counters_values_[i].Add(cpu_sampler_->Load(counters_cpus_[i]));
 			}
 		}
 	}
-	if (LOGGER->LogType() == Logger::Type::Trace) {
-		for (size_t i = 0; i < counters_name_.size(); ++i) {
-			wstring msg = L"AVG for ";
-			msg.append(counters_name_[i]);
-			msg.append(L"=").append(to_wstring(res[i]));
-			LOGGER->Print(msg, Logger::Type::Trace);
+#endif
+}
+
+// The trace line also shows how steady the load was over the window.
+vector<double> PerfMonitor::GetAvgValues() {
+	vector<double> res(counters_name_.size(), 0);
+	bool is_trace = LOGGER->IsEnabled(Logger::Type::Trace);
+	lock_guard<mutex> guard(access_counters_);
+	for (size_t i = 0; i < counters_values_.size(); ++i) {
+		const RingBuffer<double>& values = counters_values_[i].Values(Second);
+		if (values.Size() == values.Capacity()) res[i] = values.Avg();
+		if (is_trace) {
+			LOGGER->Print(Logger::Type::Trace, false, L"AVG for ", counters_name_[i], L"=", res[i],
+				L" MIN=", values.Min(), L" MAX=", values.Max(), L" STDDEV=", values.StdDev());
 		}
 	}
 	return res;
+}
+
+vector<double> PerfMonitor::GetAvgValues(double& confidence) {
+	vector<double> res(counters_name_.size(), 0);
+	confidence = counters_values_.empty() ? 0.0 : 1.0;
+	lock_guard<mutex> guard(access_counters_);
+	for (size_t i = 0; i < counters_values_.size(); ++i) {
+		const RingBuffer<double>& values = counters_values_[i].Values(Second);
+		res[i] = values.Avg();
+		confidence = min(confidence, static_cast<double>(values.Size()) / static_cast<double>(values.Capacity()));
+	}
+	return res;
+}
+
+void PerfMonitor::GetSecondValues(vector<vector<double>>& values) {
+	lock_guard<mutex> guard(access_counters_);
+	values.resize(counters_values_.size());
+	for (size_t i = 0; i < counters_values_.size(); ++i) {
+		const RingBuffer<double>& seconds = counters_values_[i].Values(Second);
+		values[i].clear();
+		for (size_t j = 0; j < seconds.Size(); ++j) values[i].push_back(seconds.At(j));
+	}
+}
+
+void PerfMonitor::AddSecondValues(const vector<vector<double>>& values) {
+	lock_guard<mutex> guard(access_counters_);
+	for (size_t i = 0; i < counters_values_.size() && i < values.size(); ++i) {
+		counters_values_[i].AddSeconds(values[i]);
+	}
+}
+
+// Average over the values the tier has so far, 0 for a counter without values at this resolution.
+vector<double> PerfMonitor::GetAvgValues(Resolution resolution) {
+	vector<double> res(counters_name_.size(), 0);
+	lock_guard<mutex> guard(access_counters_);
+	for (size_t i = 0; i < counters_values_.size(); ++i) {
+		res[i] = counters_values_[i].Values(resolution).Avg();
+	}
+	return res;
+}
+
+vector<double> PerfMonitor::GetMaxValues(Resolution resolution) {
+	vector<double> res(counters_name_.size(), 0);
+	lock_guard<mutex> guard(access_counters_);
+	for (size_t i = 0; i < counters_values_.size(); ++i) {
+		res[i] = counters_values_[i].Values(resolution).Max();
+	}
+	return res;
 }
\ No newline at end of file
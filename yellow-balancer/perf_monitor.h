@@ -1,41 +1,91 @@
 ﻿#pragma once
 
+#ifdef _WIN32
 #include <Pdh.h>
 #include <PdhMsg.h>
+#endif
+#include <chrono>
 #include <string>
 #include <vector>
 #include <thread>
+#include <memory>
 #include <optional>
 #include <mutex>
 #include <numeric>
 #include "Logger.h"
+#include "cpu_stat.h"
 #include "ring_buffer.h"
 
+#ifdef _WIN32
 #pragma comment(lib,"pdh.lib")
+#endif
+
+// Samples of one counter at several resolutions: raw samples are averaged into 1 s values, those
+// into 10 s values and those into 1 min values. Every tier keeps a window of its own, so short bursts
+// stay visible at the raw resolution without a long raw window.
+class CounterSeries {
+public:
+	CounterSeries(size_t samples_per_second, size_t seconds);
+	void Add(double value);
+	// Changes the window of the Second tier, its last values are kept.
+	void SetSeconds(size_t seconds) { tiers_[1].values_.Resize(seconds); }
+	void AddSeconds(const std::vector<double>& values);
+	const RingBuffer<double>& Values(size_t tier) const { return tiers_[tier].values_; }
+private:
+	struct Tier {
+		RingBuffer<double> values_;
+		size_t per_value_;
+		double sum_;
+		size_t count_;
+	};
+	std::vector<Tier> tiers_;
+};
 
 class PerfMonitor;
 void StartCollectingThread(PerfMonitor* perf_monitor);
 
 class PerfMonitor{
 public:
+	enum Resolution { Raw, Second, TenSeconds, Minute };
 	void SetCollectionPeriod(int collection_period);
 	int CollectionPeriod() { return collection_period_; }
+	void SetSampleInterval(int sample_interval);
+	int SampleInterval() { return static_cast<int>(sample_interval_.count()); }
 	void AddCounter(const std::wstring& full_name);
+	void AddCounter(const std::wstring& full_name, const std::vector<uint32_t>& cpus);
+	void SetCpuSampler(std::unique_ptr<CpuStatSampler> cpu_sampler);
+	bool GetHottestDomain(CpuStatSampler::View view, uint32_t& id, double& load);
 	void StartCollecting();
 	void StopCollecting();
+	void AddValues(const std::vector<double>& values);
 	std::vector<double> GetAvgValues();
+	// Averages of the values collected so far while the windows fill. confidence is the filled share of the
+	// least filled window: 0 before the first value, 1 when GetAvgValues() gives the same.
+	std::vector<double> GetAvgValues(double& confidence);
+	std::vector<double> GetAvgValues(Resolution resolution);
+	std::vector<double> GetMaxValues(Resolution resolution);
 	const std::vector<std::wstring>& GetCountersName() { return counters_name_; }
+	// Second values of every counter, oldest first; the vectors are reused between calls.
+	void GetSecondValues(std::vector<std::vector<double>>& values);
+	// Adds the Second values of a previous run, for the counters in the same order.
+	void AddSecondValues(const std::vector<std::vector<double>>& values);
 	~PerfMonitor();
 private:
 	friend void StartCollectingThread(PerfMonitor* perf_monitor);
+#ifdef _WIN32
 	PDH_HQUERY pdh_query_ = NULL;
-	int collection_period_ = 60;
 	std::vector<PDH_HCOUNTER*> counters_;
+#endif
+	int collection_period_ = 60;
+	std::chrono::milliseconds sample_interval_ = std::chrono::milliseconds(1000);
 	std::vector<std::wstring> counters_name_;
-	std::vector<RingBuffer<double>> counters_values_;
+	std::vector<CounterSeries> counters_values_;
+	std::vector<std::vector<uint32_t>> counters_cpus_;
+	std::unique_ptr<CpuStatSampler> cpu_sampler_;
 	std::thread collector_thread_;
 	bool is_collect_ = false;
 	std::thread::id collector_thread_id_;
 	void Collect();
+	size_t SamplesPerSecond() const { return static_cast<size_t>(1000 / sample_interval_.count()); }
 	std::mutex access_counters_;
 };
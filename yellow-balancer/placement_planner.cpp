@@ -0,0 +1,195 @@
+﻿#include "placement_planner.h"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+size_t PlacementPlan::Moves() const {
+	size_t moves = 0;
+	for (auto it = placements_.begin(); it != placements_.end(); ++it) {
+		if (IsMove(*it)) ++moves;
+	}
+	return moves;
+}
+
+static double normalizedLoad(double load, double capacity) {
+	return capacity > 0.0 ? load / capacity : numeric_limits<double>::infinity();
+}
+
+double PlacementPlanner::MoveCost(size_t nodes, int node, int target_node) const {
+	if (node < 0 || target_node < 0 || move_distances_.size() != nodes * nodes) return migration_cost_;
+	return migration_cost_ * move_distances_[static_cast<size_t>(node) * nodes + static_cast<size_t>(target_node)];
+}
+
+void PlacementPlanner::SetBackgrounds(vector<NodeLoad>& nodes, const vector<double>& measured, const vector<Placement>& placements) {
+	double total_capacity = 0.0;
+	for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+		total_capacity += max(it->capacity_, 0.0);
+	}
+	vector<double> bound_load(nodes.size(), 0.0);
+	double unbound_load = 0.0;
+	auto add_load = [&bound_load, &unbound_load](int node, double load) {
+		if (node >= 0 && node < static_cast<int>(bound_load.size())) bound_load[node] += load;
+		else unbound_load += load;
+	};
+	for (auto it = placements.begin(); it != placements.end(); ++it) {
+		add_load(it->current_node_, it->load_ * (1.0 - it->moved_share_));
+		if (it->moved_share_ > 0.0) add_load(it->origin_node_, it->load_ * it->moved_share_);
+	}
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		double unbound_share = total_capacity > 0.0 ? unbound_load * max(nodes[i].capacity_, 0.0) / total_capacity : 0.0;
+		nodes[i].background_ = max((i < measured.size() ? measured[i] : 0.0) - bound_load[i] - unbound_share, 0.0);
+	}
+}
+
+// With is_fixed the bound processes keep their nodes and only the unbound ones are placed.
+void PlacementPlanner::Assign(PlacementPlan& plan, bool is_fixed) const {
+	vector<double> assigned(plan.nodes_.size());
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		assigned[i] = plan.nodes_[i].background_;
+	}
+	if (is_fixed) {
+		for (auto it = plan.placements_.begin(); it != plan.placements_.end(); ++it) {
+			if (it->current_node_ >= 0) {
+				it->target_node_ = it->current_node_;
+				assigned[it->current_node_] += it->load_;
+			}
+		}
+	}
+
+	// The fixed pass places no bound process, the held back moves stay as the first pass counted them.
+	size_t moves = 0;
+	if (!is_fixed) plan.prevented_ = 0;
+	for (auto it = plan.placements_.begin(); it != plan.placements_.end(); ++it) {
+		if (is_fixed && it->current_node_ >= 0) continue;
+		bool is_bound = it->current_node_ >= 0;
+		int best_node = -1;
+		double best_cost = numeric_limits<double>::infinity();
+		// The node the process would go to without the hysteresis.
+		int free_node = -1;
+		double free_cost = numeric_limits<double>::infinity();
+		for (size_t i = 0; i < assigned.size(); ++i) {
+			double cost = normalizedLoad(assigned[i] + it->load_, plan.nodes_[i].capacity_);
+			if (is_bound && it->current_node_ != static_cast<int>(i)) cost += MoveCost(assigned.size(), it->current_node_, static_cast<int>(i));
+			if (it->memory_row_ >= 0) cost += remote_penalty_ * plan.remote_shares_[it->memory_row_ * plan.nodes_.size() + i] * normalizedLoad(it->load_, plan.nodes_[i].capacity_);
+			if (cost < free_cost) {
+				free_cost = cost;
+				free_node = static_cast<int>(i);
+			}
+			if (is_bound && it->origin_node_ == static_cast<int>(i) && it->current_node_ != it->origin_node_) cost += MoveCost(assigned.size(), it->current_node_, it->origin_node_) * damping_;
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_node = static_cast<int>(i);
+			}
+		}
+		if (best_node < 0) best_node = is_bound ? it->current_node_ : 0;
+		if (is_bound && best_node != it->current_node_) {
+			if (it->is_pinned_ || (max_moves_ > 0 && moves >= max_moves_)) best_node = it->current_node_;
+			else ++moves;
+		}
+		if (is_bound && (it->is_pinned_ || it->origin_node_ >= 0) && free_node >= 0 && free_node != it->current_node_ && best_node == it->current_node_) ++plan.prevented_;
+		it->target_node_ = best_node;
+		assigned[best_node] += it->load_;
+	}
+
+	plan.planned_max_load_ = 0.0;
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		plan.nodes_[i].planned_ = normalizedLoad(assigned[i], plan.nodes_[i].capacity_);
+		plan.planned_max_load_ = max(plan.planned_max_load_, plan.nodes_[i].planned_);
+	}
+}
+
+size_t PlacementPlanner::SpreadThreads(PlacementPlan& plan, int node, vector<ThreadPlacement>& threads) const {
+	if (node < 0 || node >= static_cast<int>(plan.nodes_.size())) return 0;
+	vector<double> assigned(plan.nodes_.size());
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		assigned[i] = plan.nodes_[i].planned_ * plan.nodes_[i].capacity_;
+	}
+	stable_sort(threads.begin(), threads.end(),
+		[](const ThreadPlacement& lhs, const ThreadPlacement& rhs)->bool {
+			return lhs.load_ > rhs.load_;
+		}
+	);
+
+	size_t moves = 0;
+	for (auto it = threads.begin(); it != threads.end(); ++it) {
+		it->target_node_ = it->current_node_;
+		if (it->current_node_ != node || it->load_ <= 0.0) continue;
+		// Of two nodes with the same load the nearer one takes the thread.
+		int best_node = -1;
+		double best_load = numeric_limits<double>::infinity();
+		double best_cost = numeric_limits<double>::infinity();
+		for (size_t i = 0; i < assigned.size(); ++i) {
+			if (static_cast<int>(i) == node) continue;
+			double load = normalizedLoad(assigned[i] + it->load_, plan.nodes_[i].capacity_);
+			double cost = load + MoveCost(assigned.size(), node, static_cast<int>(i));
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_load = load;
+				best_node = static_cast<int>(i);
+			}
+		}
+		if (best_node < 0) continue;
+		double source_load = normalizedLoad(assigned[node], plan.nodes_[node].capacity_);
+		double moved_load = max(normalizedLoad(assigned[node] - it->load_, plan.nodes_[node].capacity_), best_load);
+		if (moved_load + MoveCost(assigned.size(), node, best_node) >= source_load) continue;
+		it->target_node_ = best_node;
+		assigned[node] -= it->load_;
+		assigned[best_node] += it->load_;
+		++moves;
+	}
+
+	plan.planned_max_load_ = 0.0;
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		plan.nodes_[i].planned_ = normalizedLoad(assigned[i], plan.nodes_[i].capacity_);
+		plan.planned_max_load_ = max(plan.planned_max_load_, plan.nodes_[i].planned_);
+	}
+	return moves;
+}
+
+PlacementPlan PlacementPlanner::Plan(const vector<NodeLoad>& nodes, const vector<Placement>& placements, vector<double> remote_shares) const {
+	PlacementPlan plan;
+	plan.nodes_ = nodes;
+	plan.placements_ = placements;
+	plan.remote_shares_ = move(remote_shares);
+	if (plan.nodes_.empty()) return plan;
+
+	double total_capacity = 0.0;
+	for (auto it = plan.nodes_.begin(); it != plan.nodes_.end(); ++it) {
+		total_capacity += max(it->capacity_, 0.0);
+	}
+
+	// Unbound processes run on every node, their load is spread in proportion to capacity.
+	vector<double> current(plan.nodes_.size());
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		current[i] = plan.nodes_[i].background_;
+	}
+	for (auto it = plan.placements_.begin(); it != plan.placements_.end(); ++it) {
+		if (it->current_node_ >= static_cast<int>(plan.nodes_.size())) it->current_node_ = -1;
+		if (static_cast<size_t>(it->memory_row_ + 1) * plan.nodes_.size() > plan.remote_shares_.size()) it->memory_row_ = -1;
+		if (it->current_node_ >= 0) {
+			current[it->current_node_] += it->load_;
+		}
+		else if (total_capacity > 0.0) {
+			for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+				current[i] += it->load_ * max(plan.nodes_[i].capacity_, 0.0) / total_capacity;
+			}
+		}
+	}
+	plan.current_max_load_ = 0.0;
+	for (size_t i = 0; i < plan.nodes_.size(); ++i) {
+		plan.nodes_[i].current_ = normalizedLoad(current[i], plan.nodes_[i].capacity_);
+		plan.current_max_load_ = max(plan.current_max_load_, plan.nodes_[i].current_);
+	}
+
+	stable_sort(plan.placements_.begin(), plan.placements_.end(),
+		[](const Placement& lhs, const Placement& rhs)->bool {
+			return lhs.load_ > rhs.load_;
+		}
+	);
+
+	Assign(plan, false);
+	plan.is_rebalanced_ = plan.planned_max_load_ < plan.current_max_load_ - migration_cost_;
+	if (!plan.is_rebalanced_) Assign(plan, true);
+	return plan;
+}
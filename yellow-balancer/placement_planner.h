@@ -0,0 +1,93 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Loads are in logical CPUs (1.0 is one CPU busy for the whole interval); normalized loads are
+// divided by the capacity of the node, so 1.0 is a fully busy node.
+struct NodeLoad {
+	double capacity_;
+	double background_;
+	double current_;
+	double planned_;
+};
+
+// current_node_ is -1 when the process is not bound to a single node; memory_row_ is the row of its
+// remote memory shares in the plan, -1 when they are not known. A pinned process was moved too
+// recently to be moved again, origin_node_ is the node it was moved away from (-1 for none). moved_share_
+// is the share of its load window from before that move, which the measured load of origin_node_ still holds.
+struct Placement {
+	uint32_t pid_;
+	double load_;
+	int current_node_;
+	int target_node_;
+	int memory_row_ = -1;
+	bool is_pinned_ = false;
+	int origin_node_ = -1;
+	double moved_share_ = 0.0;
+};
+
+// A thread of a process that is too big for one node; current_node_ is the node it runs on.
+struct ThreadPlacement {
+	uint32_t tid_;
+	double load_;
+	int current_node_;
+	int target_node_;
+};
+
+struct PlacementPlan {
+	std::vector<NodeLoad> nodes_;
+	std::vector<Placement> placements_;
+	// Share of the resident memory of a placement outside every node, one row of nodes_.size() values per placement.
+	std::vector<double> remote_shares_;
+	double current_max_load_ = 0.0;
+	double planned_max_load_ = 0.0;
+	bool is_rebalanced_ = false;
+	// Moves of processes moved before that the hysteresis held back.
+	size_t prevented_ = 0;
+
+	static bool IsMove(const Placement& placement) { return placement.current_node_ >= 0 && placement.current_node_ != placement.target_node_; }
+	size_t Moves() const;
+};
+
+// Greedy LPT: the heaviest process goes first, each one onto the node with the lowest normalized
+// load after the placement. Moving a bound process costs migration_cost of normalized load, and the
+// bound processes are moved at all only when the plan lowers the maximum node load by more than
+// that cost; otherwise they stay and only the unbound processes are placed. A process also costs
+// remote_penalty of its own normalized load for the share of its memory outside the node, so it is
+// drawn to the node that holds its memory and a move away from it costs more.
+// A move costs migration_cost times the distance between the two nodes relative to the nearest pair of
+// nodes, so a process leaves its package only for a larger gain than it needs to move within it.
+// Hysteresis: a pinned process stays, a move back to the origin node costs damping times more and at
+// most max_moves bound processes (0 - any number) are moved by one plan, the heaviest first.
+class PlacementPlanner {
+public:
+	explicit PlacementPlanner(double migration_cost = DEFAULT_MIGRATION_COST) : migration_cost_(migration_cost) {}
+	void SetMigrationCost(double migration_cost) { migration_cost_ = migration_cost; }
+	double MigrationCost() const { return migration_cost_; }
+	void SetRemotePenalty(double remote_penalty) { remote_penalty_ = remote_penalty; }
+	double RemotePenalty() const { return remote_penalty_; }
+	void SetMaxMoves(size_t max_moves) { max_moves_ = max_moves; }
+	void SetDamping(double damping) { damping_ = damping; }
+	// Relative distances by the node indexes of the plan, nodes x nodes; empty - every move costs the same.
+	void SetMoveDistances(std::vector<double> move_distances) { move_distances_ = std::move(move_distances); }
+	// Sets the background of every node to its measured load (in logical CPUs) less the placements that
+	// ran on it within the window: the unbound ones by its share of the capacity.
+	static void SetBackgrounds(std::vector<NodeLoad>& nodes, const std::vector<double>& measured, const std::vector<Placement>& placements);
+	PlacementPlan Plan(const std::vector<NodeLoad>& nodes, const std::vector<Placement>& placements, std::vector<double> remote_shares = {}) const;
+	// Moves the hottest threads that run on the node to the least loaded nodes of the plan, as long as
+	// every move lowers the larger of the two node loads by more than the migration cost. The planned
+	// loads of the plan are updated; returns the number of moved threads.
+	size_t SpreadThreads(PlacementPlan& plan, int node, std::vector<ThreadPlacement>& threads) const;
+private:
+	static constexpr double DEFAULT_MIGRATION_COST = 0.05;
+	double migration_cost_;
+	double remote_penalty_ = 0.0;
+	size_t max_moves_ = 0;
+	double damping_ = 0.0;
+	std::vector<double> move_distances_;
+	double MoveCost(size_t nodes, int node, int target_node) const;
+	void Assign(PlacementPlan& plan, bool is_fixed) const;
+};
@@ -0,0 +1,18 @@
+﻿#include "process_events.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <thread>
+
+using namespace std;
+
+bool PollingProcessEvents::Wait(int timeout_ms, vector<uint32_t>& pids) {
+	this_thread::sleep_for(chrono::milliseconds(timeout_ms));
+	current_.clear();
+	if (!ListProcesses(current_)) return true;
+	sort(current_.begin(), current_.end());
+	if (is_listed_) set_difference(current_.begin(), current_.end(), previous_.begin(), previous_.end(), back_inserter(pids));
+	is_listed_ = true;
+	previous_.swap(current_);
+	return true;
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Pids of the processes that have just started. Wait returns after timeout_ms at the latest, so that the
+// thread calling it notices a stop. A pid may come more than once or belong to a process that has already
+// exited; false means the source is broken and gives no more events.
+class ProcessEventSource {
+public:
+	virtual ~ProcessEventSource() {}
+	virtual bool Wait(int timeout_ms, std::vector<uint32_t>& pids) = 0;
+	// True when the OS delivers the events, false for a source that polls the list of processes.
+	virtual bool IsEventDriven() const = 0;
+};
+
+// Lists the processes every Wait and reports the pids that were not in the previous list. The first
+// list only sets the base, the processes running at the start are left to the scans of the balancer.
+class PollingProcessEvents : public ProcessEventSource {
+public:
+	bool Wait(int timeout_ms, std::vector<uint32_t>& pids) override;
+	bool IsEventDriven() const override { return false; }
+protected:
+	virtual bool ListProcesses(std::vector<uint32_t>& pids) = 0;
+private:
+	std::vector<uint32_t> previous_;
+	std::vector<uint32_t> current_;
+	bool is_listed_ = false;
+};
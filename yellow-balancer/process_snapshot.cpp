@@ -0,0 +1,80 @@
+﻿#include "process_snapshot.h"
+
+using namespace std;
+
+static const wchar_t IDLE_PROCESS_NAME[] = L"System Idle Process";
+static const wchar_t UNKNOWN_PROCESS_NAME[] = L"unknow";
+
+void SnapshotBuffer::Grow(size_t required) {
+	size_t new_size = required > buffer_.size() ? required + required / 8 : buffer_.size() * 2;
+	new_size = (new_size + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+	buffer_.resize(new_size);
+}
+
+ProcessSnapshotWalker::ProcessSnapshotWalker(const uint8_t* data, size_t size) :
+	data_(data),
+	size_(size),
+	offset_(0),
+	is_end_(size == 0),
+	is_complete_(false) {}
+
+const SYSTEM_PROCESS_INFORMATION* ProcessSnapshotWalker::Next() {
+	if (is_end_) return nullptr;
+
+	const size_t header_size = offsetof(SYSTEM_PROCESS_INFORMATION, ThreadInfos);
+	if (offset_ + header_size > size_) {
+		is_end_ = true;
+		return nullptr;
+	}
+	const SYSTEM_PROCESS_INFORMATION* info = reinterpret_cast<const SYSTEM_PROCESS_INFORMATION*>(data_ + offset_);
+	if (offset_ + header_size + static_cast<size_t>(info->ThreadCount) * sizeof(SYSTEM_THREAD_INFORMATION) > size_) {
+		is_end_ = true;
+		return nullptr;
+	}
+
+	if (info->NextOffset == 0) {
+		is_end_ = true;
+		is_complete_ = true;
+	}
+	else if (info->NextOffset < header_size || info->NextOffset % sizeof(uint32_t) != 0) {
+		is_end_ = true;
+	}
+	else {
+		offset_ += info->NextOffset;
+	}
+	return info;
+}
+
+static bool isSameName(const char16_t* buffer, size_t length, const wchar_t* name, size_t name_length) {
+	if (length != name_length) return false;
+	for (size_t i = 0; i < length; ++i) {
+		if (static_cast<wchar_t>(buffer[i]) != name[i]) return false;
+	}
+	return true;
+}
+
+bool IsImageNameInFilter(const SYSTEM_PROCESS_INFORMATION& info, const unordered_set<wstring>& process_filter) {
+	if (process_filter.empty()) return true;
+	if (info.ProcessId == 0) return process_filter.find(IDLE_PROCESS_NAME) != process_filter.end();
+	if (!info.ImageName.Buffer) return process_filter.find(UNKNOWN_PROCESS_NAME) != process_filter.end();
+
+	size_t length = info.ImageName.Length / sizeof(char16_t);
+	for (auto it = process_filter.begin(); it != process_filter.end(); ++it) {
+		if (isSameName(info.ImageName.Buffer, length, it->c_str(), it->size())) return true;
+	}
+	return false;
+}
+
+wstring_view ImageName(const SYSTEM_PROCESS_INFORMATION& info, wstring& buffer) {
+	if (info.ProcessId == 0) return IDLE_PROCESS_NAME;
+	if (!info.ImageName.Buffer) return UNKNOWN_PROCESS_NAME;
+
+	size_t length = info.ImageName.Length / sizeof(char16_t);
+	if constexpr (sizeof(wchar_t) == sizeof(char16_t)) {
+		return wstring_view(reinterpret_cast<const wchar_t*>(info.ImageName.Buffer), length);
+	}
+	else {
+		buffer.assign(info.ImageName.Buffer, info.ImageName.Buffer + length);
+		return buffer;
+	}
+}
@@ -0,0 +1,216 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "system_probe.h"
+
+// Layouts of the SystemProcessInformation snapshot declared with fixed-width types, so that
+// synthetic snapshots can be built and walked on any platform. Pointer-sized fields and the
+// padding around them follow the pointer size of the build, as on Windows.
+#if UINTPTR_MAX > UINT32_MAX
+#define NT_POINTER_64
+#endif
+
+typedef int32_t KPRIORITY;
+
+struct NT_FILETIME {
+	uint32_t dwLowDateTime;
+	uint32_t dwHighDateTime;
+};
+
+struct CLIENT_ID {
+	uint32_t UniqueProcess; // Process ID
+#ifdef NT_POINTER_64
+	uint32_t pad1;
+#endif
+	uint32_t UniqueThread;  // Thread ID
+#ifdef NT_POINTER_64
+	uint32_t pad2;
+#endif
+};
+
+typedef struct {
+	NT_FILETIME ProcessorTime;
+	NT_FILETIME UserTime;
+	NT_FILETIME CreateTime;
+	uint32_t WaitTime;
+#ifdef NT_POINTER_64
+	uint32_t pad1;
+#endif
+	uintptr_t StartAddress;
+	CLIENT_ID Client_Id;
+	KPRIORITY CurrentPriority;
+	KPRIORITY BasePriority;
+	uint32_t ContextSwitchesPerSec;
+	uint32_t ThreadState;
+	uint32_t ThreadWaitReason;
+	uint32_t pad2;
+} SYSTEM_THREAD_INFORMATION;
+
+typedef struct {
+	uint16_t Length;
+	uint16_t MaximumLength;
+	const char16_t* Buffer;
+} UNICODE_STRING;
+
+typedef struct {
+	uintptr_t PeakVirtualSize;
+	uintptr_t VirtualSize;
+	uint32_t PageFaultCount;
+#ifdef NT_POINTER_64
+	uint32_t pad1;
+#endif
+	uintptr_t PeakWorkingSetSize;
+	uintptr_t WorkingSetSize;
+	uintptr_t QuotaPeakPagedPoolUsage;
+	uintptr_t QuotaPagedPoolUsage;
+	uintptr_t QuotaPeakNonPagedPoolUsage;
+	uintptr_t QuotaNonPagedPoolUsage;
+	uintptr_t PagefileUsage;
+	uintptr_t PeakPagefileUsage;
+} VM_COUNTERS;
+
+typedef struct {
+	uint64_t ReadOperationCount;
+	uint64_t WriteOperationCount;
+	uint64_t OtherOperationCount;
+	uint64_t ReadTransferCount;
+	uint64_t WriteTransferCount;
+	uint64_t OtherTransferCount;
+} NT_IO_COUNTERS;
+
+typedef struct {
+	uint32_t NextOffset;
+	uint32_t ThreadCount;
+	int64_t WorkingSetPrivateSize;
+	uint32_t HardFaultCount;
+	uint32_t NumberOfThreadsHighWatermark;
+	uint64_t CycleTime;
+	NT_FILETIME CreateTime;
+	NT_FILETIME UserTime;
+	NT_FILETIME KernelTime;
+	UNICODE_STRING ImageName;
+	KPRIORITY BasePriority;
+#ifdef NT_POINTER_64
+	uint32_t pad1;
+#endif
+	uint32_t ProcessId;
+#ifdef NT_POINTER_64
+	uint32_t pad2;
+#endif
+	uint32_t InheritedFromProcessId;
+#ifdef NT_POINTER_64
+	uint32_t pad3;
+#endif
+	uint32_t HandleCount;
+	uint32_t SessionId;
+	uintptr_t UniqueProcessKey; // always NULL, use SystemExtendedProcessInformation (57) to get value
+	VM_COUNTERS VirtualMemoryCounters;
+	uintptr_t PrivatePageCount;
+	NT_IO_COUNTERS IoCounters;
+	SYSTEM_THREAD_INFORMATION ThreadInfos[1];
+} SYSTEM_PROCESS_INFORMATION;
+
+const int32_t SNAPSHOT_STATUS_INFO_LENGTH_MISMATCH = static_cast<int32_t>(0xC0000004);
+
+inline int64_t fileTimeToInt64(const NT_FILETIME& file_time) {
+	return static_cast<int64_t>((static_cast<uint64_t>(file_time.dwHighDateTime) << 32) | file_time.dwLowDateTime);
+}
+
+// Buffer for the snapshot that is kept between ticks. Fill asks for the snapshot with the current
+// size first and only grows the buffer, with headroom, when the system reports that it is too small,
+// so the steady state is one query per tick.
+class SnapshotBuffer {
+public:
+	template <class Query>
+	int32_t Fill(Query query);
+	const uint8_t* Data() const { return buffer_.data(); }
+	size_t Size() const { return size_; }
+	size_t Capacity() const { return buffer_.size(); }
+	size_t Queries() const { return queries_; }
+private:
+	static const size_t INITIAL_SIZE = 256 * 1024;
+	static const size_t GRANULARITY = 64 * 1024;
+	static const int MAX_ATTEMPTS = 8;
+	std::vector<uint8_t> buffer_;
+	size_t size_ = 0;
+	size_t queries_ = 0;
+	void Grow(size_t required);
+};
+
+// Query must have the NtQuerySystemInformation shape: (void* data, uint32_t size, uint32_t* required) -> status.
+template <class Query>
+int32_t SnapshotBuffer::Fill(Query query) {
+	if (buffer_.empty()) buffer_.resize(INITIAL_SIZE);
+	size_ = 0;
+	int32_t status = SNAPSHOT_STATUS_INFO_LENGTH_MISMATCH;
+	for (int attempt = 0; attempt < MAX_ATTEMPTS && status == SNAPSHOT_STATUS_INFO_LENGTH_MISMATCH; ++attempt) {
+		uint32_t required = 0;
+		++queries_;
+		status = query(buffer_.data(), static_cast<uint32_t>(buffer_.size()), &required);
+		if (status == SNAPSHOT_STATUS_INFO_LENGTH_MISMATCH) {
+			Grow(required);
+		}
+		else if (status == 0) {
+			size_ = required && required <= buffer_.size() ? required : buffer_.size();
+		}
+	}
+	return status;
+}
+
+// Walks the entries of a filled snapshot in place. Every entry is bounds-checked against the
+// buffer; a malformed chain stops the walk and leaves IsComplete() false.
+class ProcessSnapshotWalker {
+public:
+	ProcessSnapshotWalker(const uint8_t* data, size_t size);
+	const SYSTEM_PROCESS_INFORMATION* Next();
+	bool IsComplete() const { return is_complete_; }
+private:
+	const uint8_t* data_;
+	size_t size_;
+	size_t offset_;
+	bool is_end_;
+	bool is_complete_;
+};
+
+bool IsImageNameInFilter(const SYSTEM_PROCESS_INFORMATION& info, const std::unordered_set<std::wstring>& process_filter);
+std::wstring_view ImageName(const SYSTEM_PROCESS_INFORMATION& info, std::wstring& buffer);
+
+// Passes the processes of the snapshot that match the filter, each followed by its threads, to the visitor.
+// on_process(info) is called before a process is visited and thread_affinity(info, thread) supplies the
+// GroupAffinity of every thread, which the snapshot does not contain.
+template <class OnProcess, class ThreadAffinity>
+bool VisitProcessSnapshot(const uint8_t* data, size_t size, const std::unordered_set<std::wstring>& process_filter,
+	std::wstring& image_name, ProcessVisitor& visitor, OnProcess on_process, ThreadAffinity thread_affinity) {
+	ProcessSnapshotWalker walker(data, size);
+	while (const SYSTEM_PROCESS_INFORMATION* info = walker.Next()) {
+		if (!IsImageNameInFilter(*info, process_filter)) continue;
+
+		on_process(*info);
+		visitor.Process({
+			info->ProcessId,
+			ImageName(*info, image_name),
+			fileTimeToInt64(info->CreateTime),
+			fileTimeToInt64(info->UserTime),
+			fileTimeToInt64(info->KernelTime),
+			info->ThreadCount
+			});
+
+		for (uint32_t j = 0; j < info->ThreadCount; ++j) {
+			const SYSTEM_THREAD_INFORMATION& thread = info->ThreadInfos[j];
+			visitor.Thread({
+				thread.Client_Id.UniqueThread,
+				fileTimeToInt64(thread.CreateTime),
+				fileTimeToInt64(thread.UserTime),
+				thread.ThreadState,
+				thread.ThreadWaitReason,
+				thread_affinity(*info, thread)
+				});
+		}
+	}
+	return walker.IsComplete();
+}
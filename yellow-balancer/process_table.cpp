@@ -0,0 +1,216 @@
+﻿#include "process_table.h"
+#include "Logger.h"
+
+using namespace std;
+
+static auto LOGGER = Logger::getInstance();
+
+static const uint32_t MIN_BLOCK_CLASS = 2;
+
+static uint32_t blockClass(uint32_t count) {
+	uint32_t block_class = MIN_BLOCK_CLASS;
+	while ((uint32_t(1) << block_class) < count) ++block_class;
+	return block_class;
+}
+
+ThreadRange ThreadStore::Allocate(uint32_t count) {
+	uint32_t block_class = blockClass(count);
+	uint32_t capacity = uint32_t(1) << block_class;
+	if (block_class < free_blocks_.size() && !free_blocks_[block_class].empty()) {
+		uint32_t offset = free_blocks_[block_class].back();
+		free_blocks_[block_class].pop_back();
+		return { offset, 0, capacity };
+	}
+	uint32_t offset = static_cast<uint32_t>(thread_id_.size());
+	size_t size = static_cast<size_t>(offset) + capacity;
+	thread_id_.resize(size);
+	create_time_.resize(size);
+	user_time_.resize(size);
+	user_time_delta_.resize(size);
+	thread_state_.resize(size);
+	thread_wait_reason_.resize(size);
+	affinity_.resize(size);
+	return { offset, 0, capacity };
+}
+
+void ThreadStore::Release(ThreadRange& range) {
+	if (range.capacity_) {
+		uint32_t block_class = blockClass(range.capacity_);
+		if (block_class >= free_blocks_.size()) free_blocks_.resize(block_class + 1);
+		free_blocks_[block_class].push_back(range.offset_);
+	}
+	range = { 0, 0, 0 };
+}
+
+void ThreadStore::Resize(ThreadRange& range, uint32_t count) {
+	if (count <= range.capacity_ && (count * 4 >= range.capacity_ || range.capacity_ <= (uint32_t(1) << MIN_BLOCK_CLASS))) {
+		return;
+	}
+	ThreadRange new_range = Allocate(count);
+	new_range.count_ = min(range.count_, count);
+	for (uint32_t i = 0; i < new_range.count_; ++i) {
+		Set(new_range.offset_ + i, Get(range.offset_ + i));
+		user_time_delta_[new_range.offset_ + i] = user_time_delta_[range.offset_ + i];
+	}
+	Release(range);
+	range = new_range;
+}
+
+void ThreadStore::Set(uint32_t index, const ThreadInfo& thread) {
+	thread_id_[index] = thread.thread_id_;
+	create_time_[index] = thread.create_time_;
+	user_time_[index] = thread.user_time_;
+	thread_state_[index] = thread.thread_state_;
+	thread_wait_reason_[index] = thread.thread_wait_reason_;
+	affinity_[index] = thread.group_affinity_;
+}
+
+ThreadInfo ThreadStore::Get(uint32_t index) const {
+	return { thread_id_[index], create_time_[index], user_time_[index], thread_state_[index], thread_wait_reason_[index], affinity_[index] };
+}
+
+void ProcessTable::BeginScan() {
+	++generation_;
+	user_times_.Advance();
+	current_ = nullptr;
+	thread_cursor_ = 0;
+	added_ = 0;
+	removed_ = 0;
+}
+
+void ProcessTable::FinishProcess() {
+	if (current_) {
+		current_->threads_.count_ = thread_cursor_;
+		threads_.Resize(current_->threads_, thread_cursor_);
+		current_ = nullptr;
+	}
+	thread_cursor_ = 0;
+	previous_count_ = 0;
+	is_previous_copied_ = false;
+	previous_threads_.clear();
+	previous_cursor_ = 0;
+}
+
+void ProcessTable::Process(const ProcessRecord& process) {
+	FinishProcess();
+
+	auto it = processes_.find(process.pid_);
+	if (it != processes_.end() && it->second.create_time_ != process.create_time_) {
+		threads_.Release(it->second.threads_);
+		user_times_.ReleaseRow(it->second.user_time_row_);
+		processes_.erase(it);
+		it = processes_.end();
+		++removed_;
+	}
+
+	if (it == processes_.end()) {
+		it = processes_.insert(pair<uint32_t, ProcessInfo>(
+			process.pid_,
+			{
+				process.pid_,
+				wstring(process.name_),
+				process.create_time_,
+				process.user_time_,
+				process.kernel_time_,
+				user_times_.AddRow(),
+				threads_.Allocate(process.thread_count_),
+				generation_
+			}
+		)).first;
+		++added_;
+		if (!saved_.empty()) RestoreProcess(it->second);
+	}
+	else {
+		ProcessInfo& info = it->second;
+		user_times_.Set(info.user_time_row_, process.user_time_ - info.cur_user_time_);
+		info.cur_user_time_ = process.user_time_;
+		info.cur_kernel_time_ = process.kernel_time_;
+		info.generation_ = generation_;
+		if (process.thread_count_ > info.threads_.capacity_) threads_.Resize(info.threads_, process.thread_count_);
+		previous_count_ = info.threads_.count_;
+	}
+	current_ = &it->second;
+}
+
+void ProcessTable::Thread(const ThreadInfo& thread) {
+	if (!current_) return;
+	ThreadRange& range = current_->threads_;
+	if (thread_cursor_ >= range.capacity_) {
+		range.count_ = thread_cursor_;
+		threads_.Resize(range, thread_cursor_ + 1);
+	}
+	uint32_t index = range.offset_ + thread_cursor_;
+	int64_t delta = UserTimeDelta(index, thread);
+	threads_.Set(index, thread);
+	threads_.SetUserTimeDelta(index, delta);
+	++thread_cursor_;
+}
+
+// Called before the thread is written over the slot of the same position in the previous scan.
+int64_t ProcessTable::UserTimeDelta(uint32_t index, const ThreadInfo& thread) {
+	if (!is_previous_copied_) {
+		if (thread_cursor_ < previous_count_ && threads_.ThreadId(index) == thread.thread_id_) {
+			return max<int64_t>(thread.user_time_ - threads_.UserTime(index), 0);
+		}
+		for (uint32_t i = thread_cursor_; i < previous_count_; ++i) {
+			uint32_t previous = index - thread_cursor_ + i;
+			previous_threads_.push_back({ threads_.ThreadId(previous), threads_.UserTime(previous) });
+		}
+		is_previous_copied_ = true;
+	}
+	for (size_t i = previous_cursor_; i < previous_threads_.size(); ++i) {
+		if (previous_threads_[i].thread_id_ == thread.thread_id_) {
+			previous_cursor_ = i + 1;
+			return max<int64_t>(thread.user_time_ - previous_threads_[i].user_time_, 0);
+		}
+	}
+	return 0;
+}
+
+void ProcessTable::Restore(uint64_t generation, unordered_map<uint32_t, SavedProcess> processes) {
+	generation_ = max(generation_, generation);
+	saved_ = move(processes);
+	restored_ = 0;
+}
+
+void ProcessTable::RestoreProcess(ProcessInfo& info) {
+	auto it = saved_.find(info.pid_);
+	if (it == saved_.end() || it->second.create_time_ != info.create_time_) return;
+	user_times_.RestoreRow(info.user_time_row_, it->second.user_times_.data(), it->second.user_times_.size());
+	info.moved_generation_ = it->second.moved_generation_;
+	info.origin_node_ = it->second.origin_node_;
+	saved_.erase(it);
+	++restored_;
+}
+
+void ProcessTable::EndScan(bool is_complete) {
+	FinishProcess();
+	if (is_complete) {
+		saved_.clear();
+		for (auto it = processes_.begin(); it != processes_.end();) {
+			if (it->second.generation_ != generation_) {
+				threads_.Release(it->second.threads_);
+				user_times_.ReleaseRow(it->second.user_time_row_);
+				it = processes_.erase(it);
+				++removed_;
+			}
+			else {
+				++it;
+			}
+		}
+	}
+	user_times_.Aggregate();
+	if (LOGGER->IsEnabled(Logger::Type::Trace)) LogUserTimes();
+}
+
+void ProcessTable::LogUserTimes() {
+	for (auto it = processes_.begin(); it != processes_.end(); ++it) {
+		const ProcessInfo& info = it->second;
+		if (!user_times_.IsFull(info.user_time_row_)) continue;
+		LOGGER->Print(Logger::Type::Trace, false,
+			L"AVG USER_TIME=", user_times_.Avg(info.user_time_row_),
+			L" DELTA=", user_times_.Delta(info.user_time_row_),
+			L" for process ", info.name_,
+			L" with pid ", info.pid_);
+	}
+}
@@ -0,0 +1,115 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "system_probe.h"
+#include "time_series_store.h"
+
+struct ThreadRange {
+	uint32_t offset_;
+	uint32_t count_;
+	uint32_t capacity_;
+};
+
+// Structure-of-arrays pool for the threads of all tracked processes. Each process owns a block
+// with a power-of-two capacity; released blocks are reused, so the pool stops growing once the
+// set of processes is stable.
+class ThreadStore {
+public:
+	ThreadRange Allocate(uint32_t count);
+	void Release(ThreadRange& range);
+	void Resize(ThreadRange& range, uint32_t count);
+	void Set(uint32_t index, const ThreadInfo& thread);
+	ThreadInfo Get(uint32_t index) const;
+	uint32_t ThreadId(uint32_t index) const { return thread_id_[index]; }
+	const GroupAffinity& Affinity(uint32_t index) const { return affinity_[index]; }
+	int64_t UserTime(uint32_t index) const { return user_time_[index]; }
+	// USER_TIME of the thread since the previous scan, 0 on the scan that found it.
+	int64_t UserTimeDelta(uint32_t index) const { return user_time_delta_[index]; }
+	void SetUserTimeDelta(uint32_t index, int64_t delta) { user_time_delta_[index] = delta; }
+	size_t Capacity() const { return thread_id_.size(); }
+private:
+	std::vector<uint32_t> thread_id_;
+	std::vector<int64_t> create_time_;
+	std::vector<int64_t> user_time_;
+	std::vector<int64_t> user_time_delta_;
+	std::vector<uint32_t> thread_state_;
+	std::vector<uint32_t> thread_wait_reason_;
+	std::vector<GroupAffinity> affinity_;
+	std::vector<std::vector<uint32_t>> free_blocks_;
+};
+
+struct ProcessInfo {
+	uint32_t pid_;
+	std::wstring name_;
+	int64_t create_time_;
+	int64_t cur_user_time_;
+	int64_t cur_kernel_time_;
+	uint32_t user_time_row_;
+	ThreadRange threads_;
+	uint64_t generation_;
+	// Scan of the last move of the process by the balancer (0 - never moved) and the node it left then, -1 for none.
+	uint64_t moved_generation_ = 0;
+	int origin_node_ = -1;
+};
+
+// A process of a previous run of the service, with its USER_TIME samples oldest first.
+struct SavedProcess {
+	int64_t create_time_;
+	uint64_t moved_generation_;
+	int origin_node_;
+	std::vector<int64_t> user_times_;
+};
+
+// Persistent table of the filtered processes. A scan stamps every process it sees with the current
+// generation; processes that are new, restarted under the same pid or gone are the only ones that
+// allocate or free anything. USER_TIME deltas go to a row of UserTimes(), aggregated at EndScan.
+class ProcessTable : public ProcessVisitor {
+public:
+	using Map = std::unordered_map<uint32_t, ProcessInfo>;
+	void SetRingBufferSize(size_t ring_buffer_size) { user_times_.SetWindow(ring_buffer_size); }
+	// The USER_TIME deltas of the window were taken over old_interval, the next ones over new_interval.
+	void ScaleUserTimes(int new_interval, int old_interval) { user_times_.Scale(new_interval, old_interval); }
+	void BeginScan();
+	void Process(const ProcessRecord& process) override;
+	void Thread(const ThreadInfo& thread) override;
+	void EndScan(bool is_complete);
+	// Continues the generations of a previous run. A process the next complete scan finds with the same pid
+	// and create time takes over its samples and last move, the processes it does not find are dropped.
+	void Restore(uint64_t generation, std::unordered_map<uint32_t, SavedProcess> processes);
+	size_t Restored() const { return restored_; }
+	Map& Processes() { return processes_; }
+	const ThreadStore& Threads() const { return threads_; }
+	const TimeSeriesStore& UserTimes() const { return user_times_; }
+	uint64_t Generation() const { return generation_; }
+	size_t Added() const { return added_; }
+	size_t Removed() const { return removed_; }
+private:
+	Map processes_;
+	ThreadStore threads_;
+	TimeSeriesStore user_times_;
+	uint64_t generation_ = 0;
+	ProcessInfo* current_ = nullptr;
+	uint32_t thread_cursor_ = 0;
+	// The threads come in the same order on every scan and are compared with the previous scan in place.
+	// From the first thread that differs the rest of the previous threads is copied aside and matched
+	// with one pass that skips the exited ones.
+	struct ThreadTime {
+		uint32_t thread_id_;
+		int64_t user_time_;
+	};
+	uint32_t previous_count_ = 0;
+	bool is_previous_copied_ = false;
+	std::vector<ThreadTime> previous_threads_;
+	size_t previous_cursor_ = 0;
+	int64_t UserTimeDelta(uint32_t index, const ThreadInfo& thread);
+	size_t added_ = 0;
+	size_t removed_ = 0;
+	std::unordered_map<uint32_t, SavedProcess> saved_;
+	size_t restored_ = 0;
+	void RestoreProcess(ProcessInfo& info);
+	void FinishProcess();
+	void LogUserTimes();
+};
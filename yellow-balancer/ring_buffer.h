@@ -1,42 +1,182 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 #include <vector>
-#include <numeric>
 
-template <class T>
+// Storage of a RingBuffer: a vector sized at construction, or an inline array when the capacity is a template argument.
+template <class T, size_t N>
+using RingStorage = std::conditional_t<N == 0, std::vector<T>, std::array<T, N>>;
+
+// Window of the last Capacity() values with running aggregates, all of them read in O(1):
+// the sum (Avg), the minimum and maximum (monotonic queues of samples) and the variance
+// (Welford's algorithm with removal of the value that leaves the window).
+// Floating-point aggregates are recomputed from the window once per wrap-around, so rounding
+// errors of add/remove do not accumulate; that keeps Add amortized O(1).
+// N > 0 fixes the capacity at compile time and keeps the window inline.
+template <class T, size_t N = 0>
 class RingBuffer {
 public:
-	RingBuffer(size_t size);
+	explicit RingBuffer(size_t size = N);
 	void Add(T value);
-	size_t Size() { return size_; }
-	size_t Capacity() { return buffer_.size(); }
-	T Avg();
+	// Changes the capacity of a runtime-sized buffer, the most recent values that fit stay in it.
+	void Resize(size_t size);
+	size_t Size() const { return size_; }
+	size_t Capacity() const { return buffer_.size(); }
+	T Sum() const { return sum_; }
+	T Avg() const;
+	T Min() const;
+	T Max() const;
+	T Last() const;
+	// The i-th oldest value of the window, i < Size().
+	T At(size_t i) const;
+	double Variance() const;
+	double StdDev() const { return std::sqrt(Variance()); }
 private:
-	std::vector<T> buffer_;
-	size_t index_;
-	size_t size_;
+	struct Sample {
+		uint64_t number_;
+		size_t index_;
+	};
+	// Candidates for the minimum (or maximum) in the order of arrival.
+	struct MonotonicQueue {
+		RingStorage<Sample, N> samples_;
+		size_t head_ = 0;
+		size_t count_ = 0;
+		const Sample& Front() const { return samples_[head_]; }
+		const Sample& Back() const { return samples_[Wrap(head_ + count_ - 1)]; }
+		void PopFront() { head_ = Wrap(head_ + 1); --count_; }
+		void PopBack() { --count_; }
+		void PushBack(const Sample& sample) { samples_[Wrap(head_ + count_)] = sample; ++count_; }
+		size_t Wrap(size_t index) const { return index >= samples_.size() ? index - samples_.size() : index; }
+	};
+	RingStorage<T, N> buffer_;
+	size_t index_ = 0;
+	size_t size_ = 0;
+	uint64_t added_ = 0;
+	T sum_ = 0;
+	double mean_ = 0.0;
+	double m2_ = 0.0;
+	MonotonicQueue min_;
+	MonotonicQueue max_;
+	template <class Less>
+	void Push(MonotonicQueue& queue, const Sample& sample, Less less);
+	void Recompute();
 };
 
-template <typename T>
-RingBuffer<T>::RingBuffer(size_t size) {
-	buffer_.resize(size);
-	index_ = 0;
-	size_ = 0;
+template <class T, size_t N>
+RingBuffer<T, N>::RingBuffer(size_t size) {
+	if constexpr (N == 0) {
+		buffer_.resize(size ? size : 1);
+		min_.samples_.resize(buffer_.size());
+		max_.samples_.resize(buffer_.size());
+	}
+	else {
+		buffer_.fill(0);
+	}
 }
 
-template <typename T>
-void RingBuffer<T>::Add(T value) {
+// Drops the sample that left the window from the front (its slot already holds the new value) and
+// the samples that can no longer be the extreme from the back.
+template <class T, size_t N>
+template <class Less>
+void RingBuffer<T, N>::Push(MonotonicQueue& queue, const Sample& sample, Less less) {
+	while (queue.count_ && queue.Front().number_ + buffer_.size() <= sample.number_) queue.PopFront();
+	while (queue.count_ && !less(buffer_[queue.Back().index_], buffer_[sample.index_])) queue.PopBack();
+	queue.PushBack(sample);
+}
+
+template <class T, size_t N>
+void RingBuffer<T, N>::Add(T value) {
+	T removed = buffer_[index_];
+	bool is_full = size_ == buffer_.size();
+	uint64_t number = added_++;
+
 	buffer_[index_] = value;
+	Push(min_, { number, index_ }, [](const T& lhs, const T& rhs) { return lhs < rhs; });
+	Push(max_, { number, index_ }, [](const T& lhs, const T& rhs) { return lhs > rhs; });
+
+	double x = static_cast<double>(value);
+	if (is_full) {
+		sum_ += value - removed;
+		double x_removed = static_cast<double>(removed);
+		double old_mean = mean_;
+		mean_ += (x - x_removed) / static_cast<double>(size_);
+		m2_ += (x - x_removed) * (x - mean_ + x_removed - old_mean);
+	}
+	else {
+		sum_ += value;
+		++size_;
+		double delta = x - mean_;
+		mean_ += delta / static_cast<double>(size_);
+		m2_ += delta * (x - mean_);
+	}
 	++index_;
-	if (index_ >= buffer_.size()) index_ = 0;
-	if (size_ < buffer_.size()) ++size_;
+	if (index_ >= buffer_.size()) {
+		index_ = 0;
+		Recompute();
+	}
 }
 
-template <typename T>
-T RingBuffer<T>::Avg() {
-	T zero = 0;
+template <class T, size_t N>
+void RingBuffer<T, N>::Resize(size_t size) {
+	static_assert(N == 0, "the capacity of an inline RingBuffer is fixed");
+	RingBuffer resized(size);
+	size_t kept = std::min(size_, resized.Capacity());
+	for (size_t i = size_ - kept; i < size_; ++i) {
+		resized.Add(At(i));
+	}
+	*this = std::move(resized);
+}
+
+template <class T, size_t N>
+void RingBuffer<T, N>::Recompute() {
+	T sum = 0;
+	for (size_t i = 0; i < size_; ++i) sum += buffer_[i];
+	sum_ = sum;
+	mean_ = static_cast<double>(sum_) / static_cast<double>(size_);
+	m2_ = 0.0;
+	for (size_t i = 0; i < size_; ++i) {
+		double delta = static_cast<double>(buffer_[i]) - mean_;
+		m2_ += delta * delta;
+	}
+}
+
+template <class T, size_t N>
+T RingBuffer<T, N>::Avg() const {
 	if (size_) {
-		return std::accumulate(buffer_.begin(), buffer_.begin() + size_, zero) / size_;
+		return sum_ / static_cast<T>(size_);
 	}
 	return 0;
-}
\ No newline at end of file
+}
+
+template <class T, size_t N>
+T RingBuffer<T, N>::Min() const {
+	return min_.count_ ? buffer_[min_.Front().index_] : 0;
+}
+
+template <class T, size_t N>
+T RingBuffer<T, N>::Max() const {
+	return max_.count_ ? buffer_[max_.Front().index_] : 0;
+}
+
+template <class T, size_t N>
+T RingBuffer<T, N>::Last() const {
+	return added_ ? buffer_[index_ ? index_ - 1 : buffer_.size() - 1] : 0;
+}
+
+template <class T, size_t N>
+T RingBuffer<T, N>::At(size_t i) const {
+	size_t oldest = size_ == buffer_.size() ? index_ : 0;
+	return buffer_[(oldest + i) % buffer_.size()];
+}
+
+// Population variance of the window.
+template <class T, size_t N>
+double RingBuffer<T, N>::Variance() const {
+	return size_ > 1 && m2_ > 0.0 ? m2_ / static_cast<double>(size_) : 0.0;
+}
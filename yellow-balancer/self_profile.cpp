@@ -0,0 +1,88 @@
+﻿#include "self_profile.h"
+#include "Logger.h"
+
+using namespace std;
+
+static auto LOGGER = Logger::getInstance();
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+	if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+	int msb = 0;
+	for (int step = 32; step; step >>= 1) {
+		if (value >> (msb + step)) msb += step;
+	}
+	int shift = msb - SUB_BUCKET_BITS;
+	return (static_cast<size_t>(shift + 1) << SUB_BUCKET_BITS) + static_cast<size_t>((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t index) {
+	if (index < SUB_BUCKETS) return index;
+	int shift = static_cast<int>(index >> SUB_BUCKET_BITS) - 1;
+	uint64_t mantissa = (index & (SUB_BUCKETS - 1)) | SUB_BUCKETS;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+	counts_[BucketIndex(value)].fetch_add(1, memory_order_relaxed);
+	count_.fetch_add(1, memory_order_relaxed);
+	sum_.fetch_add(value, memory_order_relaxed);
+	uint64_t max = max_.load(memory_order_relaxed);
+	while (value > max && !max_.compare_exchange_weak(max, value, memory_order_relaxed)) {}
+}
+
+uint64_t LatencyHistogram::Quantile(double quantile) const {
+	uint64_t count = Count();
+	if (count == 0) return 0;
+	uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count) + 0.5);
+	if (rank == 0) rank = 1;
+	uint64_t cumulative = 0;
+	for (size_t i = 0; i < BUCKETS; ++i) {
+		cumulative += counts_[i].load(memory_order_relaxed);
+		if (cumulative >= rank) return min(BucketUpperBound(i), Max());
+	}
+	return Max();
+}
+
+void SelfProfile::Add(Phase phase, uint64_t nanoseconds, uint64_t syscalls, uint64_t allocations) {
+	PhaseStats& stats = phases_[phase];
+	stats.latency_.Record(nanoseconds);
+	stats.syscalls_.fetch_add(syscalls, memory_order_relaxed);
+	stats.allocations_.fetch_add(allocations, memory_order_relaxed);
+}
+
+const char* SelfProfile::PhaseName(Phase phase) {
+	static const char* names[PHASE_COUNT] = { "Read", "ActiveProcesses", "GetAvgValues", "SetAffinity", "PlanPlacement", "ApplyPlan", "SampleMemory", "SaveState" };
+	return phase < PHASE_COUNT ? names[phase] : "unknown";
+}
+
+bool SelfProfile::AppendPhase(string& line, Phase phase) const {
+	const PhaseStats& stats = phases_[phase];
+	uint64_t calls = stats.latency_.Count();
+	if (calls == 0) return false;
+	double runs = static_cast<double>(calls);
+	line.append(PhaseName(phase)).append(";calls=");
+	appendLog(line, calls);
+	line.append(";mean ns=");
+	appendLog(line, stats.latency_.Sum() / calls);
+	line.append(";p50 ns=");
+	appendLog(line, stats.latency_.Quantile(0.5));
+	line.append(";p90 ns=");
+	appendLog(line, stats.latency_.Quantile(0.9));
+	line.append(";p99 ns=");
+	appendLog(line, stats.latency_.Quantile(0.99));
+	line.append(";max ns=");
+	appendLog(line, stats.latency_.Max());
+	line.append(";syscalls per call=");
+	appendLog(line, static_cast<double>(stats.syscalls_.load(memory_order_relaxed)) / runs);
+	line.append(";allocations per call=");
+	appendLog(line, static_cast<double>(stats.allocations_.load(memory_order_relaxed)) / runs);
+	return true;
+}
+
+void SelfProfile::Log() const {
+	string line;
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		line.assign("Profile ");
+		if (AppendPhase(line, static_cast<Phase>(i))) LOGGER->Print(line, Logger::Type::Info, true);
+	}
+}
@@ -0,0 +1,88 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Counts of the calling thread: the OS calls made by the system probes and the calls of the global
+// operator new when allocation_hook.cpp is linked in. A phase takes the difference of its thread's
+// counts, so the calls of other threads never get into it.
+struct ThreadCounters {
+	uint64_t syscalls_;
+	uint64_t allocations_;
+};
+
+inline thread_local ThreadCounters thread_counters = {};
+
+inline void CountSyscalls(uint64_t count = 1) {
+	thread_counters.syscalls_ += count;
+}
+
+// Log-linear histogram of durations in nanoseconds, as HdrHistogram keeps them: every power of two is
+// split into 16 linear sub-buckets, so a reported value is within 1/16 of the recorded one. Record is
+// a few relaxed atomic operations and does not lock, the histogram may be read while it is recorded.
+class LatencyHistogram {
+public:
+	static const int SUB_BUCKET_BITS = 4;
+	static const size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+	static const size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+	void Record(uint64_t value);
+	uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+	uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+	// The upper bound of the bucket that holds the given quantile (0..1) of the recorded values.
+	uint64_t Quantile(double quantile) const;
+	static size_t BucketIndex(uint64_t value);
+	static uint64_t BucketUpperBound(size_t index);
+private:
+	std::atomic<uint64_t> counts_[BUCKETS] = {};
+	std::atomic<uint64_t> count_{ 0 };
+	std::atomic<uint64_t> sum_{ 0 };
+	std::atomic<uint64_t> max_{ 0 };
+};
+
+// Durations, OS calls and allocations of the phases of the worker tick since the start of the service.
+class SelfProfile {
+public:
+	enum Phase { Read, ActiveProcesses, GetAvgValues, SetAffinity, PlanPlacement, ApplyPlan, SampleMemory, SaveState, PHASE_COUNT };
+	void Add(Phase phase, uint64_t nanoseconds, uint64_t syscalls, uint64_t allocations);
+	const LatencyHistogram& Latency(Phase phase) const { return phases_[phase].latency_; }
+	// Appends the summary of a phase; false when the phase has not run yet.
+	bool AppendPhase(std::string& line, Phase phase) const;
+	// Writes the summary of every phase that has run at info level.
+	void Log() const;
+	static const char* PhaseName(Phase phase);
+private:
+	struct PhaseStats {
+		LatencyHistogram latency_;
+		std::atomic<uint64_t> syscalls_{ 0 };
+		std::atomic<uint64_t> allocations_{ 0 };
+	};
+	PhaseStats phases_[PHASE_COUNT];
+};
+
+// Measures the scope it lives in as one run of the phase.
+class ScopedPhase {
+public:
+	ScopedPhase(SelfProfile& profile, SelfProfile::Phase phase) :
+		profile_(profile),
+		phase_(phase),
+		counters_(thread_counters),
+		start_(std::chrono::steady_clock::now()) {
+	}
+	ScopedPhase(const ScopedPhase&) = delete;
+	ScopedPhase& operator=(const ScopedPhase&) = delete;
+	~ScopedPhase() {
+		auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+		profile_.Add(phase_, static_cast<uint64_t>(nanoseconds),
+			thread_counters.syscalls_ - counters_.syscalls_,
+			thread_counters.allocations_ - counters_.allocations_);
+	}
+private:
+	SelfProfile& profile_;
+	SelfProfile::Phase phase_;
+	ThreadCounters counters_;
+	std::chrono::steady_clock::time_point start_;
+};
@@ -7,6 +7,12 @@ namespace json = boost::json;
 
 static auto LOGGER = Logger::getInstance();
 
+#ifdef _WIN32
+#define DEFAULT_PROCESS "rphost.exe"
+#else
+#define DEFAULT_PROCESS "rphost"
+#endif
+
 void Settings::CreateSettings(const fs::path& file_path) {
     if (!fs::exists(file_path)) {
         const std::string json = R"({ 
@@ -15,7 +21,22 @@ void Settings::CreateSettings(const fs::path& file_path) {
   "log_storage_duration_in_hours" : 24,
   "maximum_cpu_value" : 70,
   "delta_cpu_values" : 30,
-  "processes" : ["rphost.exe"]
+  "migration_cost_percent" : 5,
+  "remote_memory_penalty_percent" : 30,
+  "memory_migration_in_megabytes_per_second" : 128,
+  "minimum_dwell_time_in_seconds" : 300,
+  "maximum_moves_per_tick" : 4,
+  "move_damping_percent" : 100,
+  "sample_interval_in_milliseconds" : 1000,
+  "journal_size_in_megabytes" : 16,
+  "metrics_port" : 0,
+  "profile_log_period_in_minutes" : 60,
+  "state_save_period_in_seconds" : 60,
+  "state_max_age_in_seconds" : 300,
+  "thread_balancing" : false,
+  "spawn_placement" : true,
+  "fast_warm_up" : true,
+  "processes" : [")" DEFAULT_PROCESS R"("]
 })";
         ofstream out(file_path);
         out << json;
@@ -39,6 +60,29 @@ void ReadValue(json::object* j_object, int& value, const char* key, bool& result
     }
 }
 
+void ReadValue(json::object* j_object, bool& value, const char* key, bool& result) {
+    json::object::iterator it = j_object->find(key);
+    if (it != j_object->cend()) {
+        if (it->value().if_bool()) {
+            value = it->value().as_bool();
+        }
+        else {
+            result = false;
+        }
+    }
+    else {
+        result = false;
+    }
+}
+
+// Keys added in later versions keep their default value when an older settings.json does not have them.
+template <class T>
+static void ReadOptionalValue(json::object* j_object, T& value, const char* key, bool& result) {
+    if (j_object->find(key) != j_object->cend()) {
+        ReadValue(j_object, value, key, result);
+    }
+}
+
 void ReadValue(json::object* j_object, vector<wstring>& value, const char* key, bool& result) {
     json::object::iterator it = j_object->find(key);
     if (it != j_object->cend()) {
@@ -85,6 +129,21 @@ bool Settings::Read(fs::path dir) {
             ReadValue(j_object, log_storage_duration_, "log_storage_duration_in_hours", is_correct);
             ReadValue(j_object, maximum_cpu_value_, "maximum_cpu_value", is_correct);
             ReadValue(j_object, delta_cpu_values_, "delta_cpu_values", is_correct);
+            ReadOptionalValue(j_object, migration_cost_, "migration_cost_percent", is_correct);
+            ReadOptionalValue(j_object, remote_memory_penalty_, "remote_memory_penalty_percent", is_correct);
+            ReadOptionalValue(j_object, memory_migration_, "memory_migration_in_megabytes_per_second", is_correct);
+            ReadOptionalValue(j_object, minimum_dwell_time_, "minimum_dwell_time_in_seconds", is_correct);
+            ReadOptionalValue(j_object, maximum_moves_per_tick_, "maximum_moves_per_tick", is_correct);
+            ReadOptionalValue(j_object, move_damping_, "move_damping_percent", is_correct);
+            ReadOptionalValue(j_object, sample_interval_, "sample_interval_in_milliseconds", is_correct);
+            ReadOptionalValue(j_object, journal_size_, "journal_size_in_megabytes", is_correct);
+            ReadOptionalValue(j_object, metrics_port_, "metrics_port", is_correct);
+            ReadOptionalValue(j_object, profile_log_period_, "profile_log_period_in_minutes", is_correct);
+            ReadOptionalValue(j_object, state_save_period_, "state_save_period_in_seconds", is_correct);
+            ReadOptionalValue(j_object, state_max_age_, "state_max_age_in_seconds", is_correct);
+            ReadOptionalValue(j_object, is_thread_balancing_, "thread_balancing", is_correct);
+            ReadOptionalValue(j_object, is_spawn_placement_, "spawn_placement", is_correct);
+            ReadOptionalValue(j_object, is_fast_warm_up_, "fast_warm_up", is_correct);
             ReadValue(j_object, processes_, "processes", is_correct);
         }
         else {
@@ -98,7 +157,7 @@ bool Settings::Read(fs::path dir) {
     }
 
     if (processes_.empty()) {
-        processes_.push_back(L"rphost.exe");
+        processes_.push_back(Utf8ToWideChar(DEFAULT_PROCESS));
     }
 
     return is_correct;
@@ -3,7 +3,7 @@
 #include <string>
 #include <filesystem>
 #include <boost/json.hpp>
-#include "logger.h"
+#include "Logger.h"
 #include "encoding_string.h"
 
 class Settings {
@@ -12,6 +12,21 @@ class Settings {
     int log_storage_duration_;
     int maximum_cpu_value_;
     int delta_cpu_values_;
+    int migration_cost_ = 5;
+    int remote_memory_penalty_ = 30;
+    int memory_migration_ = 128;
+    int minimum_dwell_time_ = 300;
+    int maximum_moves_per_tick_ = 4;
+    int move_damping_ = 100;
+    int sample_interval_ = 1000;
+    int journal_size_ = 16;
+    int metrics_port_ = 0;
+    int profile_log_period_ = 60;
+    int state_save_period_ = 60;
+    int state_max_age_ = 300;
+    bool is_thread_balancing_ = false;
+    bool is_spawn_placement_ = true;
+    bool is_fast_warm_up_ = true;
     std::vector<std::wstring> processes_;
     void CreateSettings(const std::filesystem::path& file_path);
 public:
@@ -21,5 +36,20 @@ public:
     int LogStorageDuration() { return log_storage_duration_; }
     int MaximumCpuValue() { return maximum_cpu_value_; }
     int DeltaCpuValues() { return delta_cpu_values_; }
+    int MigrationCost() { return migration_cost_; }
+    int RemoteMemoryPenalty() { return remote_memory_penalty_; }
+    int MemoryMigration() { return memory_migration_; }
+    int MinimumDwellTime() { return minimum_dwell_time_; }
+    int MaximumMovesPerTick() { return maximum_moves_per_tick_; }
+    int MoveDamping() { return move_damping_; }
+    int SampleInterval() { return sample_interval_; }
+    int JournalSize() { return journal_size_; }
+    int MetricsPort() { return metrics_port_; }
+    int ProfileLogPeriod() { return profile_log_period_; }
+    int StateSavePeriod() { return state_save_period_; }
+    int StateMaxAge() { return state_max_age_; }
+    bool IsThreadBalancing() { return is_thread_balancing_; }
+    bool IsSpawnPlacement() { return is_spawn_placement_; }
+    bool IsFastWarmUp() { return is_fast_warm_up_; }
     const std::vector<std::wstring>& Processes() const { return processes_; }
 };
@@ -0,0 +1,95 @@
+﻿#ifndef _WIN32
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include "settings_watcher.h"
+#include "Logger.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+#ifdef _WIN32
+
+bool SettingsWatcher::Start(const fs::path& file_path) {
+	Stop();
+	file_path_ = file_path;
+	error_code ec;
+	write_time_ = fs::last_write_time(file_path_, ec);
+	HANDLE notification = FindFirstChangeNotificationW(file_path_.parent_path().c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (notification == INVALID_HANDLE_VALUE) {
+		LOGGER->Print(Logger::Type::Error, false, L"SettingsWatcher: can't watch ", file_path_.parent_path().wstring(), L". Error ", GetLastError());
+		return false;
+	}
+	notification_ = notification;
+	return true;
+}
+
+void SettingsWatcher::Stop() {
+	if (notification_) {
+		FindCloseChangeNotification(static_cast<HANDLE>(notification_));
+		notification_ = nullptr;
+	}
+}
+
+// The notification is for the whole directory, the logs written next to the file wake it too, so the
+// write time of the file tells whether the file itself changed.
+bool SettingsWatcher::IsChanged() {
+	if (!notification_ || WaitForSingleObject(static_cast<HANDLE>(notification_), 0) != WAIT_OBJECT_0) return false;
+	FindNextChangeNotification(static_cast<HANDLE>(notification_));
+	error_code ec;
+	fs::file_time_type write_time = fs::last_write_time(file_path_, ec);
+	if (ec || write_time == write_time_) return false;
+	write_time_ = write_time;
+	return true;
+}
+
+#else
+
+bool SettingsWatcher::Start(const fs::path& file_path) {
+	Stop();
+	file_path_ = file_path;
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		LOGGER->Print(Logger::Type::Error, false, L"SettingsWatcher: inotify_init1 failed. Error ", errno);
+		return false;
+	}
+	// Editors save by writing the file in place or by renaming a new file over it.
+	if (inotify_add_watch(fd, file_path_.parent_path().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		LOGGER->Print(Logger::Type::Error, false, L"SettingsWatcher: can't watch ", file_path_.parent_path().wstring(), L". Error ", errno);
+		close(fd);
+		return false;
+	}
+	inotify_fd_ = fd;
+	return true;
+}
+
+void SettingsWatcher::Stop() {
+	if (inotify_fd_ >= 0) {
+		close(inotify_fd_);
+		inotify_fd_ = -1;
+	}
+}
+
+// Reads every queued event, so several writes of one save give one reload.
+bool SettingsWatcher::IsChanged() {
+	if (inotify_fd_ < 0) return false;
+	alignas(inotify_event) char buffer[4096];
+	string file_name = file_path_.filename().string();
+	bool is_changed = false;
+	for (;;) {
+		ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+		if (length <= 0) break;
+		for (char* p = buffer; p < buffer + length;) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+			if (event->len && file_name == event->name) is_changed = true;
+			p += sizeof(inotify_event) + event->len;
+		}
+	}
+	return is_changed;
+}
+
+#endif
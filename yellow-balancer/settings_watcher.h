@@ -0,0 +1,25 @@
+﻿#pragma once
+
+#include <filesystem>
+
+// Tells the worker that settings.json was written. The directory of the file is watched, so an editor
+// that saves by replacing the file is noticed too: inotify on Linux, a change notification on Windows.
+// IsChanged does not block and is called from the loop of the worker between the ticks.
+class SettingsWatcher {
+public:
+	SettingsWatcher() = default;
+	SettingsWatcher(const SettingsWatcher&) = delete;
+	SettingsWatcher& operator=(const SettingsWatcher&) = delete;
+	~SettingsWatcher() { Stop(); }
+	bool Start(const std::filesystem::path& file_path);
+	void Stop();
+	bool IsChanged();
+private:
+	std::filesystem::path file_path_;
+#ifdef _WIN32
+	void* notification_ = nullptr;
+	std::filesystem::file_time_type write_time_;
+#else
+	int inotify_fd_ = -1;
+#endif
+};
@@ -0,0 +1,90 @@
+﻿#include "spawn_placer.h"
+#include <algorithm>
+#include <chrono>
+#include "Logger.h"
+
+using namespace std;
+
+static auto LOGGER = Logger::getInstance();
+
+// The longest wait for events, the thread notices Stop after it. A polling source lists the processes once per wait.
+static const int WAIT_MS = 100;
+// The load a new process is expected to add to its node until the next tick, in logical CPUs.
+static const double NEW_PROCESS_LOAD = 1.0;
+
+void SpawnPlacer::SetNodes(const vector<NumaNode>& numa_nodes) {
+	lock_guard<mutex> guard(access_);
+	numa_nodes_ = numa_nodes;
+	capacities_.assign(numa_nodes_.size(), 0.0);
+	loads_.assign(numa_nodes_.size(), 0.0);
+	for (size_t i = 0; i < numa_nodes_.size(); ++i) {
+		int cpus = 0;
+		for (uint64_t mask = numa_nodes_[i].group_mask_.mask_; mask; mask &= mask - 1) ++cpus;
+		capacities_[i] = max(cpus, 1);
+	}
+}
+
+void SpawnPlacer::SetFilter(const unordered_set<wstring>& process_filter) {
+	lock_guard<mutex> guard(access_);
+	process_filter_ = process_filter;
+}
+
+void SpawnPlacer::SetNodeLoads(const vector<double>& values) {
+	lock_guard<mutex> guard(access_);
+	for (size_t i = 0; i < loads_.size(); ++i) {
+		loads_[i] = i + 1 < values.size() ? values[i + 1] / 100.0 * capacities_[i] : 0.0;
+	}
+}
+
+bool SpawnPlacer::Start() {
+	if (thread_.joinable()) return true;
+	source_ = probe_.CreateProcessEventSource();
+	if (!source_) return false;
+	LOGGER->Print(Logger::Type::Info, true, L"New processes are placed at their start;events=", source_->IsEventDriven() ? L"os" : L"polling");
+	is_stop_ = false;
+	thread_ = thread(&SpawnPlacer::Run, this);
+	return true;
+}
+
+void SpawnPlacer::Stop() {
+	is_stop_ = true;
+	if (thread_.joinable()) thread_.join();
+	source_.reset();
+}
+
+void SpawnPlacer::Run() {
+	while (!is_stop_) {
+		pids_.clear();
+		if (!source_->Wait(WAIT_MS, pids_)) {
+			LOGGER->Print(L"SpawnPlacer: process events stopped, new processes wait for the balancer", Logger::Type::Error);
+			return;
+		}
+		for (auto it = pids_.begin(); it != pids_.end(); ++it) {
+			Place(*it);
+		}
+	}
+}
+
+bool SpawnPlacer::Place(uint32_t pid) {
+	auto start = chrono::steady_clock::now();
+	wstring name;
+	if (!probe_.ProcessName(pid, name)) return false;
+	lock_guard<mutex> guard(access_);
+	if (numa_nodes_.size() < 2) return false;
+	if (process_filter_.size() != 0 && process_filter_.find(name) == process_filter_.end()) return false;
+	size_t node = 0;
+	for (size_t i = 1; i < numa_nodes_.size(); ++i) {
+		if (loads_[i] / capacities_[i] < loads_[node] / capacities_[node]) node = i;
+	}
+	const NumaNode& target_node = numa_nodes_[node];
+	if (!probe_.SetNewProcessAffinity(pid, target_node.group_mask_)) return false;
+	loads_[node] += NEW_PROCESS_LOAD;
+	placed_.fetch_add(1, memory_order_relaxed);
+	metrics_.AddSpawnPlacement(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+	LOGGER->Print(Logger::Type::Info, true,
+		name, L";pid=", pid, L";numa=new",
+		L";new numa=", target_node.node_number_,
+		L";new numa group=", target_node.group_mask_.group_,
+		L";new mask=", target_node.group_mask_.mask_);
+	return true;
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "metrics.h"
+#include "system_probe.h"
+
+// Binds a process that passes the filter to the least loaded node as soon as it starts, instead of
+// leaving it where the OS put it until it has a full window of USER_TIME for the planner. The node is
+// chosen by the loads of the nodes alone; every placement counts as one busy CPU of its node until
+// the next tick, so a burst of starts is spread. Once its window is full the process is balanced by
+// its measured load as any other.
+class SpawnPlacer {
+public:
+	SpawnPlacer(SystemProbe& probe, BalancerMetrics& metrics) : probe_(probe), metrics_(metrics) {}
+	SpawnPlacer(const SpawnPlacer&) = delete;
+	SpawnPlacer& operator=(const SpawnPlacer&) = delete;
+	~SpawnPlacer() { Stop(); }
+	void SetNodes(const std::vector<NumaNode>& numa_nodes);
+	void SetFilter(const std::unordered_set<std::wstring>& process_filter);
+	// The counter values of a tick in percent: the total first, then one per node.
+	void SetNodeLoads(const std::vector<double>& values);
+	// Reads the process start events on a thread of its own; without it the owner calls Place itself.
+	bool Start();
+	void Stop();
+	bool IsRunning() const { return thread_.joinable(); }
+	// False when the process does not pass the filter, has exited or can't be bound.
+	bool Place(uint32_t pid);
+	size_t Placed() const { return placed_.load(std::memory_order_relaxed); }
+private:
+	SystemProbe& probe_;
+	BalancerMetrics& metrics_;
+	std::mutex access_;
+	std::vector<NumaNode> numa_nodes_;
+	std::vector<double> capacities_;
+	// Busy logical CPUs of every node.
+	std::vector<double> loads_;
+	std::unordered_set<std::wstring> process_filter_;
+	std::unique_ptr<ProcessEventSource> source_;
+	std::vector<uint32_t> pids_;
+	std::thread thread_;
+	std::atomic<bool> is_stop_{ false };
+	std::atomic<size_t> placed_{ 0 };
+	void Run();
+};
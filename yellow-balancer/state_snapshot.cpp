@@ -0,0 +1,160 @@
+﻿#include "state_snapshot.h"
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include "Logger.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+static const char STATE_MAGIC[8] = { 'Y', 'B', 'S', 'T', 'A', 'T', 'E', 0 };
+
+// FNV-1a of the records, enough to tell a damaged file from a whole one.
+static uint64_t stateChecksum(const char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// The buffer keeps its capacity, a save of a stable set of processes allocates nothing.
+void StateSnapshot::Begin(int switching_frequency, uint64_t generation, int64_t time) {
+	header_ = {};
+	memcpy(header_.magic_, STATE_MAGIC, sizeof(STATE_MAGIC));
+	header_.version_ = VERSION;
+	header_.switching_frequency_ = static_cast<uint32_t>(switching_frequency);
+	header_.generation_ = generation;
+	header_.time_ = time;
+	buffer_.resize(sizeof(Header));
+}
+
+char* StateSnapshot::AddRecord(Type type, size_t size) {
+	RecordHeader record = { type, 0, static_cast<uint32_t>(size) };
+	size_t offset = buffer_.size();
+	buffer_.resize(offset + sizeof(record) + size);
+	memcpy(&buffer_[offset], &record, sizeof(record));
+	return &buffer_[offset + sizeof(record)];
+}
+
+void StateSnapshot::AddProcess(const ProcessInfo& process, const TimeSeriesStore& user_times) {
+	if (samples_.size() < user_times.Window()) samples_.resize(user_times.Window());
+	size_t count = user_times.CopyRow(process.user_time_row_, samples_.data());
+	ProcessRecord record = { process.pid_, process.origin_node_, process.create_time_, process.moved_generation_ };
+	char* data = AddRecord(Process, sizeof(record) + count * sizeof(int64_t));
+	memcpy(data, &record, sizeof(record));
+	if (count) memcpy(data + sizeof(record), samples_.data(), count * sizeof(int64_t));
+}
+
+void StateSnapshot::AddSplitProcess(uint32_t pid, int64_t create_time) {
+	SplitProcessRecord record = { pid, 0, create_time };
+	memcpy(AddRecord(SplitProcess, sizeof(record)), &record, sizeof(record));
+}
+
+void StateSnapshot::AddCounter(uint32_t index, const vector<double>& values) {
+	CounterRecord record = { index, 0 };
+	char* data = AddRecord(Counter, sizeof(record) + values.size() * sizeof(double));
+	memcpy(data, &record, sizeof(record));
+	if (!values.empty()) memcpy(data + sizeof(record), values.data(), values.size() * sizeof(double));
+}
+
+bool StateSnapshot::Write(const fs::path& path) {
+	header_.size_ = buffer_.size() - sizeof(Header);
+	header_.checksum_ = stateChecksum(buffer_.data() + sizeof(Header), buffer_.size() - sizeof(Header));
+	memcpy(buffer_.data(), &header_, sizeof(Header));
+
+	fs::path temp_path = fs::path(path).concat(L".tmp");
+	ofstream out(temp_path, ios::out | ios::binary | ios::trunc);
+	if (!out.is_open() || !out.write(buffer_.data(), static_cast<streamsize>(buffer_.size()))) {
+		LOGGER->Print(Logger::Type::Error, false, L"StateSnapshot: can't write ", temp_path.wstring());
+		return false;
+	}
+	out.close();
+	error_code ec;
+	fs::rename(temp_path, path, ec);
+	if (ec) {
+		LOGGER->Print(Logger::Type::Error, false, L"StateSnapshot: can't replace ", path.wstring(), L". Error ", ec.value());
+		return false;
+	}
+	return true;
+}
+
+bool StateSnapshot::Read(const fs::path& path, wstring& error) {
+	processes_.clear();
+	split_processes_.clear();
+	counters_.clear();
+	ifstream in(path, ios::in | ios::binary);
+	if (!in.is_open()) {
+		error = wstring(L"Can't open state ").append(path.wstring());
+		return false;
+	}
+	if (!in.read(reinterpret_cast<char*>(&header_), sizeof(header_)) || memcmp(header_.magic_, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+		error = wstring(L"Not a state snapshot: ").append(path.wstring());
+		return false;
+	}
+	if (header_.version_ != VERSION) {
+		error = wstring(L"Unsupported state version ").append(to_wstring(header_.version_));
+		return false;
+	}
+	// The size is checked against the file before anything is allocated for it.
+	error_code ec;
+	uintmax_t file_size = fs::file_size(path, ec);
+	if (ec || file_size < sizeof(Header) || header_.size_ != file_size - sizeof(Header)) {
+		error = wstring(L"State snapshot is damaged: ").append(path.wstring());
+		return false;
+	}
+	buffer_.resize(static_cast<size_t>(header_.size_));
+	if (!in.read(buffer_.data(), static_cast<streamsize>(buffer_.size())) || stateChecksum(buffer_.data(), buffer_.size()) != header_.checksum_) {
+		error = wstring(L"State snapshot is damaged: ").append(path.wstring());
+		return false;
+	}
+	size_t offset = 0;
+	while (offset + sizeof(RecordHeader) <= buffer_.size()) {
+		RecordHeader record;
+		memcpy(&record, &buffer_[offset], sizeof(record));
+		offset += sizeof(record);
+		if (record.size_ > buffer_.size() - offset) break;
+		ReadRecord(record, &buffer_[offset]);
+		offset += record.size_;
+	}
+	return true;
+}
+
+void StateSnapshot::ReadRecord(const RecordHeader& record, const char* data) {
+	switch (record.type_)
+	{
+	case Process:
+		if (record.size_ >= sizeof(ProcessRecord)) {
+			ProcessRecord process;
+			memcpy(&process, data, sizeof(process));
+			SavedProcess& saved = processes_[process.pid_];
+			saved = { process.create_time_, process.moved_generation_, process.origin_node_, {} };
+			saved.user_times_.resize((record.size_ - sizeof(process)) / sizeof(int64_t));
+			if (!saved.user_times_.empty()) memcpy(saved.user_times_.data(), data + sizeof(process), saved.user_times_.size() * sizeof(int64_t));
+		}
+		break;
+	case SplitProcess:
+		if (record.size_ >= sizeof(SplitProcessRecord)) {
+			SplitProcessRecord split;
+			memcpy(&split, data, sizeof(split));
+			split_processes_[split.pid_] = split.create_time_;
+		}
+		break;
+	case Counter:
+		if (record.size_ >= sizeof(CounterRecord)) {
+			CounterRecord counter;
+			memcpy(&counter, data, sizeof(counter));
+			if (counter.index_ >= counters_.size()) counters_.resize(counter.index_ + 1);
+			vector<double>& values = counters_[counter.index_];
+			values.resize((record.size_ - sizeof(counter)) / sizeof(double));
+			if (!values.empty()) memcpy(values.data(), data + sizeof(counter), values.size() * sizeof(double));
+		}
+		break;
+	default:
+		break;
+	}
+}
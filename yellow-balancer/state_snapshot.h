@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "process_table.h"
+#include "time_series_store.h"
+
+// Binary snapshot of the balancer state a restarted service continues from: the USER_TIME samples and
+// the last moves of the processes keyed by pid and create time, the spread processes and the Second
+// values of the counters. The file is a header and tagged records, a reader skips the record types it
+// does not know. A snapshot is built in a buffer kept between saves and written to a temporary file that
+// replaces the previous one, so a crash leaves either of them whole. Time is on the clock of the create times.
+class StateSnapshot {
+public:
+	enum Type : uint16_t { Process = 1, SplitProcess, Counter };
+
+	void Begin(int switching_frequency, uint64_t generation, int64_t time);
+	void AddProcess(const ProcessInfo& process, const TimeSeriesStore& user_times);
+	void AddSplitProcess(uint32_t pid, int64_t create_time);
+	void AddCounter(uint32_t index, const std::vector<double>& values);
+	bool Write(const std::filesystem::path& path);
+
+	// A file of another version or with a wrong checksum is not read.
+	bool Read(const std::filesystem::path& path, std::wstring& error);
+	int SwitchingFrequency() const { return static_cast<int>(header_.switching_frequency_); }
+	uint64_t Generation() const { return header_.generation_; }
+	int64_t Time() const { return header_.time_; }
+	std::unordered_map<uint32_t, SavedProcess>& Processes() { return processes_; }
+	const std::unordered_map<uint32_t, int64_t>& SplitProcesses() const { return split_processes_; }
+	const std::vector<std::vector<double>>& Counters() const { return counters_; }
+private:
+	struct Header {
+		char magic_[8];
+		uint32_t version_;
+		uint32_t switching_frequency_;
+		uint64_t generation_;
+		int64_t time_;
+		uint64_t size_;
+		uint64_t checksum_;
+	};
+	struct RecordHeader {
+		uint16_t type_;
+		uint16_t reserved_;
+		uint32_t size_;
+	};
+	struct ProcessRecord {
+		uint32_t pid_;
+		int32_t origin_node_;
+		int64_t create_time_;
+		uint64_t moved_generation_;
+	};
+	struct SplitProcessRecord {
+		uint32_t pid_;
+		uint32_t reserved_;
+		int64_t create_time_;
+	};
+	struct CounterRecord {
+		uint32_t index_;
+		uint32_t reserved_;
+	};
+	static const uint32_t VERSION = 1;
+	Header header_ = {};
+	std::vector<char> buffer_;
+	std::vector<int64_t> samples_;
+	std::unordered_map<uint32_t, SavedProcess> processes_;
+	std::unordered_map<uint32_t, int64_t> split_processes_;
+	std::vector<std::vector<double>> counters_;
+	char* AddRecord(Type type, size_t size);
+	void ReadRecord(const RecordHeader& record, const char* data);
+};
@@ -0,0 +1,13 @@
+﻿#ifdef _WIN32
+#include "system_probe_win.h"
+#else
+#include "system_probe_linux.h"
+#endif
+
+std::unique_ptr<SystemProbe> CreateSystemProbe() {
+#ifdef _WIN32
+	return std::make_unique<WinSystemProbe>();
+#else
+	return std::make_unique<LinuxSystemProbe>("/proc", "/sys");
+#endif
+}
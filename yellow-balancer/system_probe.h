@@ -0,0 +1,102 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "cpu_stat.h"
+#include "process_events.h"
+#include "topology.h"
+
+struct GroupAffinity {
+	uint64_t mask_;
+	uint16_t group_;
+};
+
+inline bool operator==(const GroupAffinity& lhs, const GroupAffinity& rhs) {
+	return lhs.group_ == rhs.group_ && lhs.mask_ == rhs.mask_;
+}
+
+inline bool operator!=(const GroupAffinity& lhs, const GroupAffinity& rhs) {
+	return !(lhs == rhs);
+}
+
+struct NumaNode {
+	uint32_t node_number_;
+	GroupAffinity group_mask_;
+};
+
+// Mapped address range [begin_, end_) of a process.
+struct MemoryRegion {
+	uint64_t begin_;
+	uint64_t end_;
+};
+
+struct ThreadInfo {
+	uint32_t thread_id_;
+	int64_t create_time_;
+	int64_t user_time_;
+	uint32_t thread_state_;
+	uint32_t thread_wait_reason_;
+	GroupAffinity group_affinity_;
+};
+
+// Times are kept in 100-nanosecond units (FILETIME resolution) on every platform.
+struct ProcessRecord {
+	uint32_t pid_;
+	std::wstring_view name_;
+	int64_t create_time_;
+	int64_t user_time_;
+	int64_t kernel_time_;
+	uint32_t thread_count_;
+};
+
+// Receives the processes that pass the filter, each one followed by its threads.
+class ProcessVisitor {
+public:
+	virtual ~ProcessVisitor() {}
+	virtual void Process(const ProcessRecord& process) = 0;
+	virtual void Thread(const ThreadInfo& thread) = 0;
+};
+
+class SystemProbe {
+public:
+	virtual ~SystemProbe() {}
+	virtual bool Init() = 0;
+	virtual std::vector<NumaNode> NumaNodes() = 0;
+	virtual bool ActiveProcesses(const std::unordered_set<std::wstring>& process_filter, ProcessVisitor& visitor) = 0;
+	virtual std::vector<uint16_t> ProcessNumaGroups(uint32_t pid) = 0;
+	virtual std::pair<uint64_t, uint64_t> ProcessAffinityMask(uint32_t pid) = 0;
+	virtual bool SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) = 0;
+	virtual bool SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) = 0;
+	// The current time on the clock of ProcessRecord::create_time_, -1 where the probe can't tell it.
+	virtual int64_t CurrentTime() { return -1; }
+	// Logical CPUs of a group mask and a per-CPU load sampler, on platforms where the load is not collected through PDH.
+	virtual std::vector<uint32_t> GroupCpus(const GroupAffinity& group_affinity) { return {}; }
+	virtual std::unique_ptr<CpuStatSampler> CreateCpuSampler() { return nullptr; }
+	// The packages, nodes, L3 caches and cores of the logical CPUs with the node distances; false where the probe can't tell them.
+	virtual bool ReadTopology(CpuTopology& topology) { return false; }
+	// Resident bytes of the process on every NUMA node, indexed by node_number_; false where the platform does not report them.
+	virtual bool ProcessNodeMemory(uint32_t pid, std::vector<uint64_t>& node_bytes) { return false; }
+	// The two below are called by the memory migration thread while the worker uses the probe, so they keep no
+	// state of the probe. MovePages moves the resident pages of [begin, end) that are on other nodes to the node
+	// and counts the bytes moved; both are false where the platform can't do it or the process has exited.
+	virtual bool CanMovePages() const { return false; }
+	virtual bool ProcessMemoryRegions(uint32_t pid, std::vector<MemoryRegion>& regions) { return false; }
+	virtual bool MovePages(uint32_t pid, uint64_t begin, uint64_t end, uint32_t node_number, uint64_t& moved_bytes) { return false; }
+	// The source of process start events, nullptr where there is none. The thread that reads it calls the two
+	// below while the worker uses the probe, so they keep no state of the probe either: the name of a process
+	// as the filter matches it and the affinity of a process that has just started, for all of its threads.
+	virtual std::unique_ptr<ProcessEventSource> CreateProcessEventSource() { return nullptr; }
+	virtual bool ProcessName(uint32_t pid, std::wstring& name) { return false; }
+	virtual bool SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) { return false; }
+	// OS error code of the last failed SetProcessAffinity or SetThreadAffinity, -1 when there is none to report.
+	int32_t LastError() const { return last_error_; }
+protected:
+	int32_t last_error_ = -1;
+};
+
+std::unique_ptr<SystemProbe> CreateSystemProbe();
@@ -0,0 +1,658 @@
+﻿#ifdef __linux__
+
+#include "system_probe_linux.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "Logger.h"
+#include "encoding_string.h"
+#include "self_profile.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+static const size_t MAX_GROUP_SIZE = 64;
+static const rlim_t RESERVED_FILES = 256;
+static const rlim_t MAX_FILES = 1 << 20;
+static const size_t FILES_PER_TASK = 3;
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+// PROC_EVENT_EXEC of linux/cn_proc.h; older headers scope the enum inside proc_event, newer ones do not.
+static const uint32_t PROC_EXEC_EVENT = 0x00000002;
+static const size_t PROC_EVENTS_BUFFER_SIZE = 16384;
+
+static bool readFile(const fs::path& path, string& buffer) {
+	buffer.clear();
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	CountSyscalls();
+	if (fd < 0) return false;
+	char chunk[4096];
+	ssize_t size;
+	while ((size = read(fd, chunk, sizeof(chunk))) > 0) {
+		buffer.append(chunk, static_cast<size_t>(size));
+		CountSyscalls();
+	}
+	close(fd);
+	CountSyscalls(2);
+	return size == 0;
+}
+
+bool ParseCpuList(const string& cpu_list, vector<uint32_t>& cpus) {
+	cpus.clear();
+	const char* p = cpu_list.c_str();
+	while (*p) {
+		while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n') ++p;
+		if (!*p) break;
+		char* end = nullptr;
+		unsigned long first = strtoul(p, &end, 10);
+		if (end == p) return false;
+		unsigned long last = first;
+		p = end;
+		if (*p == '-') {
+			++p;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first) return false;
+			p = end;
+		}
+		for (unsigned long cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(static_cast<uint32_t>(cpu));
+		}
+	}
+	return true;
+}
+
+// Sums the "N<node>=<pages>" fields of every mapping of /proc/<pid>/numa_maps; the page size of a
+// mapping comes at the end of its line as kernelpagesize_kB.
+bool ParseNumaMaps(const string& numa_maps, vector<uint64_t>& node_bytes) {
+	static const char page_size_key[] = "kernelpagesize_kB=";
+	node_bytes.clear();
+	size_t begin = 0;
+	while (begin < numa_maps.size()) {
+		size_t end = numa_maps.find('\n', begin);
+		if (end == string::npos) end = numa_maps.size();
+		uint64_t page_size = 4096;
+		size_t pos = numa_maps.find(page_size_key, begin);
+		if (pos != string::npos && pos < end) page_size = strtoull(numa_maps.c_str() + pos + sizeof(page_size_key) - 1, nullptr, 10) * 1024;
+
+		for (pos = numa_maps.find(" N", begin); pos != string::npos && pos < end; pos = numa_maps.find(" N", pos + 2)) {
+			const char* p = numa_maps.c_str() + pos + 2;
+			if (*p < '0' || *p > '9') continue;
+			char* field_end = nullptr;
+			unsigned long node = strtoul(p, &field_end, 10);
+			if (*field_end != '=') continue;
+			uint64_t pages = strtoull(field_end + 1, nullptr, 10);
+			if (node >= node_bytes.size()) node_bytes.resize(node + 1, 0);
+			node_bytes[node] += pages * page_size;
+		}
+		begin = end + 1;
+	}
+	return true;
+}
+
+static bool parseNodeNumber(const string& dir_name, uint32_t& node_number) {
+	if (dir_name.size() <= 4 || dir_name.compare(0, 4, "node") != 0) return false;
+	for (size_t i = 4; i < dir_name.size(); ++i) {
+		if (dir_name[i] < '0' || dir_name[i] > '9') return false;
+	}
+	node_number = static_cast<uint32_t>(strtoul(dir_name.c_str() + 4, nullptr, 10));
+	return true;
+}
+
+static bool parseId(const string& dir_name, uint32_t& id) {
+	if (dir_name.empty()) return false;
+	for (char ch : dir_name) {
+		if (ch < '0' || ch > '9') return false;
+	}
+	id = static_cast<uint32_t>(strtoul(dir_name.c_str(), nullptr, 10));
+	return true;
+}
+
+// Splits the content of /proc/<pid>/stat into the command name and the fields following it.
+// fields[0] is the state (field 3 in proc(5)), so field N of proc(5) is fields[N - 3].
+static bool parseStat(const string& stat, string& comm, vector<const char*>& fields) {
+	size_t open = stat.find('(');
+	size_t close = stat.rfind(')');
+	if (open == string::npos || close == string::npos || close < open) return false;
+	comm.assign(stat, open + 1, close - open - 1);
+	fields.clear();
+	const char* p = stat.c_str() + close + 1;
+	while (*p) {
+		while (*p == ' ') ++p;
+		if (!*p || *p == '\n') break;
+		fields.push_back(p);
+		while (*p && *p != ' ' && *p != '\n') ++p;
+	}
+	return fields.size() > 19;
+}
+
+void TaskFilesTraits::Close(TaskFiles& files) {
+	if (files.stat_ >= 0) close(files.stat_);
+	if (files.status_ >= 0) close(files.status_);
+	if (files.pidfd_ >= 0) close(files.pidfd_);
+	CountSyscalls((files.stat_ >= 0) + (files.status_ >= 0) + (files.pidfd_ >= 0));
+	files = Invalid();
+}
+
+LinuxSystemProbe::LinuxSystemProbe(fs::path procfs_root, fs::path sysfs_root) :
+	procfs_root_(move(procfs_root)),
+	sysfs_root_(move(sysfs_root)) {
+	long ticks = sysconf(_SC_CLK_TCK);
+	filetime_per_tick_ = 10000000 / (ticks > 0 ? ticks : 100);
+	long page_size = sysconf(_SC_PAGESIZE);
+	page_size_ = page_size > 0 ? static_cast<uint64_t>(page_size) : 4096;
+	// A pidfd only makes sense for the pids of the live system, not for a replayed procfs tree.
+	use_pidfd_ = procfs_root_ == "/proc";
+}
+
+// Raises the soft limit of open files up to the hard one and leaves a reserve for the rest of the service.
+void LinuxSystemProbe::InitFilesLimit() {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+	rlim_t wanted = limit.rlim_max == RLIM_INFINITY ? MAX_FILES : min(limit.rlim_max, MAX_FILES);
+	if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted) {
+		rlim_t current = limit.rlim_cur;
+		limit.rlim_cur = wanted;
+		if (setrlimit(RLIMIT_NOFILE, &limit) != 0) limit.rlim_cur = current;
+	}
+	rlim_t files = limit.rlim_cur == RLIM_INFINITY ? MAX_FILES : limit.rlim_cur;
+	max_cached_files_ = files > RESERVED_FILES ? static_cast<size_t>((files - RESERVED_FILES) / FILES_PER_TASK) : 0;
+}
+
+bool LinuxSystemProbe::ReadFile(const fs::path& path) {
+	return readFile(path, read_buffer_);
+}
+
+bool LinuxSystemProbe::ReadFd(int fd) {
+	read_buffer_.clear();
+	char chunk[4096];
+	off_t offset = 0;
+	ssize_t size;
+	while ((size = pread(fd, chunk, sizeof(chunk), offset)) > 0) {
+		read_buffer_.append(chunk, static_cast<size_t>(size));
+		offset += size;
+		CountSyscalls();
+	}
+	CountSyscalls();
+	return size == 0 && offset > 0;
+}
+
+TaskFiles LinuxSystemProbe::OpenTaskFiles(const fs::path& dir, uint32_t pid) {
+	TaskFiles files = TaskFilesTraits::Invalid();
+	if (process_files_.Live() + thread_files_.Live() >= max_cached_files_) return files;
+	files.stat_ = open((dir / "stat").c_str(), O_RDONLY | O_CLOEXEC);
+	CountSyscalls();
+	if (files.stat_ < 0) return files;
+	files.status_ = open((dir / "status").c_str(), O_RDONLY | O_CLOEXEC);
+	CountSyscalls();
+	if (use_pidfd_ && pid != 0) {
+		files.pidfd_ = static_cast<int>(syscall(SYS_pidfd_open, static_cast<pid_t>(pid), 0));
+		CountSyscalls();
+	}
+	return files;
+}
+
+TaskFiles LinuxSystemProbe::CachedTaskFiles(TaskFilesCache& cache, uint32_t id, const fs::path& dir, bool is_process) {
+	return cache.Get(id, [this, &dir, is_process](uint32_t id) { return OpenTaskFiles(dir, is_process ? id : 0); });
+}
+
+// The descriptor of an exited task fails to read; it is reopened once in case the id was reused.
+// Without a cached descriptor (inaccessible task or no room left) the file is read by path.
+bool LinuxSystemProbe::ReadStat(TaskFilesCache& cache, uint32_t id, const fs::path& dir, bool is_process) {
+	TaskFiles files = CachedTaskFiles(cache, id, dir, is_process);
+	if (TaskFilesTraits::IsValid(files)) {
+		if (ReadFd(files.stat_)) return true;
+		cache.Reset(id);
+		files = CachedTaskFiles(cache, id, dir, is_process);
+		if (TaskFilesTraits::IsValid(files)) return ReadFd(files.stat_);
+	}
+	return ReadFile(dir / "stat");
+}
+
+// The stat of a process outside the filter is read by a path built in a reused buffer, its files are not kept open.
+bool LinuxSystemProbe::ReadProcessStat(uint32_t pid) {
+	stat_path_.assign(procfs_root_.native()).append(1, '/').append(to_string(pid)).append("/stat");
+	int fd = open(stat_path_.c_str(), O_RDONLY | O_CLOEXEC);
+	CountSyscalls();
+	if (fd < 0) return false;
+	bool is_read = ReadFd(fd);
+	close(fd);
+	CountSyscalls();
+	return is_read;
+}
+
+// False only when the pidfd proves that the cached process has exited and its pid may belong to another one.
+bool LinuxSystemProbe::IsProcessAlive(uint32_t pid) {
+	TaskFiles files = CachedTaskFiles(process_files_, pid, procfs_root_ / to_string(pid), true);
+	if (files.pidfd_ < 0) return true;
+	CountSyscalls();
+	return syscall(SYS_pidfd_send_signal, files.pidfd_, 0, nullptr, 0) == 0 || errno != ESRCH;
+}
+
+void LinuxSystemProbe::AddNode(uint32_t node_number, const vector<uint32_t>& cpus) {
+	for (size_t first = 0; first < cpus.size(); first += MAX_GROUP_SIZE) {
+		uint16_t group = static_cast<uint16_t>(groups_cpus_.size());
+		size_t last = min(cpus.size(), first + MAX_GROUP_SIZE);
+		groups_cpus_.emplace_back(cpus.begin() + first, cpus.begin() + last);
+		uint64_t mask = 0;
+		for (size_t i = first; i < last; ++i) {
+			uint16_t bit = static_cast<uint16_t>(i - first);
+			if (cpus[i] >= cpu_positions_.size()) cpu_positions_.resize(cpus[i] + 1, { UINT16_MAX, 0 });
+			cpu_positions_[cpus[i]] = { group, bit };
+			mask |= uint64_t(1) << bit;
+		}
+		numa_nodes_.push_back({ node_number, { mask, group } });
+	}
+}
+
+bool LinuxSystemProbe::Init() {
+	InitFilesLimit();
+	numa_nodes_.clear();
+	groups_cpus_.clear();
+	cpu_positions_.clear();
+
+	vector<pair<uint32_t, fs::path>> node_dirs;
+	error_code ec;
+	for (fs::directory_iterator it(sysfs_root_ / "devices/system/node", ec), end; !ec && it != end; it.increment(ec)) {
+		uint32_t node_number;
+		if (parseNodeNumber(it->path().filename().string(), node_number)) {
+			node_dirs.push_back({ node_number, it->path() });
+		}
+	}
+	sort(node_dirs.begin(), node_dirs.end());
+
+	vector<uint32_t> cpus;
+	for (auto it = node_dirs.begin(); it != node_dirs.end(); ++it) {
+		if (ReadFile(it->second / "cpulist") && ParseCpuList(read_buffer_, cpus) && !cpus.empty()) {
+			AddNode(it->first, cpus);
+		}
+	}
+
+	if (numa_nodes_.empty()) {
+		if (ReadFile(sysfs_root_ / "devices/system/cpu/online") && ParseCpuList(read_buffer_, cpus) && !cpus.empty()) {
+			AddNode(0, cpus);
+		}
+		else {
+			LOGGER->Print(wstring(L"LinuxSystemProbe: no NUMA topology in ").append(sysfs_root_.wstring()), Logger::Type::Error);
+			return false;
+		}
+	}
+	return true;
+}
+
+vector<NumaNode> LinuxSystemProbe::NumaNodes() {
+	return numa_nodes_;
+}
+
+// The start time of a process in its stat counts from the boot, suspended time included.
+int64_t LinuxSystemProbe::CurrentTime() {
+	timespec now;
+	if (clock_gettime(CLOCK_BOOTTIME, &now) != 0) return -1;
+	return static_cast<int64_t>(now.tv_sec) * 10000000 + now.tv_nsec / 100;
+}
+
+vector<uint32_t> LinuxSystemProbe::GroupCpus(const GroupAffinity& group_affinity) {
+	vector<uint32_t> cpus;
+	if (group_affinity.group_ >= groups_cpus_.size()) return cpus;
+	const vector<uint32_t>& group_cpus = groups_cpus_[group_affinity.group_];
+	for (size_t i = 0; i < group_cpus.size(); ++i) {
+		if (group_affinity.mask_ & (uint64_t(1) << i)) cpus.push_back(group_cpus[i]);
+	}
+	return cpus;
+}
+
+unique_ptr<CpuStatSampler> LinuxSystemProbe::CreateCpuSampler() {
+	return make_unique<CpuStatSampler>(procfs_root_, sysfs_root_);
+}
+
+// numa_maps walks the page tables of the whole process, it is read for a few processes per tick only.
+bool LinuxSystemProbe::ProcessNodeMemory(uint32_t pid, vector<uint64_t>& node_bytes) {
+	return ReadFile(procfs_root_ / to_string(pid) / "numa_maps") && ParseNumaMaps(read_buffer_, node_bytes);
+}
+
+// Regions without any access rights hold no pages and are skipped, as is the vsyscall page of the kernel.
+bool LinuxSystemProbe::ProcessMemoryRegions(uint32_t pid, vector<MemoryRegion>& regions) {
+	regions.clear();
+	string maps;
+	if (!readFile(procfs_root_ / to_string(pid) / "maps", maps)) return false;
+	size_t begin = 0;
+	while (begin < maps.size()) {
+		size_t end = maps.find('\n', begin);
+		if (end == string::npos) end = maps.size();
+		char* p = nullptr;
+		uint64_t region_begin = strtoull(maps.c_str() + begin, &p, 16);
+		if (*p == '-') {
+			uint64_t region_end = strtoull(p + 1, &p, 16);
+			size_t special = maps.find("[vsyscall]", begin);
+			if (*p == ' ' && strncmp(p + 1, "---", 3) != 0 && (special == string::npos || special > end) && region_end > region_begin) {
+				regions.push_back({ region_begin, region_end });
+			}
+		}
+		begin = end + 1;
+	}
+	return true;
+}
+
+// move_pages is asked first where the pages are, so that the pages already on the node and the ones never
+// touched are neither moved nor counted.
+bool LinuxSystemProbe::MovePages(uint32_t pid, uint64_t begin, uint64_t end, uint32_t node_number, uint64_t& moved_bytes) {
+	moved_bytes = 0;
+	vector<void*> pages;
+	for (uint64_t address = begin - begin % page_size_; address < end; address += page_size_) {
+		pages.push_back(reinterpret_cast<void*>(address));
+	}
+	if (pages.empty()) return true;
+	vector<int> status(pages.size());
+	CountSyscalls();
+	if (syscall(SYS_move_pages, static_cast<pid_t>(pid), pages.size(), pages.data(), nullptr, status.data(), 0) != 0) {
+		if (errno != ESRCH) LOGGER->Print(Logger::Type::Error, false, L"move_pages failed for pid ", pid, L". ", strerror(errno));
+		return false;
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < pages.size(); ++i) {
+		if (status[i] >= 0 && static_cast<uint32_t>(status[i]) != node_number) pages[count++] = pages[i];
+	}
+	if (count == 0) return true;
+	vector<int> nodes(count, static_cast<int>(node_number));
+	CountSyscalls();
+	if (syscall(SYS_move_pages, static_cast<pid_t>(pid), count, pages.data(), nodes.data(), status.data(), MPOL_MF_MOVE) < 0) {
+		if (errno != ESRCH) LOGGER->Print(Logger::Type::Error, false, L"move_pages failed for pid ", pid, L". ", strerror(errno));
+		return false;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (status[i] == static_cast<int>(node_number)) moved_bytes += page_size_;
+	}
+	return true;
+}
+
+ProcConnectorEvents::~ProcConnectorEvents() {
+	if (socket_ >= 0) close(socket_);
+}
+
+bool ProcConnectorEvents::Open() {
+	int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (fd < 0) return false;
+	sockaddr_nl address = {};
+	address.nl_family = AF_NETLINK;
+	address.nl_groups = CN_IDX_PROC;
+	char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+	nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+	header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+	header->nlmsg_type = NLMSG_DONE;
+	cn_msg* message = static_cast<cn_msg*>(NLMSG_DATA(header));
+	message->id.idx = CN_IDX_PROC;
+	message->id.val = CN_VAL_PROC;
+	message->len = sizeof(proc_cn_mcast_op);
+	proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	memcpy(message->data, &op, sizeof(op));
+	if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || send(fd, request, header->nlmsg_len, 0) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return false;
+	}
+	socket_ = fd;
+	buffer_.resize(PROC_EVENTS_BUFFER_SIZE);
+	return true;
+}
+
+// A burst of events beyond the socket buffer is lost with ENOBUFS; those processes wait for the next scan.
+bool ProcConnectorEvents::Wait(int timeout_ms, vector<uint32_t>& pids) {
+	pollfd fd = { socket_, POLLIN, 0 };
+	CountSyscalls();
+	if (poll(&fd, 1, timeout_ms) <= 0) return true;
+	for (;;) {
+		CountSyscalls();
+		ssize_t size = recv(socket_, buffer_.data(), buffer_.size(), MSG_DONTWAIT);
+		if (size < 0) {
+			if (errno == ENOBUFS) {
+				LOGGER->Print(L"ProcConnectorEvents: process events are lost, the socket buffer is full", Logger::Type::Error);
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		int length = static_cast<int>(size);
+		for (nlmsghdr* header = reinterpret_cast<nlmsghdr*>(buffer_.data()); NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+			if (header->nlmsg_type == NLMSG_NOOP || header->nlmsg_type == NLMSG_ERROR) continue;
+			const cn_msg* message = static_cast<const cn_msg*>(NLMSG_DATA(header));
+			if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC || message->len < sizeof(proc_event)) continue;
+			const proc_event* event = reinterpret_cast<const proc_event*>(message->data);
+			if (static_cast<uint32_t>(event->what) == PROC_EXEC_EVENT) pids.push_back(static_cast<uint32_t>(event->event_data.exec.process_tgid));
+		}
+	}
+}
+
+bool ProcfsProcessEvents::ListProcesses(vector<uint32_t>& pids) {
+	error_code ec;
+	uint32_t pid = 0;
+	for (fs::directory_iterator it(procfs_root_, ec), end; !ec && it != end; it.increment(ec)) {
+		if (parseId(it->path().filename().string(), pid)) pids.push_back(pid);
+	}
+	return !ec;
+}
+
+unique_ptr<ProcessEventSource> LinuxSystemProbe::CreateProcessEventSource() {
+	auto connector = make_unique<ProcConnectorEvents>();
+	if (connector->Open()) return connector;
+	LOGGER->Print(Logger::Type::Info, true, L"The proc connector is not available (", strerror(errno), L"), new processes are polled");
+	return make_unique<ProcfsProcessEvents>(procfs_root_);
+}
+
+bool LinuxSystemProbe::ProcessName(uint32_t pid, wstring& name) {
+	string stat;
+	string comm;
+	vector<const char*> fields;
+	if (!readFile(procfs_root_ / to_string(pid) / "stat", stat) || !parseStat(stat, comm, fields)) return false;
+	name = Utf8ToWideChar(comm);
+	return true;
+}
+
+// Right after exec the process has one thread, the threads it starts later inherit its affinity.
+// A process found by polling may have more of them already.
+bool LinuxSystemProbe::SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) {
+	if (ApplyAffinity(pid, group_affinity) != 0) return false;
+	error_code ec;
+	uint32_t tid = 0;
+	for (fs::directory_iterator it(procfs_root_ / to_string(pid) / "task", ec), end; !ec && it != end; it.increment(ec)) {
+		if (parseId(it->path().filename().string(), tid) && tid != pid) ApplyAffinity(tid, group_affinity);
+	}
+	return true;
+}
+
+bool LinuxSystemProbe::ReadAllowedCpus(TaskFilesCache& cache, uint32_t id, const fs::path& dir, bool is_process) {
+	TaskFiles files = CachedTaskFiles(cache, id, dir, is_process);
+	bool is_read = files.status_ >= 0 ? ReadFd(files.status_) : ReadFile(dir / "status");
+	if (!is_read) return false;
+	static const char key[] = "Cpus_allowed_list:";
+	size_t pos = read_buffer_.find(key);
+	if (pos == string::npos) return false;
+	pos += sizeof(key) - 1;
+	size_t end = read_buffer_.find('\n', pos);
+	return ParseCpuList(read_buffer_.substr(pos, end == string::npos ? string::npos : end - pos), cpus_buffer_);
+}
+
+GroupAffinity LinuxSystemProbe::PrimaryGroupAffinity(const vector<uint32_t>& cpus) const {
+	vector<uint64_t> masks(groups_cpus_.size(), 0);
+	for (auto cpu : cpus) {
+		if (cpu < cpu_positions_.size() && cpu_positions_[cpu].group_ != UINT16_MAX) {
+			masks[cpu_positions_[cpu].group_] |= uint64_t(1) << cpu_positions_[cpu].bit_;
+		}
+	}
+	GroupAffinity res = { 0, 0 };
+	int max_count = 0;
+	for (size_t i = 0; i < masks.size(); ++i) {
+		int count = __builtin_popcountll(masks[i]);
+		if (count > max_count) {
+			max_count = count;
+			res = { masks[i], static_cast<uint16_t>(i) };
+		}
+	}
+	return res;
+}
+
+bool LinuxSystemProbe::ActiveProcesses(const unordered_set<wstring>& process_filter, ProcessVisitor& visitor) {
+	string comm;
+	vector<const char*> fields;
+	error_code ec;
+	fs::directory_iterator it(procfs_root_, ec);
+	if (ec) {
+		LOGGER->Print(wstring(L"LinuxSystemProbe::ActiveProcesses: ").append(Utf8ToWideChar(ec.message())), Logger::Type::Error);
+		return false;
+	}
+	// A directory walk is counted as one call, the reads of std::filesystem inside it are not seen.
+	CountSyscalls();
+	// The names are compared in UTF-8, only the processes of the filter get their wide names.
+	if (process_filter_ != process_filter) {
+		process_filter_ = process_filter;
+		process_filter_utf8_.clear();
+		for (auto name = process_filter_.begin(); name != process_filter_.end(); ++name) process_filter_utf8_.insert(WideCharToUtf8(*name));
+	}
+	process_files_.BeginScan();
+	thread_files_.BeginScan();
+	for (fs::directory_iterator end; !ec && it != end; it.increment(ec)) {
+		uint32_t pid = 0;
+		if (!parseId(it->path().filename().string(), pid)) continue;
+		// Only a process stamped by an earlier scan, i.e. one that passed the filter, reads its stat through cached files.
+		bool is_read = process_files_.Contains(pid) ? ReadStat(process_files_, pid, it->path(), true) : ReadProcessStat(pid);
+		if (!is_read || !parseStat(read_buffer_, comm, fields)) continue;
+		if (!process_filter_utf8_.empty() && process_filter_utf8_.find(comm) == process_filter_utf8_.end()) continue;
+		int64_t create_time = strtoll(fields[19], nullptr, 10) * filetime_per_tick_;
+		process_files_.Stamp(pid, create_time);
+
+		wstring image_name = Utf8ToWideChar(comm);
+
+		visitor.Process({
+			pid,
+			image_name,
+			create_time,
+			strtoll(fields[11], nullptr, 10) * filetime_per_tick_,
+			strtoll(fields[12], nullptr, 10) * filetime_per_tick_,
+			static_cast<uint32_t>(strtoul(fields[17], nullptr, 10))
+			});
+
+		error_code ec_task;
+		CountSyscalls();
+		for (fs::directory_iterator it_task(it->path() / "task", ec_task), end_task; !ec_task && it_task != end_task; it_task.increment(ec_task)) {
+			uint32_t tid = 0;
+			if (!parseId(it_task->path().filename().string(), tid)) continue;
+			if (!ReadStat(thread_files_, tid, it_task->path(), false) || !parseStat(read_buffer_, comm, fields)) continue;
+			ThreadInfo thread = {
+				tid,
+				strtoll(fields[19], nullptr, 10) * filetime_per_tick_,
+				strtoll(fields[11], nullptr, 10) * filetime_per_tick_,
+				static_cast<uint32_t>(fields[0][0]),
+				0,
+				{ 0, 0 }
+			};
+			thread_files_.Stamp(tid, thread.create_time_);
+			if (ReadAllowedCpus(thread_files_, tid, it_task->path(), false)) {
+				thread.group_affinity_ = PrimaryGroupAffinity(cpus_buffer_);
+			}
+			visitor.Thread(thread);
+		}
+	}
+	if (ec) return false;
+	process_files_.Sweep();
+	thread_files_.Sweep();
+	return true;
+}
+
+vector<uint16_t> LinuxSystemProbe::ProcessNumaGroups(uint32_t pid) {
+	if (!ReadAllowedCpus(process_files_, pid, procfs_root_ / to_string(pid), true)) {
+		LOGGER->Print(Logger::Type::Error, false, L"Failed to retrieve allowed cpus for process pid ", pid);
+		return {};
+	}
+	vector<uint16_t> groups;
+	for (auto cpu : cpus_buffer_) {
+		if (cpu < cpu_positions_.size() && cpu_positions_[cpu].group_ != UINT16_MAX) {
+			uint16_t group = cpu_positions_[cpu].group_;
+			if (find(groups.begin(), groups.end(), group) == groups.end()) groups.push_back(group);
+		}
+	}
+	return groups;
+}
+
+pair<uint64_t, uint64_t> LinuxSystemProbe::ProcessAffinityMask(uint32_t pid) {
+	if (!ReadAllowedCpus(process_files_, pid, procfs_root_ / to_string(pid), true)) {
+		LOGGER->Print(Logger::Type::Error, false, L"Failed to retrieve processor affinity mask for process pid ", pid);
+		return { 0, 0 };
+	}
+	GroupAffinity group_affinity = PrimaryGroupAffinity(cpus_buffer_);
+	uint64_t system_mask = 0;
+	for (auto it = numa_nodes_.begin(); it != numa_nodes_.end(); ++it) {
+		if (it->group_mask_.group_ == group_affinity.group_) system_mask |= it->group_mask_.mask_;
+	}
+	return { group_affinity.mask_, system_mask };
+}
+
+// Only reads the topology of Init, so the process event thread may call it too. Returns 0 or the errno.
+int LinuxSystemProbe::ApplyAffinity(uint32_t id, const GroupAffinity& group_affinity) const {
+	if (group_affinity.group_ >= groups_cpus_.size()) return EINVAL;
+	const vector<uint32_t>& group_cpus = groups_cpus_[group_affinity.group_];
+	size_t cpu_count = cpu_positions_.size();
+	cpu_set_t* cpu_set = CPU_ALLOC(cpu_count);
+	if (!cpu_set) return ENOMEM;
+	size_t set_size = CPU_ALLOC_SIZE(cpu_count);
+	CPU_ZERO_S(set_size, cpu_set);
+	for (size_t bit = 0; bit < group_cpus.size(); ++bit) {
+		if (group_affinity.mask_ & (uint64_t(1) << bit)) CPU_SET_S(group_cpus[bit], set_size, cpu_set);
+	}
+	int res = sched_setaffinity(static_cast<pid_t>(id), set_size, cpu_set);
+	CountSyscalls();
+	int error = errno;
+	CPU_FREE(cpu_set);
+	return res != 0 ? error : 0;
+}
+
+bool LinuxSystemProbe::SetAffinity(uint32_t id, const GroupAffinity& group_affinity) {
+	if (group_affinity.group_ >= groups_cpus_.size()) {
+		last_error_ = EINVAL;
+		return false;
+	}
+	int error = ApplyAffinity(id, group_affinity);
+	if (error != 0) {
+		last_error_ = error;
+		LOGGER->Print(Logger::Type::Error, false, L"sched_setaffinity failed for id ", id, L". ", strerror(error));
+		return false;
+	}
+	return true;
+}
+
+bool LinuxSystemProbe::SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) {
+	if (!IsProcessAlive(pid)) {
+		last_error_ = ESRCH;
+		LOGGER->Print(Logger::Type::Error, false, L"Process pid ", pid, L" has exited, affinity is not set");
+		process_files_.Reset(pid);
+		return false;
+	}
+	return SetAffinity(pid, group_affinity);
+}
+
+bool LinuxSystemProbe::SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) {
+	return SetAffinity(tid, group_affinity);
+}
+
+#endif
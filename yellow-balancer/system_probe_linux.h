@@ -0,0 +1,116 @@
+﻿#pragma once
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+#include "handle_cache.h"
+#include "system_probe.h"
+
+bool ParseCpuList(const std::string& cpu_list, std::vector<uint32_t>& cpus);
+bool ParseNumaMaps(const std::string& numa_maps, std::vector<uint64_t>& node_bytes);
+
+// Open descriptors of /proc/<pid>/stat and status (or task/<tid>/...), re-read with pread on every tick.
+// The pidfd pins the identity of a process so that a reused pid is never mistaken for the cached one.
+struct TaskFiles {
+	int stat_;
+	int status_;
+	int pidfd_;
+};
+
+struct TaskFilesTraits {
+	static TaskFiles Invalid() { return { -1, -1, -1 }; }
+	static bool IsValid(const TaskFiles& files) { return files.stat_ >= 0; }
+	static void Close(TaskFiles& files);
+};
+
+typedef HandleCache<TaskFiles, TaskFilesTraits> TaskFilesCache;
+
+// Exec events of the kernel proc connector, delivered as they happen. Listening needs CAP_NET_ADMIN.
+class ProcConnectorEvents : public ProcessEventSource {
+public:
+	ProcConnectorEvents() = default;
+	ProcConnectorEvents(const ProcConnectorEvents&) = delete;
+	ProcConnectorEvents& operator=(const ProcConnectorEvents&) = delete;
+	~ProcConnectorEvents();
+	// False when the connector is not available, errno tells why.
+	bool Open();
+	bool Wait(int timeout_ms, std::vector<uint32_t>& pids) override;
+	bool IsEventDriven() const override { return true; }
+private:
+	int socket_ = -1;
+	std::vector<char> buffer_;
+};
+
+// The fallback without the proc connector: the pid directories of procfs.
+class ProcfsProcessEvents : public PollingProcessEvents {
+public:
+	explicit ProcfsProcessEvents(std::filesystem::path procfs_root) : procfs_root_(std::move(procfs_root)) {}
+protected:
+	bool ListProcesses(std::vector<uint32_t>& pids) override;
+private:
+	std::filesystem::path procfs_root_;
+};
+
+// Linux has no processor groups, so the probe splits every NUMA node into groups of at most 64 logical CPUs
+// the same way Windows does and GroupAffinity masks address CPUs by their position inside the group.
+class LinuxSystemProbe : public SystemProbe {
+public:
+	LinuxSystemProbe(std::filesystem::path procfs_root, std::filesystem::path sysfs_root);
+	bool Init() override;
+	std::vector<NumaNode> NumaNodes() override;
+	bool ActiveProcesses(const std::unordered_set<std::wstring>& process_filter, ProcessVisitor& visitor) override;
+	std::vector<uint16_t> ProcessNumaGroups(uint32_t pid) override;
+	std::pair<uint64_t, uint64_t> ProcessAffinityMask(uint32_t pid) override;
+	bool SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) override;
+	bool SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) override;
+	int64_t CurrentTime() override;
+	std::vector<uint32_t> GroupCpus(const GroupAffinity& group_affinity) override;
+	std::unique_ptr<CpuStatSampler> CreateCpuSampler() override;
+	bool ReadTopology(CpuTopology& topology) override { return ReadSysfsTopology(sysfs_root_, topology); }
+	bool ProcessNodeMemory(uint32_t pid, std::vector<uint64_t>& node_bytes) override;
+	bool CanMovePages() const override { return true; }
+	bool ProcessMemoryRegions(uint32_t pid, std::vector<MemoryRegion>& regions) override;
+	bool MovePages(uint32_t pid, uint64_t begin, uint64_t end, uint32_t node_number, uint64_t& moved_bytes) override;
+	std::unique_ptr<ProcessEventSource> CreateProcessEventSource() override;
+	bool ProcessName(uint32_t pid, std::wstring& name) override;
+	bool SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) override;
+	const std::filesystem::path& ProcfsRoot() const { return procfs_root_; }
+	const std::filesystem::path& SysfsRoot() const { return sysfs_root_; }
+	const std::vector<std::vector<uint32_t>>& GroupsCpus() const { return groups_cpus_; }
+private:
+	struct CpuPosition {
+		uint16_t group_;
+		uint16_t bit_;
+	};
+	std::filesystem::path procfs_root_;
+	std::filesystem::path sysfs_root_;
+	std::vector<NumaNode> numa_nodes_;
+	std::vector<std::vector<uint32_t>> groups_cpus_;
+	std::vector<CpuPosition> cpu_positions_;
+	int64_t filetime_per_tick_;
+	uint64_t page_size_;
+	std::string read_buffer_;
+	std::vector<uint32_t> cpus_buffer_;
+	std::string stat_path_;
+	std::unordered_set<std::wstring> process_filter_;
+	std::unordered_set<std::string> process_filter_utf8_;
+	TaskFilesCache process_files_;
+	TaskFilesCache thread_files_;
+	size_t max_cached_files_ = 0;
+	bool use_pidfd_ = false;
+
+	void AddNode(uint32_t node_number, const std::vector<uint32_t>& cpus);
+	void InitFilesLimit();
+	bool ReadFile(const std::filesystem::path& path);
+	bool ReadFd(int fd);
+	TaskFiles OpenTaskFiles(const std::filesystem::path& dir, uint32_t pid);
+	TaskFiles CachedTaskFiles(TaskFilesCache& cache, uint32_t id, const std::filesystem::path& dir, bool is_process);
+	bool ReadStat(TaskFilesCache& cache, uint32_t id, const std::filesystem::path& dir, bool is_process);
+	bool ReadProcessStat(uint32_t pid);
+	bool ReadAllowedCpus(TaskFilesCache& cache, uint32_t id, const std::filesystem::path& dir, bool is_process);
+	bool IsProcessAlive(uint32_t pid);
+	GroupAffinity PrimaryGroupAffinity(const std::vector<uint32_t>& cpus) const;
+	bool SetAffinity(uint32_t id, const GroupAffinity& group_affinity);
+	int ApplyAffinity(uint32_t id, const GroupAffinity& group_affinity) const;
+};
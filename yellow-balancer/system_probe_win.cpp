@@ -0,0 +1,490 @@
+﻿#include "system_probe_win.h"
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+#include "Logger.h"
+
+using namespace std;
+
+static auto LOGGER = Logger::getInstance();
+
+const WCHAR* ThreadStateValueNames[] = {
+  L"Initialized",
+  L"Ready",
+  L"Running",
+  L"Standby",
+  L"Terminated",
+  L"Waiting",
+  L"Transition",
+  L"DeferredReady"
+};
+
+const WCHAR* ThreadWaitReasonValueNames[] = {
+	L"Executive",
+	L"FreePage",
+	L"PageIn",
+	L"PoolAllocation",
+	L"DelayExecution",
+	L"Suspended",
+	L"UserRequest",
+	L"WrExecutive ",
+	L"WrFreePage",
+	L"WrPageIn",
+	L"WrPoolAllocation",
+	L"WrDelayExecution",
+	L"WrSuspended",
+	L"WrUserRequest",
+	L"WrEventPair",
+	L"WrQueue",
+	L"WrLpcReceive",
+	L"WrLpcReply",
+	L"WrVirtualMemory",
+	L"WrPageOut",
+	L"WrRendezvous",
+	L"WrKeyedEvent",
+	L"WrTerminated",
+	L"WrProcessInSwap",
+	L"WrCpuRateControl",
+	L"WrCalloutStack",
+	L"WrKernel",
+	L"WrResource",
+	L"WrPushLock",
+	L"WrMutex",
+	L"WrQuantumEnd",
+	L"WrDispatchInt",
+	L"WrPreempted",
+	L"WrYieldExecution",
+	L"WrFastMutex",
+	L"WrGuardedMutex",
+	L"WrRundown",
+	L"MaximumWaitReason"
+};
+
+void print_bitmap(ULONG_PTR mask){
+	for (int i = sizeof(mask) * 8 - 1; i >= 0; --i) {
+		printf("%d", (int)(mask >> i) & 1);
+	}
+}
+
+pair<DWORD, wstring> getLastError() {
+	DWORD errorMessageID = ::GetLastError();
+	if (errorMessageID == 0) {
+		return { errorMessageID, std::wstring() }; //No error message has been recorded
+	}
+
+	LPWSTR messageBuffer = nullptr;
+
+	size_t size = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		NULL, errorMessageID, MAKELANGID(LANG_ENGLISH, SUBLANG_ENGLISH_US), (LPWSTR)&messageBuffer, 0, NULL);
+
+	wstring message(messageBuffer, size - 2);
+
+	while (message.back() == L'\n' || message.back() == L'\n') {
+		message.pop_back();
+	}
+
+	LocalFree(messageBuffer);
+
+	return { errorMessageID, message };
+}
+
+static bool enableDebugPrivilege() {
+	HANDLE hToken;
+	if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &hToken) == FALSE) {
+		std::wstring err_wstr = L"Error getting token for current process. ";
+		err_wstr
+			.append(getLastError().second);
+		LOGGER->Print(err_wstr, Logger::Type::Error);
+		return false;
+	}
+
+	LUID luid;
+	if (LookupPrivilegeValueW(NULL, SE_DEBUG_NAME, &luid) == FALSE) {
+		std::wstring err_wstr = L"Error reading SE_DEBUG_NAME privilege value for current process. ";
+		err_wstr
+			.append(getLastError().second);
+		LOGGER->Print(err_wstr, Logger::Type::Error);
+		CloseHandle(hToken);
+		return false;
+	}
+
+	TOKEN_PRIVILEGES newState;
+	newState.PrivilegeCount = 1;
+	newState.Privileges[0].Luid = luid;
+	newState.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool res_adj_token = AdjustTokenPrivileges(hToken, FALSE, &newState, sizeof(newState), NULL, NULL);
+	auto error = getLastError();
+	CloseHandle(hToken);
+	if (!res_adj_token || error.first == ERROR_NOT_ALL_ASSIGNED) {
+		std::wstring err_wstr = L"Error setting SE_DEBUG_NAME privilege value for current process. ";
+		err_wstr
+			.append(error.second);
+		LOGGER->Print(err_wstr, Logger::Type::Error);
+		return false;
+	}
+	return true;
+}
+
+HANDLE openProcess(uint32_t id_process) {
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_SET_INFORMATION, FALSE, id_process);
+	CountSyscalls();
+	if (hProcess == NULL) {
+		wstring err_wstr = L"Error connecting to local process pid ";
+		err_wstr
+			.append(std::to_wstring(id_process)).append(L". ")
+			.append(getLastError().second);
+		LOGGER->Print(err_wstr, Logger::Type::Error);
+	}
+	return hProcess;
+}
+
+static HANDLE openThread(uint32_t id_thread) {
+	CountSyscalls();
+	return OpenThread(THREAD_QUERY_LIMITED_INFORMATION | THREAD_SET_INFORMATION, FALSE, id_thread);
+}
+
+LONGLONG fileTimeToLongLong(const FILETIME& fileTime) {
+	uint64_t uTime;
+	memcpy(&uTime, &fileTime, sizeof(uTime));
+	return uTime;
+}
+
+wstring systemTimeToWstring(const SYSTEMTIME& time) {
+	wstringstream wss_;
+	wss_ << setfill(L'0') << setw(4) << time.wYear << L'-' << setw(2) << time.wMonth << L'-' << setw(2) << time.wDay
+		<< L' '
+		<< setw(2) << time.wHour << L':' << setw(2) << time.wMinute << L':' << setw(2) << time.wSecond << L'.' << setw(3) << time.wMilliseconds;
+	return wss_.str();
+}
+
+wstring ThreadStateToWstring(ULONG thread_state) {
+	if (thread_state < 8)
+		return ThreadStateValueNames[thread_state];
+	else
+		return to_wstring(thread_state);
+}
+
+wstring ThreadWaitReasonToWstring(ULONG thread_wait_reason) {
+	if (thread_wait_reason < 38)
+		return ThreadWaitReasonValueNames[thread_wait_reason];
+	else
+		return to_wstring(thread_wait_reason);
+}
+
+static GROUP_AFFINITY toGroupAffinity(const GroupAffinity& group_affinity) {
+	GROUP_AFFINITY res = {};
+	res.Mask = static_cast<KAFFINITY>(group_affinity.mask_);
+	res.Group = group_affinity.group_;
+	return res;
+}
+
+static GroupAffinity fromGroupAffinity(const GROUP_AFFINITY& group_affinity) {
+	return { static_cast<uint64_t>(group_affinity.Mask), group_affinity.Group };
+}
+
+bool WinSystemProbe::Init() {
+	// Enabled once for the lifetime of the service, the handles opened with it are cached.
+	enableDebugPrivilege();
+	bool is_set = InitNtSetInformationProcess();
+	bool is_query = InitNtQuerySystemInformation();
+	return is_set && is_query;
+}
+
+bool WinSystemProbe::InitNtSetInformationProcess() {
+	auto handle = GetModuleHandle(L"ntdll");
+	if (!handle) {
+		LOGGER->Print(L"GetModuleHandle(\"ntdll\") - not found!", Logger::Type::Error);
+		return false;
+	}
+	void* p_void = GetProcAddress(handle, "NtSetInformationProcess");
+	if (!p_void) {
+		LOGGER->Print(L"GetProcAddress(GetModuleHandle(\"ntdll\"), \"NtSetInformationProcess\") - not found!", Logger::Type::Error);
+		return false;
+	}
+	NtSetInformationProcess = (pNtSetInformationProcess)p_void;
+	return true;
+}
+
+bool WinSystemProbe::InitNtQuerySystemInformation() {
+	auto handle = GetModuleHandle(L"ntdll");
+	if (!handle) {
+		LOGGER->Print(L"GetModuleHandle(\"ntdll\") - not found!", Logger::Type::Error);
+		return false;
+	}
+	void* p_void = GetProcAddress(handle, "NtQuerySystemInformation");
+	if (!p_void) {
+		LOGGER->Print(L"GetProcAddress(GetModuleHandle(\"ntdll\"), \"NtQuerySystemInformation\") - not found!", Logger::Type::Error);
+		return false;
+	}
+	NtQuerySystemInformation = (pNtQuerySystemInformation)p_void;
+	return true;
+}
+
+HANDLE WinSystemProbe::ProcessHandle(uint32_t pid) {
+	return process_handles_.Get(pid, openProcess);
+}
+
+HANDLE WinSystemProbe::ThreadHandle(uint32_t tid) {
+	return thread_handles_.Get(tid, openThread);
+}
+
+vector<NumaNode> WinSystemProbe::NumaNodes() {
+	vector<NumaNode> numa_nodes;
+	DWORD ReturnLength = 0;
+	GetLogicalProcessorInformationEx(LOGICAL_PROCESSOR_RELATIONSHIP::RelationNumaNode, NULL, &ReturnLength);
+	std::vector<BYTE> buffer(ReturnLength);
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* p;
+	if (GetLogicalProcessorInformationEx(LOGICAL_PROCESSOR_RELATIONSHIP::RelationNumaNode, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&buffer[0], &ReturnLength)) {
+		BYTE* pCur = (BYTE*)&buffer[0];
+		BYTE* pEnd = pCur + ReturnLength;
+		for (; pCur < pEnd; pCur += ((SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)pCur)->Size) {
+			p = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)pCur;
+			numa_nodes.push_back({ p->NumaNode.NodeNumber, fromGroupAffinity(p->NumaNode.GroupMask) });
+		}
+	}
+	return numa_nodes;
+}
+
+// Sets the id of the level for every CPU of the mask, NO_DOMAIN for the first CPU of the mask as the id.
+static void setDomain(vector<uint32_t>& ids, const GROUP_AFFINITY& group_affinity, uint32_t id) {
+	uint32_t first_cpu = static_cast<uint32_t>(group_affinity.Group) * 64;
+	for (uint32_t bit = 0; bit < 64; ++bit) {
+		if (!(static_cast<uint64_t>(group_affinity.Mask) & (uint64_t(1) << bit))) continue;
+		uint32_t cpu = first_cpu + bit;
+		if (id == CpuTopology::NO_DOMAIN) id = cpu;
+		if (cpu >= ids.size()) ids.resize(cpu + 1, CpuTopology::NO_DOMAIN);
+		ids[cpu] = id;
+	}
+}
+
+// Windows does not report the SLIT, the distances between the nodes are estimated from the packages.
+bool WinSystemProbe::ReadTopology(CpuTopology& topology) {
+	topology.Clear();
+	DWORD ReturnLength = 0;
+	GetLogicalProcessorInformationEx(LOGICAL_PROCESSOR_RELATIONSHIP::RelationAll, NULL, &ReturnLength);
+	std::vector<BYTE> buffer(ReturnLength);
+	if (ReturnLength == 0 || !GetLogicalProcessorInformationEx(LOGICAL_PROCESSOR_RELATIONSHIP::RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&buffer[0], &ReturnLength)) {
+		LOGGER->Print(Logger::Type::Error, false, L"WinSystemProbe::ReadTopology: GetLogicalProcessorInformationEx error ", ::GetLastError());
+		return false;
+	}
+	vector<uint32_t> ids[CpuTopology::LEVEL_COUNT];
+	uint32_t packages = 0;
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX* p;
+	BYTE* pCur = (BYTE*)&buffer[0];
+	BYTE* pEnd = pCur + ReturnLength;
+	for (; pCur < pEnd; pCur += ((SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)pCur)->Size) {
+		p = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)pCur;
+		switch (p->Relationship)
+		{
+		case RelationProcessorCore:
+			setDomain(ids[CpuTopology::Core], p->Processor.GroupMask[0], CpuTopology::NO_DOMAIN);
+			break;
+		case RelationProcessorPackage:
+			for (WORD i = 0; i < p->Processor.GroupCount; ++i) {
+				setDomain(ids[CpuTopology::Package], p->Processor.GroupMask[i], packages);
+			}
+			++packages;
+			break;
+		case RelationNumaNode:
+			setDomain(ids[CpuTopology::Node], p->NumaNode.GroupMask, p->NumaNode.NodeNumber);
+			break;
+		case RelationCache:
+			if (p->Cache.Level == 3) setDomain(ids[CpuTopology::L3], p->Cache.GroupMask, CpuTopology::NO_DOMAIN);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// A CPU without an L3 cache has its node stand for it, without a core it is a core of its own.
+	const vector<uint32_t>& nodes = ids[CpuTopology::Node];
+	unordered_map<uint32_t, uint32_t> node_first_cpus;
+	for (uint32_t cpu = 0; cpu < nodes.size(); ++cpu) {
+		if (nodes[cpu] != CpuTopology::NO_DOMAIN) node_first_cpus.emplace(nodes[cpu], cpu);
+	}
+	auto id = [&ids](CpuTopology::Level level, uint32_t cpu, uint32_t default_id) {
+		return cpu < ids[level].size() && ids[level][cpu] != CpuTopology::NO_DOMAIN ? ids[level][cpu] : default_id;
+	};
+	for (uint32_t cpu = 0; cpu < nodes.size(); ++cpu) {
+		if (nodes[cpu] == CpuTopology::NO_DOMAIN) continue;
+		topology.AddCpu(cpu, id(CpuTopology::Core, cpu, cpu), id(CpuTopology::L3, cpu, node_first_cpus[nodes[cpu]]), nodes[cpu], id(CpuTopology::Package, cpu, 0));
+	}
+	topology.Finish();
+	return !topology.IsEmpty();
+}
+
+bool WinSystemProbe::ActiveProcesses(const unordered_set<wstring>& process_filter, ProcessVisitor& visitor) {
+	if (!NtQuerySystemInformation) return false;
+
+	NTSTATUS status = buffer_active_processes.Fill([this](void* data, uint32_t size, uint32_t* required) -> int32_t {
+		ULONG buflen = 0;
+		NTSTATUS status = NtQuerySystemInformation(SYSTEMPROCESSINFORMATION, data, size, &buflen);
+		CountSyscalls();
+		*required = buflen;
+		return status;
+	});
+	if (status != 0) {
+		LOGGER->Print(Logger::Type::Error, false,
+			L"WinSystemProbe::ActiveProcesses: NtQuerySystemInformation status ", status,
+			L". Buflen=", buffer_active_processes.Capacity());
+		return false;
+	}
+
+	process_handles_.BeginScan();
+	thread_handles_.BeginScan();
+	bool is_complete = VisitProcessSnapshot(buffer_active_processes.Data(), buffer_active_processes.Size(), process_filter, image_name_, visitor,
+		[this](const SYSTEM_PROCESS_INFORMATION& info) {
+			process_handles_.Stamp(info.ProcessId, fileTimeToInt64(info.CreateTime));
+		},
+		[this](const SYSTEM_PROCESS_INFORMATION&, const SYSTEM_THREAD_INFORMATION& thread) -> GroupAffinity {
+			GroupAffinity res = { 0, 0 };
+			thread_handles_.Stamp(thread.Client_Id.UniqueThread, fileTimeToInt64(thread.CreateTime));
+			HANDLE thread_handle = ThreadHandle(thread.Client_Id.UniqueThread);
+			if (NULL != thread_handle) {
+				GROUP_AFFINITY group_affinity = {};
+				CountSyscalls();
+				if (GetThreadGroupAffinity(thread_handle, &group_affinity)) {
+					res = fromGroupAffinity(group_affinity);
+				}
+			}
+			return res;
+		}
+	);
+	if (!is_complete) {
+		LOGGER->Print(L"WinSystemProbe::ActiveProcesses: malformed process snapshot", Logger::Type::Error);
+		return false;
+	}
+	process_handles_.Sweep();
+	thread_handles_.Sweep();
+	return true;
+}
+
+vector<uint16_t> WinSystemProbe::ProcessNumaGroups(uint32_t pid) {
+	HANDLE hProcess = ProcessHandle(pid);
+	if (hProcess != NULL) {
+		std::vector<USHORT> GroupArray(128);
+		USHORT GroupCount = static_cast<USHORT>(GroupArray.size());
+		CountSyscalls();
+		if (GetProcessGroupAffinity(hProcess, &GroupCount, &GroupArray[0])) {
+			GroupArray.resize(GroupCount);
+			return GroupArray;
+		}
+		else {
+			std::wstring err_wstr = L"Failed to retrieve processor group affinity for process pid ";
+			err_wstr
+				.append(std::to_wstring(pid)).append(L". ")
+				.append(getLastError().second);
+			LOGGER->Print(err_wstr, Logger::Type::Error);
+			return {};
+		}
+	}
+	return {};
+}
+
+pair<uint64_t, uint64_t> WinSystemProbe::ProcessAffinityMask(uint32_t pid) {
+	DWORD_PTR process_affinity_mask = 0;
+	DWORD_PTR system_affinity_mask = 0;
+
+	HANDLE hProcess = ProcessHandle(pid);
+	if (hProcess != NULL) {
+		CountSyscalls();
+		if (!GetProcessAffinityMask(hProcess, &process_affinity_mask, &system_affinity_mask)) {
+			std::wstring err_wstr = L"Failed to retrieve processor affinity mask for process pid ";
+			err_wstr
+				.append(std::to_wstring(pid)).append(L". ")
+				.append(getLastError().second);
+			LOGGER->Print(err_wstr, Logger::Type::Error);
+		}
+	}
+	return { process_affinity_mask, system_affinity_mask };
+}
+
+bool WinSystemProbe::SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) {
+	last_error_ = -1;
+	if (!NtSetInformationProcess) return false;
+	HANDLE hProcess = ProcessHandle(pid);
+	if (hProcess != NULL) {
+		GROUP_AFFINITY win_group_affinity = toGroupAffinity(group_affinity);
+		NTSTATUS status = NtSetInformationProcess(hProcess, (PROCESS_INFORMATION_CLASS)0x15, (void*)&win_group_affinity, sizeof(GROUP_AFFINITY));
+		CountSyscalls();
+		if (status != 0) {
+			last_error_ = status;
+			LOGGER->Print(Logger::Type::Error, false, L"Error set process affinity: ", status);
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool WinSystemProbe::SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) {
+	last_error_ = -1;
+	HANDLE thread_handle = ThreadHandle(tid);
+	if (NULL != thread_handle) {
+		GROUP_AFFINITY win_group_affinity = toGroupAffinity(group_affinity);
+		CountSyscalls();
+		if (!SetThreadGroupAffinity(thread_handle, &win_group_affinity, NULL)) {
+			last_error_ = static_cast<int32_t>(::GetLastError());
+			std::wstring err_wstr = L"Failed to set group affinity for thread tid ";
+			err_wstr
+				.append(std::to_wstring(tid)).append(L". ")
+				.append(getLastError().second);
+			LOGGER->Print(err_wstr, Logger::Type::Error);
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+int64_t WinSystemProbe::CurrentTime() {
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	return static_cast<int64_t>((static_cast<uint64_t>(now.dwHighDateTime) << 32) | now.dwLowDateTime);
+}
+
+bool ToolhelpProcessEvents::ListProcesses(vector<uint32_t>& pids) {
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	CountSyscalls();
+	if (snapshot == INVALID_HANDLE_VALUE) return false;
+	PROCESSENTRY32W entry = {};
+	entry.dwSize = sizeof(entry);
+	for (BOOL is_entry = Process32FirstW(snapshot, &entry); is_entry; is_entry = Process32NextW(snapshot, &entry)) {
+		pids.push_back(entry.th32ProcessID);
+	}
+	CloseHandle(snapshot);
+	return true;
+}
+
+unique_ptr<ProcessEventSource> WinSystemProbe::CreateProcessEventSource() {
+	return make_unique<ToolhelpProcessEvents>();
+}
+
+// The handles of the event thread are its own, the handle caches of the probe belong to the worker.
+bool WinSystemProbe::ProcessName(uint32_t pid, wstring& name) {
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+	CountSyscalls();
+	if (hProcess == NULL) return false;
+	WCHAR path[MAX_PATH];
+	DWORD size = MAX_PATH;
+	BOOL is_read = QueryFullProcessImageNameW(hProcess, 0, path, &size);
+	CloseHandle(hProcess);
+	CountSyscalls(2);
+	if (!is_read) return false;
+	name = filesystem::path(wstring(path, size)).filename().wstring();
+	return true;
+}
+
+// The threads of the process follow its new affinity, the ones it starts later inherit it.
+bool WinSystemProbe::SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) {
+	if (!NtSetInformationProcess) return false;
+	HANDLE hProcess = OpenProcess(PROCESS_SET_INFORMATION, FALSE, pid);
+	CountSyscalls();
+	if (hProcess == NULL) return false;
+	GROUP_AFFINITY win_group_affinity = toGroupAffinity(group_affinity);
+	NTSTATUS status = NtSetInformationProcess(hProcess, (PROCESS_INFORMATION_CLASS)0x15, (void*)&win_group_affinity, sizeof(GROUP_AFFINITY));
+	CloseHandle(hProcess);
+	CountSyscalls(2);
+	return status == 0;
+}
@@ -0,0 +1,118 @@
+﻿#pragma once
+
+#define _WIN32_WINNT 0x0601
+
+#include <windows.h>
+#include <processtopologyapi.h>
+#include <tlhelp32.h>
+#include <string>
+#include <vector>
+#include "handle_cache.h"
+#include "process_snapshot.h"
+#include "self_profile.h"
+#include "system_probe.h"
+
+#define SYSTEMPROCESSINFORMATION 5
+#define STATUS_INFO_LENGTH_MISMATCH ((NTSTATUS) 0xC0000004)
+
+typedef NTSTATUS(WINAPI* pNtQuerySystemInformation)(int, PVOID, ULONG, PULONG);
+
+typedef NTSTATUS(NTAPI* pNtSetInformationProcess)(
+	HANDLE ProcessHandle,
+	PROCESS_INFORMATION_CLASS ProcessInformationClass,
+	PVOID ProcessInformation,
+	ULONG ProcessInformationLength
+	);
+
+typedef enum {
+	ThreadStateInitialized,
+	ThreadStateReady,
+	ThreadStateRunning,
+	ThreadStateStandby,
+	ThreadStateTerminated,
+	ThreadStateWaiting,
+	ThreadStateTransition,
+	ThreadStateDeferredReady
+} THREAD_STATE;
+
+typedef enum {
+	ThreadWaitReasonExecutive,
+	ThreadWaitReasonFreePage,
+	ThreadWaitReasonPageIn,
+	ThreadWaitReasonPoolAllocation,
+	ThreadWaitReasonDelayExecution,
+	ThreadWaitReasonSuspended,
+	ThreadWaitReasonUserRequest,
+	ThreadWaitReasonWrExecutive,
+	ThreadWaitReasonWrFreePage,
+	ThreadWaitReasonWrPageIn,
+	ThreadWaitReasonWrPoolAllocation,
+	ThreadWaitReasonWrDelayExecution,
+	ThreadWaitReasonWrSuspended,
+	ThreadWaitReasonWrUserRequest,
+	ThreadWaitReasonWrEventPair,
+	ThreadWaitReasonWrQueue,
+	ThreadWaitReasonWrLpcReceive,
+	ThreadWaitReasonWrLpcReply,
+	ThreadWaitReasonWrVirtualMemory,
+	ThreadWaitReasonWrPageOut,
+	ThreadWaitReasonWrRendezvous,
+	ThreadWaitReasonWrKeyedEvent,
+	ThreadWaitReasonWrTerminated,
+	ThreadWaitReasonWrProcessInSwap,
+	ThreadWaitReasonWrCpuRateControl,
+	ThreadWaitReasonWrCalloutStack,
+	ThreadWaitReasonWrKernel,
+	ThreadWaitReasonWrResource,
+	ThreadWaitReasonWrPushLock,
+	ThreadWaitReasonWrMutex,
+	ThreadWaitReasonWrQuantumEnd,
+	ThreadWaitReasonWrDispatchInt,
+	ThreadWaitReasonWrPreempted,
+	ThreadWaitReasonWrYieldExecution,
+	ThreadWaitReasonWrFastMutex,
+	ThreadWaitReasonWrGuardedMutex,
+	ThreadWaitReasonWrRundown,
+	ThreadWaitReasonMaximumWaitReason
+} THREAD_WAIT_REASON;
+
+struct WinHandleTraits {
+	static HANDLE Invalid() { return NULL; }
+	static bool IsValid(const HANDLE& handle) { return handle != NULL; }
+	static void Close(HANDLE& handle) { CloseHandle(handle); CountSyscalls(); }
+};
+
+typedef HandleCache<HANDLE, WinHandleTraits> WinHandleCache;
+
+// Windows has no process start events without WMI or ETW, the processes of a Toolhelp snapshot are compared.
+class ToolhelpProcessEvents : public PollingProcessEvents {
+protected:
+	bool ListProcesses(std::vector<uint32_t>& pids) override;
+};
+
+class WinSystemProbe : public SystemProbe {
+public:
+	bool Init() override;
+	std::vector<NumaNode> NumaNodes() override;
+	bool ActiveProcesses(const std::unordered_set<std::wstring>& process_filter, ProcessVisitor& visitor) override;
+	std::vector<uint16_t> ProcessNumaGroups(uint32_t pid) override;
+	std::pair<uint64_t, uint64_t> ProcessAffinityMask(uint32_t pid) override;
+	bool SetProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) override;
+	bool SetThreadAffinity(uint32_t tid, const GroupAffinity& group_affinity) override;
+	int64_t CurrentTime() override;
+	bool ReadTopology(CpuTopology& topology) override;
+	std::unique_ptr<ProcessEventSource> CreateProcessEventSource() override;
+	bool ProcessName(uint32_t pid, std::wstring& name) override;
+	bool SetNewProcessAffinity(uint32_t pid, const GroupAffinity& group_affinity) override;
+private:
+	pNtSetInformationProcess NtSetInformationProcess = nullptr;
+	pNtQuerySystemInformation NtQuerySystemInformation = nullptr;
+	SnapshotBuffer buffer_active_processes;
+	std::wstring image_name_;
+	WinHandleCache process_handles_;
+	WinHandleCache thread_handles_;
+	bool InitNtSetInformationProcess();
+	bool InitNtQuerySystemInformation();
+	HANDLE ProcessHandle(uint32_t pid);
+	HANDLE ThreadHandle(uint32_t tid);
+};
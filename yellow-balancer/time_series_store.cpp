@@ -0,0 +1,183 @@
+﻿#include "time_series_store.h"
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define TIME_SERIES_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#include <cpuid.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+#ifdef TIME_SERIES_AVX2
+// AVX2 needs both the CPU support and the OS saving the YMM registers.
+static bool hasAvx2() {
+	unsigned int regs[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	regs[2] = static_cast<unsigned int>(info[2]);
+	bool is_os_avx = (regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	regs[1] = static_cast<unsigned int>(info[1]);
+#else
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+	bool is_os_avx = false;
+	if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28))) {
+		unsigned int xcr0_low, xcr0_high;
+		__asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+		is_os_avx = (xcr0_low & 6) == 6;
+	}
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	return is_os_avx && (regs[1] & (1u << 5));
+}
+
+static const bool IS_AVX2 = hasAvx2();
+#endif
+
+// Keeps the last samples of every row that fit into the new window, the newest one stays under the cursor.
+void TimeSeriesStore::SetWindow(size_t window) {
+	window = max<size_t>(window, 1);
+	size_t kept = min(window, window_);
+	vector<int64_t> values(window * capacity_, 0);
+	for (size_t i = 0; i < kept; ++i) {
+		size_t column = (cursor_ + window_ - i) % window_;
+		copy(values_.begin() + column * capacity_, values_.begin() + (column + 1) * capacity_, values.begin() + (kept - 1 - i) * capacity_);
+	}
+	values_.swap(values);
+	window_ = window;
+	cursor_ = kept - 1;
+	for (size_t r = 0; r < rows_; ++r) {
+		samples_[r] = min<uint32_t>(samples_[r], static_cast<uint32_t>(window_));
+	}
+	Aggregate();
+}
+
+void TimeSeriesStore::Scale(int64_t numerator, int64_t denominator) {
+	if (denominator <= 0 || numerator == denominator) return;
+	for (auto it = values_.begin(); it != values_.end(); ++it) {
+		*it = *it * numerator / denominator;
+	}
+	Aggregate();
+}
+
+// Capacity stays a multiple of ROW_ALIGNMENT, so the vector pass never has a partial block.
+void TimeSeriesStore::Grow() {
+	size_t capacity = max(capacity_ * 2, ROW_ALIGNMENT);
+	vector<int64_t> values(window_ * capacity, 0);
+	for (size_t c = 0; c < window_; ++c) {
+		copy(values_.begin() + c * capacity_, values_.begin() + c * capacity_ + rows_, values.begin() + c * capacity);
+	}
+	values_.swap(values);
+	samples_.resize(capacity, 0);
+	sums_.resize(capacity, 0);
+	deltas_.resize(capacity, 0);
+	capacity_ = capacity;
+}
+
+uint32_t TimeSeriesStore::AddRow() {
+	if (!free_rows_.empty()) {
+		uint32_t row = free_rows_.back();
+		free_rows_.pop_back();
+		return row;
+	}
+	if (rows_ == capacity_) Grow();
+	return static_cast<uint32_t>(rows_++);
+}
+
+// The row is cleared here, so AddRow always hands out a row without samples.
+void TimeSeriesStore::ReleaseRow(uint32_t row) {
+	for (size_t c = 0; c < window_; ++c) values_[c * capacity_ + row] = 0;
+	samples_[row] = 0;
+	sums_[row] = 0;
+	deltas_[row] = 0;
+	free_rows_.push_back(row);
+}
+
+size_t TimeSeriesStore::CopyRow(uint32_t row, int64_t* values) const {
+	size_t count = samples_[row];
+	for (size_t i = 0; i < count; ++i) {
+		size_t column = (cursor_ + window_ - (count - 1 - i)) % window_;
+		values[i] = values_[column * capacity_ + row];
+	}
+	return count;
+}
+
+// The row gets its sums at the next Aggregate, as a row written by Set.
+void TimeSeriesStore::RestoreRow(uint32_t row, const int64_t* values, size_t count) {
+	count = min(count, window_);
+	for (size_t i = 0; i < count; ++i) {
+		size_t column = (cursor_ + window_ - i) % window_;
+		values_[column * capacity_ + row] = values[count - 1 - i];
+	}
+	samples_[row] = static_cast<uint32_t>(count);
+}
+
+// Moves the cursor to the oldest column and clears it for the samples of the new tick.
+void TimeSeriesStore::Advance() {
+	cursor_ = cursor_ + 1 < window_ ? cursor_ + 1 : 0;
+	fill(values_.begin() + cursor_ * capacity_, values_.begin() + cursor_ * capacity_ + rows_, 0);
+}
+
+void TimeSeriesStore::Set(uint32_t row, int64_t value) {
+	values_[cursor_ * capacity_ + row] = value;
+	if (samples_[row] < window_) ++samples_[row];
+}
+
+void TimeSeriesStore::Aggregate() {
+	size_t previous = cursor_ ? cursor_ - 1 : window_ - 1;
+#ifdef TIME_SERIES_AVX2
+	if (IS_AVX2) {
+		AggregateAvx2(previous);
+		return;
+	}
+#endif
+	AggregateScalar(previous);
+}
+
+void TimeSeriesStore::AggregateScalar(size_t previous) {
+	for (size_t r = 0; r < rows_; ++r) {
+		int64_t sum = 0;
+		for (size_t c = 0; c < window_; ++c) sum += values_[c * capacity_ + r];
+		sums_[r] = sum;
+		deltas_[r] = values_[cursor_ * capacity_ + r] - values_[previous * capacity_ + r];
+	}
+}
+
+#ifdef TIME_SERIES_AVX2
+// Eight rows (one cache line of every column) per step, in two accumulators.
+AVX2_TARGET void TimeSeriesStore::AggregateAvx2(size_t previous) {
+	const int64_t* values = values_.data();
+	for (size_t r = 0; r < rows_; r += ROW_ALIGNMENT) {
+		__m256i sum_low = _mm256_setzero_si256();
+		__m256i sum_high = _mm256_setzero_si256();
+		for (size_t c = 0; c < window_; ++c) {
+			const int64_t* column = values + c * capacity_ + r;
+			sum_low = _mm256_add_epi64(sum_low, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column)));
+			sum_high = _mm256_add_epi64(sum_high, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + 4)));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&sums_[r]), sum_low);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&sums_[r + 4]), sum_high);
+
+		const int64_t* current = values + cursor_ * capacity_ + r;
+		const int64_t* last = values + previous * capacity_ + r;
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&deltas_[r]), _mm256_sub_epi64(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(current)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(last))));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&deltas_[r + 4]), _mm256_sub_epi64(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + 4)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(last + 4))));
+	}
+}
+#else
+void TimeSeriesStore::AggregateAvx2(size_t previous) {
+	AggregateScalar(previous);
+}
+#endif
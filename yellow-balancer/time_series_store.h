@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Samples of all tracked processes in one row x window matrix instead of a ring buffer per process.
+// The matrix is stored by columns: column c holds sample c of every row, and all rows share the write
+// cursor, so a tick writes into one contiguous column. Aggregate computes the window sums and the last
+// deltas of every row in one pass (AVX2 when the CPU has it), and Avg/Delta then only read them.
+class TimeSeriesStore {
+public:
+	// Keeps the most recent samples, so the window can be changed while the rows are collected.
+	void SetWindow(size_t window);
+	// Multiplies every sample by numerator / denominator, for samples taken over another interval than the next ones.
+	void Scale(int64_t numerator, int64_t denominator);
+	size_t Window() const { return window_; }
+	uint32_t AddRow();
+	void ReleaseRow(uint32_t row);
+	void Advance();
+	void Set(uint32_t row, int64_t value);
+	void Aggregate();
+	size_t Samples(uint32_t row) const { return samples_[row]; }
+	bool IsFull(uint32_t row) const { return samples_[row] >= window_; }
+	int64_t Sum(uint32_t row) const { return sums_[row]; }
+	int64_t Avg(uint32_t row) const { return samples_[row] ? sums_[row] / static_cast<int64_t>(samples_[row]) : 0; }
+	// Difference between the last two samples; meaningful when the row has at least two of them.
+	int64_t Delta(uint32_t row) const { return deltas_[row]; }
+	// Copies the samples of the row oldest first, at most Window() of them, and returns their number.
+	size_t CopyRow(uint32_t row, int64_t* values) const;
+	// Writes the samples of a previous run into a row without samples, the newest one under the cursor.
+	void RestoreRow(uint32_t row, const int64_t* values, size_t count);
+	size_t Capacity() const { return capacity_; }
+	size_t Rows() const { return rows_ - free_rows_.size(); }
+private:
+	static constexpr size_t ROW_ALIGNMENT = 8;
+	size_t window_ = 1;
+	size_t capacity_ = 0;
+	size_t rows_ = 0;
+	size_t cursor_ = 0;
+	std::vector<int64_t> values_;
+	std::vector<uint32_t> samples_;
+	std::vector<int64_t> sums_;
+	std::vector<int64_t> deltas_;
+	std::vector<uint32_t> free_rows_;
+	void Grow();
+	void AggregateScalar(size_t previous);
+	void AggregateAvx2(size_t previous);
+};
@@ -0,0 +1,233 @@
+﻿#include "topology.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include "system_probe_linux.h"
+#endif
+#include "Logger.h"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+static auto LOGGER = Logger::getInstance();
+
+static const size_t CACHE_INDEXES = 16;
+
+void CpuTopology::Clear() {
+	cpus_.clear();
+	reported_distances_.clear();
+	for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+		levels_[level] = {};
+	}
+	node_distances_.clear();
+}
+
+void CpuTopology::AddCpu(uint32_t cpu, uint32_t core, uint32_t l3, uint32_t node, uint32_t package) {
+	cpus_.push_back({ cpu, { core, l3, node, package } });
+}
+
+void CpuTopology::SetNodeDistance(uint32_t node_number, uint32_t other_node_number, uint32_t distance) {
+	reported_distances_.push_back({ node_number, other_node_number, distance });
+}
+
+// A CPU added twice keeps its first ids.
+void CpuTopology::Finish() {
+	stable_sort(cpus_.begin(), cpus_.end(), [](const CpuIds& lhs, const CpuIds& rhs) { return lhs.cpu_ < rhs.cpu_; });
+	cpus_.erase(unique(cpus_.begin(), cpus_.end(), [](const CpuIds& lhs, const CpuIds& rhs) { return lhs.cpu_ == rhs.cpu_; }), cpus_.end());
+	size_t max_cpu = cpus_.empty() ? 0 : static_cast<size_t>(cpus_.back().cpu_) + 1;
+
+	for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+		LevelDomains& domains = levels_[level];
+		domains.ids_.clear();
+		for (auto it = cpus_.begin(); it != cpus_.end(); ++it) domains.ids_.push_back(it->ids_[level]);
+		sort(domains.ids_.begin(), domains.ids_.end());
+		domains.ids_.erase(unique(domains.ids_.begin(), domains.ids_.end()), domains.ids_.end());
+
+		domains.domain_of_cpu_.assign(max_cpu, NO_DOMAIN);
+		domains.offsets_.assign(domains.ids_.size() + 1, 0);
+		for (auto it = cpus_.begin(); it != cpus_.end(); ++it) {
+			uint32_t domain = FindDomain(static_cast<Level>(level), it->ids_[level]);
+			domains.domain_of_cpu_[it->cpu_] = domain;
+			++domains.offsets_[domain + 1];
+		}
+		for (size_t d = 1; d < domains.offsets_.size(); ++d) domains.offsets_[d] += domains.offsets_[d - 1];
+		// The CPUs come sorted, so every domain gets its CPUs in ascending order.
+		vector<uint32_t> next(domains.offsets_.begin(), domains.offsets_.end() - 1);
+		domains.cpus_.assign(cpus_.size(), 0);
+		for (auto it = cpus_.begin(); it != cpus_.end(); ++it) {
+			domains.cpus_[next[domains.domain_of_cpu_[it->cpu_]]++] = it->cpu_;
+		}
+	}
+
+	size_t nodes = Domains(Node);
+	node_distances_.assign(nodes * nodes, LOCAL_DISTANCE);
+	for (uint32_t i = 0; i < nodes; ++i) {
+		uint32_t package = DomainOf(Package, *DomainCpus(Node, i).begin());
+		for (uint32_t j = 0; j < nodes; ++j) {
+			if (i == j) continue;
+			node_distances_[i * nodes + j] = DomainOf(Package, *DomainCpus(Node, j).begin()) == package ? PACKAGE_DISTANCE : REMOTE_DISTANCE;
+		}
+	}
+	for (auto it = reported_distances_.begin(); it != reported_distances_.end(); ++it) {
+		uint32_t node = FindDomain(Node, it->node_number_);
+		uint32_t other_node = FindDomain(Node, it->other_node_number_);
+		if (node != NO_DOMAIN && other_node != NO_DOMAIN && it->distance_ > 0) node_distances_[node * nodes + other_node] = it->distance_;
+	}
+}
+
+uint32_t CpuTopology::FindDomain(Level level, uint32_t id) const {
+	const vector<uint32_t>& ids = levels_[level].ids_;
+	auto it = lower_bound(ids.begin(), ids.end(), id);
+	return it != ids.end() && *it == id ? static_cast<uint32_t>(it - ids.begin()) : NO_DOMAIN;
+}
+
+CpuTopology::CpuRange CpuTopology::DomainCpus(Level level, uint32_t domain) const {
+	const LevelDomains& domains = levels_[level];
+	const uint32_t* cpus = domains.cpus_.data();
+	return { cpus + domains.offsets_[domain], cpus + domains.offsets_[domain + 1] };
+}
+
+CpuTopology::Level CpuTopology::SharedLevel(uint32_t cpu, uint32_t other_cpu) const {
+	for (size_t level = 0; level < LEVEL_COUNT; ++level) {
+		uint32_t domain = DomainOf(static_cast<Level>(level), cpu);
+		if (domain != NO_DOMAIN && domain == DomainOf(static_cast<Level>(level), other_cpu)) return static_cast<Level>(level);
+	}
+	return LEVEL_COUNT;
+}
+
+uint32_t CpuTopology::NearestNodeDistance() const {
+	size_t nodes = Domains(Node);
+	uint32_t nearest = 0;
+	for (size_t i = 0; i < nodes; ++i) {
+		for (size_t j = 0; j < nodes; ++j) {
+			uint32_t distance = node_distances_[i * nodes + j];
+			if (i != j && (nearest == 0 || distance < nearest)) nearest = distance;
+		}
+	}
+	return nearest ? nearest : LOCAL_DISTANCE;
+}
+
+void CpuTopology::Log() const {
+	LOGGER->Print(Logger::Type::Info, true,
+		L"Topology;cpus=", Cpus(),
+		L";cores=", Domains(Core),
+		L";l3 caches=", Domains(L3),
+		L";nodes=", Domains(Node),
+		L";packages=", Domains(Package));
+	for (uint32_t node = 0; node < Domains(Node); ++node) {
+		CpuRange cpus = DomainCpus(Node, node);
+		size_t l3_caches = 0;
+		uint32_t last_l3 = NO_DOMAIN;
+		for (auto cpu : cpus) {
+			// The L3 domains are numbered by their first CPU, a node meets each of them in ascending order.
+			uint32_t l3 = DomainOf(L3, cpu);
+			if (l3 != last_l3) ++l3_caches;
+			last_l3 = l3;
+		}
+		wstring distances;
+		for (uint32_t other_node = 0; other_node < Domains(Node); ++other_node) {
+			if (other_node) distances.append(L",");
+			distances.append(to_wstring(NodeDistance(node, other_node)));
+		}
+		LOGGER->Print(Logger::Type::Info, true,
+			L"Topology numa=", DomainId(Node, node),
+			L";package=", DomainId(Package, DomainOf(Package, *cpus.begin())),
+			L";cpus=", cpus.size(),
+			L";l3 caches=", l3_caches,
+			L";distances=", distances);
+	}
+}
+
+#ifndef _WIN32
+
+static bool readText(const fs::path& path, string& text) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	char buffer[4096];
+	ssize_t size = read(fd, buffer, sizeof(buffer));
+	close(fd);
+	if (size <= 0) return false;
+	text.assign(buffer, static_cast<size_t>(size));
+	return true;
+}
+
+bool ReadSysfsTopology(const fs::path& sysfs_root, CpuTopology& topology) {
+	topology.Clear();
+	string text;
+	vector<uint32_t> cpus;
+	vector<uint32_t> node_of_cpu;
+	// All node numbers, nodes without CPUs too, and the first CPU of every node with CPUs.
+	vector<uint32_t> node_numbers;
+	vector<pair<uint32_t, uint32_t>> nodes;
+	error_code ec;
+	for (fs::directory_iterator it(sysfs_root / "devices/system/node", ec), end; !ec && it != end; it.increment(ec)) {
+		string name = it->path().filename().string();
+		if (name.size() <= 4 || name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != string::npos) continue;
+		uint32_t node_number = static_cast<uint32_t>(strtoul(name.c_str() + 4, nullptr, 10));
+		node_numbers.push_back(node_number);
+		if (!readText(it->path() / "cpulist", text) || !ParseCpuList(text, cpus) || cpus.empty()) continue;
+		nodes.push_back({ node_number, cpus[0] });
+		for (auto cpu : cpus) {
+			if (cpu >= node_of_cpu.size()) node_of_cpu.resize(cpu + 1, CpuTopology::NO_DOMAIN);
+			node_of_cpu[cpu] = node_number;
+		}
+	}
+	sort(node_numbers.begin(), node_numbers.end());
+	sort(nodes.begin(), nodes.end());
+
+	cpus.clear();
+	for (uint32_t cpu = 0; cpu < node_of_cpu.size(); ++cpu) {
+		if (node_of_cpu[cpu] != CpuTopology::NO_DOMAIN) cpus.push_back(cpu);
+	}
+	if (cpus.empty() && (!readText(sysfs_root / "devices/system/cpu/online", text) || !ParseCpuList(text, cpus) || cpus.empty())) {
+		LOGGER->Print(wstring(L"No CPU topology in ").append(sysfs_root.wstring()), Logger::Type::Error);
+		return false;
+	}
+
+	vector<uint32_t> shared;
+	for (auto cpu : cpus) {
+		uint32_t node_number = cpu < node_of_cpu.size() && node_of_cpu[cpu] != CpuTopology::NO_DOMAIN ? node_of_cpu[cpu] : 0;
+		fs::path cpu_dir = sysfs_root / "devices/system/cpu" / ("cpu" + to_string(cpu));
+
+		uint32_t package = 0;
+		if (readText(cpu_dir / "topology/physical_package_id", text)) package = static_cast<uint32_t>(strtoul(text.c_str(), nullptr, 10));
+
+		uint32_t l3 = CpuTopology::NO_DOMAIN;
+		for (size_t i = 0; i < CACHE_INDEXES && l3 == CpuTopology::NO_DOMAIN; ++i) {
+			fs::path index_dir = cpu_dir / "cache" / ("index" + to_string(i));
+			if (!readText(index_dir / "level", text)) break;
+			if (strtoul(text.c_str(), nullptr, 10) == 3 && readText(index_dir / "shared_cpu_list", text) && ParseCpuList(text, shared) && !shared.empty()) {
+				l3 = shared[0];
+			}
+		}
+		if (l3 == CpuTopology::NO_DOMAIN) {
+			auto it = lower_bound(nodes.begin(), nodes.end(), make_pair(node_number, uint32_t(0)));
+			l3 = it != nodes.end() && it->first == node_number ? it->second : cpus[0];
+		}
+
+		uint32_t core = cpu;
+		if (readText(cpu_dir / "topology/thread_siblings_list", text) && ParseCpuList(text, shared) && !shared.empty()) core = shared[0];
+		topology.AddCpu(cpu, core, l3, node_number, package);
+	}
+
+	// A distance file lists the distances to all nodes in the order of their numbers.
+	for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+		if (!readText(sysfs_root / "devices/system/node" / ("node" + to_string(it->first)) / "distance", text)) continue;
+		const char* p = text.c_str();
+		for (auto it_other = node_numbers.begin(); it_other != node_numbers.end(); ++it_other) {
+			char* end;
+			unsigned long distance = strtoul(p, &end, 10);
+			if (end == p) break;
+			topology.SetNodeDistance(it->first, *it_other, static_cast<uint32_t>(distance));
+			p = end;
+		}
+	}
+	topology.Finish();
+	return true;
+}
+
+#endif
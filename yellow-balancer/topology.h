@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Hardware topology of the logical CPUs, built once at the start: every CPU belongs to one domain of each
+// level, from the SMT siblings of a core up to the package. CPUs are numbered as the OS numbers them, on
+// Windows group * 64 + the bit of the CPU in its group. A domain is an index within its level, sorted by
+// the id: the number of a node or package, the first CPU of an L3 cache or core. The domain of a CPU and
+// the CPUs of a domain are both array lookups, the CPUs of a domain lie in one contiguous range.
+class CpuTopology {
+public:
+	enum Level { Core, L3, Node, Package, LEVEL_COUNT };
+	static constexpr uint32_t NO_DOMAIN = UINT32_MAX;
+	static constexpr uint32_t LOCAL_DISTANCE = 10;
+
+	struct CpuRange {
+		const uint32_t* begin_;
+		const uint32_t* end_;
+		const uint32_t* begin() const { return begin_; }
+		const uint32_t* end() const { return end_; }
+		size_t size() const { return static_cast<size_t>(end_ - begin_); }
+	};
+
+	void Clear();
+	// A CPU with the ids of its domains; the lookups are valid after Finish.
+	void AddCpu(uint32_t cpu, uint32_t core, uint32_t l3, uint32_t node, uint32_t package);
+	// Distance of the SLIT between two nodes by their numbers, LOCAL_DISTANCE for a node to itself.
+	void SetNodeDistance(uint32_t node_number, uint32_t other_node_number, uint32_t distance);
+	void Finish();
+
+	bool IsEmpty() const { return cpus_.empty(); }
+	size_t Cpus() const { return cpus_.size(); }
+	size_t Domains(Level level) const { return levels_[level].ids_.size(); }
+	// NO_DOMAIN for a CPU the topology does not know.
+	uint32_t DomainOf(Level level, uint32_t cpu) const {
+		return cpu < levels_[level].domain_of_cpu_.size() ? levels_[level].domain_of_cpu_[cpu] : NO_DOMAIN;
+	}
+	uint32_t DomainId(Level level, uint32_t domain) const { return levels_[level].ids_[domain]; }
+	uint32_t FindDomain(Level level, uint32_t id) const;
+	CpuRange DomainCpus(Level level, uint32_t domain) const;
+	// The finest level whose domain holds both CPUs, LEVEL_COUNT when they are on different packages.
+	Level SharedLevel(uint32_t cpu, uint32_t other_cpu) const;
+	// By the domains of the Node level. Pairs the OS does not report are estimated from the packages, as the
+	// SLIT of a two-socket EPYC host has them: 12 within a package and 32 between packages.
+	uint32_t NodeDistance(uint32_t node, uint32_t other_node) const { return node_distances_[node * Domains(Node) + other_node]; }
+	// The smallest distance between two different nodes, LOCAL_DISTANCE on a single node host.
+	uint32_t NearestNodeDistance() const;
+	void Log() const;
+private:
+	static constexpr uint32_t PACKAGE_DISTANCE = 12;
+	static constexpr uint32_t REMOTE_DISTANCE = 32;
+	struct CpuIds {
+		uint32_t cpu_;
+		uint32_t ids_[LEVEL_COUNT];
+	};
+	struct NodeDistanceEntry {
+		uint32_t node_number_;
+		uint32_t other_node_number_;
+		uint32_t distance_;
+	};
+	struct LevelDomains {
+		std::vector<uint32_t> domain_of_cpu_;
+		std::vector<uint32_t> ids_;
+		// CPUs of domain d are cpus_[offsets_[d]] .. cpus_[offsets_[d + 1] - 1].
+		std::vector<uint32_t> offsets_;
+		std::vector<uint32_t> cpus_;
+	};
+	std::vector<CpuIds> cpus_;
+	std::vector<NodeDistanceEntry> reported_distances_;
+	LevelDomains levels_[LEVEL_COUNT];
+	std::vector<uint32_t> node_distances_;
+};
+
+#ifndef _WIN32
+// The topology from sysfs: the nodes of devices/system/node and their distance files, the packages, L3
+// caches and SMT siblings of devices/system/cpu. A CPU without a node is on node 0, without an L3 cache
+// its node stands for it. False when no CPU is found.
+bool ReadSysfsTopology(const std::filesystem::path& sysfs_root, CpuTopology& topology);
+#endif